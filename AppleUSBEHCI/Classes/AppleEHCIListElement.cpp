@@ -623,6 +623,9 @@ AppleEHCIIsochEndpoint::init()
 		highSpeedHub = highSpeedPort = 0;
 		useBackPtr = false;
 		pSPE = NULL;
+		reuseList = NULL;
+		reuseCount = 0;
+		reuseTDs = false;
 	}
 	return ret;
 }
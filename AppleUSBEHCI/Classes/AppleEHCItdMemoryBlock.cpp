@@ -99,6 +99,7 @@ AppleEHCItdMemoryBlock::NewMemoryBlock(void)
 			{
 				me->_TDs[i].pPhysical = sharedPhysical+(i * sizeof(EHCIGeneralTransferDescriptorShared));
 				me->_TDs[i].pShared = &sharedPtr[i];
+				me->_TDs[i].pMemBlock = me;
 			}
 		}
 		else
@@ -428,8 +428,13 @@ AppleUSBEHCI::UIMInitialize(IOService * provider)
 			break;
 		}
 		_frameListSize = 1024;
+		_interruptThreshold = kEHCIMinInterruptThreshold;
+		_UIMDiagnostics.interruptThreshold = _interruptThreshold;
+		setProperty("InterruptThreshold", _interruptThreshold, 32);
+		setProperty("InterruptRate", _UIMDiagnostics.interruptRate, 32);
+		_lastInterruptSampleTime = mach_absolute_time();
 		USBCmd &= ~kEHCICMDIntThresholdMask;
-		USBCmd |= 1 << kEHCICMDIntThresholdOffset;						// Interrupt every micro frame as needed (4745296)
+		USBCmd |= _interruptThreshold << kEHCICMDIntThresholdOffset;		// Interrupt every micro frame as needed (4745296) - UpdateInterruptThreshold may raise this under load
 
 			// get rid of the count as well as the enable bit
 			//USBCmd &= ~kEHCICMDAsyncParkModeCountMask;
@@ -1282,6 +1287,7 @@ AppleUSBEHCI::AllocateQH(void)
 		_edMBHead = memBlock;
 		numEDs = memBlock->NumEDs();
 		_pLastFreeQH = AppleEHCIQueueHead::WithSharedMemory(memBlock->GetLogicalPtr(0), memBlock->GetPhysicalPtr(0));
+		_pLastFreeQH->_memBlock = memBlock;
 		_pFreeQH = _pLastFreeQH;
 		for (i=1; i < numEDs; i++)
 		{
@@ -1293,6 +1299,7 @@ AppleUSBEHCI::AllocateQH(void)
 				freeQH = _pFreeQH;
 				break;
 			}
+			freeQH->_memBlock = memBlock;
 			freeQH->_logicalNext = _pFreeQH;
 			_pFreeQH = freeQH;
 			// in a normal loop termination, freeQH and _pFreeQH are the same, just like when we don't use this code
@@ -1305,6 +1312,7 @@ AppleUSBEHCI::AllocateQH(void)
 		if (!_pFreeQH)
 			_pLastFreeQH = NULL;
 		freeQH->_logicalNext = NULL;
+		freeQH->_memBlock->GetUsage()->IncrementUseCount();
     }
     return freeQH;
 }
@@ -1321,6 +1329,7 @@ AppleUSBEHCI::DeallocateTD (EHCIGeneralTransferDescriptorPtr pTD)
     // bzero(pTD, sizeof(*pTD));
     pTD->pLogicalNext = NULL;
     pTD->pPhysical = physical;
+	pTD->pMemBlock->GetUsage()->DecrementUseCount();
 	
     if (_pLastFreeTD)
     {
@@ -1344,6 +1353,7 @@ AppleUSBEHCI::DeallocateED (AppleEHCIQueueHead *pED)
     USBLog(7, "AppleUSBEHCI[%p]::DeallocateED - AsyncListAddr(%08x) deallocating %08x and smashing physical link",  this, (int)_pEHCIRegisters->AsyncListAddr, (int)pED->_sharedPhysical);
     pED->_logicalNext = NULL;
 	pED->SetPhysicalLink(0xFEDCBA98);
+	pED->_memBlock->GetUsage()->DecrementUseCount();
 
     if (_pLastFreeQH)
     {
@@ -1415,7 +1425,7 @@ AppleUSBEHCI::AllocateTD(void)
 		freeTD->multiXferTransaction = false;
 		freeTD->finalXferInTransaction = false;
 		freeTD->tdSize = 0;
-
+		freeTD->pMemBlock->GetUsage()->IncrementUseCount();
     }
     return freeTD;
 }
@@ -1448,6 +1458,7 @@ AppleUSBEHCI::AllocateITD(void)
 		_itdMBHead = memBlock;
 		numTDs = memBlock->NumTDs();
 		_pLastFreeITD = AppleEHCIIsochTransferDescriptor::WithSharedMemory(memBlock->GetLogicalPtr(0), memBlock->GetPhysicalPtr(0));
+		_pLastFreeITD->_memBlock = memBlock;
 		_pFreeITD = _pLastFreeITD;
 		for (i=1; i < numTDs; i++)
 		{
@@ -1458,6 +1469,7 @@ AppleUSBEHCI::AllocateITD(void)
 				freeITD = _pFreeITD;
 				break;
 			}
+			freeITD->_memBlock = memBlock;
 			freeITD->_logicalNext = _pFreeITD;
 			_pFreeITD = freeITD;
 			// in a normal loop termination, freeED and _pFreeED are the same, just like when we don't use this code
@@ -1469,6 +1481,7 @@ AppleUSBEHCI::AllocateITD(void)
 		freeITD->_logicalNext = NULL;
         if (!_pFreeITD)
             _pLastFreeITD = NULL;
+		freeITD->_memBlock->GetUsage()->IncrementUseCount();
     }
 	
 	// initialize the page pointers to zero length
@@ -1484,8 +1497,21 @@ AppleUSBEHCI::AllocateITD(void)
 IOReturn 
 AppleUSBEHCI::DeallocateITD (AppleEHCIIsochTransferDescriptor *pTD)
 {
+	AppleEHCIIsochEndpoint		*pEP = OSDynamicCast(AppleEHCIIsochEndpoint, pTD->_pEndpoint);
+	
     USBLog(7, "AppleUSBEHCI[%p]::DeallocateITD - deallocating %p",  this, pTD);
+	
+	// if the endpoint is still streaming, let it keep this ITD for its next transfer
+	if (pEP && pEP->reuseTDs && !pEP->aborting && (pEP->reuseCount < kEHCIIsochEndpointMaxReuseTDs))
+	{
+		pTD->_logicalNext = pEP->reuseList;
+		pEP->reuseList = pTD;
+		pEP->reuseCount++;
+		return kIOReturnSuccess;
+	}
+	
     pTD->_logicalNext = NULL;
+	pTD->_memBlock->GetUsage()->DecrementUseCount();
 	
     if (_pLastFreeITD)
     {
@@ -1529,6 +1555,7 @@ AppleUSBEHCI::AllocateSITD(void)
 		numTDs = memBlock->NumTDs();
 		USBLog(3, "AppleUSBEHCI[%p]::AllocateSITD - got new memory block (%p) with %d SITDs in it",  this, memBlock, (int)numTDs);
 		_pLastFreeSITD = AppleEHCISplitIsochTransferDescriptor::WithSharedMemory(memBlock->GetLogicalPtr(0), memBlock->GetPhysicalPtr(0));
+		_pLastFreeSITD->_memBlock = memBlock;
 		_pFreeSITD = _pLastFreeSITD;
 		for (i=1; i < numTDs; i++)
 		{
@@ -1539,6 +1566,7 @@ AppleUSBEHCI::AllocateSITD(void)
 				freeSITD = _pFreeSITD;
 				break;
 			}
+			freeSITD->_memBlock = memBlock;
 			freeSITD->_logicalNext = _pFreeSITD;
 			_pFreeSITD = freeSITD;
 			// in a normal loop termination, freeED and _pFreeED are the same, just like when we don't use this code
@@ -1551,6 +1579,7 @@ AppleUSBEHCI::AllocateSITD(void)
 			_pLastFreeSITD = NULL;
 		freeSITD->_logicalNext = NULL;
 		freeSITD->_isDummySITD = false;
+		freeSITD->_memBlock->GetUsage()->IncrementUseCount();
     }
     USBLog(7, "AppleUSBEHCI[%p]::AllocateSITD - returning %p",  this, freeSITD);
     return freeSITD;
@@ -1560,10 +1589,23 @@ AppleUSBEHCI::AllocateSITD(void)
 IOReturn 
 AppleUSBEHCI::DeallocateSITD (AppleEHCISplitIsochTransferDescriptor *pTD)
 {
+	AppleEHCIIsochEndpoint		*pEP = OSDynamicCast(AppleEHCIIsochEndpoint, pTD->_pEndpoint);
+	UInt64						currentFrame = GetFrameNumber();
+	
     USBLog(7, "AppleUSBEHCI[%p]::DeallocateSITD - deallocating %p",  this, pTD);
+	
+	// if the endpoint is still streaming, let it keep this SITD for its next transfer - but only once the hardware is done with it
+	if (pEP && pEP->reuseTDs && !pEP->aborting && (pTD->_frameNumber < currentFrame) && (pEP->reuseCount < kEHCIIsochEndpointMaxReuseTDs))
+	{
+		pTD->_logicalNext = pEP->reuseList;
+		pEP->reuseList = pTD;
+		pEP->reuseCount++;
+		return kIOReturnSuccess;
+	}
+	
     pTD->_logicalNext = NULL;
 	
-	if (pTD->_frameNumber == GetFrameNumber())
+	if (pTD->_frameNumber == currentFrame)
 	{
 		// the UIM has completed its work with this SITD, but it could still be accessed by the hardware, so we need to delay
 		// putting it on the free list until we know that the hardware is no longer accessing it (based on the frame number)
@@ -1582,7 +1624,7 @@ AppleUSBEHCI::DeallocateSITD (AppleEHCISplitIsochTransferDescriptor *pTD)
 	}
 	else
 	{
-
+		pTD->_memBlock->GetUsage()->DecrementUseCount();
 		if (_pLastFreeSITD)
 		{
 			_pLastFreeSITD->_logicalNext = pTD;
@@ -1607,6 +1649,7 @@ AppleUSBEHCI::DeallocateSITD (AppleEHCISplitIsochTransferDescriptor *pTD)
 		
 		USBLog(7, "AppleUSBEHCI::DeallocateSITD - pTD(%p) was delayed (frame %qd) and I am now freeing it", pTD, pTD->_frameNumber);
 		pTD->_logicalNext = NULL;
+		pTD->_memBlock->GetUsage()->DecrementUseCount();
 		if (_pLastFreeSITD)
 		{
 			_pLastFreeSITD->_logicalNext = pTD;
@@ -1628,6 +1671,236 @@ AppleUSBEHCI::DeallocateSITD (AppleEHCISplitIsochTransferDescriptor *pTD)
 
 
 
+//================================================================================================
+//
+//   AllocateEndpointITD/AllocateEndpointSITD
+//
+//		Isoch endpoints which are streaming hold on to the iTDs/siTDs from their completed transfers, so
+//		a steady audio/video stream cycles through the same small set of descriptors instead of going
+//		back and forth to the controller wide free lists. Fall back to those lists when the endpoint
+//		has nothing to reuse.
+//
+//================================================================================================
+//
+AppleEHCIIsochTransferDescriptor *
+AppleUSBEHCI::AllocateEndpointITD(AppleEHCIIsochEndpoint *pEP)
+{
+    AppleEHCIIsochTransferDescriptor *freeITD;
+	
+	freeITD = OSDynamicCast(AppleEHCIIsochTransferDescriptor, pEP->reuseList);
+	if (!freeITD)
+		return AllocateITD();
+	
+	pEP->reuseList = OSDynamicCast(IOUSBControllerIsochListElement, freeITD->_logicalNext);
+	pEP->reuseCount--;
+	freeITD->_logicalNext = NULL;
+	
+	// initialize the page pointers to zero length
+	//
+    bzero(&freeITD->GetSharedLogical()->Transaction0, sizeof(EHCIIsochTransferDescriptorShared)-sizeof(USBPhysicalAddress32) );
+	
+    USBLog(7, "AppleUSBEHCI[%p]::AllocateEndpointITD - reusing %p for EP %p",  this, freeITD, pEP);
+    return freeITD;
+}
+
+
+
+AppleEHCISplitIsochTransferDescriptor *
+AppleUSBEHCI::AllocateEndpointSITD(AppleEHCIIsochEndpoint *pEP)
+{
+    AppleEHCISplitIsochTransferDescriptor *freeSITD;
+	
+	freeSITD = OSDynamicCast(AppleEHCISplitIsochTransferDescriptor, pEP->reuseList);
+	if (!freeSITD)
+		return AllocateSITD();
+	
+	pEP->reuseList = OSDynamicCast(IOUSBControllerIsochListElement, freeSITD->_logicalNext);
+	pEP->reuseCount--;
+	freeSITD->_logicalNext = NULL;
+	freeSITD->_isDummySITD = false;
+	
+    USBLog(7, "AppleUSBEHCI[%p]::AllocateEndpointSITD - reusing %p for EP %p",  this, freeSITD, pEP);
+    return freeSITD;
+}
+
+
+
+//================================================================================================
+//
+//   ReturnEndpointTDs
+//
+//		Stop an isoch endpoint from holding on to descriptors and give the ones it has back to the
+//		controller wide free lists. Called when the endpoint is being deleted.
+//
+//================================================================================================
+//
+void
+AppleUSBEHCI::ReturnEndpointTDs(AppleEHCIIsochEndpoint *pEP)
+{
+	IOUSBControllerIsochListElement		*pTD;
+	
+	pEP->reuseTDs = false;
+	
+	USBLog(6, "AppleUSBEHCI[%p]::ReturnEndpointTDs - EP %p returning %d TDs", this, pEP, (int)pEP->reuseCount);
+	while ((pTD = pEP->reuseList))
+	{
+		pEP->reuseList = OSDynamicCast(IOUSBControllerIsochListElement, pTD->_logicalNext);
+		pTD->_logicalNext = NULL;
+		pTD->_pEndpoint = NULL;
+		pTD->Deallocate(this);
+	}
+	pEP->reuseCount = 0;
+}
+
+
+
+// ========================================================================
+#pragma mark Memory Block Reclamation
+// ========================================================================
+
+// The free list link and the owning block are kept in different fields in a TD than in the list elements, and only the
+// list elements are OSObjects of their own, so ReclaimMemoryBlocks reaches them through these
+//
+static inline EHCIGeneralTransferDescriptorPtr
+NextFreeElement(EHCIGeneralTransferDescriptorPtr pTD)
+{
+	return pTD->pLogicalNext;
+}
+
+static inline void
+SetNextFreeElement(EHCIGeneralTransferDescriptorPtr pTD, EHCIGeneralTransferDescriptorPtr pNextTD)
+{
+	pTD->pLogicalNext = pNextTD;
+}
+
+static inline bool
+IsOwnedByBlock(EHCIGeneralTransferDescriptorPtr pTD, AppleEHCItdMemoryBlock *block)
+{
+	return (pTD->pMemBlock == block);
+}
+
+static inline void
+ReleaseFreeElement(EHCIGeneralTransferDescriptorPtr pTD)
+{
+#pragma unused (pTD)
+	// a TD lives in its memory block, so it goes away with the block
+}
+
+template <class ElementType>
+static inline ElementType *
+NextFreeElement(ElementType *pElement)
+{
+	return OSDynamicCast(ElementType, pElement->_logicalNext);
+}
+
+template <class ElementType>
+static inline void
+SetNextFreeElement(ElementType *pElement, ElementType *pNextElement)
+{
+	pElement->_logicalNext = pNextElement;
+}
+
+template <class ElementType, class BlockType>
+static inline bool
+IsOwnedByBlock(ElementType *pElement, BlockType *block)
+{
+	return (pElement->_memBlock == block);
+}
+
+template <class ElementType>
+static inline void
+ReleaseFreeElement(ElementType *pElement)
+{
+	pElement->release();
+}
+
+
+
+//================================================================================================
+//
+//   ReclaimMemoryBlocks
+//
+//		Give every block on the list a watchdog tick, and release each one which has been completely free
+//		for kEHCIMemoryBlockReclaimIdleTicks ticks, after pulling its elements off of the free list.  The
+//		last block on the list is always kept.
+//
+//================================================================================================
+//
+template <class BlockType, class ElementType>
+static void
+ReclaimMemoryBlocks(AppleUSBEHCI *controller, const char *blockKind, BlockType **blockHead, ElementType **freeHead, ElementType **lastFree)
+{
+	BlockType			*curBlock = *blockHead;
+	BlockType			*prevBlock = NULL;
+	BlockType			*nextBlock;
+	ElementType			*pElement, *pPrevElement, *pNextElement;
+	
+	while (curBlock)
+	{
+		nextBlock = curBlock->GetNextBlock();
+		if ((curBlock->GetUsage()->IdleTick() < kEHCIMemoryBlockReclaimIdleTicks) || (!prevBlock && !nextBlock))
+		{
+			prevBlock = curBlock;
+			curBlock = nextBlock;
+			continue;
+		}
+		
+		// pull all of this block's elements off of the free list (SITDs on the delayed list are still counted as in use)
+		pPrevElement = NULL;
+		pElement = *freeHead;
+		while (pElement)
+		{
+			pNextElement = NextFreeElement(pElement);
+			if (IsOwnedByBlock(pElement, curBlock))
+			{
+				if (pPrevElement)
+					SetNextFreeElement(pPrevElement, pNextElement);
+				else
+					*freeHead = pNextElement;
+				if (*lastFree == pElement)
+					*lastFree = pPrevElement;
+				ReleaseFreeElement(pElement);
+			}
+			else
+				pPrevElement = pElement;
+			pElement = pNextElement;
+		}
+		
+		if (prevBlock)
+			prevBlock->SetNextBlock(nextBlock);
+		else
+			*blockHead = nextBlock;
+		
+		USBLog(5, "AppleUSBEHCI[%p]::ReclaimIdleMemoryBlocks - releasing idle %s memory block %p", controller, blockKind, curBlock);
+		curBlock->release();
+		curBlock = nextBlock;
+	}
+}
+
+
+
+//================================================================================================
+//
+//   ReclaimIdleMemoryBlocks
+//
+//		Called from UIMCheckForTimeouts. Any memory block whose elements have all been sitting on the
+//		free list for kEHCIMemoryBlockReclaimIdleTicks consecutive watchdog ticks is pulled off the free
+//		list and released, so that a burst of traffic does not leave us at the peak footprint forever.
+//		We always keep at least one block of each type so that light loads do not thrash.
+//
+//================================================================================================
+//
+void
+AppleUSBEHCI::ReclaimIdleMemoryBlocks(void)
+{
+	ReclaimMemoryBlocks(this, "TD", &_tdMBHead, &_pFreeTD, &_pLastFreeTD);
+	ReclaimMemoryBlocks(this, "QH", &_edMBHead, &_pFreeQH, &_pLastFreeQH);
+	ReclaimMemoryBlocks(this, "ITD", &_itdMBHead, &_pFreeITD, &_pLastFreeITD);
+	ReclaimMemoryBlocks(this, "SITD", &_sitdMBHead, &_pFreeSITD, &_pLastFreeSITD);
+}
+
+
+
 /*
  * got an error on a TD with no completion routine.
  * Search for a later TD on the same end point which does have one,
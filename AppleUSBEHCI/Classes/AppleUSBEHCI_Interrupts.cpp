@@ -292,6 +292,8 @@ AppleUSBEHCI::FilterInterrupt(int index)
 		}
         if (activeInterrupts & kEHCICompleteIntBit)
 		{
+			_completeInterruptCount++;								// sampled once a second by UpdateInterruptThreshold
+			
             // Now that we have the beginning of the queue, walk it looking for low latency isoch TD's
             // Use this time as the time stamp time for all the TD's that we processed.  
             //
@@ -496,3 +498,84 @@ AppleUSBEHCI::FilterInterrupt(int index)
     
 }
 
+
+
+
+//================================================================================================
+//
+//   UpdateInterruptThreshold
+//
+//		Called once a watchdog tick, and whenever a latency sensitive pipe is opened. When nothing
+//		latency sensitive is scheduled and the controller is taking a completion interrupt in most
+//		microframes, raise the USBCMD interrupt threshold so that we interrupt at most once per frame.
+//		As soon as an isoch endpoint or a fast interrupt endpoint shows up, go back to every microframe.
+//
+//================================================================================================
+//
+void
+AppleUSBEHCI::UpdateInterruptThreshold(void)
+{
+	UInt64			currentTime = mach_absolute_time();
+	UInt64			elapsedNS;
+	UInt32			interrupts;
+	UInt32			newThreshold = kEHCIMinInterruptThreshold;
+	
+	absolutetime_to_nanoseconds(currentTime - _lastInterruptSampleTime, &elapsedNS);
+	if (elapsedNS >= kUSBWatchdogTimeoutMS * 1000000ULL)
+	{
+		interrupts = _completeInterruptCount;
+		_completeInterruptRate = (UInt32)(((UInt64)(interrupts - _lastCompleteInterruptCount) * 1000000000ULL) / elapsedNS);
+		_lastCompleteInterruptCount = interrupts;
+		_lastInterruptSampleTime = currentTime;
+		
+		// The serialized "Statistics" object only carries the fields it was built with, so these two go out as properties of their own
+		if (_completeInterruptRate != _UIMDiagnostics.interruptRate)
+		{
+			_UIMDiagnostics.interruptRate = _completeInterruptRate;
+			setProperty("InterruptRate", _completeInterruptRate, 32);
+		}
+	}
+	
+	if (!_isochEPList && !_lowLatencyIntEDsInSchedule)
+	{
+		if (_interruptThreshold > kEHCIMinInterruptThreshold)
+		{
+			// we are already throttled, which caps us at one interrupt per frame - stay that way until the load goes away
+			if (_completeInterruptRate >= kEHCIUnthrottleInterruptRate)
+				newThreshold = _interruptThreshold;
+		}
+		else if (_completeInterruptRate >= kEHCIThrottleInterruptRate)
+		{
+			newThreshold = kEHCIThrottledInterruptThreshold;
+		}
+	}
+	
+	if (newThreshold != _interruptThreshold)
+		SetInterruptThreshold(newThreshold);
+}
+
+
+
+void
+AppleUSBEHCI::SetInterruptThreshold(UInt32 microFrames)
+{
+	UInt32		USBCmd;
+	
+	USBLog(5, "AppleUSBEHCI[%p]::SetInterruptThreshold - changing from %d to %d uFrames (%d interrupts/sec, isoch EPs(%s), %d low latency interrupt EDs)", this, (int)_interruptThreshold, (int)microFrames, (int)_completeInterruptRate, _isochEPList ? "yes" : "no", (int)_lowLatencyIntEDsInSchedule);
+	_interruptThreshold = microFrames;
+	_UIMDiagnostics.interruptThreshold = microFrames;
+	setProperty("InterruptThreshold", microFrames, 32);
+	
+	// if we are not running, the new value will be picked up when we restart
+	if (!_controllerAvailable || (_myBusState != kUSBBusStateRunning))
+		return;
+	
+	USBCmd = USBToHostLong(_pEHCIRegisters->USBCMD);
+	if (USBCmd == kEHCIInvalidRegisterValue)
+		return;
+	
+	USBCmd &= ~kEHCICMDIntThresholdMask;
+	USBCmd |= _interruptThreshold << kEHCICMDIntThresholdOffset;
+	_pEHCIRegisters->USBCMD = HostToUSBLong(USBCmd);
+	IOSync();
+}
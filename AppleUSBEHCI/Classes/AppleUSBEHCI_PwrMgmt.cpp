@@ -263,7 +263,7 @@ AppleUSBEHCI::ResumeUSBBus()
 		
 		// rdar://7315326 - Make sure that the threshold is set back to what we want it.. Some controllers appear to change it during sleep
 		USBCmd &= ~kEHCICMDIntThresholdMask;
-		USBCmd |= 1 << kEHCICMDIntThresholdOffset;						// Interrupt every micro frame as needed (4745296)
+		USBCmd |= _interruptThreshold << kEHCICMDIntThresholdOffset;	// whatever UpdateInterruptThreshold last chose
 
 		// same with Async Park Mode
 		// get rid of the count as well as the enable bit
@@ -811,7 +811,7 @@ AppleUSBEHCI::RestartControllerFromReset(void)
 	_myBusState = kUSBBusStateRunning;
 
 	USBCmd &= ~kEHCICMDIntThresholdMask;
-	USBCmd |= 1 << kEHCICMDIntThresholdOffset;						// Interrupt every micro frame as needed (4745296)
+	USBCmd |= _interruptThreshold << kEHCICMDIntThresholdOffset;	// whatever UpdateInterruptThreshold last chose
 
 		// get rid of the count as well as the enable bit
 		//USBCmd &= ~kEHCICMDAsyncParkModeCountMask;
@@ -2899,6 +2899,11 @@ AppleUSBEHCI::linkInterruptEndpoint(AppleEHCIQueueHead *pEP)
 		offset += pollingRate;
     } 
     _periodicEDsInSchedule++;
+	if (pollingRate < kEHCILowLatencyPollingRate)
+	{
+		_lowLatencyIntEDsInSchedule++;
+		UpdateInterruptThreshold();
+	}
 }
 
 
@@ -2953,7 +2958,11 @@ AppleUSBEHCI::unlinkIntEndpoint(AppleEHCIQueueHead * pED)
     pED->_logicalNext = NULL;
     
     if (foundED)
+	{
 		_periodicEDsInSchedule--;
+		if ((pollingRate < kEHCILowLatencyPollingRate) && _lowLatencyIntEDsInSchedule)
+			_lowLatencyIntEDsInSchedule--;
+	}
 	
     USBLog(7, "-AppleUSBEHCI[%p]::unlinkIntEndpoint(%p)", this, pED);
 }
@@ -3105,6 +3114,10 @@ AppleUSBEHCI::UIMCreateIsochEndpoint(short					functionAddress,
 		pEP->maxPacketSize = maxPacketSize;
 		pEP->inSlot = kEHCIPeriodicListEntries+1;
 		pEP->ttiPtr = ttiPtr;
+		pEP->reuseTDs = true;
+		
+		// isoch traffic needs every microframe's completions
+		UpdateInterruptThreshold();
 	}
 
 	err = AllocateIsochBandwidth(pEP, ttiPtr);
@@ -3302,7 +3315,6 @@ AppleUSBEHCI::AbortIsochEP(AppleEHCIIsochEndpoint* pEP)
 IOReturn
 AppleUSBEHCI::DeleteIsochEP(AppleEHCIIsochEndpoint *pEP)
 {
-    IOUSBControllerIsochEndpoint* 		curEP, *prevEP;
     UInt32								currentMaxPacketSize;
 	
     USBLog(7, "AppleUSBEHCI[%p]::DeleteIsochEP (%p)", this, pEP);
@@ -3315,21 +3327,9 @@ AppleUSBEHCI::DeleteIsochEP(AppleEHCIIsochEndpoint *pEP)
 			USBError(1, "AppleUSBEHCI[%p]::DeleteIsochEP- after abort there are STILL %d active TDs", this, (uint32_t) pEP->activeTDs);
 		}
     }
-    prevEP = NULL;
-    curEP = _isochEPList;
-    while (curEP)
-    {
-		if (curEP == pEP)
-		{
-			if (prevEP)
-				prevEP->nextEP = curEP->nextEP;
-			else
-				_isochEPList = curEP->nextEP;
-			break;
-		}
-		prevEP = curEP;
-		curEP = curEP->nextEP;
-    }
+	ReturnEndpointTDs(pEP);
+	
+    RemoveIsochronousEndpoint(pEP);
     
 	// Save the current max packet size, as DeallocateIsochBandwidth will set the ep->mps to 0
 	currentMaxPacketSize = pEP->maxPacketSize;
@@ -3472,7 +3472,7 @@ AppleUSBEHCI::CreateHSIsochTransfer(AppleEHCIIsochEndpoint * pEP, IOUSBIsocComma
 		
         // go ahead and make sure we can grab at least ONE TD, before we lock the buffer	
         //
-        pNewITD = AllocateITD();
+        pNewITD = AllocateEndpointITD(pEP);
         USBLog(7, "AppleUSBEHCI[%p]::CreateHSIsochTransfer - new iTD %p", this, pNewITD);
         if (pNewITD == NULL)
         {
@@ -3752,7 +3752,7 @@ AppleUSBEHCI::CreateSplitIsochTransfer(AppleEHCIIsochEndpoint * pEP, IOUSBIsocCo
     {
 		UInt16		reqCount, reqLeft;
 		
-        pNewSITD = AllocateSITD();
+        pNewSITD = AllocateEndpointSITD(pEP);
 		if (lowLatency)
 			reqCount = pLLFrames[i].frReqCount;
 		else
@@ -3949,7 +3949,7 @@ AppleUSBEHCI::CreateSplitIsochTransfer(AppleEHCIIsochEndpoint * pEP, IOUSBIsocCo
 	// if we are wrapping around, we need to add one more link to wrap things up
 	if (pEP->useBackPtr)
 	{		
-        pDummySITD = AllocateSITD();
+        pDummySITD = AllocateEndpointSITD(pEP);
 		// most of the fields get copied from the last SITD
         pDummySITD->GetSharedLogical()->nextSITD = HostToUSBLong(kEHCITermFlag);
 		pDummySITD->GetSharedLogical()->routeFlags = pNewSITD->GetSharedLogical()->routeFlags;
@@ -4608,8 +4608,14 @@ AppleUSBEHCI::CheckEDListForTimeouts(AppleEHCIQueueHead *head)
 			UInt32	firstActiveFrame = pTD->command->GetUIMScratch(kEHCIUIMScratchFirstActiveFrame);
 			if (!firstActiveFrame)
 			{
-				pTD->command->SetUIMScratch(kEHCIUIMScratchFirstActiveFrame, curFrame);
-				continue;
+				// count from when the transfer was queued if the family recorded it, so that the deadline it scheduled the watchdog for holds
+				firstActiveFrame = pTD->command->GetWatchdogSubmitFrame();
+				if (!firstActiveFrame)
+				{
+					pTD->command->SetUIMScratch(kEHCIUIMScratchFirstActiveFrame, curFrame);
+					continue;
+				}
+				pTD->command->SetUIMScratch(kEHCIUIMScratchFirstActiveFrame, firstActiveFrame);
 			}
 			if ((curFrame - firstActiveFrame) >= completionTimeout)
 			{
@@ -4665,7 +4671,8 @@ AppleUSBEHCI::CheckEDListForTimeouts(AppleEHCIQueueHead *head)
 //  UIMCheckForTimeouts
 //
 //  This routine is called every kUSBWatchdogTimeoutMS by the controller.  It is useful for
-//  periodic checks in the UIM
+//  periodic checks in the UIM.  In between, the controller calls UIMCheckForCommandTimeouts
+//  when a transfer is due to time out.
 //
 //=============================================================================================
 //
@@ -4678,7 +4685,6 @@ AppleUSBEHCI::UIMCheckForTimeouts(void)
     bool			allPortsDisconnected = false;
 	UInt32			usbcmd;
 	UInt32			usbsts;
-	UInt32			retries = 0;
 	
     // If we are not active anymore or if we're in ehciBusStateOff, then don't check for timeouts 
     //
@@ -4772,19 +4778,47 @@ AppleUSBEHCI::UIMCheckForTimeouts(void)
 			_periodicScheduleUnsynchCount = 0;
 	}
 
+	UIMCheckForCommandTimeouts();
+	
+	// see if the interrupt load calls for a different interrupt threshold
+	UpdateInterruptThreshold();
+	
+	// give back any descriptor memory left over from a burst of activity
+	ReclaimIdleMemoryBlocks();
+}
+
+
+
+//=============================================================================================
+//
+//  UIMCheckForCommandTimeouts
+//
+//  Just the transfer timeout part of UIMCheckForTimeouts, for when the controller's watchdog
+//  comes in early for a transfer deadline.
+//
+//=============================================================================================
+//
+void
+AppleUSBEHCI::UIMCheckForCommandTimeouts(void)
+{
+	UInt32			retries = 0;
+	
+	// UIMCheckForTimeouts deals with a controller which has gone away on its next pass
+	if ( isInactive() || !_controllerAvailable || (_myBusState != kUSBBusStateRunning) || _wakingFromHibernation )
+		return;
+	
     // Check to see if our control or bulk lists have a TD that has timed out
     while(CheckEDListForTimeouts(_AsyncHead))
 	{
 		if (retries++ > 100)
 		{
-			USBError(1, "AppleUSBEHCI[%p]::UIMCheckForTimeouts - exceeded 100 calls to CheckEDListForTimeouts on the AsyncHead!", this);
+			USBError(1, "AppleUSBEHCI[%p]::UIMCheckForCommandTimeouts - exceeded 100 calls to CheckEDListForTimeouts on the AsyncHead!", this);
 			break;
 		}
 	}
 	
 	// Even more important to do that in the inactive list, that's where you likely find them
     CheckEDListForTimeouts(_InactiveAsyncHead);
-	
 }
 
 
@@ -103,6 +103,7 @@ public:
 	IOPhysicalAddress						_lastSeenTD;							// For inactive QH detection
 	UInt64									_lastSeenFrame;							// Also for inactive detection
 	UInt32									_numTDs;								// For more intelligent broken queue detection
+	AppleEHCIedMemoryBlock					*_memBlock;								// the memory block which owns this QH
 };
 
 
@@ -125,6 +126,8 @@ public:
     // not a virtual method, because the return type assumes knowledge of the element type
     EHCIIsochTransferDescriptorSharedPtr	GetSharedLogical(void);
 	
+	AppleEHCIitdMemoryBlock					*_memBlock;						// the memory block which owns this ITD
+	
 private:
     IOReturn mungeEHCIStatus(UInt32 status, UInt16 *transferLen, UInt32 maxPacketSize, UInt8 direction);
     
@@ -154,6 +157,7 @@ public:
     
 	// split Isoch specific varibles
 	bool								_isDummySITD;
+	AppleEHCIsitdMemoryBlock			*_memBlock;							// the memory block which owns this SITD
 };
 
 
@@ -177,6 +181,11 @@ public:
 	UInt8								_speed;						// the speed of this EP
 	UInt8								_startFrame;				// beginning ms frame in a 32 ms schedule
 	UInt8								_startuFrame;				// first uFrame, used for HS endpoints only!
+	
+	// iTDs/siTDs from this endpoint's completed transfers, kept for reuse by its next transfers
+	IOUSBControllerIsochListElement		*reuseList;
+	UInt32								reuseCount;
+	bool								reuseTDs;					// false once the endpoint is being deleted
 };
 
 #endif
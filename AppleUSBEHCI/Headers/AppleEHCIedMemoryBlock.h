@@ -39,6 +39,7 @@ private:
     EHCIQueueHeadSharedPtr		_sharedLogical;
     AppleEHCIedMemoryBlock		*_nextBlock;
 	IOBufferMemoryDescriptor	*_buffer;
+    EHCIMemoryBlockUsage			_usage;
     
 public:
 
@@ -51,4 +52,5 @@ public:
     UInt32							NumEDs(void);
     IOPhysicalAddress				GetPhysicalPtr(UInt32 index);
     EHCIQueueHeadSharedPtr			GetLogicalPtr(UInt32 index);
+    EHCIMemoryBlockUsage				*GetUsage(void) { return &_usage; }
 };
\ No newline at end of file
@@ -38,6 +38,7 @@ private:
     EHCIIsochTransferDescriptorSharedPtr	_sharedLogical;
     AppleEHCIitdMemoryBlock					*_nextBlock;
 	IOBufferMemoryDescriptor				*_buffer;
+    EHCIMemoryBlockUsage						_usage;
     
 public:
 
@@ -50,5 +51,6 @@ public:
     UInt32									NumTDs(void);
     IOPhysicalAddress						GetPhysicalPtr(UInt32 index);
     EHCIIsochTransferDescriptorSharedPtr	GetLogicalPtr(UInt32 index);
+    EHCIMemoryBlockUsage						*GetUsage(void) { return &_usage; }
     
 };
\ No newline at end of file
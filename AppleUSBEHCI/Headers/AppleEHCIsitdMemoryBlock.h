@@ -37,6 +37,7 @@ private:
     EHCISplitIsochTransferDescriptorSharedPtr	_sharedLogical;
     AppleEHCIsitdMemoryBlock					*_nextBlock;
 	IOBufferMemoryDescriptor					*_buffer;
+    EHCIMemoryBlockUsage							_usage;
     
 public:
 
@@ -49,5 +50,6 @@ public:
     UInt32										NumTDs(void);
     IOPhysicalAddress							GetPhysicalPtr(UInt32 index);
     EHCISplitIsochTransferDescriptorSharedPtr	GetLogicalPtr(UInt32 index);
+    EHCIMemoryBlockUsage							*GetUsage(void) { return &_usage; }
     
 };
\ No newline at end of file
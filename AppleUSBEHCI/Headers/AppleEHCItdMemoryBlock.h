@@ -36,6 +36,7 @@ private:
     EHCIGeneralTransferDescriptor		_TDs[TDsPerBlock];
     AppleEHCItdMemoryBlock				*_nextBlock;
 	IOBufferMemoryDescriptor			*_buffer;
+    EHCIMemoryBlockUsage					_usage;
     
 public:
 
@@ -45,6 +46,7 @@ public:
     static AppleEHCItdMemoryBlock		*NewMemoryBlock(void);
     UInt32								NumTDs(void);
     EHCIGeneralTransferDescriptorPtr	GetTD(UInt32 index);
+    EHCIMemoryBlockUsage					*GetUsage(void) { return &_usage; }
     void								SetNextBlock(AppleEHCItdMemoryBlock *next);
     AppleEHCItdMemoryBlock				*GetNextBlock(void);
     
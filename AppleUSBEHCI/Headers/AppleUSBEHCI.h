@@ -96,6 +96,7 @@ struct EHCIGeneralTransferDescriptor
 	UInt64									lastFrame;				// the frame the last time we checked for a timeout
     UInt32									lastRemaining;			//the "remaining" count the last time we checked
     UInt32									tdSize;					//the total bytes to be transferred by this TD. For statistics only
+	AppleEHCItdMemoryBlock					*pMemBlock;				// the memory block which owns this TD
     UInt32									flagsAtError;			// the flags word the last time this stopped with an error
     UInt32									errCount;				// software error count for restarting transactions.
 	
@@ -124,6 +125,36 @@ enum
     kEHCICheckForRootHubInactivityPeriod = 2		// Wait for 2 secs after the last time the root hub was active
 };
 
+enum
+{
+	kEHCIMemoryBlockReclaimIdleTicks = 30,			// release a descriptor memory block after it has been completely free for 30 watchdog ticks
+	kEHCIIsochEndpointMaxReuseTDs = 128				// most iTDs/siTDs an isoch endpoint will hold on to for its next transfers
+};
+
+// How many elements of a descriptor memory block are off the free list, and for how many watchdog ticks there have been
+// none.  Every memory block type keeps one of these, so that ReclaimIdleMemoryBlocks can treat them all alike.
+class EHCIMemoryBlockUsage
+{
+    UInt32		_useCount;						// elements of the block which are not on a free list
+    UInt32		_idleTicks;						// consecutive watchdog ticks with a zero _useCount
+	
+public:
+    void		IncrementUseCount(void) { _useCount++; _idleTicks = 0; }
+    void		DecrementUseCount(void) { if (_useCount) _useCount--; }
+	
+    // called once per watchdog tick - returns the number of consecutive ticks for which none of the elements were in use
+    UInt32		IdleTick(void) { if (_useCount) _idleTicks = 0; else _idleTicks++; return _idleTicks; }
+};
+
+enum
+{
+	kEHCIMinInterruptThreshold = 1,					// interrupt every micro frame as needed (4745296)
+	kEHCIThrottledInterruptThreshold = 8,			// interrupt at most once per frame
+	kEHCIThrottleInterruptRate = 2000,				// completion interrupts/sec above which we throttle, if nothing latency sensitive is open
+	kEHCIUnthrottleInterruptRate = 250,				// completion interrupts/sec below which we go back to every micro frame
+	kEHCILowLatencyPollingRate = 4					// interrupt endpoints polled faster than this (in ms) keep us at every micro frame
+};
+
 
 enum{
 	kMaxPorts = 15
@@ -173,6 +204,8 @@ class AppleUSBEHCI : public IOUSBControllerV3
 		UInt32			errors3Strikes;
 		UInt32			prevErrors3Strikes;
 		UInt32			controlBulkTxOut;
+		UInt32			interruptRate;					// completion interrupts per second over the last watchdog tick
+		UInt32			interruptThreshold;				// current USBCMD interrupt threshold, in uFrames
 	} UIMDiagnostics;
 	
 	
@@ -244,6 +277,12 @@ protected:
 	UInt8									_asynchScheduleUnsynchCount;
 	UInt8									_periodicScheduleUnsynchCount;
     UInt32									_periodicEDsInSchedule;					// interrupt endpoints
+	UInt32									_lowLatencyIntEDsInSchedule;			// interrupt endpoints polled faster than kEHCILowLatencyPollingRate
+	UInt32									_interruptThreshold;					// current USBCMD interrupt threshold, in uFrames
+	volatile UInt32							_completeInterruptCount;				// bumped by the filter routine for every completion interrupt
+	UInt32									_lastCompleteInterruptCount;			// _completeInterruptCount at the last sample
+	UInt32									_completeInterruptRate;					// completion interrupts per second at the last sample
+	UInt64									_lastInterruptSampleTime;				// mach_absolute_time of the last sample
     volatile UInt64							_frameNumber;							// the current frame number (high bits only)
     UInt16									_rootHubFuncAddress;					// Function Address for the root hub
     struct  {
@@ -352,6 +391,9 @@ protected:
     EHCIGeneralTransferDescriptorPtr AllocateTD(void);
     AppleEHCIIsochTransferDescriptor *AllocateITD(void);
     AppleEHCISplitIsochTransferDescriptor *AllocateSITD(void);
+    AppleEHCIIsochTransferDescriptor *AllocateEndpointITD(AppleEHCIIsochEndpoint *pEP);
+    AppleEHCISplitIsochTransferDescriptor *AllocateEndpointSITD(AppleEHCIIsochEndpoint *pEP);
+	void ReturnEndpointTDs(AppleEHCIIsochEndpoint *pEP);
 	
     IOReturn  allocateTDs(AppleEHCIQueueHead		*pEDQueue,
 						  IOUSBCommand*			command,
@@ -411,6 +453,7 @@ protected:
 	
     UInt32				findBufferRemaining(AppleEHCIQueueHead *pED);
 	void				UIMCheckForTimeouts(void);
+	void				UIMCheckForCommandTimeouts(void);
 	
 	IOReturn			AllocateInterruptBandwidth(AppleEHCIQueueHead	*pED, AppleUSBEHCITTInfo *pTT);
 	IOReturn			ReturnInterruptBandwidth(AppleEHCIQueueHead	*pED);
@@ -449,6 +492,11 @@ public:
     IOReturn DeallocateITD (AppleEHCIIsochTransferDescriptor *pTD);
     IOReturn DeallocateSITD (AppleEHCISplitIsochTransferDescriptor *pTD);
 	
+	void UpdateInterruptThreshold(void);
+	void SetInterruptThreshold(UInt32 microFrames);
+	
+	void ReclaimIdleMemoryBlocks(void);
+	
 	// Control
     virtual IOReturn UIMCreateControlEndpoint(UInt8				functionNumber,
 											  UInt8				endpointNumber,
@@ -295,6 +295,13 @@ AppleUSBHub::ConfigureHubDriver(void)
 		USBLog(5, "AppleUSBHub[%p]::ConfigureHubDriver - found kRetryBogusPortStatus (%d)", this, _retryBogusPortStatus);
     }
 
+    boolProperty = (OSBoolean *)_device->getProperty("kRelaxedEnumerationTiming");
+    if ( boolProperty )
+    {
+        _relaxedEnumerationTiming = boolProperty->isTrue();
+		USBLog(5, "AppleUSBHub[%p]::ConfigureHubDriver - found kRelaxedEnumerationTiming (%d)", this, _relaxedEnumerationTiming);
+    }
+
 	boolProperty = (OSBoolean *)_device->getProperty("kAssumePortsAreCaptive");
     if ( boolProperty )
     {
@@ -2795,6 +2802,22 @@ AppleUSBHub::HubStatusChanged(void)
 	return (err == kIOReturnSuccess);
 }
 
+
+
+// Called by a port when it is done handling a status change, with the number of GetPortStatus/ClearPortFeature requests it
+// made to read and clear the change.  We keep totals so that we can tell how many requests a status change costs us.
+void
+AppleUSBHub::StatusChangeProcessed(UInt32 requests)
+{
+	SInt32		events = OSIncrementAtomic(&_statusChangeEvents) + 1;
+	SInt32		total = OSAddAtomic((SInt32)requests, &_statusChangeRequests) + (SInt32)requests;
+	
+	setProperty("StatusChangeEvents", (UInt32)events, 32);
+	setProperty("StatusChangeRequests", (UInt32)total, 32);
+}
+
+
+
 UInt32 
 AppleUSBHub::GetHubErrataBits()
 {
@@ -3528,7 +3551,10 @@ AppleUSBHub::DoPortAction(UInt32 type, UInt32 portNumber, UInt32 options  )
 
            case kIOUSBMessageHubResumePort:
 				EnsureUsability();
-                err = port->SuspendPort( false, true );
+				if (options & kHubPortActionPredictiveResume)
+					err = port->SuspendPort( false, false, true );
+				else
+					err = port->SuspendPort( false, true );
 				USBLog(5, "AppleUSBHub[%p]::DoPortAction - port[%p] port %d of hub at 0x%x now in state[%d]", this, port, (uint32_t)portNumber, (uint32_t)_locationID, port->_portPMState);
 				if (!err && (_myPowerState == kIOUSBHubPowerStateLowPower))
 				{
@@ -83,6 +83,41 @@ static CaptiveErrataListEntry  gErrataList[] = {
 
 #define ERRATALISTLENGTH (sizeof(gErrataList)/sizeof(CaptiveErrataListEntry))
 
+// Enumeration delays, in ms.  We use the spec minimum unless the device or its hub has shown that it needs more time, in which
+// case we use the relaxed value.  A device has shown that it needs more time if it failed to enumerate the last time we tried, if it
+// has needed a retry to enumerate since we booted, or if its driver reenumerated it with kUSBAddExtraResetTimeMask.  A hub can
+// ask for relaxed timing on all of its ports with the kRelaxedEnumerationTiming errata property.
+static const struct
+{
+	UInt32		specMinimum;
+	UInt32		relaxed;
+} gEnumerationDelayPolicy[kHubPortDelayCount] = {
+	{ 100,	300 },		// kHubPortDelayDebounce - TATTDB (USB 2.0, section 7.1.7.3)
+	{ 100,	100 },		// kHubPortDelayResetStatus - TDRST (USB 2.0, section 7.1.7.5) is only 10-20ms, but 7294126 needed the 100ms.  We
+						// can't know before the reset whether a new device is one of those, so every device still gets it
+	{ 10,	300 },		// kHubPortDelayResetRecovery - TRSTRCY (USB 2.0, section 7.1.7.5)
+	{ 2,	10 },		// kHubPortDelaySetAddressRecovery - TDSETADDR (USB 2.0, section 9.2.6.3)
+	{ 3,	30 }		// kHubPortDelayDescriptorRetry
+};
+
+// The devices that have needed more than the spec minimum delays to enumerate since we booted, packed as (vendorID << 16) | productID.
+// An entry is written with a single store and a zero entry is empty, so readers don't need a lock.  When the table is full we
+// forget the oldest device.
+//
+// We don't know who is on a port until we have read its device descriptor, which is after the debounce, the reset and the first
+// GetDescriptor.  Until then the only IDs we can look up are the port's own _lastVendorID/_lastProductID, i.e. the device that was
+// enumerated on this same port last time.  So a learned device gets the relaxed delays for those early steps only when it comes
+// back to the port it was on; plugged into any other port, it gets them from the SetAddress onwards, and only once we have its
+// full descriptor (high and super speed devices - see AddDeviceResetChangeHandler).
+enum
+{
+	kRelaxedTimingDeviceCount = 32
+};
+static volatile UInt32	gRelaxedTimingDevices[kRelaxedTimingDeviceCount];
+static volatile SInt32	gRelaxedTimingNextEntry = 0;
+
+static const char *		gEnumerationPhaseNames[kHubPortEnumPhaseCount] = { "Debounce", "Reset", "Descriptors", "Address", "Config" };
+
 static portStatusChangeVector defaultPortVectors[kNumChangeHandlers] =
 {
     { 0, kHubPortOverCurrent,				kUSBHubPortOverCurrentChangeFeature },
@@ -131,12 +166,19 @@ AppleUSBHubPort::init( AppleUSBHub *parent, int portNum, UInt32 powerAvailable,
     _attachRetry				= 0;
 	_attachRetryFailed			= false;
     _devZeroCounter				= 0;
+	_devZeroLockHeld			= false;
 	_attachMessageDisplayed		= false;
     _overCurrentNoticeDisplayed = false;
 	_portPMState				= usbHPPMS_uninitialized;
 	_resumePending				= false;
 	_portResumeRecoveryTime		= kPortResumeRecoveryTime;
 	_delayOnStatusChange		= false;
+	_concurrentEnumeration		= false;
+	_relaxedTiming				= false;
+	_enumerationRetried			= false;
+	_lastVendorID				= 0;
+	_lastProductID				= 0;
+	_enumPhase					= kHubPortEnumPhaseNone;
 
     _muxed                      = muxed;
     _portLinkState              = 0xFFFF;           // Initialize to invalid state
@@ -148,6 +190,18 @@ AppleUSBHubPort::init( AppleUSBHub *parent, int portNum, UInt32 powerAvailable,
 		USBLog(2,"AppleUSBHubPort[%p]::init failure (Parent: %p, Bus: %p, Desc: %p, PortNum: %d", this, parent, _bus, _hubDesc, portNum); 
         return kIOReturnBadArgument;
     }
+	
+	// A device in the default state answers to address zero, so normally only one port on the bus can be between reset and
+	// SetAddress at a time.  A controller with per-slot addressing routes address zero traffic to the one port it is
+	// addressing, and then the only thing we have to serialize is our use of the bus's device zero pipe.  That is true
+	// for the root hub ports and for SuperSpeed hubs (which are point to point) but not for a USB 2 hub, which repeats
+	// address zero traffic to all of its enabled ports.
+	if ( (_hub->_isRootHub || _hub->_ssHub) && (_bus->getProperty(kUSBControllerPerSlotAddressing) == kOSBooleanTrue) )
+	{
+		USBLog(5,"AppleUSBHubPort[%p]::init - port %d can enumerate concurrently", this, portNum);
+		_concurrentEnumeration = true;
+	}
+	
     _runLock = IOLockAlloc();
     if (!_runLock)
 	{
@@ -222,6 +276,21 @@ AppleUSBHubPort::init( AppleUSBHub *parent, int portNum, UInt32 powerAvailable,
         return kIOReturnNoMemory;
     }
 	
+    _predictiveResumeThread = thread_call_allocate((thread_call_func_t)PredictiveResumeEntry, (thread_call_param_t)this);
+    
+    if (!_predictiveResumeThread)
+    {
+		USBLog(2,"AppleUSBHubPort[%p]::init Could not allocate the _predictiveResumeThread", this);
+        thread_call_free(_initThread);
+        thread_call_free(_portStatusChangedHandlerThread);
+        thread_call_free(_addDeviceThread);
+        thread_call_free(_enablePowerAfterOvercurrentThread);
+        IOLockFree(_runLock);
+        IOLockFree(_initLock);
+        IOLockFree(_removeDeviceLock);
+        return kIOReturnNoMemory;
+    }
+	
     _gate = IOCommandGate::commandGate(this);
 	
     if (!_gate)
@@ -440,8 +509,7 @@ AppleUSBHubPort::stop(void)
     {
 		USBLog(2, "AppleUSBHubPort[%p]::stop - had devZero, releasing", this);
 		USBTrace( kUSBTHubPort,  kTPHubPortStop, (uintptr_t)this, _portNum, _hub->_locationID, 12 );
-		_bus->ReleaseDeviceZero();
-		_devZero = false;
+		ReleaseDeviceZero();
     }
 
 	USBLog(3, "AppleUSBHubPort[%p]::stop - calling RemoveDevice", this);
@@ -512,6 +580,13 @@ AppleUSBHubPort::stop(void)
         _enablePowerAfterOvercurrentThread = 0;
     }
 	
+	if (_predictiveResumeThread)
+    {
+		CancelPredictiveResume();
+        thread_call_free(_predictiveResumeThread);
+        _predictiveResumeThread = 0;
+    }
+	
     if (_gate)
     {
 		if (_workLoop)
@@ -720,10 +795,29 @@ AppleUSBHubPort::AddDevice(bool issueRemoveDevice)
 		return;
 	}
 	
+	// We get here from a connect (which has already started the timeline and decided on our delays), from a retry, or from a
+	// reenumeration of the port
+	if ( _enumPhase == kHubPortEnumPhaseNone )
+		ResetEnumerationTimeline();
+	
+	if ( _attachRetry > 0 )
+		_enumerationRetried = true;
+	
+	if ( !_relaxedTiming )
+		UpdateTimingPolicy(_lastVendorID, _lastProductID);
+	
     do
     {
          // Indicate that we are dealing with device zero, still
-        if ( !_devZero )
+        if ( !_devZero && _concurrentEnumeration )
+        {
+			// Claim device zero for this port, but leave the bus's lock until AddDeviceResetChangeHandler is ready to talk to
+			// address zero, so that the reset and the settle delays can overlap with the other ports' enumeration
+            USBLog(5, "***** AppleUSBHubPort[%p]::AddDevice - port %d on hub at 0x%x - bus %p - claiming dev zero, deferring the lock", this, _portNum, (uint32_t)_hub->_locationID, _bus);
+			_devZero = true;
+			_devZeroCounter++;
+        }
+        else if ( !_devZero )
         {
             USBLog(5, "***** AppleUSBHubPort[%p]::AddDevice - port %d on hub at 0x%x - bus %p - acquiring dev zero lock", this, _portNum, (uint32_t)_hub->_locationID, _bus);
             _devZero = AcquireDeviceZero();
@@ -754,6 +848,8 @@ AppleUSBHubPort::AddDevice(bool issueRemoveDevice)
             USBLog(5, "***** AppleUSBHubPort[%p]::AddDevice - port %d on hub at 0x%x - bus %p - already owned devZero lock", this, _portNum, (uint32_t)_hub->_locationID, _bus);
         }
 
+		BeginEnumerationPhase(kHubPortEnumPhaseReset);
+		
 		if(_hub->_ssHub && !_hub->IsHSRootHub())	// For external SS Hubs, don't do a reset
 		{
 			if ( !_getDeviceDescriptorFailed && GETLINKSTATE(status.statusFlags) == kSSHubPortLinkStateU0 )
@@ -776,7 +872,7 @@ AppleUSBHubPort::AddDevice(bool issueRemoveDevice)
 		// we can't just do it at the end of this function like we used to, because as soon as we set
 		// the reset bit, it is possible for the hub driver to get a reset change event, since we have
 		// been spun off on a separate thread which does not block the interrupt pipe read
-		_delayOnStatusChange = true;		// 7294126 - to be more compatible with the old code, make sure we delay 100 ms before we read the status on a status change
+		_delayOnStatusChange = true;		// 7294126 - to be more compatible with the old code, make sure we delay before we read the status on a status change
 
 		// For a SuperSpeed Root Hub, we want to issue a USB2 reset during our first attempt at enumerating a device.  If we are having trouble enumerating the device, then
 		// we shall issue a Warm Reset, which causes the device to retrain the link.  
@@ -901,8 +997,7 @@ AppleUSBHubPort::AddDevice(bool issueRemoveDevice)
 			}
 		}
         
-        _bus->ReleaseDeviceZero();
-        _devZero = false;
+        ReleaseDeviceZero();
         
         // put it back to the default if there was an error
         SetPortVector(&AppleUSBHubPort::DefaultResetChangeHandler, kHubPortBeingReset);
@@ -1044,8 +1139,7 @@ AppleUSBHubPort::CallAddDeviceResetChangeHandlerDirectly(UInt16 portChange, UInt
 			// We should disable the port here as well..
 			//
 			USBLog(5,"AppleUSBHubPort[%p]::CallAddDeviceResetChangeHandlerDirectly - port %d - err = %x - done, releasing Dev Zero lock", this, _portNum, err);
-			_bus->ReleaseDeviceZero();
-			_devZero = false;
+			ReleaseDeviceZero();
 		}
 	}
 	
@@ -1087,6 +1181,10 @@ AppleUSBHubPort::RemoveDevice(void)
 	bzero(&_desc, sizeof(_desc));
 	IOLockUnlock(_removeDeviceLock);
 
+	// whatever comes next on this port will have its own rhythm
+	CancelPredictiveResume();
+	ResetPortAccessHistory();
+	
     if (cachedPortDevice)
     {
 		USBLog(1, "AppleUSBHubPort[%p]::RemoveDevice start (%s) port %d @ 0x%x", this, cachedPortDevice->getName(), (uint32_t)_portNum, (uint32_t)_hub->_locationID);
@@ -1268,12 +1366,13 @@ AppleUSBHubPort::MessageDeviceClients( UInt32 type, void * argument, vm_size_t a
 
 
 IOReturn 
-AppleUSBHubPort::SuspendPort( bool suspend, bool fromDevice )
+AppleUSBHubPort::SuspendPort( bool suspend, bool fromDevice, bool predictive )
 {
     IOReturn			status = kIOReturnSuccess;
     IOUSBHubPortStatus	hubPortStatus;
 	UInt32				resumeRetries = 10;
 	OSBoolean			*expressCardCantWakeRef;
+	UInt64				requestTime = mach_absolute_time();
 		
     USBLog(5, "AppleUSBHubPort[%p]::SuspendPort(%s) for port %d fromDevice(%s), _resumePending(%d), isInactive(%s)", this, suspend ? "suspend" : "resume", _portNum, fromDevice ? "true" : "false", _resumePending, _hub->isInactive() ? "true" : "false");
 
@@ -1337,6 +1436,33 @@ AppleUSBHubPort::SuspendPort( bool suspend, bool fromDevice )
 					USBLog(1, "AppleUSBHubPort[%p]::SuspendPort - port %d, unable (err = %x) to disable port", this, _portNum, err);
 				}
 			}
+			else if ( fromDevice && (status == kIOReturnSuccess) )
+			{
+				// The driver is done with the device for now.  If we resumed it ahead of an access, the driver keeping it until
+				// that access was due is as close as we can get to knowing that it was used
+				if ( _predictiveResumeOutstanding )
+				{
+					uint64_t		deviation;
+					
+					_predictiveResumeOutstanding = false;
+					clock_interval_to_absolutetime_interval(_accessDeviationMS, kMillisecondScale, &deviation);
+					if ( (mach_absolute_time() + deviation) >= _predictedPortAccess )
+					{
+						// take the access as having happened when we expected it, so that we keep the rhythm
+						_lastPortAccess = _predictedPortAccess;
+						_predictiveResumeMisses = 0;
+					}
+					else
+					{
+						// suspended again before the access was due, so the resume was not needed
+						PredictiveResumeMissed();
+					}
+				}
+				
+				// If it has a rhythm, be ready for it to come back
+				_portSuspendedSince = mach_absolute_time();
+				SchedulePredictiveResume();
+			}
 		}
 		else
 		{
@@ -1348,6 +1474,31 @@ AppleUSBHubPort::SuspendPort( bool suspend, bool fromDevice )
 			else
 			{
 				status = Resume();
+				
+				if ( (status == kIOReturnSuccess) && predictive )
+				{
+					// Whether the access we resumed for happened is only known when the driver suspends the device again
+					uint64_t		period;
+					
+					clock_interval_to_absolutetime_interval(_accessPeriodMS, kMillisecondScale, &period);
+					_predictedPortAccess = _lastPortAccess + period;
+					_predictiveResumeOutstanding = true;
+					_predictiveResumeCount++;
+					PublishPortSuspendStatistics();
+				}
+				else if ( (status == kIOReturnSuccess) && fromDevice )
+				{
+					// The driver needed the device and had to wait for the resume.  If we were predicting, we got it wrong
+					if ( CancelPredictiveResume() || _predictiveResumeOutstanding )
+					{
+						_predictiveResumeOutstanding = false;
+						PredictiveResumeMissed();
+					}
+					_resumeStalls++;
+					_resumeStallTime += mach_absolute_time() - requestTime;
+					RecordPortAccess(requestTime);
+					PublishPortSuspendStatistics();
+				}
 			}
 		}
 	}
@@ -1393,6 +1544,10 @@ AppleUSBHubPort::ReEnumeratePort(UInt32 options)
     {
         USBLog(5,"AppleUSBHubPort[%p]::ReEnumeratePort -- reenumerating port %d, options 0x%x",this, (uint32_t)_portNum, (uint32_t)options);
         _extraResetDelay = true;
+		
+		// The driver knows that this device needs more time, so give it the relaxed delays the next time it connects, too
+		if ( _portDevice )
+			LearnRelaxedTiming(_portDevice->GetVendorID(), _portDevice->GetProductID());
     }
     else
     {
@@ -1614,8 +1769,7 @@ AppleUSBHubPort::ResetPort()
 		}
 		else if (_devZero)
 		{
-			_bus->ReleaseDeviceZero();
-			_devZero = false;
+			ReleaseDeviceZero();
 		}
 		
 		// If we have a kIOReturnBusy, check to see if the device is still attached (for USB2) or if the link is in RX.Detect (USB3) and if so
@@ -1846,13 +2000,14 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
             // If the device attached to this port misbehaved last time we tried to enumerate it, let's
             // relax the timing a little bit and give it more time.
             //
+            delay = EnumerationDelay(kHubPortDelayResetRecovery);
             if (_getDeviceDescriptorFailed)
             {
-                delay = 300;
+                delay = gEnumerationDelayPolicy[kHubPortDelayResetRecovery].relaxed;
                 USBLog(3, "**1** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d on hub at 0x%x - new delay %d", this, (uint32_t)_portNum, (uint32_t)_hub->_locationID, (uint32_t)delay);
             }
                 
-            // Now wait 10 ms (or 300ms -- see above) after reset
+            // Now give the device its reset recovery time (relaxed -- see above)
             //
             USBLog(5, "**1** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d on hub at 0x%x - delaying %d ms", this, (uint32_t)_portNum, (uint32_t)_hub->_locationID, (uint32_t)delay);
 #if DEBUG_LEVEL != DEBUG_LEVEL_PRODUCTION
@@ -1888,6 +2043,21 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
 					
 			}
 			
+			// With concurrent enumeration, this is where we start using the bus's device zero pipe
+			if ( _devZero && !_devZeroLockHeld )
+			{
+				USBLog(5, "**2** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d on hub at 0x%x - acquiring dev zero lock", this, _portNum, (uint32_t) _hub->_locationID);
+				if ( !AcquireDeviceZero() )
+				{
+					// We still have our claim, so the error path below will disable the port and give it up
+					USBLog(2, "**2** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d on hub at 0x%x - unable to get devZero lock", this, _portNum, (uint32_t) _hub->_locationID);
+					FatalError(kIOReturnCannotLock, "acquiring device zero");
+					err = kIOReturnCannotLock;
+					break;
+				}
+			}
+			
+            BeginEnumerationPhase(kHubPortEnumPhaseDescriptors);
             USBLog(5, "**2** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d on hub at 0x%x - configuring dev zero", this, _portNum, (uint32_t) _hub->_locationID);
 
             err = DoConfigureDeviceZero(_bus, packetSize, _speed,  _hub->_device->GetAddress(), _portNum);
@@ -1920,8 +2090,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
 					FatalError(err, "clearing port feature (2)");
 				}
 				
-				_bus->ReleaseDeviceZero();
-				_devZero = false;
+				ReleaseDeviceZero();
 				_portDevice = NULL;
 				return err;
 			}
@@ -1949,24 +2118,45 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
 				{
 					USBLog(3, "**3** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, unable (err = %x) to disable port", this, _portNum, err);
 					FatalError(err, "clearing port feature (2)");
-					_bus->ReleaseDeviceZero();
-					_devZero = false;
+					ReleaseDeviceZero();
 					_portDevice = NULL;
 					return err;
 				}
 				
-				_bus->ReleaseDeviceZero();
-				_devZero = false;
+				ReleaseDeviceZero();
 				_state = hpsSetAddressFailed;
 				
 				return DetachDevice();
 			}
 
             USBLog(5,"**3** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, using %d for maxPacketSize", this, _portNum, _desc.bMaxPacketSize0);            
+			
+			// If we got the whole descriptor (see GetDevZeroDescriptorWithRetries), we know who this is now, and whether it is a device we
+			// have learned needs more time
+			if ( !_relaxedTiming && (kUSBDeviceSpeedHigh == _speed || kUSBDeviceSpeedSuper == _speed) && NeedsRelaxedTiming(USBToHostWord(_desc.idVendor), USBToHostWord(_desc.idProduct)) )
+			{
+				USBLog(5,"**3** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, device 0x%04x/0x%04x needs relaxed timing", this, _portNum, USBToHostWord(_desc.idVendor), USBToHostWord(_desc.idProduct));
+				_relaxedTiming = true;
+			}
         }
 
         // MacOS 9 STATE 4
         
+		// If we came straight here from hpsDeadDeviceZero we have not taken the lock yet
+		if ( _devZero && !_devZeroLockHeld )
+		{
+			USBLog(5, "**4** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d on hub at 0x%x - acquiring dev zero lock", this, _portNum, (uint32_t) _hub->_locationID);
+			if ( !AcquireDeviceZero() )
+			{
+				USBLog(2, "**4** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d on hub at 0x%x - unable to get devZero lock", this, _portNum, (uint32_t) _hub->_locationID);
+				FatalError(kIOReturnCannotLock, "acquiring device zero");
+				err = kIOReturnCannotLock;
+				break;
+			}
+		}
+		
+		BeginEnumerationPhase(kHubPortEnumPhaseAddress);
+		
         if (_setAddressFailed > 0)
         {
             // Last time we were here, the following set address failed, so give it some more time
@@ -1995,8 +2185,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
 				USBLog(1,"**5** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - Port %d of Hub at 0x%x,  we have a hub, but this would be the 6th hub in the bus, which is illegal.  Erroring out", this, _portNum, (uint32_t)_hub->_locationID );
 				USBError(1,"A USB Hub (connected to the hub at 0x%x) has been plugged in but it will result in an illegal configuration.  The hub will not be enabled.", (uint32_t)_hub->_locationID);
 				USBTrace( kUSBTHubPort,  kTPHubPortAddDeviceResetChangeHandler, (uintptr_t)this, _portNum, _hub->_locationID, 1 );
-                _bus->ReleaseDeviceZero();
-                _devZero = false;
+                ReleaseDeviceZero();
 				_portDevice = NULL;
 				err = kIOReturnNoDevice;
 				break;
@@ -2020,15 +2209,13 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
             {
                 USBLog(3, "**5** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, unable (err = %x) to disable port", this, _portNum, err);
                 FatalError(err, "clearing port feature (3)");
-                _bus->ReleaseDeviceZero();
-                _devZero = false;
+                ReleaseDeviceZero();
                 _state = hpsSetAddressFailed;
                 _portDevice = NULL;
                return err;
             }
             
-            _bus->ReleaseDeviceZero();
-            _devZero = false;
+            ReleaseDeviceZero();
             _state = hpsSetAddressFailed;
             
             return DetachDevice();
@@ -2041,13 +2228,12 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
 				USBLog(7, "AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d of hub @ 0x%x, _addDeviceThreadActive after SetAddress(), before IOSleep(2) ", this, _portNum,  (uint32_t)_hub->_locationID);
 			}
 			
-            // Section 9.2.6.3 of the spec gives the device 2ms to recover from the SetAddress
-            IOSleep( 2 );
+            // Section 9.2.6.3 of the spec gives the device 2ms to recover from the SetAddress (more, if it has needed relaxed timing)
+            IOSleep( EnumerationDelay(kHubPortDelaySetAddressRecovery) );
 
             // Release devZero lock
             USBLog(5, "**5** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, Releasing DeviceZero after successful SetAddress to %d", this, _portNum, address);
-            _bus->ReleaseDeviceZero();
-            _devZero = false;
+            ReleaseDeviceZero();
             _state = hpsNormal;
             
         }
@@ -2055,6 +2241,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
         if ( _state == hpsDeadDeviceZero )
         {
             _setAddressFailed++;
+			_enumerationRetried = true;
             USBLog(3, "**6** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, setaddressfailed = %d, disabling port", this, _portNum, _setAddressFailed);
             
             // Note: we are intentionally not changing the value of err below
@@ -2067,8 +2254,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
             if (_devZero)
             {
                 USBLog(3, "**6** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, releasing devZero lock", this, _portNum);
-                _bus->ReleaseDeviceZero();
-                _devZero = false;
+                ReleaseDeviceZero();
             }
             
             USBLog(3, "**7** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, setting state to hpsSetAddressFailed", this, _portNum);
@@ -2108,8 +2294,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
             if (_devZero)
             {
                 USBLog(3, "**9** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, releasing devZero lock", this, _portNum);
-                _bus->ReleaseDeviceZero();
-                _devZero = false;
+                ReleaseDeviceZero();
             }
 
             USBLog(3, "**9** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, delaying 10 ms and calling AddDevice", this, _portNum);
@@ -2124,6 +2309,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
 
         _state = hpsNormal;
         
+		BeginEnumerationPhase(kHubPortEnumPhaseConfig);
 		err = DoCreateDevice(_bus, usbDevice, address, _desc.bMaxPacketSize0, _speed, _portPowerAvailable, _hub->_device->GetAddress(), _portNum);
         if ( err == kIOReturnSuccess )
         {
@@ -2162,8 +2348,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
 			if (_devZero)
 			{
 				USBLog(3, "**9** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, releasing devZero lock", this, _portNum);
-				_bus->ReleaseDeviceZero();
-				_devZero = false;
+				ReleaseDeviceZero();
 			}
 
 			USBLog(3, "**9** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, delaying 10 ms and calling AddDevice", this, _portNum);
@@ -2178,6 +2363,13 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
 	
         USBLog(5, "**10** AppleUSBHubPort[%p]::AddDeviceResetChangeHandler -  port %d, at addr: %d, Successful", this, _portNum, address);
 
+		// Remember who this is, so that we can pick our delays before we can read its descriptor the next time it connects, and if it
+		// took us more than one try to enumerate it, use the relaxed delays for it from now on
+		_lastVendorID = usbDevice->GetVendorID();
+		_lastProductID = usbDevice->GetProductID();
+		if ( _enumerationRetried )
+			LearnRelaxedTiming(_lastVendorID, _lastProductID);
+		
         _attachRetry = 0;
 		_attachRetryFailed	= false;
 		if ( _attachMessageDisplayed )
@@ -2309,6 +2501,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
        // register the NUB
 		USBLog(1, "AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - Port %d of Hub at 0x%x (USB Address: %d), calling registerService for device %s", this,  (uint32_t)_portNum, (uint32_t)_hub->_locationID, (uint32_t)address, usbDevice->getName() );
 		USBTrace(kUSBTEnumeration, kTPEnumerationRegisterService, (uintptr_t)this, _portNum, _hub->_locationID, 0);
+		PublishEnumerationTimeline(usbDevice);
         usbDevice->registerService();
 		
 		// Detect New Expresscard and reset the _detectedExpressCardCantWake variable.
@@ -2330,8 +2523,7 @@ AppleUSBHubPort::AddDeviceResetChangeHandler(UInt16 changeFlags, UInt16 statusFl
             USBLog(3, "AppleUSBHubPort[%p]::AddDeviceResetChangeHandler - port %d, err = %x, releasing devZero lock", this, _portNum, err);
 			if ( !_hub->_ssHub )
             	_hub->ClearPortFeature(kUSBHubPortEnableFeature, _portNum);
-            _bus->ReleaseDeviceZero();
-            _devZero = false;
+            ReleaseDeviceZero();
         }
     }
     SetPortVector(&AppleUSBHubPort::DefaultResetChangeHandler, kHubPortBeingReset);
@@ -2390,8 +2582,7 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
                 USBLog(5, "AppleUSBHubPort[%p]::HandleResetPortHandler - port %d - device appears to have gone away and then come back", this, _portNum);
   				_resetPending = false;
               	err = kIOReturnSuccess;
-				_bus->ReleaseDeviceZero();
-				_devZero = false;
+				ReleaseDeviceZero();
               	_state = hpsDeadDeviceZero;
 				break;
             }
@@ -2399,13 +2590,14 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
 			// If the device attached to this port misbehaved last time we tried to enumerate it, let's
             // relax the timing a little bit and give it more time.
             //
+            delay = EnumerationDelay(kHubPortDelayResetRecovery);
             if (_getDeviceDescriptorFailed)
             {
-                delay = 300;
+                delay = gEnumerationDelayPolicy[kHubPortDelayResetRecovery].relaxed;
                 USBLog(3, "**1** AppleUSBHubPort[%p]::HandleResetPortHandler - port %d on hub at 0x%x - new delay %d", this, (uint32_t)_portNum, (uint32_t)_hub->_locationID, (uint32_t)delay);
             }
 			
-            // Now wait 10 ms (or 300ms -- see above) after reset
+            // Now give the device its reset recovery time (relaxed -- see above)
             //
             USBLog(5, "**1** AppleUSBHubPort[%p]::HandleResetPortHandler - port %d on hub at 0x%x - delaying %d ms", this, (uint32_t)_portNum, (uint32_t)_hub->_locationID, (uint32_t)delay);
 #if DEBUG_LEVEL != DEBUG_LEVEL_PRODUCTION
@@ -2468,14 +2660,12 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
 					USBLog(1, "**3** AppleUSBHubPort[%p]::HandleResetPortHandler - port %d, unable (err = %x) to disable port", this, (uint32_t)_portNum, err);
 					USBTrace( kUSBTHubPort,  kTPHubPortHandleResetPortHandler, (uintptr_t)this, _portNum, err, 1);
 					FatalError(err, "clearing port feature (4)");
-					_bus->ReleaseDeviceZero();
-					_devZero = false;
+					ReleaseDeviceZero();
 					_portDevice = NULL;
 					return err;
 				}
 				
-				_bus->ReleaseDeviceZero();
-				_devZero = false;
+				ReleaseDeviceZero();
 				_state = hpsSetAddressFailed;
 				
 				// Do not call DetachDevice now.  Let the ResetPort() code decide when to do that.
@@ -2527,8 +2717,7 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
                 {
                     USBLog(3, "**5** AppleUSBHubPort[%p]::HandleResetPortHandler - port %d, unable (err = %x) to disable port", this, _portNum, err);
 					
-                    _bus->ReleaseDeviceZero();
-                    _devZero = false;
+                    ReleaseDeviceZero();
                     _state = hpsSetAddressFailed;
 					
                     // Now, we need to notify our client that the reset did not complete
@@ -2553,8 +2742,7 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
                     return err;
                 }
                 
-                _bus->ReleaseDeviceZero();
-                _devZero = false;
+                ReleaseDeviceZero();
                 _state = hpsSetAddressFailed;
 				
                 // Now, we need to notify our client that the reset did not complete
@@ -2605,14 +2793,13 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
                     USBLog(5, "AppleUSBHubPort[%p]::HandleResetPortHandler - Didn't get bus3", this);
                 }
                 
-                // Section 9.2.6.3 of the spec gives the device 2ms to recover from the SetAddress
-                IOSleep( 2 );
+                // Section 9.2.6.3 of the spec gives the device 2ms to recover from the SetAddress (more, if it has needed relaxed timing)
+                IOSleep( EnumerationDelay(kHubPortDelaySetAddressRecovery) );
 				
                 // Release devZero lock
                 USBLog(5, "**5** AppleUSBHubPort[%p]::HandleResetPortHandler - port %d, Releasing DeviceZero after successful SetAddress", this, _portNum);
 				_resetPending = false;
-               _bus->ReleaseDeviceZero();
-                _devZero = false;
+               ReleaseDeviceZero();
                 _state = hpsNormal;
             }
         }
@@ -2633,8 +2820,7 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
             if (_devZero)
             {
                 USBLog(3, "**6** AppleUSBHubPort[%p]::HandleResetPortHandler - port %d, releasing devZero lock", this, _portNum);
-                _bus->ReleaseDeviceZero();
-                _devZero = false;
+                ReleaseDeviceZero();
             }
             
             // MacOS 9 STATE 7
@@ -2674,8 +2860,7 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
             {
                 USBLog(3, "**9** AppleUSBHubPort[%p]::HandleResetPortHandler - port %d, releasing devZero lock", this, _portNum);
 				_resetPending = true;
-               _bus->ReleaseDeviceZero();
-                _devZero = false;
+               ReleaseDeviceZero();
             }
             USBLog(3, "**9** AppleUSBHubPort[%p]::HandleResetPortHandler - port %d, _portDevice disappeared, returning", this, _portNum);
 			
@@ -2707,8 +2892,7 @@ AppleUSBHubPort::HandleResetPortHandler(UInt16 changeFlags, UInt16 statusFlags)
             if (!_hub->_ssHub)
 				_hub->ClearPortFeature(kUSBHubPortEnableFeature, _portNum);
 			_resetPending = true;
-           _bus->ReleaseDeviceZero();
-            _devZero = false;
+           ReleaseDeviceZero();
         }
     }
 
@@ -2768,9 +2952,23 @@ AppleUSBHubPort::HandleSuspendPortHandler(UInt16 changeFlags, UInt16 statusFlags
 	
 	if (_portPMState == usbHPPMS_drvr_suspended)
 	{
+		if (_portSuspendedSince)
+		{
+			_portSuspendedTime += mach_absolute_time() - _portSuspendedSince;
+			_portSuspendedSince = 0;
+		}
+		
 		// make sure we are still connected before sending a resume message
 		if (statusFlags & kHubPortConnection)
 		{
+			if (!fromResume)
+			{
+				// The device woke up because it has something for its driver, which is as much an access as the driver resuming it
+				CancelPredictiveResume();
+				RecordPortAccess(mach_absolute_time());
+				PublishPortSuspendStatistics();
+			}
+			
 			USBLog(5, "AppleUSBHubPort[%p]::HandleSuspendPortHandler _suspendChangeAlreadyLogged: %s", this, _suspendChangeAlreadyLogged ? "true" : "false");
 			if (!fromResume && !_suspendChangeAlreadyLogged)
 			{
@@ -2984,16 +3182,25 @@ AppleUSBHubPort::DefaultConnectionChangeHandler(UInt16 changeFlags, UInt16 statu
     _connectionChangedState = 0;
     do
     {		
+		if (status.statusFlags & kHubPortConnection)
+		{
+			// Start a new timeline.  Until we can read its descriptor, assume that this is the same device we had last time
+			ResetEnumerationTimeline();
+			BeginEnumerationPhase(kHubPortEnumPhaseDebounce);
+			_enumerationRetried = false;
+			UpdateTimingPolicy(_lastVendorID, _lastProductID);
+		}
+		
         // Wait before asserting reset (USB 1.1, section 7.1.7.1)
         //
         if ( _getDeviceDescriptorFailed )
         {
             _connectionChangedState = 1;
-            USBLog(3, "AppleUSBHubPort[%p]::DefaultConnectionChangeHandler port (%d) - previous enumeration failed - sleeping 300 ms", this, _portNum);
+            USBLog(3, "AppleUSBHubPort[%p]::DefaultConnectionChangeHandler port (%d) - previous enumeration failed - sleeping %d ms", this, _portNum, (uint32_t)gEnumerationDelayPolicy[kHubPortDelayDebounce].relaxed);
 #if DEBUG_LEVEL != DEBUG_LEVEL_PRODUCTION
             {if(_bus->getWorkLoop()->inGate()){USBLog(1, "AppleUSBHubPort[%p]::DefaultConnectionChangeHandler - IOSleep in gate:%d", this, 1);}}
 #endif
-            IOSleep(300);
+            IOSleep(gEnumerationDelayPolicy[kHubPortDelayDebounce].relaxed);
 			if (!(status.statusFlags & kHubPortConnection))
 			{
 				USBLog(5, "AppleUSBHubPort[%p]::DefaultConnectionChangeHandler port (%d) - This is a disconnect", this, _portNum);
@@ -3010,12 +3217,12 @@ AppleUSBHubPort::DefaultConnectionChangeHandler(UInt16 changeFlags, UInt16 statu
 			// 
 			if (status.statusFlags & kHubPortConnection)
 			{
-				USBLog(5, "AppleUSBHubPort[%p]::DefaultConnectionChangeHandler port (%d) - waiting 100 ms before asserting reset", this, _portNum);
+				USBLog(5, "AppleUSBHubPort[%p]::DefaultConnectionChangeHandler port (%d) - waiting %d ms before asserting reset", this, _portNum, (uint32_t)EnumerationDelay(kHubPortDelayDebounce));
 				_connectionChangedState = 2;
 #if DEBUG_LEVEL != DEBUG_LEVEL_PRODUCTION
                 {if(_bus->getWorkLoop()->inGate()){USBLog(1, "AppleUSBHubPort[%p]::DefaultConnectionChangeHandler - IOSleep in gate:%d", this, 2);}}
 #endif
-				IOSleep(100);
+				IOSleep(EnumerationDelay(kHubPortDelayDebounce));
 			}
 			else
 			{
@@ -3055,8 +3262,7 @@ AppleUSBHubPort::DefaultConnectionChangeHandler(UInt16 changeFlags, UInt16 statu
             USBLog(5, "AppleUSBHubPort[%p]::DefaultConnectionChangeHandler - port %d - releasing devZero lock", this, _portNum);
             // _state = hpsNormal;
             _connectionChangedState = 3;
-            _bus->ReleaseDeviceZero();
-            _devZero = false;
+            ReleaseDeviceZero();
         }
         
         if (_portDevice)
@@ -3288,6 +3494,7 @@ AppleUSBHubPort::PortStatusChangedHandler(void)
     int			which;
     IOReturn	err = kIOReturnSuccess;
     bool		skipOverGetPortStatus = false;
+	UInt32		requests = 0;					// GetPortStatus and ClearPortFeature requests made to handle this change
 	
 	// If we're already processing a status change, then just indicate so and return
     if (!IOLockTryLock(_runLock))
@@ -3317,12 +3524,12 @@ AppleUSBHubPort::PortStatusChangedHandler(void)
 
 	if (_delayOnStatusChange)
 	{
-		USBLog(5, "AppleUSBHubPort[%p]::PortStatusChangedHandler: delaying 100ms before first GetPortStatus after a reset of port %d", this, _portNum);
-		// 7294126 - add a 100ms delay immediately after resetting a port and before we try to get status for that port again
+		USBLog(5, "AppleUSBHubPort[%p]::PortStatusChangedHandler: delaying %dms before first GetPortStatus after a reset of port %d", this, (uint32_t)EnumerationDelay(kHubPortDelayResetStatus), _portNum);
+		// 7294126 - add a delay immediately after resetting a port and before we try to get status for that port again (see gEnumerationDelayPolicy)
 #if DEBUG_LEVEL != DEBUG_LEVEL_PRODUCTION
         {if(_bus->getWorkLoop()->inGate()){USBLog(1, "AppleUSBHubPort[%p]::PortStatusChangedHandler - IOSleep in gate:%d", this, 1);}}
 #endif
-		IOSleep(100);
+		IOSleep(EnumerationDelay(kHubPortDelayResetStatus));
 		_delayOnStatusChange = false;
 	}
 	
@@ -3336,6 +3543,7 @@ AppleUSBHubPort::PortStatusChangedHandler(void)
 			USBLog(5, "AppleUSBHubPort[%p]::PortStatusChangedHandler: calling GetPortStatus for port %d", this, _portNum);
            
 			// Do a port status request on current port
+			requests++;
             if ((err = _hub->GetPortStatus(&_portStatus, _portNum)))
             {
                 
@@ -3360,6 +3568,7 @@ AppleUSBHubPort::PortStatusChangedHandler(void)
 			if (_hub->_ssHub)
 			{
 				UInt16	portLinkErrorCount = 0;
+				requests++;
 				err = _hub->GetPortErrorCount(_portNum, &portLinkErrorCount);
 				if ((err ==kIOReturnSuccess) && (portLinkErrorCount > _portLinkErrorCount))
 				{
@@ -3408,6 +3617,7 @@ AppleUSBHubPort::PortStatusChangedHandler(void)
             
             USBLog(5, "AppleUSBHubPort[%p]::PortStatusChangedHandler - port %d - change %d clearing feature 0x%x (%s)", this, (uint32_t)_portNum, which, (uint32_t)_changeHandler[which].clearFeature, _hub->FeatureName(_changeHandler[which].clearFeature));
             _statusChangedState = 4;
+			requests++;
             if ((err = _hub->ClearPortFeature(_changeHandler[which].clearFeature, _portNum)))
             {
                 USBLog(3, "AppleUSBHubPort[%p]::PortStatusChangedHandler - port %d - error %x clearing feature 0x%x (%s)", this, (uint32_t)_portNum, err, (uint32_t)_changeHandler[which].clearFeature, _hub->FeatureName(_changeHandler[which].clearFeature));
@@ -3430,6 +3640,7 @@ AppleUSBHubPort::PortStatusChangedHandler(void)
         // Do a port status request on current port, after clearing the feature above.
         //
         _statusChangedState = 6;
+		requests++;
         if ((err = _hub->GetPortStatus(&_portStatus, _portNum)))
         {
             USBLog(3, "AppleUSBHubPort[%p]::PortStatusChangedHandler: error 0x%x getting port status", this, err);
@@ -3493,12 +3704,12 @@ errorExit:
 			// We should disable the port here as well..
 			//
 			USBLog(5,"AppleUSBHubPort[%p]::PortStatusChangedHandler - port %d - err = %x - done, releasing Dev Zero lock", this, _portNum, err);
-			_bus->ReleaseDeviceZero();
-			_devZero = false;
+			ReleaseDeviceZero();
 		}
 	}
 	
-    USBLog(5,"AppleUSBHubPort[%p]::PortStatusChangedHandler - port %d - err = %x - done, releasing _runLock", this, _portNum, err);
+    USBLog(5,"AppleUSBHubPort[%p]::PortStatusChangedHandler - port %d - err = %x - done (%d requests), releasing _runLock", this, _portNum, err, (uint32_t)requests);
+	_hub->StatusChangeProcessed(requests);
     
     IOLockUnlock(_runLock);
     IOLockUnlock(_initLock);
@@ -3624,10 +3835,7 @@ AppleUSBHubPort::ReleaseDevZeroLock()
 
         _state = hpsNormal;
  
-        if ( _bus )
-            _bus->ReleaseDeviceZero();
-            
-        _devZero = false;
+        ReleaseDeviceZero();
         
         
         // Nano says this is probably not needed, it was causing audio glitches.
@@ -3796,7 +4004,7 @@ ErrorExit:
 IOReturn
 AppleUSBHubPort::GetDevZeroDescriptorWithRetries()
 {
-    UInt32				delay = 30;
+    UInt32				delay = 0;
     UInt32				retries = kMaxDevZeroRetries;
     IOReturn			err = kIOReturnSuccess;
     IOReturn			portStatusErr = kIOReturnSuccess;
@@ -3885,10 +4093,11 @@ AppleUSBHubPort::GetDevZeroDescriptorWithRetries()
                 }
             }
 			
-            if ( retries == 2)
-                delay = 3;
-            else if ( retries == 1 )
-                delay = 30;
+            // Retry quickly, but give the device the relaxed delay before our last try
+            if ( retries == 1 )
+                delay = gEnumerationDelayPolicy[kHubPortDelayDescriptorRetry].relaxed;
+            else
+                delay = EnumerationDelay(kHubPortDelayDescriptorRetry);
                 
             USBLog(3, "AppleUSBHubPort[%p]::GetDevZeroDescriptorWithRetries - port %d of hub @ 0x%x , err: %x - sleeping for %d milliseconds", this, (uint32_t)_portNum, (uint32_t)_hub->_locationID, err, (uint32_t)delay);
 #if DEBUG_LEVEL != DEBUG_LEVEL_PRODUCTION
@@ -3942,11 +4151,31 @@ AppleUSBHubPort::AcquireDeviceZero()
     // at time 0.
     //
     if ( devZero )
+	{
         _devZeroCounter++;
+		_devZeroLockHeld = true;
+	}
     
     return devZero;
 }
 
+
+
+// Give up this port's claim on device zero, and the bus's device zero lock if we took it.  With concurrent
+// enumeration we can have the first without the second (see AddDevice).
+//
+void
+AppleUSBHubPort::ReleaseDeviceZero()
+{
+	if ( _devZeroLockHeld && _bus )
+	{
+		_devZeroLockHeld = false;
+		_bus->ReleaseDeviceZero();
+	}
+	
+	_devZero = false;
+}
+
 void
 AppleUSBHubPort::DisplayOverCurrentNotice(bool individual)
 {
@@ -3988,6 +4217,328 @@ AppleUSBHubPort::IsCaptiveOverride(UInt16 vendorID, UInt16 productID)
 	return false;
 }       
 
+
+
+UInt32
+AppleUSBHubPort::EnumerationDelay(USBHubPortDelay which)
+{
+	if ( _relaxedTiming )
+		return gEnumerationDelayPolicy[which].relaxed;
+	
+	return gEnumerationDelayPolicy[which].specMinimum;
+}
+
+
+
+// Decide whether the enumeration we are about to do needs the relaxed delays.  vendorID/productID is the device we think is
+// on the port, or 0/0 if we don't know yet.
+void
+AppleUSBHubPort::UpdateTimingPolicy(UInt16 vendorID, UInt16 productID)
+{
+	bool	relaxed = false;
+	
+	if ( _getDeviceDescriptorFailed || _hub->_relaxedEnumerationTiming )
+		relaxed = true;
+	else if ( NeedsRelaxedTiming(vendorID, productID) )
+		relaxed = true;
+	
+	if ( relaxed != _relaxedTiming )
+	{
+		USBLog(5, "AppleUSBHubPort[%p]::UpdateTimingPolicy - port %d of hub @ 0x%x - using %s delays for device 0x%04x/0x%04x", this, _portNum, (uint32_t)_hub->_locationID, relaxed ? "relaxed" : "spec minimum", vendorID, productID);
+	}
+	_relaxedTiming = relaxed;
+}
+
+
+
+bool
+AppleUSBHubPort::NeedsRelaxedTiming(UInt16 vendorID, UInt16 productID)
+{
+	UInt32		device = ((UInt32)vendorID << 16) | productID;
+	UInt32		i;
+	
+	if ( device == 0 )
+		return false;
+	
+	for (i = 0; i < kRelaxedTimingDeviceCount; i++)
+	{
+		if ( gRelaxedTimingDevices[i] == device )
+			return true;
+	}
+	
+	return false;
+}
+
+
+
+void
+AppleUSBHubPort::LearnRelaxedTiming(UInt16 vendorID, UInt16 productID)
+{
+	SInt32		entry;
+	
+	if ( (vendorID == 0 && productID == 0) || NeedsRelaxedTiming(vendorID, productID) )
+		return;
+	
+	
+	USBLog(3, "AppleUSBHubPort[%p]::LearnRelaxedTiming - port %d of hub @ 0x%x - device 0x%04x/0x%04x needed more time to enumerate, using relaxed delays for it from now on", this, _portNum, (uint32_t)_hub->_locationID, vendorID, productID);
+	entry = OSIncrementAtomic(&gRelaxedTimingNextEntry);
+	gRelaxedTimingDevices[(UInt32)entry % kRelaxedTimingDeviceCount] = ((UInt32)vendorID << 16) | productID;
+}
+
+
+
+void
+AppleUSBHubPort::ResetEnumerationTimeline()
+{
+	bzero(_enumPhaseTime, sizeof(_enumPhaseTime));
+	_enumPhase = kHubPortEnumPhaseNone;
+}
+
+
+
+// Charge the time since the last call to the phase we were in, and start timing the given phase.  Passing kHubPortEnumPhaseNone
+// stops the clock.  A phase that we go through more than once (because we retried) accumulates.
+void
+AppleUSBHubPort::BeginEnumerationPhase(USBHubPortEnumPhase phase)
+{
+	UInt64		now = mach_absolute_time();
+	
+	if ( _enumPhase < kHubPortEnumPhaseCount )
+		_enumPhaseTime[_enumPhase] += now - _enumPhaseStart;
+	
+	_enumPhase = phase;
+	_enumPhaseStart = now;
+}
+
+
+
+void
+AppleUSBHubPort::PublishEnumerationTimeline(IOUSBDevice * device)
+{
+	OSDictionary *	timeline;
+	UInt64			us;
+	UInt32			i;
+	
+	BeginEnumerationPhase(kHubPortEnumPhaseNone);
+	
+	timeline = OSDictionary::withCapacity(kHubPortEnumPhaseCount + 1);
+	if ( !timeline )
+		return;
+	
+	for (i = 0; i < kHubPortEnumPhaseCount; i++)
+	{
+		absolutetime_to_nanoseconds(*(AbsoluteTime *)&_enumPhaseTime[i], &us);
+		us /= 1000;
+		
+		OSNumber * number = OSNumber::withNumber(us, 64);
+		if ( number )
+		{
+			timeline->setObject(gEnumerationPhaseNames[i], number);
+			number->release();
+		}
+	}
+	timeline->setObject("RelaxedTiming", _relaxedTiming ? kOSBooleanTrue : kOSBooleanFalse);
+	
+	USBLog(5, "AppleUSBHubPort[%p]::PublishEnumerationTimeline - port %d of hub @ 0x%x - device 0x%04x/0x%04x", this, _portNum, (uint32_t)_hub->_locationID, device->GetVendorID(), device->GetProductID());
+	device->setProperty("EnumerationTimeline", timeline);
+	timeline->release();
+}
+
+
+// Learn the interval at which the device is needed from the times it is resumed by its driver or wakes itself up.  The smoothing is
+// the one TCP uses for its round trip time: an eighth of each error goes into the period and a quarter into the deviation.
+void
+AppleUSBHubPort::RecordPortAccess(UInt64 now)
+{
+	UInt64		elapsed;
+	UInt64		ms;
+	SInt32		error;
+	
+	if ( (_lastPortAccess != 0) && (now > _lastPortAccess) )
+	{
+		elapsed = now - _lastPortAccess;
+		absolutetime_to_nanoseconds(*(AbsoluteTime *)&elapsed, &ms);
+		ms /= 1000000;
+		
+		if ( ms > kPortAccessMaxPeriodMS )
+		{
+			// too far apart to be part of a pattern, start again from this one
+			_accessSamples = 0;
+		}
+		else if ( _accessSamples == 0 )
+		{
+			_accessPeriodMS = (UInt32)ms;
+			_accessDeviationMS = (UInt32)ms / 2;
+			_accessSamples = 1;
+		}
+		else
+		{
+			error = (SInt32)ms - (SInt32)_accessPeriodMS;
+			_accessPeriodMS = (UInt32)((SInt32)_accessPeriodMS + (error / 8));
+			_accessDeviationMS = (UInt32)((SInt32)_accessDeviationMS + (((error < 0) ? -error : error) - (SInt32)_accessDeviationMS) / 4);
+			_accessSamples++;
+		}
+		USBLog(7, "AppleUSBHubPort[%p]::RecordPortAccess - port %d - %d ms since the last access, period %d ms, deviation %d ms (%d samples)", this, _portNum, (int)ms, (int)_accessPeriodMS, (int)_accessDeviationMS, (int)_accessSamples);
+	}
+	
+	_lastPortAccess = now;
+}
+
+
+
+bool
+AppleUSBHubPort::IsAccessPeriodic()
+{
+	return ( (_accessSamples >= kPortAccessMinSamples) && (_accessPeriodMS >= kPortAccessMinPeriodMS) && ((_accessDeviationMS * 4) <= _accessPeriodMS) );
+}
+
+
+
+// Called when the driver suspends the port.  We aim to be done with the resume signaling and the recovery time, plus the jitter we have
+// seen, by the time the next access is due.
+void
+AppleUSBHubPort::SchedulePredictiveResume()
+{
+	uint64_t		period;
+	uint64_t		lead;
+	uint64_t		deadline;
+	
+	if ( !_predictiveResumeThread || !IsAccessPeriodic() )
+		return;
+	
+	clock_interval_to_absolutetime_interval(_accessPeriodMS, kMillisecondScale, &period);
+	clock_interval_to_absolutetime_interval(kPortResumeSignalingTime + _portResumeRecoveryTime + _accessDeviationMS, kMillisecondScale, &lead);
+	deadline = _lastPortAccess + period;
+	
+	if ( (deadline <= lead) || ((deadline - lead) <= mach_absolute_time()) )
+	{
+		// the driver suspended the device too close to its next access for us to get ahead of it
+		USBLog(6, "AppleUSBHubPort[%p]::SchedulePredictiveResume - port %d - next access is due too soon to resume ahead of it", this, _portNum);
+		return;
+	}
+	deadline -= lead;
+	
+	retain();
+	if ( thread_call_enter_delayed(_predictiveResumeThread, deadline) == true )
+	{
+		// it was already scheduled, and is now scheduled for the new deadline
+		release();
+	}
+}
+
+
+
+// Returns true if a predictive resume was scheduled and we took it back.
+bool
+AppleUSBHubPort::CancelPredictiveResume()
+{
+	if ( _predictiveResumeThread && (thread_call_cancel(_predictiveResumeThread) == true) )
+	{
+		release();
+		return true;
+	}
+	
+	return false;
+}
+
+
+
+// A predictive resume came too late for the driver, or was not needed at all.  Too many of those in a row and the pattern we learnt
+// is not the one the device has, so we stop resuming until we have learnt it again.
+void
+AppleUSBHubPort::PredictiveResumeMissed()
+{
+	_predictiveResumeMissCount++;
+	if ( ++_predictiveResumeMisses >= kPredictiveResumeMaxMisses )
+	{
+		USBLog(3, "AppleUSBHubPort[%p]::PredictiveResumeMissed - port %d of hub @ 0x%x - %d predictive resumes in a row missed, learning the access pattern again", this, _portNum, (uint32_t)_hub->_locationID, (int)_predictiveResumeMisses);
+		_accessSamples = 0;
+		_predictiveResumeMisses = 0;
+	}
+}
+
+
+
+void
+AppleUSBHubPort::ResetPortAccessHistory()
+{
+	_predictiveResumeOutstanding = false;
+	_lastPortAccess = 0;
+	_predictedPortAccess = 0;
+	_portSuspendedSince = 0;
+	_accessPeriodMS = 0;
+	_accessDeviationMS = 0;
+	_accessSamples = 0;
+	_predictiveResumeMisses = 0;
+	_resumeStalls = 0;
+	_resumeStallTime = 0;
+	_portSuspendedTime = 0;
+	_predictiveResumeCount = 0;
+	_predictiveResumeMissCount = 0;
+}
+
+
+
+// The idle timeout belongs to the driver, but we can tell it what we have learnt.  If the device is needed more often than it is worth
+// suspending it, the driver is better off waiting out the gaps.  Otherwise we have nothing better than its own timeout, so we return 0.
+UInt32
+AppleUSBHubPort::SuggestedIdleTimeout()
+{
+	if ( (_accessSamples < kPortAccessMinSamples) || (_accessPeriodMS >= kPortAccessMinPeriodMS) )
+		return 0;
+	
+	return _accessPeriodMS + (2 * _accessDeviationMS);
+}
+
+
+
+static void
+SetStatistic(OSDictionary * statistics, const char * key, UInt64 value)
+{
+	OSNumber * number = OSNumber::withNumber(value, 64);
+	
+	if ( number )
+	{
+		statistics->setObject(key, number);
+		number->release();
+	}
+}
+
+
+
+void
+AppleUSBHubPort::PublishPortSuspendStatistics()
+{
+	IOUSBDevice *	cachedDevice = _portDevice;			// in case _portDevice goes away while we are publishing
+	OSDictionary *	statistics;
+	UInt64			ms;
+	
+	if ( !cachedDevice )
+		return;
+	
+	statistics = OSDictionary::withCapacity(8);
+	if ( !statistics )
+		return;
+	
+	SetStatistic(statistics, "ResumeStalls", _resumeStalls);
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&_resumeStallTime, &ms);
+	SetStatistic(statistics, "ResumeStallMS", ms / 1000000);
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&_portSuspendedTime, &ms);
+	SetStatistic(statistics, "SuspendedMS", ms / 1000000);
+	SetStatistic(statistics, "PredictiveResumes", _predictiveResumeCount);
+	SetStatistic(statistics, "PredictiveResumeMisses", _predictiveResumeMissCount);
+	SetStatistic(statistics, "AccessPeriodMS", IsAccessPeriodic() ? _accessPeriodMS : 0);
+	SetStatistic(statistics, "SuggestedIdleTimeoutMS", SuggestedIdleTimeout());
+	
+	cachedDevice->retain();
+	cachedDevice->setProperty("PortSuspendStatistics", statistics);
+	cachedDevice->release();
+	statistics->release();
+}
+
+
+
+
 bool 
 AppleUSBHubPort::ShouldApplyDisconnectWorkaround()
 {
@@ -4207,6 +4758,52 @@ AppleUSBHubPort::EnablePowerAfterOvercurrentEntry(OSObject *target)
     me->release();
 }
 
+
+// Resume the port just ahead of the access we expect, so that the driver finds the device ready instead of waiting for the resume.  We go
+// through DoPortAction so that this is serialized with the driver's own suspends and resumes, and the driver is told with
+// kIOUSBMessagePortHasBeenResumed like for any other resume it did not ask for.
+void 
+AppleUSBHubPort::PredictiveResumeEntry(OSObject *target)
+{
+    AppleUSBHubPort 	*me;
+	IOReturn			err;
+    
+    if (!target)
+    {
+        USBLog(5, "AppleUSBHubPort::PredictiveResumeEntry - no target!");
+        return;
+    }
+    
+    me = OSDynamicCast(AppleUSBHubPort, target);
+    
+    if (!me)
+    {
+        USBLog(5, "AppleUSBHubPort::PredictiveResumeEntry - target is not really me!");
+        return;
+    }
+	
+	if ( me->IsInactive() || me->_hub->isInactive() || (me->_hub->_myPowerState != kIOUSBHubPowerStateOn) || !me->_portDevice || (me->_portPMState != usbHPPMS_drvr_suspended) )
+	{
+		// the hub is going to sleep or away, or the driver has already resumed the device
+		USBLog(6, "AppleUSBHubPort[%p]::PredictiveResumeEntry - nothing to do for port %d (_portPMState %d)", me, me->_portNum, (int)me->_portPMState);
+		me->release();
+		return;
+	}
+
+	USBLog(5, "AppleUSBHubPort[%p]::PredictiveResumeEntry - resuming port %d of hub @ 0x%x ahead of its next access (period %d ms, deviation %d ms)", me, me->_portNum, (uint32_t)me->_hub->_locationID, (int)me->_accessPeriodMS, (int)me->_accessDeviationMS);
+	me->_hub->retain();
+	me->_hub->EnsureUsability();
+	err = me->_hub->DoPortAction(kIOUSBMessageHubResumePort, me->_portNum, kHubPortActionPredictiveResume);
+	me->_hub->release();
+	if ( err != kIOReturnSuccess )
+	{
+		USBLog(3, "AppleUSBHubPort[%p]::PredictiveResumeEntry - port %d, DoPortAction(kIOUSBMessageHubResumePort) returned 0x%x", me, me->_portNum, err);
+	}
+	
+    me->release();
+}
+
+
 void 
 AppleUSBHubPort::EnablePowerAfterOvercurrent()
 {
@@ -72,6 +72,12 @@ enum
 	kDisplayOverCurrentTimeout = 30			// # of seconds that need to pass before we will show an overcurrent dialog again
 };
 
+// options for DoPortAction(kIOUSBMessageHubResumePort)
+enum
+{
+	kHubPortActionPredictiveResume = 0x0001		// the port is resuming itself ahead of an access it expects, not for the device's driver
+};
+
 
 class IOUSBController;
 class IOUSBDevice;
@@ -154,12 +160,15 @@ class AppleUSBHub : public IOUSBHubPolicyMaker
 	UInt32								_outstandingResumes;
 	UInt32								_hubGetConfigResetRetries;				
 	UInt32								_externalSuperSpeedPorts;
+	volatile SInt32						_statusChangeEvents;					// port status changes we have handled
+	volatile SInt32						_statusChangeRequests;					// GetPortStatus/ClearPortFeature requests we made to handle them
     // Errata stuff
     UInt32								_errataBits;
     UInt32								_startupDelay;
 	AbsoluteTime						_wakeupTime;
 	bool								_ignoreDisconnectOnWakeup;
 	bool								_retryBogusPortStatus;
+	bool								_relaxedEnumerationTiming;				// T if devices on this hub need more than the spec minimum enumeration delays
 	bool								_overCurrentNoticeDisplayed;
 	AbsoluteTime						_overCurrentNoticeTimeStamp;
 	bool								_treatAllPortsAsCaptive;
@@ -226,6 +235,7 @@ class AppleUSBHub : public IOUSBHubPolicyMaker
     IOReturn		ConfigureHub(void);
 
     bool			HubStatusChanged(void);
+	void			StatusChangeProcessed(UInt32 requests);
 
     IOReturn		GetHubDescriptor(IOUSB3HubDescriptor *desc);
     IOReturn		GetHubStatus(IOUSBHubStatus *status);
@@ -74,6 +74,43 @@ typedef enum
 	usbHPPMS_active
 } USBHubPortPMState;
 
+// The waits we make while enumerating a device.  Each has a spec minimum, which we use by default, and a relaxed
+// value for devices (and hubs) that have shown that they need more time.  See gEnumerationDelayPolicy.
+typedef enum
+{
+	kHubPortDelayDebounce = 0,					// after a connect, before we assert reset
+	kHubPortDelayResetStatus,					// after we assert reset, before we look at the port status again
+	kHubPortDelayResetRecovery,					// after the reset completes, before we talk to the device
+	kHubPortDelaySetAddressRecovery,			// after the SetAddress
+	kHubPortDelayDescriptorRetry,				// between retries of the GetDescriptor at address zero
+	kHubPortDelayCount
+} USBHubPortDelay;
+
+// The phases of an enumeration that we time.  Driver matching is not one of them: it runs on its own after we
+// register the new device.  (The device's "MatchingTimeUS" only covers comparing it against personalities, not
+// probing or starting the driver.)
+typedef enum
+{
+	kHubPortEnumPhaseDebounce = 0,
+	kHubPortEnumPhaseReset,
+	kHubPortEnumPhaseDescriptors,
+	kHubPortEnumPhaseAddress,
+	kHubPortEnumPhaseConfig,
+	kHubPortEnumPhaseCount,
+	kHubPortEnumPhaseNone = kHubPortEnumPhaseCount
+} USBHubPortEnumPhase;
+
+// When a driver suspends its device we learn the rhythm at which it has to resume it again, and if it is regular enough we
+// resume the port ourselves just ahead of the next access instead of making the driver wait for the resume.
+enum
+{
+	kPortAccessMinSamples				= 4,			// intervals we need to have seen before we trust the period
+	kPortAccessMinPeriodMS				= 250,			// below this the device is better off not being suspended at all
+	kPortAccessMaxPeriodMS				= 60000,		// above this an interval is not part of a pattern
+	kPortResumeSignalingTime			= 20,			// ms we drive resume on the port before it is enabled again (TDRSMDN)
+	kPredictiveResumeMaxMisses			= 3				// consecutive misses before we forget the pattern and learn it again
+};
+
 struct CaptiveErrataListEntryStruct
 {
     UInt16 				vendorID;
@@ -103,6 +140,8 @@ protected:
     IOUSBDevice *					_portDevice;
 	USBHubPortPMState				_portPMState;
     bool							_devZero;
+	bool							_devZeroLockHeld;										// we hold the bus's device zero lock, and not just _devZero
+	bool							_concurrentEnumeration;									// we can reset a new device without the device zero lock - see AddDevice
     bool							_captive;
 	bool							_hasExternalConnector;									// True if this port is external to the CPU enclosure
     bool							_retryPortStatus;
@@ -129,6 +168,7 @@ private:
     thread_call_t					_portStatusChangedHandlerThread;
     thread_call_t					_addDeviceThread;
     thread_call_t					_enablePowerAfterOvercurrentThread;
+    thread_call_t					_predictiveResumeThread;
     IOUSBHubPortStatus				_portStatus;
     USBHubPortEnumState				_state;
     IOLock *						_runLock;											// Lock to synchronize accesses to our ProcessStatus thread
@@ -154,16 +194,52 @@ private:
     bool                            _muxed;
 	UInt16							_portLinkErrorCount;
     UInt32                          _portLinkState;                                     // Saved when we get a PLC
+	bool							_relaxedTiming;										// use the relaxed enumeration delays for the device on this port
+	bool							_enumerationRetried;								// the current enumeration has had to retry, so the device needs relaxed timing
+	UInt16							_lastVendorID;										// the last device we enumerated on this port, which is our best guess at what
+	UInt16							_lastProductID;										// is connecting before we can read its descriptor
+	USBHubPortEnumPhase				_enumPhase;
+	UInt64							_enumPhaseStart;									// mach_absolute_time() at the start of _enumPhase
+	UInt64							_enumPhaseTime[kHubPortEnumPhaseCount];				// absolute time spent in each phase of the current enumeration
+	bool							_predictiveResumeOutstanding;						// we resumed the port ahead of an access and the driver has not suspended it since
+	UInt64							_lastPortAccess;									// mach_absolute_time() of the last time the device was needed
+	UInt64							_predictedPortAccess;								// mach_absolute_time() of the access _predictiveResumeOutstanding is for
+	UInt64							_portSuspendedSince;								// mach_absolute_time() at which the driver suspended the port, 0 if it is not suspended
+	UInt32							_accessPeriodMS;									// smoothed interval between accesses
+	UInt32							_accessDeviationMS;									// smoothed deviation of the intervals from _accessPeriodMS
+	UInt32							_accessSamples;
+	UInt32							_predictiveResumeMisses;							// consecutive
+	UInt32							_resumeStalls;										// resumes that the driver had to wait for
+	UInt64							_resumeStallTime;
+	UInt64							_portSuspendedTime;
+	UInt32							_predictiveResumeCount;
+	UInt32							_predictiveResumeMissCount;
 	
     static void						PortInitEntry(OSObject *target);					// this will run on its own thread
     static void						PortStatusChangedHandlerEntry(OSObject *target);	// this will run on its own thread
     static void						AddDeviceEntry(OSObject *target, thread_call_param_t issueRemoveDevice);					// this will run on its own thread
     static void						EnablePowerAfterOvercurrentEntry(OSObject *target);	// this will run on its own thread
+    static void						PredictiveResumeEntry(OSObject *target);			// this will run on its own thread
 
     IOReturn						DetachDevice();
     IOReturn						GetDevZeroDescriptorWithRetries();
     bool							AcquireDeviceZero();
     void							ReleaseDeviceZero();
+	UInt32							EnumerationDelay(USBHubPortDelay which);
+	void							UpdateTimingPolicy(UInt16 vendorID, UInt16 productID);
+	void							LearnRelaxedTiming(UInt16 vendorID, UInt16 productID);
+	bool							NeedsRelaxedTiming(UInt16 vendorID, UInt16 productID);
+	void							ResetEnumerationTimeline();
+	void							BeginEnumerationPhase(USBHubPortEnumPhase phase);
+	void							PublishEnumerationTimeline(IOUSBDevice * device);
+	void							RecordPortAccess(UInt64 now);
+	bool							IsAccessPeriodic();
+	void							SchedulePredictiveResume();
+	bool							CancelPredictiveResume();
+	void							PredictiveResumeMissed();
+	void							ResetPortAccessHistory();
+	UInt32							SuggestedIdleTimeout();
+	void							PublishPortSuspendStatistics();
 	bool							IsInactive()		{ return _isInactive; }			// Not, we are not an IOService object, so this is a mimmick of the IOService::isInactive() method
     
 protected:
@@ -203,7 +279,7 @@ protected:
     IOReturn						HandleSuspendPortHandler(UInt16 changeFlags, UInt16 statusFlags);
     void							FatalError(IOReturn err, const char *str);
     IOReturn						ReleaseDevZeroLock( void);
-    IOReturn						SuspendPort(bool suspend, bool fromDevice);
+    IOReturn						SuspendPort(bool suspend, bool fromDevice, bool predictive = false);
     IOReturn						ReEnumeratePort(UInt32 options);
 	bool							IsCaptiveOverride(UInt16 vendorID, UInt16 prodID);
 	bool							ShouldApplyDisconnectWorkaround();
@@ -1411,23 +1411,31 @@ AppleUSBOHCI::UIMProcessDoneQueue(IOUSBCompletionAction safeAction)
     IOPhysicalAddress			PhysAddr;
     AppleOHCIGeneralTransferDescriptorPtr 	pHCDoneTD;
     UInt32				cachedProducer;
+    UInt32				cachedRingProducer;
     IOPhysicalAddress			cachedWriteDoneQueueHead;
     IOInterruptState			intState;
     
 	
-    // Get the values of the Done Queue Head and the producer count.  We use a lock and disable interrupts
+    // Get the values of the Done Queue Head and the producer counts.  We use a lock and disable interrupts
     // so that the filter routine does not preempt us and updates the values while we're trying to read them.
+    // Both have to be read together - the filter only falls back to the physical done queue when the ring
+    // is full, so everything in the ring up to cachedRingProducer is older than anything on that queue
     //
     intState = IOSimpleLockLockDisableInterrupt( _wdhLock );
     
     cachedWriteDoneQueueHead = _savedDoneQueueHead;
     cachedProducer = _producerCount;
+    cachedRingProducer = _doneRingProducer;
     
     IOSimpleLockUnlockEnableInterrupt( _wdhLock, intState );
     
+    if (cachedRingProducer != _doneRingConsumer)
+        DoDoneRingProcessing(cachedRingProducer, safeAction);
+	
     // OK, now that we have a valid queue head in cachedWriteDoneQueueHead, let's process the list
     //
-    DoDoneQueueProcessing( cachedWriteDoneQueueHead, cachedProducer, safeAction);
+    if (cachedProducer != _consumerCount)
+        DoDoneQueueProcessing( cachedWriteDoneQueueHead, cachedProducer, safeAction);
 	
     return;
 	
@@ -1437,13 +1445,10 @@ AppleUSBOHCI::UIMProcessDoneQueue(IOUSBCompletionAction safeAction)
 IOReturn
 AppleUSBOHCI::DoDoneQueueProcessing(IOPhysicalAddress cachedWriteDoneQueueHead, UInt32 cachedProducer, IOUSBCompletionAction safeAction)
 {
-    UInt32					control, transferStatus;
-    long					bufferSizeRemaining;
     AppleOHCIGeneralTransferDescriptorPtr	pHCDoneTD, prevTD, nextTD;
     IOPhysicalAddress				physicalAddress;
     UInt32					pageMask;
-    AppleOHCIEndpointDescriptorPtr		tempED;
-    AppleOHCIIsochTransferDescriptorPtr		pITD, testITD;
+    AppleOHCIIsochTransferDescriptorPtr		testITD;
     volatile UInt32				cachedConsumer;
     UInt32					numTDs = 0;
     // This should never happen
@@ -1515,6 +1520,56 @@ AppleUSBOHCI::DoDoneQueueProcessing(IOPhysicalAddress cachedWriteDoneQueueHead,
     // Now, we have a new done queue head.  Now process this reversed list in LOGICAL order.  That
     // means that we can look for a NULL termination
     //
+    ProcessDoneTDList(pHCDoneTD, safeAction);
+	
+    return(kIOReturnSuccess);
+}
+
+
+
+// Take the TDs which the filter routine harvested into _doneRing.  The filter has already done the
+// physical to logical lookup and put each batch in the order the controller retired them, so all we
+// have to do here is chain them together and hand them to ProcessDoneTDList
+IOReturn
+AppleUSBOHCI::DoDoneRingProcessing(UInt32 cachedRingProducer, IOUSBCompletionAction safeAction)
+{
+    AppleOHCIGeneralTransferDescriptorPtr	pHCDoneHead = NULL, pHCDoneTail = NULL, pHCDoneTD;
+    UInt32					cachedConsumer = _doneRingConsumer;
+	
+    while (cachedConsumer != cachedRingProducer)
+    {
+        pHCDoneTD = _doneRing[cachedConsumer & (kOHCIDoneRingSize - 1)];
+        cachedConsumer++;
+		
+        pHCDoneTD->pLogicalNext = NULL;
+        if (pHCDoneTail)
+            pHCDoneTail->pLogicalNext = pHCDoneTD;
+        else
+            pHCDoneHead = pHCDoneTD;
+        pHCDoneTail = pHCDoneTD;
+    }
+	
+    // give the slots back to the filter before we start calling out
+    //
+    _doneRingConsumer = cachedConsumer;
+	
+    ProcessDoneTDList(pHCDoneHead, safeAction);
+	
+    return kIOReturnSuccess;
+}
+
+
+
+// Complete a NULL terminated, pLogicalNext linked list of retired TDs, oldest first
+void
+AppleUSBOHCI::ProcessDoneTDList(AppleOHCIGeneralTransferDescriptorPtr pHCDoneTD, IOUSBCompletionAction safeAction)
+{
+    UInt32					control, transferStatus;
+    long					bufferSizeRemaining;
+    AppleOHCIGeneralTransferDescriptorPtr	nextTD;
+    AppleOHCIEndpointDescriptorPtr		tempED;
+    AppleOHCIIsochTransferDescriptorPtr		pITD;
+	
     while (pHCDoneTD != NULL)
     {
         // USBLog(6, "AppleUSBOHCI[%p]::DoDoneQueueProcessing", this); // print_td(pHCDoneTD);
@@ -1592,8 +1647,6 @@ AppleUSBOHCI::DoDoneQueueProcessing(IOPhysicalAddress cachedWriteDoneQueueHead,
         }
         pHCDoneTD = nextTD;	/* New qHead */
     }
-	
-    return(kIOReturnSuccess);
 }
 
 
@@ -267,6 +267,8 @@ AppleUSBOHCI::FilterInterrupt(int index)
 	IOPhysicalAddress						cachedHead;
 	UInt32									cachedProducer;
 	Boolean									needSecondary = false;
+	bool									useRing = false;
+	UInt32									ringProducer = 0, ringSpace = 0, ringIndex;
 	
 	
 	// Check if the OHCI has written the DoneHead yet.  First we get the list of
@@ -521,6 +523,14 @@ AppleUSBOHCI::FilterInterrupt(int index)
 			//
 			cachedHead = physicalAddress;
 			
+			// Hand the TDs to the action routine through the done ring, which saves it the physical to logical lookups
+			// we are about to do anyway.  If the action routine has not yet taken everything off the physical done queue
+			// (because the ring filled up), keep using that queue so that nothing gets completed out of order
+			//
+			useRing = (_producerCount == _consumerCount);
+			ringProducer = _doneRingProducer;
+			ringSpace = kOHCIDoneRingSize - (ringProducer - _doneRingConsumer);
+			
 			if ( physicalAddress == NULL )
 				pHCDoneTD = NULL;
 			else
@@ -553,6 +563,14 @@ AppleUSBOHCI::FilterInterrupt(int index)
 				UInt32					frameCount;
 				UInt32					i;
 				
+				if (useRing)
+				{
+					if (numberOfTDs < ringSpace)
+						_doneRing[(ringProducer + numberOfTDs) & (kOHCIDoneRingSize - 1)] = pHCDoneTD;
+					else
+						useRing = false;				// no room - this whole batch goes on the physical done queue instead
+				}
+				
 				// Increment our count of the number of TDs that this queue head is pointing to
 				//
 				numberOfTDs++;
@@ -671,26 +689,49 @@ AppleUSBOHCI::FilterInterrupt(int index)
 				pHCDoneTD = nextTD;	/* New qHead */
 			}
 			
-			// We have now processed all the TD's in this queue.  We need to update our producer count
-			//
-			cachedProducer = _producerCount;
-			cachedProducer += numberOfTDs;
-			
-			// Now link in to the old queue head.  Note that we have to write this in bus order as the
-			// secondary interrupt routine will do the opposite when it reverses the list
-			//
-			if ( prevTD != NULL )
-				prevTD->pShared->nextTD = HostToUSBLong(oldHead);
-			
-			// Now, update the producer and head. We need to take a lock so that the consumer (the action routine) does not read them
-			// while they are in transition.
-			//
-			IOSimpleLockLock( _wdhLock );
-			
-			_savedDoneQueueHead = cachedHead;	// updates the shadow head
-			_producerCount = cachedProducer;	// Validates _producerCount;
-			
-			IOSimpleLockUnlock( _wdhLock );
+			if (useRing)
+			{
+				// The controller gives us the TDs newest first, so turn this batch around before the action routine can see it
+				//
+				for (ringIndex = 0; ringIndex < (numberOfTDs / 2); ringIndex++)
+				{
+					AppleOHCIGeneralTransferDescriptorPtr	*first = &_doneRing[(ringProducer + ringIndex) & (kOHCIDoneRingSize - 1)];
+					AppleOHCIGeneralTransferDescriptorPtr	*last = &_doneRing[(ringProducer + numberOfTDs - 1 - ringIndex) & (kOHCIDoneRingSize - 1)];
+					AppleOHCIGeneralTransferDescriptorPtr	temp = *first;
+					
+					*first = *last;
+					*last = temp;
+				}
+				
+				IOSimpleLockLock( _wdhLock );
+				
+				_doneRingProducer = ringProducer + numberOfTDs;
+				
+				IOSimpleLockUnlock( _wdhLock );
+			}
+			else
+			{
+				// We have now processed all the TD's in this queue.  We need to update our producer count
+				//
+				cachedProducer = _producerCount;
+				cachedProducer += numberOfTDs;
+				
+				// Now link in to the old queue head.  Note that we have to write this in bus order as the
+				// secondary interrupt routine will do the opposite when it reverses the list
+				//
+				if ( prevTD != NULL )
+					prevTD->pShared->nextTD = HostToUSBLong(oldHead);
+				
+				// Now, update the producer and head. We need to take a lock so that the consumer (the action routine) does not read them
+				// while they are in transition.
+				//
+				IOSimpleLockLock( _wdhLock );
+				
+				_savedDoneQueueHead = cachedHead;	// updates the shadow head
+				_producerCount = cachedProducer;	// Validates _producerCount;
+				
+				IOSimpleLockUnlock( _wdhLock );
+			}
 
 			// 8394970:  Make sure we set the flag AFTER we have incremented our producer count.
 			_writeDoneHeadInterrupt = kOHCIHcInterrupt_WDH;
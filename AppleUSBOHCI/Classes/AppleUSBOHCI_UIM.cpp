@@ -1845,8 +1845,14 @@ AppleUSBOHCI::CheckEDListForTimeouts(AppleOHCIEndpointDescriptorPtr head, AppleO
             UInt32	firstActiveFrame = pTD->command->GetUIMScratch(kOHCIUIMScratchFirstActiveFrame);
             if (!firstActiveFrame)
             {
-                pTD->command->SetUIMScratch(kOHCIUIMScratchFirstActiveFrame, curFrame);
-                continue;
+                // count from when the transfer was queued if the family recorded it, so that the deadline it scheduled the watchdog for holds
+                firstActiveFrame = pTD->command->GetWatchdogSubmitFrame();
+                if (!firstActiveFrame)
+                {
+                    pTD->command->SetUIMScratch(kOHCIUIMScratchFirstActiveFrame, curFrame);
+                    continue;
+                }
+                pTD->command->SetUIMScratch(kOHCIUIMScratchFirstActiveFrame, firstActiveFrame);
             }
             if ((curFrame - firstActiveFrame) >= completionTimeout)
             {
@@ -1923,7 +1929,8 @@ AppleUSBOHCI::ReturnAllTransactionsInEndpoint(AppleOHCIEndpointDescriptorPtr hea
 //  UIMCheckForTimeouts
 //
 //  This routine is called every kUSBWatchdogTimeoutMS by the controller.  It is useful for
-//  periodic checks in the UIM
+//  periodic checks in the UIM.  In between, the controller calls UIMCheckForCommandTimeouts
+//  when a transfer is due to time out.
 //
 //=============================================================================================
 //
@@ -1944,10 +1951,7 @@ AppleUSBOHCI::UIMCheckForTimeouts(void)
 	}
     
 	
-    // Check to see if our control or bulk lists have a TD that has timed out
-    //
-    CheckEDListForTimeouts(_pControlHead, _pControlTail);
-    CheckEDListForTimeouts(_pBulkHead, _pBulkTail);
+    UIMCheckForCommandTimeouts();
 
      // From OS9:  Ferg 1-29-01
     // some controllers can be swamped by PCI traffic and essentially go dead.  
@@ -2027,6 +2031,30 @@ AppleUSBOHCI::UIMCheckForTimeouts(void)
 
 
 
+//=============================================================================================
+//
+//  UIMCheckForCommandTimeouts
+//
+//  Just the transfer timeout part of UIMCheckForTimeouts, for when the controller's watchdog
+//  comes in early for a transfer deadline.  The dead controller check stays on the once a
+//  second pass.
+//
+//=============================================================================================
+//
+void
+AppleUSBOHCI::UIMCheckForCommandTimeouts(void)
+{
+    if ( isInactive() || !_controllerAvailable || (_myBusState != kUSBBusStateRunning))
+        return;
+    
+    // Check to see if our control or bulk lists have a TD that has timed out
+    //
+    CheckEDListForTimeouts(_pControlHead, _pControlTail);
+    CheckEDListForTimeouts(_pBulkHead, _pBulkTail);
+}
+
+
+
 IOReturn 
 AppleUSBOHCI::UIMCreateIsochTransfer(short						functionAddress,
 									 short						endpointNumber,
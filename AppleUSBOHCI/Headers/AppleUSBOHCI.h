@@ -127,6 +127,14 @@ struct AppleOHCIIsochTransferDescriptorStruct
 
 
 
+// TDs the filter routine has already taken off the done queue, waiting for the action routine
+// must be a power of 2
+enum
+{
+	kOHCIDoneRingSize				=		256
+};
+
+
 class IONaturalMemoryCursor;
 class AppleUSBOHCIedMemoryBlock;
 class AppleUSBOHCIitdMemoryBlock;
@@ -215,6 +223,9 @@ protected:
     volatile UInt32							_producerCount;			// Counter used to synchronize reading of the done queue between filter (producer) and action (consumer)
     volatile UInt32							_consumerCount;			// Counter used to synchronize reading of the done queue between filter (producer) and action (consumer)
     IOSimpleLock *							_wdhLock;
+	AppleOHCIGeneralTransferDescriptorPtr	_doneRing[kOHCIDoneRingSize];	// logical TDs harvested by the filter, oldest first
+	volatile UInt32							_doneRingProducer;		// free running index of the next _doneRing slot the filter will fill
+	volatile UInt32							_doneRingConsumer;		// free running index of the next _doneRing slot the action routine will take
     UInt64									_timeElapsed;
 	
     // variables to get the anchor frame
@@ -263,6 +274,8 @@ protected:
     IOReturn RemoveTDs(AppleOHCIEndpointDescriptorPtr pED, bool clearToggle);
     // IOReturn DoDoneQueueProcessing(AppleOHCIGeneralTransferDescriptorPtr pHCDoneTD, IOUSBCompletionAction safeAction);
     IOReturn DoDoneQueueProcessing(IOPhysicalAddress cachedWritedoneQueueHead, UInt32 cachedProducer, IOUSBCompletionAction safeAction);
+    IOReturn DoDoneRingProcessing(UInt32 cachedRingProducer, IOUSBCompletionAction safeAction);
+    void ProcessDoneTDList(AppleOHCIGeneralTransferDescriptorPtr pHCDoneTD, IOUSBCompletionAction safeAction);
                                    
                                    
     void UIMProcessDoneQueue(IOUSBCompletionAction safeAction=0);
@@ -568,6 +581,7 @@ public:
                                         void *param1, void *param2,
                                         void *param3, void *param4);
     virtual void UIMCheckForTimeouts(void);
+    virtual void UIMCheckForCommandTimeouts(void);
 	virtual IODMACommand					*GetNewDMACommand();
 	
 	// this call is not gated, so we need to gate it ourselves
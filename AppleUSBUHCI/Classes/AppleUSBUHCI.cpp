@@ -989,7 +989,16 @@ AppleUSBUHCI::ProcessCompletedTransactions(void)
     {
 		USBLog(3, "AppleUSBUHCI[%p]::ProcessCompletedTransactions err isoch list %x", this, err);
     }
-    err = scavengeQueueHeads(_intrQH[kUHCI_NINTR_QHS - 1]);
+	
+	// the hardware only retires a TD on a queue head with IOC, a short packet, or an error, all of which raise an interrupt
+	// so unless one of those was seen (or the watchdog is asking us to look anyway) there is nothing on the QHs to complete.
+	// A QH is only on the active list while it has a transfer queued, and the family keeps the watchdog's once a second
+	// pass going for as long as any transfer is outstanding, so a missed interrupt is picked up within a second
+	if (!_qhCompletionHint)
+		return;
+	
+	_qhCompletionHint = false;
+    err = scavengeQueueHeads();
     if (err != kIOReturnSuccess)
     {
 		USBLog(3, "AppleUSBUHCI[%p]::ProcessCompletedTransactions -  err queue heads %x", this, err);
@@ -1147,22 +1156,67 @@ AppleUSBUHCI::PutTDonDoneQueue(IOUSBControllerIsochEndpoint* pED, IOUSBControlle
 
 
 
+void
+AppleUSBUHCI::AddActiveQueueHead(AppleUHCIQueueHead *pQH)
+{
+	if (pQH->onActiveList)
+		return;
+	
+	pQH->nextActive = _activeQHList;
+	pQH->onActiveList = true;
+	_activeQHList = pQH;
+}
+
+
+
+void
+AppleUSBUHCI::RemoveActiveQueueHead(AppleUHCIQueueHead *pQH)
+{
+	AppleUHCIQueueHead		*pQHPrev = NULL, *pQHCur = _activeQHList;
+	
+	if (!pQH->onActiveList)
+		return;
+	
+	while (pQHCur && (pQHCur != pQH))
+	{
+		pQHPrev = pQHCur;
+		pQHCur = pQHCur->nextActive;
+	}
+	
+	if (pQHCur == NULL)
+	{
+		USBLog(1, "AppleUSBUHCI[%p]::RemoveActiveQueueHead - QH %p marked active but not on the active list", this, pQH);
+	}
+	else if (pQHPrev)
+		pQHPrev->nextActive = pQH->nextActive;
+	else
+		_activeQHList = pQH->nextActive;
+	
+	pQH->nextActive = NULL;
+	pQH->onActiveList = false;
+}
+
+
+
+// only the QHs on _activeQHList can have TDs which the hardware has retired, so that is all we walk
+// a QH is put on the list when a TD chain is queued to it (AllocTDChain) and comes off again here once its queue is empty
 IOReturn						
-AppleUSBUHCI::scavengeQueueHeads(IOUSBControllerListElement *pLE)
+AppleUSBUHCI::scavengeQueueHeads(void)
 {
     AppleUHCITransferDescriptor			*doneQueue = NULL, *doneTail= NULL, *qHead, *qTD, *qEnd;
     UInt32								ctrlStatus, leCount = 0, tdCount = 0, lastToggle = 0;
 	UInt16								actLength;
     Boolean								TDisHalted, shortTransfer;
-    AppleUHCIQueueHead					*pQH;
+    AppleUHCIQueueHead					*pQH, *pQHPrev = NULL, *pQHNext;
 	bool								logging = false;
     
-    while( (pLE != NULL) && (leCount++ < 150000) )
+	pQH = _activeQHList;
+    while( (pQH != NULL) && (leCount++ < 150000) )
     {
-		pQH = OSDynamicCast(AppleUHCIQueueHead, pLE);
+		pQHNext = pQH->nextActive;
 		tdCount = 0;
 		
-		if (pQH && (pQH->type != kQHTypeDummy) && (!pQH->stalled))
+		if ((pQH->type != kQHTypeDummy) && (!pQH->stalled))
 		{
 			bool	foundInactive = false;
 			
@@ -1345,7 +1399,21 @@ AppleUSBUHCI::scavengeQueueHeads(IOUSBControllerListElement *pLE)
 				logging = false;
 			}
 		}
-		pLE = pLE->_logicalNext;
+		
+		// nothing left queued, so drop this QH from the active list until the next AllocTDChain
+		if (pQH->firstTD == pQH->lastTD)
+		{
+			if (pQHPrev)
+				pQHPrev->nextActive = pQHNext;
+			else
+				_activeQHList = pQHNext;
+			pQH->nextActive = NULL;
+			pQH->onActiveList = false;
+		}
+		else
+			pQHPrev = pQH;
+		
+		pQH = pQHNext;
     }
 
     if (doneQueue != NULL)
@@ -1746,6 +1814,8 @@ AppleUSBUHCI::DeallocateQH(AppleUHCIQueueHead *pQH)
 {
     UInt32		physical;
 	
+	RemoveActiveQueueHead(pQH);
+	
     //zero out all unnecessary fields
     pQH->_logicalNext = NULL;
 	
@@ -1923,6 +1993,7 @@ AppleUSBUHCI::InitializeBufferMemory()
 			alignBuf->userBuffer = NULL;
 			alignBuf->userOffset = 0;
 			alignBuf->type = UHCIAlignmentBuffer::kTypeCBI;
+			alignBuf->slab = NULL;
 			queue_enter(&_cbiAlignmentBuffers, alignBuf, UHCIAlignmentBuffer *, chain);
 		}
 		dmaCommand->clearMemoryDescriptor();
@@ -1982,6 +2053,7 @@ AppleUSBUHCI::InitializeBufferMemory()
 			alignBuf->userBuffer = NULL;
 			alignBuf->userOffset = 0;
 			alignBuf->type = UHCIAlignmentBuffer::kTypeIsoch;
+			alignBuf->slab = NULL;
 			queue_enter(&_isochAlignmentBuffers, alignBuf, UHCIAlignmentBuffer *, chain);
 		}
 		}
@@ -2044,6 +2116,14 @@ AppleUSBUHCI::FreeBufferMemory()
 		ap->release();
 	}
 	
+	while (_alignmentSlabs)
+	{
+		UHCIAlignmentBufferSlab		*slab = _alignmentSlabs;
+		
+		_alignmentSlabs = slab->next;
+		FreeAlignmentBufferSlab(slab);
+	}
+	
 	if (_frameListBuffer)
 	{
 		_frameListBuffer->complete();
@@ -2072,13 +2152,25 @@ AppleUSBUHCI::GetCBIAlignmentBuffer()
 	
 	if (queue_empty(&_cbiAlignmentBuffers)) 
 	{
-		USBError(1, "AppleUSBUHCI::GetCBIAlignmentBuffer - ran out of alignment buffers");
-		return NULL;
+		_alignmentBufferMisses++;
+		if (GrowAlignmentBuffers(UHCIAlignmentBuffer::kTypeCBI) != kIOReturnSuccess)
+		{
+			USBError(1, "AppleUSBUHCI::GetCBIAlignmentBuffer - ran out of alignment buffers");
+			return NULL;
+		}
 	}
+	else
+		_alignmentBufferHits++;
+	
 	queue_remove_first(&_cbiAlignmentBuffers, ap, UHCIAlignmentBuffer *, chain);
 	ap->userBuffer = NULL;
 	ap->userOffset = 0;
 	ap->controller = this;
+	if (ap->slab)
+	{
+		ap->slab->buffersInUse++;
+		ap->slab->idleTicks = 0;
+	}
 	return ap;
 }
 
@@ -2088,6 +2180,8 @@ AppleUSBUHCI::ReleaseCBIAlignmentBuffer(UHCIAlignmentBuffer *ap)
 {
 	// USBLog(7, "AppleUSBUHCI[%p]::ReleaseAlignmentBuffer - putting alignment buffer %p into freeBuffers", this, ap);
 	queue_enter(&_cbiAlignmentBuffers, ap, UHCIAlignmentBuffer *, chain);
+	if (ap->slab)
+		ap->slab->buffersInUse--;
 }
 
 
@@ -2099,13 +2193,25 @@ AppleUSBUHCI::GetIsochAlignmentBuffer()
 	
 	if (queue_empty(&_isochAlignmentBuffers)) 
 	{
-		USBError(1, "AppleUSBUHCI::GetIsochAlignmentBuffer - ran out of alignment buffers");
-		return NULL;
+		_alignmentBufferMisses++;
+		if (GrowAlignmentBuffers(UHCIAlignmentBuffer::kTypeIsoch) != kIOReturnSuccess)
+		{
+			USBError(1, "AppleUSBUHCI::GetIsochAlignmentBuffer - ran out of alignment buffers");
+			return NULL;
+		}
 	}
+	else
+		_alignmentBufferHits++;
+	
 	queue_remove_first(&_isochAlignmentBuffers, ap, UHCIAlignmentBuffer *, chain);
 	ap->userBuffer = NULL;
 	ap->userOffset = 0;
 	ap->controller = this;
+	if (ap->slab)
+	{
+		ap->slab->buffersInUse++;
+		ap->slab->idleTicks = 0;
+	}
 	
 	_uhciAlignmentBuffersInUse++;
 	if ( _uhciAlignmentBuffersInUse > _uhciAlignmentHighWaterMark )
@@ -2125,10 +2231,200 @@ AppleUSBUHCI::ReleaseIsochAlignmentBuffer(UHCIAlignmentBuffer *ap)
 	//USBLog(6, "AppleUSBUHCI[%p]::ReleaseIsochAlignmentBuffer - putting alignment buffer %p into freeBuffers", this, ap);
 	queue_enter(&_isochAlignmentBuffers, ap, UHCIAlignmentBuffer *, chain);
 	_uhciAlignmentBuffersInUse--;
+	if (ap->slab)
+		ap->slab->buffersInUse--;
+}
+
+
+
+// Add one page worth of alignment buffers of the given type to the matching free queue
+// Only the CBI/isoch buffers which straddle a physical page boundary in the client's buffer ever come here,
+// so a busy pool means lots of unaligned transfers in flight and we would rather grow than fail them
+IOReturn
+AppleUSBUHCI::GrowAlignmentBuffers(UHCIAlignmentBuffer::bufferType type)
+{
+	UHCIAlignmentBufferSlab						*slab;
+	UHCIAlignmentBuffer							*alignBuf;
+	IODMACommand								*dmaCommand;
+	IODMACommand::Segment32						segments;
+	UInt64										offset = 0;
+	UInt32										numSegments = 1;
+	UInt32										bufferSize, i;
+	queue_head_t								*freeQueue;
+	char										*logicalBytes;
+	IOReturn									status;
+	
+	if (_alignmentSlabCount >= kUHCI_BUFFER_MAX_SLABS)
+	{
+		USBLog(1, "AppleUSBUHCI[%p]::GrowAlignmentBuffers - already have %d extra pages of alignment buffers, not growing", this, (int)_alignmentSlabCount);
+		return kIOReturnNoResources;
+	}
+	
+	if (type == UHCIAlignmentBuffer::kTypeCBI)
+	{
+		bufferSize = kUHCI_BUFFER_CBI_ALIGN_SIZE;
+		freeQueue = &_cbiAlignmentBuffers;
+	}
+	else
+	{
+		bufferSize = kUHCI_BUFFER_ISOCH_ALIGN_SIZE;
+		freeQueue = &_isochAlignmentBuffers;
+	}
+	
+	slab = new UHCIAlignmentBufferSlab;
+	if (!slab)
+		return kIOReturnNoMemory;
+	
+	slab->type = type;
+	slab->buffer = IOBufferMemoryDescriptor::inTaskWithPhysicalMask(kernel_task, kIOMemoryUnshared | kIODirectionInOut, PAGE_SIZE, kUHCIStructureAllocationPhysicalMask);
+	if (!slab->buffer)
+	{
+		USBError(1, "AppleUSBUHCI::GrowAlignmentBuffers - could not get alignment buffer page");
+		slab->release();
+		return kIOReturnNoMemory;
+	}
+	
+	status = slab->buffer->prepare();
+	if (status)
+	{
+		USBError(1, "AppleUSBUHCI::GrowAlignmentBuffers - prepare failed with status(%p)", (void*)status);
+		slab->buffer->release();
+		slab->release();
+		return status;
+	}
+	
+	dmaCommand = IODMACommand::withSpecification(kIODMACommandOutputHost32, 32, PAGE_SIZE, (IODMACommand::MappingOptions)(IODMACommand::kMapped | IODMACommand::kIterateOnly));
+	if (!dmaCommand)
+	{
+		USBError(1, "AppleUSBUHCI::GrowAlignmentBuffers - could not create IODMACommand");
+		FreeAlignmentBufferSlab(slab);
+		return kIOReturnInternalError;
+	}
+	
+	status = dmaCommand->setMemoryDescriptor(slab->buffer);
+	if (!status)
+	{
+		status = dmaCommand->gen32IOVMSegments(&offset, &segments, &numSegments);
+		if (!status && ((numSegments != 1) || (segments.fLength != PAGE_SIZE)))
+			status = kIOReturnInternalError;
+		dmaCommand->clearMemoryDescriptor();
+	}
+	dmaCommand->release();
+	
+	if (status)
+	{
+		USBError(1, "AppleUSBUHCI::GrowAlignmentBuffers - could not generate segments err (%p) numSegments (%d) fLength (%d)", (void*)status, (int)numSegments, (int)segments.fLength);
+		FreeAlignmentBufferSlab(slab);
+		return status;
+	}
+	
+	logicalBytes = (char*)slab->buffer->getBytesNoCopy();
+	for (i=0; i < (PAGE_SIZE/bufferSize); i++)
+	{
+		alignBuf = new UHCIAlignmentBuffer;
+		if (!alignBuf)
+		{
+			USBError(1, "AppleUSBUHCI::GrowAlignmentBuffers - unable to allocate expected UHCIAlignmentBuffer");
+			break;
+		}
+		alignBuf->paddr = segments.fIOVMAddr + (i*bufferSize);
+		alignBuf->vaddr = (IOVirtualAddress)(logicalBytes + (i*bufferSize));
+		alignBuf->userBuffer = NULL;
+		alignBuf->userOffset = 0;
+		alignBuf->type = type;
+		alignBuf->slab = slab;
+		queue_enter(freeQueue, alignBuf, UHCIAlignmentBuffer *, chain);
+	}
+	
+	if (i == 0)
+	{
+		FreeAlignmentBufferSlab(slab);
+		return kIOReturnNoMemory;
+	}
+	
+	slab->next = _alignmentSlabs;
+	_alignmentSlabs = slab;
+	_alignmentSlabCount++;
+	
+	USBLog(3, "AppleUSBUHCI[%p]::GrowAlignmentBuffers - added %d %s alignment buffers (%d extra pages, hits %d misses %d)", this, (int)i, (type == UHCIAlignmentBuffer::kTypeCBI) ? "CBI" : "isoch", (int)_alignmentSlabCount, (int)_alignmentBufferHits, (int)_alignmentBufferMisses);
+	setProperty("AlignmentBufferPages", _alignmentSlabCount, 32);
+	setProperty("AlignmentBufferHits", _alignmentBufferHits, 32);
+	setProperty("AlignmentBufferMisses", _alignmentBufferMisses, 32);
+	
+	return kIOReturnSuccess;
+}
+
+
+
+// Called from the watchdog - give back any extra page none of whose buffers have been used for a while
+void
+AppleUSBUHCI::ReclaimAlignmentBuffers(void)
+{
+	UHCIAlignmentBufferSlab		*slab, *prevSlab = NULL, *nextSlab;
+	UHCIAlignmentBuffer			*ap, *nextAp;
+	queue_head_t				*freeQueue;
+	bool						reclaimed = false;
+	
+	for (slab = _alignmentSlabs; slab; slab = nextSlab)
+	{
+		nextSlab = slab->next;
+		
+		if (slab->buffersInUse || (++slab->idleTicks < kUHCI_BUFFER_SLAB_IDLE_TICKS))
+		{
+			if (slab->buffersInUse)
+				slab->idleTicks = 0;
+			prevSlab = slab;
+			continue;
+		}
+		
+		if (prevSlab)
+			prevSlab->next = nextSlab;
+		else
+			_alignmentSlabs = nextSlab;
+		_alignmentSlabCount--;
+		
+		// every buffer from this page is on the free queue, so pull them off before we let the page go
+		freeQueue = (slab->type == UHCIAlignmentBuffer::kTypeCBI) ? &_cbiAlignmentBuffers : &_isochAlignmentBuffers;
+		ap = (UHCIAlignmentBuffer *)queue_first(freeQueue);
+		while (!queue_end(freeQueue, (queue_entry_t)ap))
+		{
+			nextAp = (UHCIAlignmentBuffer *)queue_next(&ap->chain);
+			if (ap->slab == slab)
+			{
+				queue_remove(freeQueue, ap, UHCIAlignmentBuffer *, chain);
+				ap->release();
+			}
+			ap = nextAp;
+		}
+		
+		FreeAlignmentBufferSlab(slab);
+		reclaimed = true;
+	}
+	
+	if (reclaimed)
+	{
+		USBLog(5, "AppleUSBUHCI[%p]::ReclaimAlignmentBuffers - now have %d extra pages of alignment buffers", this, (int)_alignmentSlabCount);
+		setProperty("AlignmentBufferPages", _alignmentSlabCount, 32);
+	}
+}
+
+
+
+void
+AppleUSBUHCI::FreeAlignmentBufferSlab(UHCIAlignmentBufferSlab *slab)
+{
+	if (slab->buffer)
+	{
+		slab->buffer->complete();
+		slab->buffer->release();
+		slab->buffer = NULL;
+	}
+	slab->release();
 }
 
 
 OSDefineMetaClassAndStructors(UHCIAlignmentBuffer, OSObject);
+OSDefineMetaClassAndStructors(UHCIAlignmentBufferSlab, OSObject);
 
 // ========================================================================
 #pragma mark AppleUSBUHCIDMACommand
@@ -395,12 +395,14 @@ AppleUSBUHCI::HandleInterrupt(void)
 	if (_usbErrorInterrupt & kUHCI_STS_EI) 
 	{
 		_usbErrorInterrupt = 0;
+		_qhCompletionHint = true;
 		USBTrace( kUSBTUHCIInterrupts,  kTPUHCIInterruptsHandleInterrupt, (uintptr_t)this, 0, 0, 7);
 		USBLog(6, "AppleUSBUHCI[%p]::HandleInterrupt - Host controller error interrupt", this);
 	}
 	if (_usbCompletionInterrupt & kUHCI_STS_INT)
 	{
 		_usbCompletionInterrupt = 0;
+		_qhCompletionHint = true;
 		
 		// USBTrace( kUSBTUHCIInterrupts,  kTPUHCIInterruptsHandleInterrupt, (uintptr_t)this, 0, 0, 8);
 		// updates hardware interrupt time from shadow vars that are se in the real irq handler
@@ -598,7 +598,6 @@ AppleUSBUHCI::UIMCreateIsochEndpoint(short					functionAddress,
 IOReturn
 AppleUSBUHCI::DeleteIsochEP(IOUSBControllerIsochEndpoint* pEP)
 {
-    IOUSBControllerIsochEndpoint		*curEP, *prevEP;
     UInt32								currentMaxPacketSize;
 	
     USBLog(7, "AppleUSBUHCI[%p]::DeleteIsochEP (%p)", this, pEP);
@@ -611,21 +610,7 @@ AppleUSBUHCI::DeleteIsochEP(IOUSBControllerIsochEndpoint* pEP)
 			USBError(1, "AppleUSBUHCI::DeleteIsochEP- after abort there are STILL %d active TDs", (uint32_t) pEP->activeTDs);
 		}
     }
-    prevEP = NULL;
-    curEP = _isochEPList;
-    while (curEP)
-    {
-		if (curEP == pEP)
-		{
-			if (prevEP)
-				prevEP->nextEP = curEP->nextEP;
-			else
-				_isochEPList = curEP->nextEP;
-			break;
-		}
-		prevEP = curEP;
-		curEP = curEP->nextEP;
-    }
+    RemoveIsochronousEndpoint(pEP);
     
 	// Save the current max packet size, as DeallocateIsochBandwidth will set the ep->mps to 0
 	currentMaxPacketSize = pEP->maxPacketSize;
@@ -1320,10 +1305,39 @@ AppleUSBUHCI::UnlinkQueueHead(AppleUHCIQueueHead *pQH, AppleUHCIQueueHead *pQHBa
 void 
 AppleUSBUHCI::UIMCheckForTimeouts(void)
 {
-    AbsoluteTime					currentTime, t;
-    UInt64							elapsedTime;
+    UInt16							status;
+
+    if (isInactive() || (_myBusState != kUSBBusStateRunning) || _wakingFromHibernation)
+	{
+        return;
+    }
+	
+    status = ioRead16(kUHCI_STS);
+	
+	// this code probably doesn't work
+    if (status & kUHCI_STS_HCH) 
+	{
+        // acknowledge
+        ioWrite16(kUHCI_STS, kUHCI_STS_HCH);
+        
+        USBError(1, "AppleUSBUHCI::UIMCheckForTimeouts - Host controller halted, resetting");
+        Reset(true);
+        Run(true);
+    }
+    
+	UIMCheckForCommandTimeouts();
+	
+	ReclaimAlignmentBuffers();
+}
+
+
+
+// the transfer timeout part of UIMCheckForTimeouts, which the controller also calls on its own when a transfer is due to time out
+void 
+AppleUSBUHCI::UIMCheckForCommandTimeouts(void)
+{
+    AbsoluteTime					currentTime;
     UInt64							frameNumber;
-    UInt16							status, cmd, intr;
 	AppleUHCIQueueHead				*pQH = NULL, *pQHBack = NULL, *pQHBack1 = NULL;
 	AppleUHCITransferDescriptor		*pTD = NULL;
 	IOPhysicalAddress				pTDPhys;
@@ -1340,28 +1354,15 @@ AppleUSBUHCI::UIMCheckForTimeouts(void)
         return;
     }
 	
-    // Check to see if we missed an interrupt.
-	USBLog(7, "AppleUSBUHCI[%p]::UIMCheckForTimeouts - calling ProcessCompletedTransactions", this);
+    // Check to see if we missed an interrupt - scan the active QHs whether or not we saw a completion
+	// interrupt, so that a transfer which has actually finished is not timed out below
+	USBLog(7, "AppleUSBUHCI[%p]::UIMCheckForCommandTimeouts - calling ProcessCompletedTransactions", this);
+	_qhCompletionHint = true;
 	ProcessCompletedTransactions();
 	
  	tempTime = mach_absolute_time();
 	currentTime = *(AbsoluteTime*)&tempTime;
    
-    status = ioRead16(kUHCI_STS);
-    cmd = ioRead16(kUHCI_CMD);
-    intr = ioRead16(kUHCI_INTR);
-	
-	// this code probably doesn't work
-    if (status & kUHCI_STS_HCH) 
-	{
-        // acknowledge
-        ioWrite16(kUHCI_STS, kUHCI_STS_HCH);
-        
-        USBError(1, "AppleUSBUHCI::UIMCheckForTimeouts - Host controller halted, resetting");
-        Reset(true);
-        Run(true);
-    }
-    
     // Adjust 64-bit frame number.
 	// This is a side-effect of GetFrameNumber().
     frameNumber = GetFrameNumber();
@@ -1437,8 +1438,14 @@ AppleUSBUHCI::UIMCheckForTimeouts(void)
 			UInt32	firstActiveFrame = pTD->command->GetUIMScratch(kUHCIUIMScratchFirstActiveFrame);
 			if (!firstActiveFrame)
 			{
-				pTD->command->SetUIMScratch(kUHCIUIMScratchFirstActiveFrame, curFrame);
-				continue;
+				// count from when the transfer was queued if the family recorded it, so that the deadline it scheduled the watchdog for holds
+				firstActiveFrame = pTD->command->GetWatchdogSubmitFrame();
+				if (!firstActiveFrame)
+				{
+					pTD->command->SetUIMScratch(kUHCIUIMScratchFirstActiveFrame, curFrame);
+					continue;
+				}
+				pTD->command->SetUIMScratch(kUHCIUIMScratchFirstActiveFrame, firstActiveFrame);
 			}
 			if ((curFrame - firstActiveFrame) >= completionTimeout)
 			{
@@ -1880,6 +1887,7 @@ AppleUSBUHCI::AllocTDChain(AppleUHCIQueueHead* pQH, IOUSBCommand *command, IOMem
     pTD1->command = NULL;
     
     pQH->lastTD = pTD1;
+	AddActiveQueueHead(pQH);
     pTDLast->GetSharedLogical()->ctrlStatus = ctrlStatus;
 	USBLog(7, "AllocTDChain - TD list for QH %p firstTD %p lastTD %p ================================================", pQH, pQH->firstTD, pQH->lastTD);
 	pTD = pQH->firstTD;
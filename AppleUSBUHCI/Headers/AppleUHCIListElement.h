@@ -68,6 +68,9 @@ public:
         
     AppleUHCITransferDescriptor					*firstTD;				// Request queue.
     AppleUHCITransferDescriptor					*lastTD;
+	
+	AppleUHCIQueueHead							*nextActive;			// next QH on the controller's active list
+	bool										onActiveList;			// this QH has TDs queued and is scanned by the scavenger
     
 };
 
@@ -61,6 +61,7 @@ class AppleUHCIIsochTransferDescriptor;
 class AppleUHCIIsochEndpoint;
 class AppleUSBUHCI;
 class AppleUSBUHCIDMACommand;
+class UHCIAlignmentBufferSlab;
 
 // Convert USBLog to use kprintf debugging
 #ifndef UHCI_USE_KPRINTF
@@ -174,12 +175,32 @@ public:
 	AppleUSBUHCI						*controller;
 	AppleUSBUHCIDMACommand				*dmaCommand;
 	bufferType							type;
+	UHCIAlignmentBufferSlab				*slab;				// page this buffer was carved from, NULL for the ones set up in InitializeBufferMemory
 	
     // Queue fields
     queue_chain_t						chain;
 };
 
 
+/*
+ * A page of alignment buffers added to one of the pools
+ * when it runs dry. Given back once none of its buffers
+ * have been used for kUHCI_BUFFER_SLAB_IDLE_TICKS.
+ */
+class UHCIAlignmentBufferSlab : public OSObject
+{
+	OSDeclareDefaultStructors(UHCIAlignmentBufferSlab)
+	
+public:
+	
+	IOBufferMemoryDescriptor			*buffer;
+	UHCIAlignmentBuffer::bufferType		type;
+	UInt32								buffersInUse;
+	UInt32								idleTicks;
+	UHCIAlignmentBufferSlab				*next;
+};
+
+
 class AppleUSBUHCIDMACommand : public IODMACommand
 {
     OSDeclareDefaultStructors(AppleUSBUHCIDMACommand)
@@ -207,7 +228,9 @@ public:
 enum {
     kUHCI_BUFFER_CBI_ALIGN_SIZE		= 64,
 	kUHCI_BUFFER_ISOCH_ALIGN_SIZE	= 1024,
-	kUHCI_BUFFER_ISOCH_ALIGN_QTY	= 24
+	kUHCI_BUFFER_ISOCH_ALIGN_QTY	= 24,
+	kUHCI_BUFFER_MAX_SLABS			= 32,				// pages we will add to the alignment pools on top of the initial ones
+	kUHCI_BUFFER_SLAB_IDLE_TICKS	= 30				// watchdog ticks an unused slab is kept around
 };
 
 /* Checking for idleness.
@@ -276,6 +299,10 @@ protected:
 	queue_head_t					_isochAlignmentBuffers;			// alignment buffers for isoch (1024 byte buffers)
 	SInt32							_uhciAlignmentHighWaterMark;
 	SInt32							_uhciAlignmentBuffersInUse;
+	UHCIAlignmentBufferSlab			*_alignmentSlabs;				// pages added to the pools above when they ran dry
+	UInt32							_alignmentSlabCount;
+	UInt32							_alignmentBufferHits;			// alignment buffers handed out straight from a pool
+	UInt32							_alignmentBufferMisses;			// ... and the ones which needed the pool to grow first
 	
     // Timeouts
     AbsoluteTime					_lastTime;
@@ -337,6 +364,10 @@ protected:
 	AppleUHCIQueueHead					*_pFreeQH;
 	AppleUHCIQueueHead					*_pLastFreeQH;
 	
+	// Queue Heads with TDs queued on them - the only ones scavengeQueueHeads needs to look at
+	AppleUHCIQueueHead					*_activeQHList;
+	bool								_qhCompletionHint;						// IOC, short packet or error interrupt seen since the last QH scavenge
+	
     IOSimpleLock *						_isochScheduleLock;
     IOSimpleLock *						_wdhLock;
     UInt16								_outSlot;
@@ -415,7 +446,9 @@ protected:
     void							ProcessCompletedTransactions(void);
 	IOReturn						scavengeIsochTransactions(void);
 	IOReturn						scavengeAnIsochTD(AppleUHCIIsochTransferDescriptor *pTD);
-	IOReturn						scavengeQueueHeads(IOUSBControllerListElement *);
+	IOReturn						scavengeQueueHeads(void);
+	void							AddActiveQueueHead(AppleUHCIQueueHead *pQH);
+	void							RemoveActiveQueueHead(AppleUHCIQueueHead *pQH);
 	IOReturn						UHCIUIMDoDoneQueueProcessing(AppleUHCITransferDescriptor *pHCDoneTD, OSStatus forceErr, AppleUHCITransferDescriptor *stopAt);
     
     // Resetting
@@ -678,6 +711,7 @@ public:
                                         void *param1, void *param2,
                                         void *param3, void *param4);
     virtual void UIMCheckForTimeouts(void);
+    virtual void UIMCheckForCommandTimeouts(void);
 	void  ReturnOneTransaction(AppleUHCITransferDescriptor		*pTD,
 							   AppleUHCIQueueHead				*pQH,
 							   AppleUHCIQueueHead				*pQHBack,
@@ -690,6 +724,9 @@ public:
 	void										ReleaseCBIAlignmentBuffer(UHCIAlignmentBuffer*);
 	UHCIAlignmentBuffer *						GetIsochAlignmentBuffer();
 	void										ReleaseIsochAlignmentBuffer(UHCIAlignmentBuffer*);
+	IOReturn									GrowAlignmentBuffers(UHCIAlignmentBuffer::bufferType type);
+	void										ReclaimAlignmentBuffers(void);
+	void										FreeAlignmentBufferSlab(UHCIAlignmentBufferSlab *slab);
 
 	IOReturn									InitializeBufferMemory();
 	void										FreeBufferMemory();
@@ -9458,6 +9458,10 @@ AppleUSBXHCI::init(OSDictionary * propTable)
 		return false;
 	
     _controllerSpeed = kUSBDeviceSpeedSuper;	
+	
+	// Devices are addressed with an Address Device command on their own slot, so a device in the default state
+	// behind one port does not see the address zero traffic for another (see AppleUSBHubPort::AddDevice)
+	setProperty(kUSBControllerPerSlotAddressing, kOSBooleanTrue);
 
 	_isochScheduleLock = IOSimpleLockAlloc();
     if (!_isochScheduleLock)
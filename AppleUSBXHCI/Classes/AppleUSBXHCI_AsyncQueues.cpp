@@ -1281,8 +1281,11 @@ AppleXHCIAsyncEndpoint::UpdateTimeouts(bool abortAll, UInt32 curFrame, bool stop
             
             if (firstSeen == 0)
             {
-                pUSBCommand->SetUIMScratch(kXHCI_ScratchFirstSeen, curFrame);
-                firstSeen = curFrame;
+                // count from when the transfer was queued if the family recorded it, so that the deadline it scheduled the watchdog for holds
+                firstSeen = pUSBCommand->GetWatchdogSubmitFrame();
+                if (firstSeen == 0)
+                    firstSeen = curFrame;
+                pUSBCommand->SetUIMScratch(kXHCI_ScratchFirstSeen, firstSeen);
             }
             
             if ((completionTimeout != 0) && ((curFrame - firstSeen) >  completionTimeout))
@@ -652,7 +652,6 @@ AppleUSBXHCI::AbortIsochEP(AppleXHCIIsochEndpoint* pEP)
 IOReturn		
 AppleUSBXHCI::DeleteIsochEP(AppleXHCIIsochEndpoint* pEP)
 {
-    IOUSBControllerIsochEndpoint* 		curEP, *prevEP;
     // UInt32								currentMaxPacketSize;
 	
     USBTrace_Start(kUSBTXHCI, kTPXHCIDeleteIsochEP,  (uintptr_t)this, 0, 0, 0);
@@ -667,21 +666,7 @@ AppleUSBXHCI::DeleteIsochEP(AppleXHCIIsochEndpoint* pEP)
 			USBError(1, "AppleUSBEHCI::DeleteIsochEP- after abort there are STILL %d active TDs", (uint32_t) pEP->activeTDs);
 		}
     }
-    prevEP = NULL;
-    curEP = _isochEPList;
-    while (curEP)
-    {
-		if (curEP == pEP)
-		{
-			if (prevEP)
-				prevEP->nextEP = curEP->nextEP;
-			else
-				_isochEPList = curEP->nextEP;
-			break;
-		}
-		prevEP = curEP;
-		curEP = curEP->nextEP;
-    }
+    RemoveIsochronousEndpoint(pEP);
     
 	// Save the current max packet size, as DeallocateIsochBandwidth will set the ep->mps to 0
 	// currentMaxPacketSize = pEP->maxPacketSize;
@@ -32,6 +32,10 @@ OSDefineMetaClassAndStructors(IOUSBCommand, IOCommand)
 
 OSDefineMetaClassAndStructors(IOUSBIsocCommand, IOCommand)
 
+extern "C" {
+	int		cpu_number(void);			// com.apple.kpi.unsupported
+}
+
 #define super			IOCommand	// same for both
 #define POISONVALUE		0xDEADBEEF
 
@@ -55,12 +59,10 @@ IOUSBCommand::init()
 {
     if (!super::init())
         return false;
-    // allocate our expansion data
+    // our expansion data is part of the object, so a command is a single allocation
     if (!_expansionData)
     {
-		_expansionData = (ExpansionData *)IOMalloc(sizeof(ExpansionData));
-		if (!_expansionData)
-			return false;
+		_expansionData = &_expansionStorage;
 		bzero(_expansionData, sizeof(ExpansionData));
     }
     return true;
@@ -70,14 +72,8 @@ IOUSBCommand::init()
 void 
 IOUSBCommand::free()
 {
-    //  This needs to be the LAST thing we do, as it disposes of our "fake" member
-    //  variables.
-    //
-    if (_expansionData)
-    {
-		IOFree(_expansionData, sizeof(ExpansionData));
-        _expansionData = NULL;
-    }
+	// the expansion data goes away with the object itself
+	_expansionData = NULL;
 	
     super::free();
 }
@@ -518,6 +514,178 @@ IOUSBCommandPool::withWorkLoop(IOWorkLoop * inWorkLoop)
 	return me;
 }
 
+bool
+IOUSBCommandPool::initWithWorkLoop(IOWorkLoop * inWorkLoop)
+{
+	int		i;
+	
+	if (!IOCommandPool::initWithWorkLoop(inWorkLoop))
+		return false;
+	
+	for (i = 0; i < kUSBCommandPoolMagazines; i++)
+	{
+		bzero(&_magazines[i], sizeof(IOUSBCommandMagazine));
+		_magazines[i].lock = IOSimpleLockAlloc();
+		if (!_magazines[i].lock)
+			return false;
+	}
+	
+	return true;
+}
+
+
+
+void
+IOUSBCommandPool::free()
+{
+	IOCommand		*command;
+	IODMACommand	*dmaCommand;
+	int				i;
+	
+	// Whoever tears us down is expected to DrainMagazines() and empty the gated pool first.  Anything still
+	// parked in a magazine at this point would otherwise leak, so release it (and its IODMACommand) here
+	for (i = 0; i < kUSBCommandPoolMagazines; i++)
+	{
+		while (_magazines[i].count)
+		{
+			command = _magazines[i].commands[--_magazines[i].count];
+			_magazines[i].commands[_magazines[i].count] = NULL;
+			if (!command)
+				continue;
+			
+			dmaCommand = NULL;
+			if (OSDynamicCast(IOUSBCommand, command))
+			{
+				dmaCommand = ((IOUSBCommand*)command)->GetDMACommand();
+				((IOUSBCommand*)command)->SetDMACommand(NULL);
+			}
+			else if (OSDynamicCast(IOUSBIsocCommand, command))
+			{
+				dmaCommand = ((IOUSBIsocCommand*)command)->GetDMACommand();
+				((IOUSBIsocCommand*)command)->SetDMACommand(NULL);
+			}
+			
+			if (dmaCommand)
+				dmaCommand->release();
+			command->release();
+		}
+		
+		if (_magazines[i].lock)
+		{
+			IOSimpleLockFree(_magazines[i].lock);
+			_magazines[i].lock = NULL;
+		}
+	}
+	
+	IOCommandPool::free();
+}
+
+
+
+IOCommand *
+IOUSBCommandPool::getCommand(bool blockForCommand)
+{
+	IOUSBCommandMagazine	*magazine = &_magazines[cpu_number() % kUSBCommandPoolMagazines];
+	IOCommand				*command = NULL;
+	
+	IOSimpleLockLock(magazine->lock);
+	if (magazine->count)
+	{
+		command = magazine->commands[--magazine->count];
+		magazine->hits++;
+	}
+	else
+		magazine->misses++;
+	IOSimpleLockUnlock(magazine->lock);
+	
+	if (command)
+	{
+		// no longer parked in a magazine (see returnCommand)
+		command->fCommandChain.next = NULL;
+		command->fCommandChain.prev = NULL;
+		return command;
+	}
+	
+	return IOCommandPool::getCommand(blockForCommand);
+}
+
+
+
+void
+IOUSBCommandPool::returnCommand(IOCommand * command)
+{
+	IOUSBCommandMagazine	*magazine = &_magazines[cpu_number() % kUSBCommandPoolMagazines];
+	
+	if (PrepareCommandForPool(command) != kIOReturnSuccess)
+		return;
+	
+	IOSimpleLockLock(magazine->lock);
+	if (magazine->count < kUSBCommandPoolMagazineSize)
+	{
+		// point the chain somewhere other than at itself, so that returning the command a second time
+		// trips the "already on queue" check in PrepareCommandForPool
+		command->fCommandChain.next = (queue_entry_t)magazine;
+		command->fCommandChain.prev = (queue_entry_t)magazine;
+		magazine->commands[magazine->count++] = command;
+		command = NULL;
+	}
+	IOSimpleLockUnlock(magazine->lock);
+	
+	// this magazine is full, so spill to the gated pool
+	if (command)
+		IOCommandPool::returnCommand(command);
+}
+
+
+
+UInt32
+IOUSBCommandPool::DrainMagazines(void)
+{
+	IOCommand		*command;
+	UInt32			drained = 0;
+	int				i;
+	
+	for (i = 0; i < kUSBCommandPoolMagazines; i++)
+	{
+		while (true)
+		{
+			command = NULL;
+			IOSimpleLockLock(_magazines[i].lock);
+			if (_magazines[i].count)
+				command = _magazines[i].commands[--_magazines[i].count];
+			IOSimpleLockUnlock(_magazines[i].lock);
+			
+			if (!command)
+				break;
+			
+			command->fCommandChain.next = NULL;
+			command->fCommandChain.prev = NULL;
+			IOCommandPool::returnCommand(command);
+			drained++;
+		}
+	}
+	
+	return drained;
+}
+
+
+
+void
+IOUSBCommandPool::GetMagazineStatistics(UInt32 * hits, UInt32 * misses)
+{
+	int		i;
+	
+	*hits = 0;
+	*misses = 0;
+	for (i = 0; i < kUSBCommandPoolMagazines; i++)
+	{
+		*hits += _magazines[i].hits;
+		*misses += _magazines[i].misses;
+	}
+}
+
+
+
 IOReturn
 IOUSBCommandPool::gatedGetCommand(IOCommand ** command, bool blockForCommand)
 {
@@ -528,8 +696,11 @@ IOUSBCommandPool::gatedGetCommand(IOCommand ** command, bool blockForCommand)
 	return ret;
 }
 
+// Sanity check a command coming back to the pool and poison the fields which should not be used again.
+// This only touches the command itself, so it is called both from gatedReturnCommand and, without the
+// gate, when the command goes into one of the per CPU magazines
 IOReturn
-IOUSBCommandPool::gatedReturnCommand(IOCommand * command)
+IOUSBCommandPool::PrepareCommandForPool(IOCommand * command)
 {
 	IOUSBCommand		*usbCommand		= OSDynamicCast(IOUSBCommand, command);					// only one of these should be non-null
 	IOUSBIsocCommand	*isocCommand	= OSDynamicCast(IOUSBIsocCommand, command);
@@ -657,6 +828,20 @@ IOUSBCommandPool::gatedReturnCommand(IOCommand * command)
 			USBError(1,"IOUSBCommandPool::gatedReturnCommand - missing dmaCommand in IOUSBIsocCommand");
 		}
 	}
+	return kIOReturnSuccess;
+}
+
+
+
+IOReturn
+IOUSBCommandPool::gatedReturnCommand(IOCommand * command)
+{
+	IOReturn	ret;
+	
+	ret = PrepareCommandForPool(command);
+	if (ret != kIOReturnSuccess)
+		return ret;
+	
 	return IOCommandPool::gatedReturnCommand(command);
 }
 
@@ -188,8 +188,8 @@ enum {
     kSizeOfCommandPool = 50,
     kSizeOfIsocCommandPool = 50,
     kSizeToIncrementCommandPool = 50,
-    kSizeToIncrementIsocCommandPool = 50
-    
+    kSizeToIncrementIsocCommandPool = 50,
+	kCommandPoolTrimIdleTicks = 30				// watchdog ticks without growth before we give back one increment
 };
 
 struct IOUSBSyncCompletionTarget
@@ -283,6 +283,97 @@ static SleepCurrentPerModel  gSleepCurrentInfo[] = {
 #define _needToClose					_expansionData->_needToClose
 #define _isochMaxBusStall				_expansionData->_isochMaxBusStall
 #define _rootHubDeviceSS				_expansionData->_rootHubDeviceSS
+#define _commandPoolIdleTicks			_expansionData->_commandPoolIdleTicks
+#define _commandPoolHighWater			_expansionData->_commandPoolHighWater
+#define _isocCommandPoolHighWater		_expansionData->_isocCommandPoolHighWater
+#define _bounceBufferLock				_expansionData->_bounceBufferLock
+#define _completionQueues				_expansionData->_completionQueues
+#define _completionQueueCount			_expansionData->_completionQueueCount
+#define _completionQueuesStopping		_expansionData->_completionQueuesStopping
+#define _completionBypassPipe			_expansionData->_completionBypassPipe
+#define _deferredCompletionsReported	_expansionData->_deferredCompletionsReported
+#define _watchdogCommands				_expansionData->_watchdogCommands
+#define _watchdogCommandCount			_expansionData->_watchdogCommandCount
+#define _watchdogTimedCommandCount		_expansionData->_watchdogTimedCommandCount
+#define _watchdogDeadline				_expansionData->_watchdogDeadline
+#define _watchdogWakeups				_expansionData->_watchdogWakeups
+#define _watchdogDisarms				_expansionData->_watchdogDisarms
+#define _watchdogWakeupsReported		_expansionData->_watchdogWakeupsReported
+#define _watchdogIdleTicks				_expansionData->_watchdogIdleTicks
+#define _watchdogMaxLateness			_expansionData->_watchdogMaxLateness
+#define _watchdogLastHousekeeping		_expansionData->_watchdogLastHousekeeping
+#define _devZeroAcquisitions			_expansionData->_devZeroAcquisitions
+#define _devZeroWaitTime				_expansionData->_devZeroWaitTime
+#define _devZeroHoldTime				_expansionData->_devZeroHoldTime
+#define _devZeroAcquiredTime			_expansionData->_devZeroAcquiredTime
+
+// A pipe as the completion queues see it - the address, endpoint and direction packed into a UInt32, which is
+// never 0.  kUSBAnyDirn (control endpoints, or closing both halves of an endpoint) matches either direction
+//
+enum
+{
+	kCompletionPipeValid		= 0x80000000,
+	kCompletionPipeAnyDirn		= 0x40000000,
+	kCompletionQueuePrealloc	= 16						// elements put on each queue's free list up front
+};
+
+static inline UInt32
+CompletionPipe(USBDeviceAddress address, UInt8 endpoint, UInt8 direction)
+{
+	UInt32	pipe = kCompletionPipeValid | ((((UInt32)address << 4) | (endpoint & 0x0F)) << 1);
+	
+	if (direction == kUSBAnyDirn)
+		pipe |= kCompletionPipeAnyDirn;
+	else if (direction == kUSBIn)
+		pipe |= 1;
+	
+	return pipe;
+}
+
+static inline bool
+CompletionPipeMatches(UInt32 pipe, UInt32 elementPipe)
+{
+	if (!pipe || !elementPipe)
+		return false;
+	
+	if (pipe & kCompletionPipeAnyDirn)
+		return ((pipe ^ elementPipe) & ~(UInt32)(kCompletionPipeAnyDirn | 1)) == 0;
+	
+	return pipe == elementPipe;
+}
+
+// A client completion waiting to be called on one of the completion threads
+//
+struct IOUSBCompletionQueueElement
+{
+	IOUSBCompletionQueueElement	*next;
+	UInt32						pipe;						// see CompletionPipe
+	IOUSBCompletion				completion;
+	IOReturn					status;
+	UInt32						actualByteCount;
+	bool						useTimeStamp;
+	AbsoluteTime				timeStamp;
+	uint64_t					queuedTime;					// mach_absolute_time() when the element was queued
+};
+
+// Each queue is drained by at most one thread call at a time, which is what keeps the completions for a pipe in order
+//
+struct IOUSBCompletionQueue
+{
+	IOSimpleLock				*lock;						// protects everything below except thread
+	thread_call_t				thread;
+	IOUSBCompletionQueueElement	*head;
+	IOUSBCompletionQueueElement	*tail;
+	IOUSBCompletionQueueElement	*freeList;
+	bool						scheduled;					// thread has been entered and has not yet found the queue empty
+	UInt32						runningPipe;				// pipe of the completion the thread is calling right now, 0 if none
+	IOThread					runningThread;
+	UInt32						depth;
+	UInt32						maxDepth;
+	UInt32						completions;				// completions called from this queue
+	uint64_t					totalDelay;					// sum of the queueing delays of those completions, in absolute time
+	uint64_t					maxDelay;
+};
 
 #pragma mark Synchronous Callbacks
 //================================================================================================
@@ -498,6 +589,23 @@ IOUSBController::start( IOService * provider )
             USBError(1,"%s[%p]::start unable to create free command pool", getName(), this);
             break;
         }
+		
+		_bounceBufferLock = IOSimpleLockAlloc();
+        if (!_bounceBufferLock)
+        {
+            USBError(1,"%s[%p]::start unable to allocate the bounce buffer lock", getName(), this);
+            break;
+        }
+		
+		OSNumber * completionThreads = OSDynamicCast(OSNumber, getProperty(kUSBCompletionThreadsKey));
+		if ( completionThreads && completionThreads->unsigned32BitValue() )
+		{
+			// Not fatal - we just call the completions on the workloop as usual
+			if ( !AllocateCompletionQueues(completionThreads->unsigned32BitValue()) )
+			{
+				USBLog(1,"%s[%p]::start unable to allocate the completion queues, completions will be called on the workloop", getName(), this);
+			}
+		}
         
         _watchdogUSBTimer = IOTimerEventSource::timerEventSource(this, WatchdogTimer);
         if (!_watchdogUSBTimer)
@@ -549,6 +657,7 @@ IOUSBController::start( IOService * provider )
 			}
 		}
         _currentSizeOfCommandPool = kSizeOfCommandPool;
+		_commandPoolHighWater = kSizeOfCommandPool;
 		
         for (i=0; i < kSizeOfIsocCommandPool; i++)
 		{
@@ -561,6 +670,7 @@ IOUSBController::start( IOService * provider )
 			}
         }
         _currentSizeOfIsocCommandPool = kSizeOfIsocCommandPool;
+		_isocCommandPoolHighWater = kSizeOfIsocCommandPool;
         
         /*
          * Initialize device zero
@@ -589,7 +699,7 @@ IOUSBController::start( IOService * provider )
 		}
 		
         _watchdogTimerActive = true;
-        _watchdogUSBTimer->setTimeoutMS(kUSBWatchdogTimeoutMS);
+        ScheduleWatchdog();
         
 		
 		// Save the 'this' pointer in the registry to help indentifies controller logs
@@ -606,6 +716,9 @@ IOUSBController::start( IOService * provider )
 	
 	USBTrace_End( kUSBTController, kTPControllerStart, (uintptr_t)this, 0, 0, 2);
 	
+	// getCommand() only looks at the current CPU's magazine, so put everything back in the gated pools first
+	DrainCommandPoolMagazines();
+	
     for ( i = 0; i < (int)_currentSizeOfCommandPool; i++ )
     {
         IOUSBCommand *command = (IOUSBCommand *)_freeUSBCommandPool->getCommand(false);    
@@ -651,6 +764,15 @@ IOUSBController::start( IOService * provider )
         _freeUSBIsocCommandPool->release();
         _freeUSBIsocCommandPool = NULL;
     }
+	
+	if ( _bounceBufferLock )
+	{
+		FreeBounceBuffers();
+		IOSimpleLockFree(_bounceBufferLock);
+		_bounceBufferLock = NULL;
+	}
+	
+	FreeCompletionQueues();
     
 	if ( _expansionData && _watchdogUSBTimer )
     {
@@ -877,6 +999,10 @@ IOUSBController::ControlTransaction(IOUSBCommand *command)
 		requestMemoryDescriptor = command->GetRequestMemoryDescriptor();
 		command->SetMultiTransferTransaction(true);
 		command->SetFinalTransferInTransaction(false);
+		
+		// transactions with their own completion (ClearTT) never reach ControlPacketHandler, so they are not watched
+		if (completion.action == (IOUSBCompletionAction) &ControlPacketHandler)
+			WatchdogTrackCommand(command);
         
 		USBLog(7,"%s[%p]::ControlTransaction(%d:%d(%s)):  Queueing Setup TD, packet = 0x%08x %08x", getName(), this, command->GetAddress(), command->GetEndpoint(), direction == kUSBIn ? "in" : "out",*(uint32_t*)request, *((uint32_t*)request+1));
 
@@ -991,6 +1117,9 @@ IOUSBController::ControlTransaction(IOUSBCommand *command)
         }
     } while(false);
 	
+	if (err)
+		WatchdogUntrackCommand(command);
+	
 	USBTrace_End( kUSBTController, kTPControlTransaction, (uintptr_t)this, err, 0, 0);
 	
     return err;
@@ -1173,6 +1302,8 @@ IOUSBController::ControlPacketHandler( OSObject * 	target,
 			USBLog(2, "%s[%p]::ControlPacketHandler, returning status of %x", me->getName(), me, command->GetStatus());
 		}
         
+		me->WatchdogUntrackCommand(command);
+		
 		isSyncTransfer = command->GetIsSyncTransfer();
 		
 		theCompletion = command->GetClientCompletion();
@@ -1245,11 +1376,13 @@ IOUSBController::InterruptTransaction(IOUSBCommand *command)
 	}
 
 	_activeInterruptTransfers++;
+	WatchdogTrackCommand(command);
     err = UIMCreateInterruptTransfer(command);
 	
 	if (err)
 	{
 		_activeInterruptTransfers--;
+		WatchdogUntrackCommand(command);
 	}
 	
 	USBTrace_End( kUSBTController, kTPInterruptTransaction, (uintptr_t)this, err, command->GetCompletionTimeout(), command->GetNoDataTimeout());
@@ -1270,6 +1403,7 @@ IOUSBController::InterruptPacketHandler(OSObject * target, void * parameter, IOR
 	IOUSBCompletion		theCompletion;
 	AbsoluteTime		theTimeStamp;
     bool                useTimeStamp;
+	bool				deferred;
 	
     if (command == 0)
         return;
@@ -1309,22 +1443,31 @@ IOUSBController::InterruptPacketHandler(OSObject * target, void * parameter, IOR
 		}
 	}
 	
+	me->WatchdogUntrackCommand(command);
+	
 	isSyncTransfer = command->GetIsSyncTransfer();
 	theCompletion = command->GetClientCompletion();
 	theTimeStamp = command->GetTimeStamp();
     useTimeStamp = command->GetUseTimeStamp();
 	
+	// A disjoint completion has to run here - it defers the client's completion itself once it has copied the data back
+    IOUSBCompletion disjointCompletion = command->GetDisjointCompletion();
+	deferred = (disjointCompletion.action == NULL) && me->DeferCompletion(command, theCompletion, status, bufferSizeRemaining, useTimeStamp ? &theTimeStamp : NULL);
+	
     // Only return the command if this is NOT a synchronous request and NOT a disjoint completion.  
 	// For Sync requests, we return it later.  For Disjoint completions, we return it in that completion
 	//
-    IOUSBCompletion disjointCompletion = command->GetDisjointCompletion();
 	if ( !isSyncTransfer && (disjointCompletion.action == NULL))
 	{
 		me->_freeUSBCommandPool->returnCommand(command);
 	}
 
     // Call the clients handler
-    if ( useTimeStamp )
+    if ( deferred )
+	{
+		// the completion thread will call it
+	}
+    else if ( useTimeStamp )
     {
         IOUSBCompletionWithTimeStamp	completionWithTimeStamp;
 		
@@ -1381,11 +1524,13 @@ IOUSBController::BulkTransaction(IOUSBCommand *command)
 		USBTrace( kUSBTController,  kTPBulkTransactionData, ((_busNumber << 16 ) | ( command->GetAddress() << 8) | command->GetEndpoint()), command->GetReqCount(), data[0], data[1]);
 	}
 		
+	WatchdogTrackCommand(command);
 	err = UIMCreateBulkTransfer(command);
 	
     if (err)
 	{
         USBLog(3,"%s[%p]::BulkTransaction: error queueing bulk packet (0x%x)", getName(), this, err);
+		WatchdogUntrackCommand(command);
 	}
 	
 	USBTrace_End( kUSBTController, kTPBulkTransaction, (uintptr_t)this, err, command->GetCompletionTimeout(), command->GetNoDataTimeout());
@@ -1403,6 +1548,7 @@ IOUSBController::BulkPacketHandler(OSObject *target, void *parameter, IOReturn	s
 	IODMACommand *			dmaCommand = command->GetDMACommand();
 	IOMemoryDescriptor *	memDesc = dmaCommand ? (IOMemoryDescriptor *)dmaCommand->getMemoryDescriptor() : NULL;
 	bool					isSyncTransfer;
+	bool					deferred;
 	IOUSBCompletion			theCompletion;
     
     if (command == 0)
@@ -1440,22 +1586,27 @@ IOUSBController::BulkPacketHandler(OSObject *target, void *parameter, IOReturn	s
 	}
 	
 	command->SetStatus(status);
+	me->WatchdogUntrackCommand(command);
 	
 	isSyncTransfer = command->GetIsSyncTransfer();
 	
 	theCompletion = command->GetClientCompletion();
 	
+	// A disjoint completion has to run here - it defers the client's completion itself once it has copied the data back
+    IOUSBCompletion disjointCompletion = command->GetDisjointCompletion();
+	deferred = (disjointCompletion.action == NULL) && me->DeferCompletion(command, theCompletion, status, bufferSizeRemaining);
+	
     // Only return the command if this is NOT a synchronous request and NOT a disjoint completion.  
 	// For Sync requests, we return it later.  For Disjoint completions, we return it in that completion
 	//
-    IOUSBCompletion disjointCompletion = command->GetDisjointCompletion();
 	if ( !isSyncTransfer && (disjointCompletion.action == NULL))
 	{
 		me->_freeUSBCommandPool->returnCommand(command);
 	}
 
 	// Call the clients handler
-    me->Complete(theCompletion, status, bufferSizeRemaining);
+	if ( !deferred )
+		me->Complete(theCompletion, status, bufferSizeRemaining);
 	
 }
 
@@ -1591,6 +1742,13 @@ IOUSBController::IsocTransaction(IOUSBIsocCommand *command)
                 requireMaxInterruptDelay(0);
         }
 	}
+	else if (_expansionData)
+	{
+		// isochronous traffic keeps the housekeeping tick going, so bring the watchdog back if it had been left disarmed
+		_watchdogIdleTicks = 0;
+		if (!_watchdogDeadline)
+			ScheduleWatchdog();
+	}
 
 	USBTrace_End( kUSBTController, kTPIsocTransaction, (uintptr_t)this, err, (uintptr_t)command->GetFrameList(), 0);
 
@@ -1660,7 +1818,10 @@ void
 IOUSBController::WatchdogTimer(OSObject *target, IOTimerEventSource *source)
 {
     IOUSBController*	me = OSDynamicCast(IOUSBController, target);
-    IOReturn			err;
+	uint64_t			now;
+	uint64_t			lateness = 0;
+	uint64_t			latenessNS;
+	uint64_t			housekeepingInterval;
 	
     if (!me || !source )
     {
@@ -1671,18 +1832,47 @@ IOUSBController::WatchdogTimer(OSObject *target, IOTimerEventSource *source)
         return;
     }
 	
-    // reset the clock
-    err = source->setTimeoutMS(kUSBWatchdogTimeoutMS);
-    if (err)
-    {
-        // do not remove the braces around this USBLog call, or the code will be wrong!
-        USBError(1, "%s[%p]::WatchdogTime: error 0x%08x", me->getName(), me, err);
-    }
-    else
-    {
-        me->UIMCheckForTimeouts();
-    }
-    
+	// keep track of how far behind the deadline we asked for we actually got to run
+	now = mach_absolute_time();
+	if (me->_watchdogDeadline && (now > me->_watchdogDeadline))
+		lateness = now - me->_watchdogDeadline;
+	if (lateness > me->_watchdogMaxLateness)
+		me->_watchdogMaxLateness = lateness;
+	me->_watchdogDeadline = 0;
+	me->_watchdogWakeups++;
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&lateness, &latenessNS);
+	USBTrace( kUSBTController, kTPControllerWatchdog, (uintptr_t)me, me->_watchdogCommandCount, (uintptr_t)(latenessNS / 1000), 1 );
+	
+	// the UIM's periodic checks and our own housekeeping still only want to run about once a second, however often
+	// the deadlines bring us in here - in between, the UIM only has to look at the outstanding transfers
+	clock_interval_to_absolutetime_interval(kUSBWatchdogTimeoutMS, kMillisecondScale, &housekeepingInterval);
+	if ((now - me->_watchdogLastHousekeeping) >= housekeepingInterval)
+	{
+		me->_watchdogLastHousekeeping = now;
+		me->UIMCheckForTimeouts();
+		me->TrimCommandPools();
+		me->UpdateBounceBufferStatistics();
+		me->UpdateCompletionQueueStatistics();
+		me->UpdateWatchdogStatistics();
+		
+		// anything outstanding (including an interrupt read without a timeout, which the UIM still scans for missed
+		// completions) or a pool still to trim keeps the housekeeping tick going
+		if (me->_watchdogCommandCount || (me->_activeIsochTransfers > 0) || (me->_currentSizeOfCommandPool > kSizeOfCommandPool) || (me->_currentSizeOfIsocCommandPool > kSizeOfIsocCommandPool))
+			me->_watchdogIdleTicks = 0;
+		else
+			me->_watchdogIdleTicks++;
+	}
+	else
+	{
+		IOUSBControllerV3	*v3Controller = OSDynamicCast(IOUSBControllerV3, me);
+		
+		if (v3Controller)
+			v3Controller->UIMCheckForCommandTimeouts();
+		else
+			me->UIMCheckForTimeouts();
+	}
+	
+	me->ScheduleWatchdog(true);
 }
 
 
@@ -1941,8 +2131,14 @@ IOUSBController::DoDeleteEP(OSObject *owner, void *arg0, void *arg1, void *arg2,
 {
 #pragma unused (arg3)
     IOUSBController *me = (IOUSBController *)owner;
+	UInt32			bypass;
+	IOReturn		kr;
 	
-    return me->UIMDeleteEndpoint((short)(uintptr_t) arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2);
+	bypass = me->BeginCompletionBypass((USBDeviceAddress)(uintptr_t) arg0, (UInt8)(uintptr_t) arg1, (UInt8)(uintptr_t) arg2);
+    kr = me->UIMDeleteEndpoint((short)(uintptr_t) arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2);
+	me->EndCompletionBypass(bypass);
+	
+	return kr;
 }
 
 
@@ -1952,8 +2148,14 @@ IOUSBController::DoAbortEP(OSObject *owner, void *arg0, void *arg1, void *arg2,
 {
 #pragma unused (arg3)
     IOUSBController *me = (IOUSBController *)owner;
+	UInt32			bypass;
+	IOReturn		kr;
+	
+	bypass = me->BeginCompletionBypass((USBDeviceAddress)(uintptr_t) arg0, (UInt8)(uintptr_t) arg1, (UInt8)(uintptr_t) arg2);
+    kr = me->UIMAbortEndpoint((short)(uintptr_t) arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2);
+	me->EndCompletionBypass(bypass);
 	
-    return me->UIMAbortEndpoint((short)(uintptr_t) arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2);
+	return kr;
 }
 
 
@@ -1963,8 +2165,14 @@ IOUSBController::DoClearEPStall(OSObject *owner, void *arg0, void *arg1, void *a
 {
 #pragma unused (arg3)
     IOUSBController *me = (IOUSBController *)owner;
+	UInt32			bypass;
+	IOReturn		kr;
 	
-    return me->UIMClearEndpointStall((short)(uintptr_t) arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2);
+	bypass = me->BeginCompletionBypass((USBDeviceAddress)(uintptr_t) arg0, (UInt8)(uintptr_t) arg1, (UInt8)(uintptr_t) arg2);
+    kr = me->UIMClearEndpointStall((short)(uintptr_t) arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2);
+	me->EndCompletionBypass(bypass);
+	
+	return kr;
 }
 
 
@@ -2031,7 +2239,7 @@ IOUSBController::DoCreateEP(OSObject *owner, void *arg0, void *arg1, void *arg2,
 IOReturn
 IOUSBController::ProtectedDevZeroLock(OSObject *target, void* lock, void* arg2, void* arg3, void* arg4)
 {
-#pragma unused (arg2, arg3, arg4)
+#pragma unused (arg3, arg4)
     IOUSBController	*	me = (IOUSBController*)target;
 	IOCommandGate * 	commandGate = me->GetCommandGate();
 	IOReturn			retVal = kIOReturnSuccess;
@@ -2108,11 +2316,26 @@ IOUSBController::ProtectedDevZeroLock(OSObject *target, void* lock, void* arg2,
 				retVal = kIOReturnSuccess;
 			}
 		}
+		
+		// AcquireDeviceZero passes in the time it started waiting, so we can account for how long the bus spends serialized on device zero
+		if ((retVal == kIOReturnSuccess) && arg2)
+		{
+			uint64_t	now = mach_absolute_time();
+			
+			me->_devZeroAcquisitions++;
+			me->_devZeroWaitTime += now - *(uint64_t *)arg2;
+			me->_devZeroAcquiredTime = now;
+		}
     }
     else
     {
 		USBLog(5, "%s[%p]::ProtectedDevZeroLock - releasing lock", me->getName(), me);
 		USBTrace( kUSBTController, kTPDevZeroLock, (uintptr_t)me, 0, 0, 8 );
+		if (me->_devZeroAcquiredTime)
+		{
+			me->_devZeroHoldTime += mach_absolute_time() - me->_devZeroAcquiredTime;
+			me->_devZeroAcquiredTime = 0;
+		}
 		me->_devZeroLock = false;
 		commandGate->commandWakeup(&me->_devZeroLock, true);
 		USBLog(5, "%s[%p]::ProtectedDevZeroLock - wakeup done", me->getName(), me);
@@ -2128,9 +2351,10 @@ IOUSBController::AcquireDeviceZero()
 {
     IOReturn			err = 0;
 	IOCommandGate * 	commandGate = GetCommandGate();
+	uint64_t			startTime = mach_absolute_time();
 	
     USBLog(6,"%s[%p]::AcquireDeviceZero  Trying to acquire Device Zero", getName(), this);
-    commandGate->runAction(ProtectedDevZeroLock, (void*)true);
+    commandGate->runAction(ProtectedDevZeroLock, (void*)true, (void*)&startTime);
 	
     USBLog(5,"%s[%p]::AcquireDeviceZero  Acquired Device Zero", getName(), this);
 		
@@ -2152,6 +2376,8 @@ IOUSBController::ReleaseDeviceZero(void)
 	
     USBLog(5,"%s[%p]::ReleaseDeviceZero Released Device Zero", getName(), this);
 	
+	UpdateDeviceZeroStatistics();
+	
     return;
 }
 
@@ -2497,6 +2723,9 @@ IOUSBController::stop( IOService * provider )
 		_watchdogUSBTimer = NULL;
     }
 	
+	// let the completion threads finish with anything the UIM already completed before it goes away
+	if ( _expansionData )
+		FreeCompletionQueues();
 	
     // Finalize the UIM -- need to do it in the stop so that other devices
     // can still use the UIM data structures while they are being terminated (e.g. we 
@@ -2522,8 +2751,11 @@ IOUSBController::stop( IOService * provider )
 	
     
     // Dispose of all the commands in the command Pool -- note that we don't block trying
-    // to get the command.  
+    // to get the command.  Commands parked in another CPU's magazine are not visible to getCommand(), so
+    // put them back in the gated pools first
     //
+	DrainCommandPoolMagazines();
+	
     for ( i = 0; i < _currentSizeOfCommandPool; i++ )
     {
 		IOUSBCommand *		command = (IOUSBCommand*)_freeUSBCommandPool->getCommand(false);    
@@ -2569,6 +2801,13 @@ IOUSBController::stop( IOService * provider )
         _freeUSBIsocCommandPool->release();
         _freeUSBIsocCommandPool = NULL;
     }
+	
+	if ( _bounceBufferLock )
+	{
+		FreeBounceBuffers();
+		IOSimpleLockFree(_bounceBufferLock);
+		_bounceBufferLock = NULL;
+	}
     
 	if ( _workLoop && _commandGate)
 		_workLoop->removeEventSource( _commandGate );
@@ -2616,8 +2855,17 @@ void
 IOUSBController::IncreaseCommandPool(void)
 {
 	IOUSBControllerV2*		me2 = OSDynamicCast(IOUSBControllerV2, this);
+	IOUSBCommandPool *		pool = OSDynamicCast(IOUSBCommandPool, _freeUSBCommandPool);
     int i;
 	
+	// getCommand only looks in the current CPU's magazine, so free commands may still be parked in the others - use those
+	// first, as long as there are enough for a control request and its buffer command, which is the most any caller needs
+	if (pool && (pool->DrainMagazines() >= 2))
+	{
+		USBLog(5,"%s[%p]::IncreaseCommandPool - reclaimed free commands from the per CPU magazines instead", getName(), this);
+		return;
+	}
+	
     USBLog(3,"%s[%p]::IncreaseCommandPool Adding (%d) to Command Pool", getName(), this, kSizeToIncrementCommandPool);
 	
     for (i = 0; i < kSizeToIncrementCommandPool; i++)
@@ -2631,6 +2879,10 @@ IOUSBController::IncreaseCommandPool(void)
 		}
     }
     _currentSizeOfCommandPool += kSizeToIncrementCommandPool;
+	_commandPoolIdleTicks = 0;
+	if (_currentSizeOfCommandPool > _commandPoolHighWater)
+		_commandPoolHighWater = _currentSizeOfCommandPool;
+	UpdateCommandPoolStatistics();
 	
 }
 
@@ -2640,8 +2892,15 @@ void
 IOUSBController::IncreaseIsocCommandPool(void)
 {
 	IOUSBControllerV2*		me2 = OSDynamicCast(IOUSBControllerV2, this);
+	IOUSBCommandPool *		pool = OSDynamicCast(IOUSBCommandPool, _freeUSBIsocCommandPool);
     int i;
 	
+	if (pool && pool->DrainMagazines())
+	{
+		USBLog(5,"%s[%p]::IncreaseIsocCommandPool - reclaimed free commands from the per CPU magazines instead", getName(), this);
+		return;
+	}
+	
     USBLog(3,"%s[%p]::IncreaseIsocCommandPool Adding (%d) to Isoc Command Pool", getName(), this, kSizeToIncrementIsocCommandPool);
     
     for (i = 0; i < kSizeToIncrementIsocCommandPool; i++)
@@ -2655,6 +2914,140 @@ IOUSBController::IncreaseIsocCommandPool(void)
 		}
     }
     _currentSizeOfIsocCommandPool += kSizeToIncrementIsocCommandPool;
+	_commandPoolIdleTicks = 0;
+	if (_currentSizeOfIsocCommandPool > _isocCommandPoolHighWater)
+		_isocCommandPoolHighWater = _currentSizeOfIsocCommandPool;
+	UpdateCommandPoolStatistics();
+}
+
+
+
+//================================================================================================
+//
+//   TrimCommandPools
+//
+//   Called from the watchdog timer (so we are on the workloop).  Once neither pool has had to grow
+//   for kCommandPoolTrimIdleTicks, give one increment of free commands back, but never go below
+//   the size we started with.
+//
+//================================================================================================
+//
+void
+IOUSBController::TrimCommandPools(void)
+{
+	IOUSBCommandPool *		pool;
+	UInt32					trimmed = 0;
+	int						i;
+	
+	if ( !_freeUSBCommandPool || !_freeUSBIsocCommandPool )
+		return;
+	
+	if ( ++_commandPoolIdleTicks < kCommandPoolTrimIdleTicks )
+		return;
+	
+	_commandPoolIdleTicks = 0;
+	
+	if ( _currentSizeOfCommandPool > kSizeOfCommandPool )
+	{
+		pool = OSDynamicCast(IOUSBCommandPool, _freeUSBCommandPool);
+		if ( pool )
+			pool->DrainMagazines();
+		
+		for ( i = 0; (i < kSizeToIncrementCommandPool) && (_currentSizeOfCommandPool > kSizeOfCommandPool); i++ )
+		{
+			IOUSBCommand *command = (IOUSBCommand *)_freeUSBCommandPool->getCommand(false);
+			if ( !command )
+				break;
+			
+			IODMACommand *dmaCommand = command->GetDMACommand();
+			if (dmaCommand)
+			{
+				dmaCommand->release();
+				command->SetDMACommand(NULL);
+			}
+			command->release();
+			_currentSizeOfCommandPool--;
+			trimmed++;
+		}
+	}
+	
+	if ( _currentSizeOfIsocCommandPool > kSizeOfIsocCommandPool )
+	{
+		pool = OSDynamicCast(IOUSBCommandPool, _freeUSBIsocCommandPool);
+		if ( pool )
+			pool->DrainMagazines();
+		
+		for ( i = 0; (i < kSizeToIncrementIsocCommandPool) && (_currentSizeOfIsocCommandPool > kSizeOfIsocCommandPool); i++ )
+		{
+			IOUSBIsocCommand *icommand = (IOUSBIsocCommand *)_freeUSBIsocCommandPool->getCommand(false);
+			if ( !icommand )
+				break;
+			
+			IODMACommand *dmaCommand = icommand->GetDMACommand();
+			if (dmaCommand)
+			{
+				dmaCommand->release();
+				icommand->SetDMACommand(NULL);
+			}
+			icommand->release();
+			_currentSizeOfIsocCommandPool--;
+			trimmed++;
+		}
+	}
+	
+	if ( trimmed )
+	{
+		USBLog(5,"%s[%p]::TrimCommandPools - released %d idle commands, pool sizes now %d/%d", getName(), this, (int)trimmed, (int)_currentSizeOfCommandPool, (int)_currentSizeOfIsocCommandPool);
+		UpdateCommandPoolStatistics();
+	}
+}
+
+
+
+//================================================================================================
+//
+//   DrainCommandPoolMagazines
+//
+//   Move every command parked in a per CPU magazine back to its gated pool, so that the teardown
+//   loops in start() and stop() (which use getCommand and so only see the current CPU's magazine)
+//   find all of them.
+//
+//================================================================================================
+//
+void
+IOUSBController::DrainCommandPoolMagazines(void)
+{
+	IOUSBCommandPool *		pool;
+	
+	pool = OSDynamicCast(IOUSBCommandPool, _freeUSBCommandPool);
+	if ( pool )
+		pool->DrainMagazines();
+	
+	pool = OSDynamicCast(IOUSBCommandPool, _freeUSBIsocCommandPool);
+	if ( pool )
+		pool->DrainMagazines();
+}
+
+
+
+void
+IOUSBController::UpdateCommandPoolStatistics(void)
+{
+	IOUSBCommandPool *		pool;
+	UInt32					hits, misses;
+	
+	setProperty("CommandPoolSize", _currentSizeOfCommandPool, 32);
+	setProperty("CommandPoolHighWaterMark", _commandPoolHighWater, 32);
+	setProperty("IsocCommandPoolSize", _currentSizeOfIsocCommandPool, 32);
+	setProperty("IsocCommandPoolHighWaterMark", _isocCommandPoolHighWater, 32);
+	
+	pool = OSDynamicCast(IOUSBCommandPool, _freeUSBCommandPool);
+	if ( pool )
+	{
+		pool->GetMagazineStatistics(&hits, &misses);
+		setProperty("CommandPoolMagazineHits", hits, 32);
+		setProperty("CommandPoolMagazineMisses", misses, 32);
+	}
 }
 
 
@@ -2690,6 +3083,834 @@ IOUSBController::CompleteWithTimeStamp(IOUSBCompletionWithTimeStamp	completion,
 
 
 
+//================================================================================================
+//
+//   AllocateCompletionQueues
+//
+//   Sets up count completion queues, each with its own thread call.  Called from start() when the
+//   personality asks for completions to be called off the workloop.
+//
+//================================================================================================
+//
+bool
+IOUSBController::AllocateCompletionQueues(UInt32 count)
+{
+	IOUSBCompletionQueueElement	*element;
+	UInt32						i, j;
+	
+	if (count > kUSBCompletionQueuesMax)
+		count = kUSBCompletionQueuesMax;
+	
+	_completionQueues = (IOUSBCompletionQueue *)IOMalloc(count * sizeof(IOUSBCompletionQueue));
+	if (!_completionQueues)
+		return false;
+	
+	bzero(_completionQueues, count * sizeof(IOUSBCompletionQueue));
+	_completionQueueCount = count;
+	
+	for (i = 0; i < count; i++)
+	{
+		_completionQueues[i].lock = IOSimpleLockAlloc();
+		_completionQueues[i].thread = thread_call_allocate((thread_call_func_t)CompletionQueueEntry, (thread_call_param_t)this);
+		if (!_completionQueues[i].lock || !_completionQueues[i].thread)
+		{
+			FreeCompletionQueues();
+			return false;
+		}
+		
+		// so that DeferCompletion normally never has to allocate on the workloop
+		for (j = 0; j < kCompletionQueuePrealloc; j++)
+		{
+			element = (IOUSBCompletionQueueElement *)IOMalloc(sizeof(IOUSBCompletionQueueElement));
+			if (!element)
+			{
+				FreeCompletionQueues();
+				return false;
+			}
+			element->next = _completionQueues[i].freeList;
+			_completionQueues[i].freeList = element;
+		}
+	}
+	
+	USBLog(3, "%s[%p]::AllocateCompletionQueues - calling bulk and interrupt completions on %d completion threads", getName(), this, (int)count);
+	return true;
+}
+
+
+
+//================================================================================================
+//
+//   FreeCompletionQueues
+//
+//   Stops deferring completions, waits for the completion threads to finish what they have already
+//   been given and frees the queues.  Must not be called on the workloop, since the client
+//   completions may need the gate.
+//
+//================================================================================================
+//
+void
+IOUSBController::FreeCompletionQueues(void)
+{
+	IOUSBCompletionQueueElement	*element;
+	UInt32						i;
+	bool						busy;
+	
+	if (!_completionQueues)
+		return;
+	
+	// DeferCompletion only runs on the workloop, so once the flag has been set through the gate no packet handler
+	// can still be between its check of the flag and its use of a queue
+	if (_commandGate && _workLoop && !_workLoop->inGate())
+	{
+		_commandGate->runAction(DoStopCompletionQueues);
+	}
+	else
+	{
+		for (i = 0; i < _completionQueueCount; i++)
+		{
+			if (_completionQueues[i].lock)
+			{
+				IOSimpleLockLock(_completionQueues[i].lock);
+				_completionQueuesStopping = true;
+				IOSimpleLockUnlock(_completionQueues[i].lock);
+			}
+		}
+	}
+	_completionQueuesStopping = true;
+	
+	do
+	{
+		busy = false;
+		for (i = 0; i < _completionQueueCount; i++)
+		{
+			if (_completionQueues[i].lock)
+			{
+				IOSimpleLockLock(_completionQueues[i].lock);
+				if (_completionQueues[i].scheduled)
+					busy = true;
+				IOSimpleLockUnlock(_completionQueues[i].lock);
+			}
+		}
+		if (busy)
+			IOSleep(1);
+	} while (busy);
+	
+	for (i = 0; i < _completionQueueCount; i++)
+	{
+		while ((element = _completionQueues[i].freeList))
+		{
+			_completionQueues[i].freeList = element->next;
+			IOFree(element, sizeof(IOUSBCompletionQueueElement));
+		}
+		if (_completionQueues[i].thread)
+			thread_call_free(_completionQueues[i].thread);
+		if (_completionQueues[i].lock)
+			IOSimpleLockFree(_completionQueues[i].lock);
+	}
+	
+	IOFree(_completionQueues, _completionQueueCount * sizeof(IOUSBCompletionQueue));
+	_completionQueues = NULL;
+	_completionQueueCount = 0;
+}
+
+
+
+IOReturn
+IOUSBController::DoStopCompletionQueues(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+#pragma unused (arg0, arg1, arg2, arg3)
+    IOUSBController *me = (IOUSBController *)owner;
+	
+	me->_completionQueuesStopping = true;
+	return kIOReturnSuccess;
+}
+
+
+
+//================================================================================================
+//
+//   CallQueuedCompletions
+//
+//   Takes every completion for pipe which is still waiting on a completion queue and calls it right
+//   here, in order.  Called on the workloop, which is where those completions would have been called
+//   if they had not been deferred.  If a completion thread is in the middle of calling one of the
+//   pipe's completions, the ones queued behind it are left for that thread - calling them here would
+//   run them alongside, and possibly ahead of, the one it is calling - and we return false.
+//
+//================================================================================================
+//
+bool
+IOUSBController::CallQueuedCompletions(UInt32 pipe)
+{
+	IOUSBCompletionQueue			*queue;
+	IOUSBCompletionQueueElement		*element, *prev, *head, *tail;
+	UInt32							i;
+	bool							drained = true;
+	
+	if (!_completionQueues)
+		return true;
+	
+	for (i = 0; i < _completionQueueCount; i++)
+	{
+		queue = &_completionQueues[i];
+		head = tail = NULL;
+		
+		IOSimpleLockLock(queue->lock);
+		if (CompletionPipeMatches(pipe, queue->runningPipe) && (queue->runningThread != IOThreadSelf()))
+		{
+			IOSimpleLockUnlock(queue->lock);
+			drained = false;
+			continue;
+		}
+		prev = NULL;
+		element = queue->head;
+		while (element)
+		{
+			IOUSBCompletionQueueElement		*next = element->next;
+			
+			if (CompletionPipeMatches(pipe, element->pipe))
+			{
+				if (prev)
+					prev->next = next;
+				else
+					queue->head = next;
+				if (queue->tail == element)
+					queue->tail = prev;
+				queue->depth--;
+				
+				element->next = NULL;
+				if (tail)
+					tail->next = element;
+				else
+					head = element;
+				tail = element;
+			}
+			else
+				prev = element;
+			element = next;
+		}
+		IOSimpleLockUnlock(queue->lock);
+		
+		while ((element = head))
+		{
+			head = element->next;
+			
+			USBTrace( kUSBTController, kTPCompletionCall, (uintptr_t)this, (uintptr_t)(element->completion.action), element->status, 4 );
+			if (element->useTimeStamp)
+				(*(IOUSBCompletionActionWithTimeStamp)element->completion.action)(element->completion.target, element->completion.parameter, element->status, element->actualByteCount, element->timeStamp);
+			else
+				(*element->completion.action)(element->completion.target, element->completion.parameter, element->status, element->actualByteCount);
+			
+			IOSimpleLockLock(queue->lock);
+			element->next = queue->freeList;
+			queue->freeList = element;
+			IOSimpleLockUnlock(queue->lock);
+		}
+	}
+	
+	return drained;
+}
+
+
+
+//================================================================================================
+//
+//   BeginCompletionBypass / EndCompletionBypass
+//
+//   Bracket a gated UIMAbortEndpoint, UIMDeleteEndpoint or UIMClearEndpointStall.  Anything already
+//   queued for the pipe is called first, and the completions the UIM returns while aborting it are
+//   called on the workloop instead of being queued, so none of them can still be waiting when the
+//   caller gets control back.  If a completion thread is calling one of the pipe's completions right
+//   now, nothing is bypassed: the aborted completions queue up behind the ones already waiting, and
+//   WaitForPipeCompletions waits for all of them once the caller is out of the gate.  Calls can nest
+//   if a completion aborts another pipe, so End restores whatever Begin returned.
+//
+//================================================================================================
+//
+UInt32
+IOUSBController::BeginCompletionBypass(USBDeviceAddress address, UInt8 endpoint, UInt8 direction)
+{
+	UInt32		previousPipe = _completionBypassPipe;
+	UInt32		pipe;
+	
+	if (!_completionQueues)
+		return previousPipe;
+	
+	pipe = CompletionPipe(address, endpoint, direction);
+	if (!CallQueuedCompletions(pipe))
+		return previousPipe;
+	
+	_completionBypassPipe = pipe;
+	
+	return previousPipe;
+}
+
+
+
+void
+IOUSBController::EndCompletionBypass(UInt32 previousPipe)
+{
+	_completionBypassPipe = previousPipe;
+}
+
+
+
+//================================================================================================
+//
+//   WaitForPipeCompletions
+//
+//   Called after AbortPipe, ClosePipe, ResetPipe and ClearPipeStall have come back out of the gate.
+//   The gated part normally called everything that was queued for the pipe, but a completion thread
+//   may be in the middle of calling one of its completions, with more of them (see
+//   BeginCompletionBypass) still queued behind it - wait for all of those to be called, so that the
+//   client can free its buffers once we return.  We cannot wait when we are inside the gate (the
+//   completion may be waiting for it) or when we are that completion.
+//
+//================================================================================================
+//
+void
+IOUSBController::WaitForPipeCompletions(USBDeviceAddress address, UInt8 endpoint, UInt8 direction)
+{
+	IOUSBCompletionQueueElement		*element;
+	UInt32							pipe;
+	UInt32							i;
+	bool							busy;
+	
+	if (!_expansionData || !_completionQueues || !_workLoop || _workLoop->inGate())
+		return;
+	
+	pipe = CompletionPipe(address, endpoint, direction);
+	do
+	{
+		busy = false;
+		for (i = 0; i < _completionQueueCount; i++)
+		{
+			IOSimpleLockLock(_completionQueues[i].lock);
+			if (_completionQueues[i].runningThread != IOThreadSelf())
+			{
+				if (CompletionPipeMatches(pipe, _completionQueues[i].runningPipe))
+					busy = true;
+				for (element = _completionQueues[i].head; element && !busy; element = element->next)
+				{
+					if (CompletionPipeMatches(pipe, element->pipe))
+						busy = true;
+				}
+			}
+			IOSimpleLockUnlock(_completionQueues[i].lock);
+		}
+		if (busy)
+			IOSleep(1);
+	} while (busy);
+}
+
+
+
+//================================================================================================
+//
+//   DeferCompletion
+//
+//   Called from the packet handlers on the workloop in place of Complete().  Synchronous transfers
+//   stay on the workloop because their completion wakes a thread sleeping on our gate.
+//
+//================================================================================================
+//
+bool
+IOUSBController::DeferCompletion(IOUSBCommand *command, IOUSBCompletion completion, IOReturn status, UInt32 actualByteCount, AbsoluteTime *timeStamp)
+{
+	IOUSBCompletionQueue			*queue;
+	IOUSBCompletionQueueElement		*element;
+	UInt32							pipe;
+	bool							schedule;
+	
+	if (!_completionQueues || _completionQueuesStopping || !command || !completion.action || command->GetIsSyncTransfer())
+		return false;
+	
+	// a pipe which is being aborted or closed gets its completions on the workloop (see BeginCompletionBypass)
+	pipe = CompletionPipe(command->GetAddress(), command->GetEndpoint(), command->GetDirection());
+	if (CompletionPipeMatches(_completionBypassPipe, pipe))
+		return false;
+	
+	// every pipe maps to exactly one queue
+	queue = &_completionQueues[(pipe & ~(UInt32)kCompletionPipeValid) % _completionQueueCount];
+	
+	IOSimpleLockLock(queue->lock);
+	element = queue->freeList;
+	if (element)
+		queue->freeList = element->next;
+	IOSimpleLockUnlock(queue->lock);
+	
+	if (!element)
+	{
+		element = (IOUSBCompletionQueueElement *)IOMalloc(sizeof(IOUSBCompletionQueueElement));
+		if (!element)
+		{
+			// the caller is going to call this one on the workloop, so call whatever is still queued for the pipe first
+			USBLog(1, "%s[%p]::DeferCompletion - could not allocate a queue element, calling completion %p on the workloop", getName(), this, completion.action);
+			if (!CallQueuedCompletions(pipe))
+			{
+				USBError(1, "%s[%p]::DeferCompletion - a completion thread is still calling completions for this pipe, so completion %p will not be in order", getName(), this, completion.action);
+			}
+			return false;
+		}
+	}
+	
+	element->next = NULL;
+	element->pipe = pipe;
+	element->completion = completion;
+	element->status = status;
+	element->actualByteCount = actualByteCount;
+	element->useTimeStamp = (timeStamp != NULL);
+	if (timeStamp)
+		element->timeStamp = *timeStamp;
+	element->queuedTime = mach_absolute_time();
+	
+	IOSimpleLockLock(queue->lock);
+	if (_completionQueuesStopping)
+	{
+		element->next = queue->freeList;
+		queue->freeList = element;
+		IOSimpleLockUnlock(queue->lock);
+		return false;
+	}
+	if (queue->tail)
+		queue->tail->next = element;
+	else
+		queue->head = element;
+	queue->tail = element;
+	if (++queue->depth > queue->maxDepth)
+		queue->maxDepth = queue->depth;
+	schedule = !queue->scheduled;
+	queue->scheduled = true;
+	IOSimpleLockUnlock(queue->lock);
+	
+	if (schedule)
+		thread_call_enter1(queue->thread, (thread_call_param_t)queue);
+	
+	return true;
+}
+
+
+
+//================================================================================================
+//
+//   CompletionQueueEntry
+//
+//   Thread call which drains one completion queue, calling each client completion outside of our gate.
+//
+//================================================================================================
+//
+void
+IOUSBController::CompletionQueueEntry(OSObject *target, thread_call_param_t queuePtr)
+{
+    IOUSBController *				me = OSDynamicCast(IOUSBController, target);
+	IOUSBCompletionQueue *			queue = (IOUSBCompletionQueue *)queuePtr;
+	IOUSBCompletionQueueElement *	element;
+	uint64_t						delay;
+	
+	if (!me || !queue)
+		return;
+	
+	me->retain();
+	
+	IOSimpleLockLock(queue->lock);
+	while ((element = queue->head))
+	{
+		queue->head = element->next;
+		if (!queue->head)
+			queue->tail = NULL;
+		queue->depth--;
+		queue->runningPipe = element->pipe;
+		queue->runningThread = IOThreadSelf();
+		IOSimpleLockUnlock(queue->lock);
+		
+		delay = mach_absolute_time() - element->queuedTime;
+		
+		USBTrace( kUSBTController, kTPCompletionCall, (uintptr_t)me, (uintptr_t)(element->completion.action), element->status, 4 );
+		if (element->useTimeStamp)
+			(*(IOUSBCompletionActionWithTimeStamp)element->completion.action)(element->completion.target, element->completion.parameter, element->status, element->actualByteCount, element->timeStamp);
+		else
+			(*element->completion.action)(element->completion.target, element->completion.parameter, element->status, element->actualByteCount);
+		
+		IOSimpleLockLock(queue->lock);
+		queue->runningPipe = 0;
+		queue->runningThread = NULL;
+		queue->completions++;
+		queue->totalDelay += delay;
+		if (delay > queue->maxDelay)
+			queue->maxDelay = delay;
+		element->next = queue->freeList;
+		queue->freeList = element;
+	}
+	queue->scheduled = false;
+	IOSimpleLockUnlock(queue->lock);
+	
+	me->release();
+}
+
+
+
+//================================================================================================
+//
+//   UpdateCompletionQueueStatistics
+//
+//   Called from the watchdog timer to publish how many completions went through the completion
+//   threads and how long they waited to be called.
+//
+//================================================================================================
+//
+void
+IOUSBController::UpdateCompletionQueueStatistics(void)
+{
+	UInt32				i;
+	UInt32				completions = 0;
+	UInt32				maxDepth = 0;
+	uint64_t			totalDelay = 0;
+	uint64_t			maxDelay = 0;
+	uint64_t			averageNS, maxNS;
+	
+	if (!_completionQueues || _completionQueuesStopping)
+		return;
+	
+	for (i = 0; i < _completionQueueCount; i++)
+	{
+		IOSimpleLockLock(_completionQueues[i].lock);
+		completions += _completionQueues[i].completions;
+		totalDelay += _completionQueues[i].totalDelay;
+		if (_completionQueues[i].maxDelay > maxDelay)
+			maxDelay = _completionQueues[i].maxDelay;
+		if (_completionQueues[i].maxDepth > maxDepth)
+			maxDepth = _completionQueues[i].maxDepth;
+		IOSimpleLockUnlock(_completionQueues[i].lock);
+	}
+	
+	if (completions == _deferredCompletionsReported)
+		return;
+	
+	_deferredCompletionsReported = completions;
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&totalDelay, &averageNS);
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&maxDelay, &maxNS);
+	averageNS /= completions;
+	
+	setProperty("DeferredCompletions", completions, 32);
+	setProperty("DeferredCompletionMaxQueueDepth", maxDepth, 32);
+	setProperty("DeferredCompletionAverageDelayUS", averageNS / 1000, 64);
+	setProperty("DeferredCompletionMaxDelayUS", maxNS / 1000, 64);
+}
+
+
+
+//================================================================================================
+//
+//   WatchdogCommandDeadline
+//
+//   When the watchdog next has to run for a command.  The UIMs count a completion timeout from the
+//   frame WatchdogTrackCommand recorded, so that one is due a fixed time after the command was queued.
+//   A no-data timeout can only start at a UIM pass which sees the transfer, so it is due one timeout
+//   after the pass which took that baseline - and until there has been one, we ask for a pass a
+//   quarter of the timeout in, rather than first looking when the timeout is already due.  If a
+//   deadline has passed and the UIM still did not time the command out (its frame count had not
+//   quite caught up, or data moved), look again a little later.
+//
+//================================================================================================
+//
+static uint64_t
+WatchdogCommandDeadline(IOUSBCommand *command, uint64_t now)
+{
+	uint64_t		deadline = 0;
+	uint64_t		noDataDeadline;
+	uint64_t		interval;
+	UInt32			timeoutMS;
+	
+	timeoutMS = command->GetCompletionTimeout();
+	if (timeoutMS)
+	{
+		clock_interval_to_absolutetime_interval(timeoutMS + kUSBWatchdogSlackMS, kMillisecondScale, &interval);
+		deadline = command->GetWatchdogSubmitTime() + interval;
+		if (deadline <= now)
+		{
+			clock_interval_to_absolutetime_interval((timeoutMS / 8) + kUSBWatchdogSlackMS, kMillisecondScale, &interval);
+			deadline = now + interval;
+		}
+	}
+	
+	timeoutMS = command->GetNoDataTimeout();
+	if (timeoutMS)
+	{
+		if (command->GetWatchdogBaseline())
+		{
+			clock_interval_to_absolutetime_interval(timeoutMS + kUSBWatchdogSlackMS, kMillisecondScale, &interval);
+			noDataDeadline = command->GetWatchdogBaseline() + interval;
+		}
+		else
+		{
+			clock_interval_to_absolutetime_interval((timeoutMS / 4) + kUSBWatchdogSlackMS, kMillisecondScale, &interval);
+			noDataDeadline = command->GetWatchdogSubmitTime() + interval;
+		}
+		if (noDataDeadline <= now)
+		{
+			clock_interval_to_absolutetime_interval(kUSBWatchdogSlackMS, kMillisecondScale, &interval);
+			noDataDeadline = now + interval;
+		}
+		if (!deadline || (noDataDeadline < deadline))
+			deadline = noDataDeadline;
+	}
+	
+	return deadline;
+}
+
+
+
+//================================================================================================
+//
+//   WatchdogTrackCommand
+//
+//   Called on the workloop just before a control, interrupt or bulk command is given to the UIM.
+//   The command goes on the list of outstanding commands with the time by which the watchdog has
+//   to run for it (see WatchdogCommandDeadline), and if that is before the watchdog is next due (or
+//   the watchdog has been left disarmed), the watchdog is brought in.  A command without a timeout
+//   has no deadline, but while it is outstanding the watchdog keeps its once a second tick, since
+//   the UIMs rely on that to catch completions whose interrupt went missing.  Root hub transfers
+//   never time out and the root hub interrupt read is always outstanding, so they are not tracked.
+//
+//================================================================================================
+//
+void
+IOUSBController::WatchdogTrackCommand(IOUSBCommand *command)
+{
+	uint64_t		now;
+	uint64_t		deadline;
+	uint64_t		wakeTime;
+	IOReturn		err;
+	
+	if (command->GetOnWatchdogList())
+		return;
+	
+	if ((_rootHubDevice && (command->GetAddress() == _rootHubDevice->GetAddress())) || (_rootHubDeviceSS && (command->GetAddress() == _rootHubDeviceSS->GetAddress())))
+		return;
+	
+	now = mach_absolute_time();
+	command->SetWatchdogSubmitTime(now);
+	command->SetWatchdogBaseline(0);
+	
+	// the UIMs count a completion timeout from this frame, instead of from the first time they see the transfer
+	command->SetWatchdogSubmitFrame(command->GetCompletionTimeout() ? GetFrameNumber32() : 0);
+	
+	deadline = WatchdogCommandDeadline(command, now);
+	if (deadline)
+		_watchdogTimedCommandCount++;
+	
+	command->SetWatchdogDeadline(deadline);
+	command->SetWatchdogPrev(NULL);
+	command->SetWatchdogNext(_watchdogCommands);
+	if (_watchdogCommands)
+		_watchdogCommands->SetWatchdogPrev(command);
+	_watchdogCommands = command;
+	command->SetOnWatchdogList(true);
+	_watchdogCommandCount++;
+	_watchdogIdleTicks = 0;
+	
+	if (!_watchdogUSBTimer || !_watchdogTimerActive)
+		return;
+	
+	wakeTime = deadline;
+	if (!_watchdogDeadline)
+	{
+		uint64_t	housekeeping;
+		
+		clock_interval_to_deadline(kUSBWatchdogTimeoutMS, kMillisecondScale, &housekeeping);
+		if (!wakeTime || (housekeeping < wakeTime))
+			wakeTime = housekeeping;
+	}
+	
+	if (wakeTime && (!_watchdogDeadline || (wakeTime < _watchdogDeadline)))
+	{
+		_watchdogDeadline = wakeTime;
+		err = _watchdogUSBTimer->wakeAtTime(*(AbsoluteTime *)&wakeTime);
+		if (err)
+		{
+			USBError(1, "%s[%p]::WatchdogTrackCommand: error 0x%08x", getName(), this, err);
+		}
+	}
+}
+
+
+
+//================================================================================================
+//
+//   WatchdogUntrackCommand
+//
+//   Called on the workloop when a tracked command completes or could not be queued.  The watchdog
+//   is not rescheduled here - if it was due for this command it just finds nothing to do.
+//
+//================================================================================================
+//
+void
+IOUSBController::WatchdogUntrackCommand(IOUSBCommand *command)
+{
+	IOUSBCommand *	prev;
+	IOUSBCommand *	next;
+	
+	if (!command->GetOnWatchdogList())
+		return;
+	
+	prev = command->GetWatchdogPrev();
+	next = command->GetWatchdogNext();
+	if (prev)
+		prev->SetWatchdogNext(next);
+	else
+		_watchdogCommands = next;
+	if (next)
+		next->SetWatchdogPrev(prev);
+	
+	if (command->GetWatchdogDeadline())
+		_watchdogTimedCommandCount--;
+	
+	command->SetWatchdogNext(NULL);
+	command->SetWatchdogPrev(NULL);
+	command->SetWatchdogDeadline(0);
+	command->SetWatchdogSubmitFrame(0);
+	command->SetOnWatchdogList(false);
+	_watchdogCommandCount--;
+}
+
+
+
+//================================================================================================
+//
+//   ScheduleWatchdog
+//
+//   Called on the workloop after the watchdog has run (afterTimeoutCheck is then true, since the
+//   UIM has just looked at every outstanding transfer), and when it is first enabled.  Arms the
+//   watchdog for the earliest deadline of the outstanding commands, bounded by the housekeeping
+//   interval until WatchdogTimer has counted kUSBWatchdogIdleTicks housekeeping ticks with no
+//   command or isochronous transfer outstanding and no command pool to trim.  The watchdog is then
+//   left disarmed, and the next WatchdogTrackCommand arms it again.
+//
+//================================================================================================
+//
+void
+IOUSBController::ScheduleWatchdog(bool afterTimeoutCheck)
+{
+	IOUSBCommand *	command;
+	uint64_t		now = mach_absolute_time();
+	uint64_t		wakeTime = 0;
+	uint64_t		deadline;
+	uint64_t		interval;
+	UInt32			noDataTimeoutMS;
+	IOReturn		err;
+	
+	if (!_watchdogUSBTimer || !_watchdogTimerActive)
+		return;
+	
+	for (command = _watchdogCommands; command; command = command->GetWatchdogNext())
+	{
+		deadline = command->GetWatchdogDeadline();
+		if (!deadline)
+			continue;
+		
+		noDataTimeoutMS = command->GetNoDataTimeout();
+		if (afterTimeoutCheck && noDataTimeoutMS)
+		{
+			// The UIM took its no-data baseline on this pass if it did not have one.  If it did, and the timeout has
+			// run out since without the UIM timing the command out, data moved and the baseline moved with it
+			clock_interval_to_absolutetime_interval(noDataTimeoutMS, kMillisecondScale, &interval);
+			if (!command->GetWatchdogBaseline() || ((command->GetWatchdogBaseline() + interval) <= now))
+			{
+				command->SetWatchdogBaseline(now);
+				deadline = 0;
+			}
+		}
+		
+		if (deadline <= now)
+		{
+			deadline = WatchdogCommandDeadline(command, now);
+			command->SetWatchdogDeadline(deadline);
+		}
+		
+		if (!wakeTime || (deadline < wakeTime))
+			wakeTime = deadline;
+	}
+	
+	if (_watchdogIdleTicks < kUSBWatchdogIdleTicks)
+	{
+		clock_interval_to_deadline(kUSBWatchdogTimeoutMS, kMillisecondScale, &deadline);
+		if (!wakeTime || (deadline < wakeTime))
+			wakeTime = deadline;
+	}
+	
+	if (!wakeTime)
+	{
+		USBLog(6, "%s[%p]::ScheduleWatchdog - idle, leaving the watchdog disarmed", getName(), this);
+		USBTrace( kUSBTController, kTPControllerWatchdog, (uintptr_t)this, 0, 0, 2 );
+		_watchdogDisarms++;
+		_watchdogDeadline = 0;
+		_watchdogUSBTimer->cancelTimeout();
+		UpdateWatchdogStatistics();
+		return;
+	}
+	
+	_watchdogDeadline = wakeTime;
+	err = _watchdogUSBTimer->wakeAtTime(*(AbsoluteTime *)&wakeTime);
+	if (err)
+	{
+		USBError(1, "%s[%p]::ScheduleWatchdog: error 0x%08x", getName(), this, err);
+	}
+}
+
+
+
+//================================================================================================
+//
+//   UpdateWatchdogStatistics
+//
+//   Publishes how often the watchdog has run and how late it has been against its deadlines.
+//
+//================================================================================================
+//
+void
+IOUSBController::UpdateWatchdogStatistics(void)
+{
+	uint64_t			maxLatenessNS;
+	
+	if (_watchdogWakeups == _watchdogWakeupsReported)
+		return;
+	
+	_watchdogWakeupsReported = _watchdogWakeups;
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&_watchdogMaxLateness, &maxLatenessNS);
+	
+	setProperty("WatchdogWakeups", _watchdogWakeups, 32);
+	setProperty("WatchdogDisarms", _watchdogDisarms, 32);
+	setProperty("WatchdogMaxLatenessUS", maxLatenessNS / 1000, 64);
+}
+
+
+
+//================================================================================================
+//
+//   UpdateDeviceZeroStatistics
+//
+//   Publishes how often the device zero lock has been taken, and how long enumeration has spent
+//   waiting for it and holding it.  On a controller without per-slot addressing this is the part
+//   of populating a bus which cannot overlap.
+//
+//================================================================================================
+//
+void
+IOUSBController::UpdateDeviceZeroStatistics(void)
+{
+	uint64_t			waitNS;
+	uint64_t			holdNS;
+	
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&_devZeroWaitTime, &waitNS);
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&_devZeroHoldTime, &holdNS);
+	
+	setProperty("DeviceZeroAcquisitions", _devZeroAcquisitions, 32);
+	setProperty("DeviceZeroWaitMS", waitNS / 1000000, 64);
+	setProperty("DeviceZeroHoldMS", holdNS / 1000000, 64);
+}
+
+
+
 IOCommandGate *
 IOUSBController::GetCommandGate(void) 
 { 
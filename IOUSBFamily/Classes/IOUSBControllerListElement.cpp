@@ -105,5 +105,6 @@ IOUSBControllerIsochEndpoint::init()
 	interval = 0;
 	direction = 0;
 	aborting = false;
+	nextHashEP = NULL;
 	return true;
 }
@@ -1036,6 +1036,17 @@ IOUSBControllerV2::DeallocateIsochEP(IOUSBControllerIsochEndpoint* pEP)
 
 
 
+static inline UInt32
+IsochEPHashBucket(short functionAddress, short endpointNumber, short direction)
+{
+	UInt32		key = ((((UInt32)functionAddress & 0x7F) << 4) | ((UInt32)endpointNumber & 0x0F)) << 2 | ((UInt32)direction & 0x03);
+	
+	// Fibonacci hash, so that the same endpoint on different devices lands in different buckets
+	return (key * 2654435761U) >> 26;
+}
+
+
+
 OSMetaClassDefineReservedUsed(IOUSBControllerV2,  11);
 IOUSBControllerIsochEndpoint*
 IOUSBControllerV2::FindIsochronousEndpoint(short								functionAddress,
@@ -1045,6 +1056,21 @@ IOUSBControllerV2::FindIsochronousEndpoint(short								functionAddress,
 {
     IOUSBControllerIsochEndpoint		*pEP, *pBack;
     
+	if (!ppEPBack)
+	{
+		// nobody needs the previous list entry, so the hash will do
+		pEP = _isochEPHash[IsochEPHashBucket(functionAddress, endpointNumber, direction)];
+		while (pEP)
+		{
+			if ((pEP->functionAddress == functionAddress)
+				&& (pEP->endpointNumber == endpointNumber)
+				&& (pEP->direction == direction))
+				break;
+			pEP = pEP->nextHashEP;
+		}
+		return pEP;
+	}
+	
     pEP = _isochEPList;
     pBack = NULL;
     while (pEP)
@@ -1087,12 +1113,55 @@ IOUSBControllerV2::CreateIsochronousEndpoint(short					functionAddress,
 		pEP->functionAddress = functionAddress;
 		pEP->endpointNumber = endpointNumber;
 		pEP->direction = direction;
+		
+		UInt32 bucket = IsochEPHashBucket(functionAddress, endpointNumber, direction);
+		pEP->nextHashEP = _isochEPHash[bucket];
+		_isochEPHash[bucket] = pEP;
 	}
     return pEP;
 }
 
 
 
+void
+IOUSBControllerV2::RemoveIsochronousEndpoint(IOUSBControllerIsochEndpoint *pEP)
+{
+    IOUSBControllerIsochEndpoint		*curEP, *prevEP;
+	
+	if (!pEP)
+		return;
+	
+    prevEP = NULL;
+    curEP = _isochEPList;
+    while (curEP)
+    {
+		if (curEP == pEP)
+		{
+			if (prevEP)
+				prevEP->nextEP = curEP->nextEP;
+			else
+				_isochEPList = curEP->nextEP;
+			break;
+		}
+		prevEP = curEP;
+		curEP = curEP->nextEP;
+    }
+	
+	IOUSBControllerIsochEndpoint		**link = &_isochEPHash[IsochEPHashBucket(pEP->functionAddress, pEP->endpointNumber, pEP->direction)];
+	while (*link)
+	{
+		if (*link == pEP)
+		{
+			*link = pEP->nextHashEP;
+			break;
+		}
+		link = &(*link)->nextHashEP;
+	}
+	pEP->nextHashEP = NULL;
+}
+
+
+
 OSMetaClassDefineReservedUsed(IOUSBControllerV2,  13);
 void
 IOUSBControllerV2::PutTDonToDoList(IOUSBControllerIsochEndpoint* pED, IOUSBControllerIsochListElement *pTD)
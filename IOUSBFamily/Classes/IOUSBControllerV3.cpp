@@ -1253,7 +1253,7 @@ IOUSBControllerV3::GatedPowerChange(OSObject *owner, void *arg0, void *arg1, voi
 		if (me->_expansionData && me->_watchdogUSBTimer && !me->_watchdogTimerActive)
 		{
 			me->_watchdogTimerActive = true;
-			me->_watchdogUSBTimer->setTimeoutMS(kUSBWatchdogTimeoutMS);
+			me->ScheduleWatchdog();
 		}
 	}
 
@@ -2057,17 +2057,25 @@ IOUSBControllerV3::AbortPipe(UInt32 streamID, USBDeviceAddress address, Endpoint
 		}
 	}
 
-	return _commandGate->runAction(DoAbortStream, (void *)streamID, (void *)(UInt32) address,
+	kr = _commandGate->runAction(DoAbortStream, (void *)streamID, (void *)(UInt32) address,
 								   (void *)(UInt32) endpoint->number, (void *)(UInt32) endpoint->direction);
-
+	WaitForPipeCompletions(address, endpoint->number, endpoint->direction);
+	
+	return kr;
 }
 
 IOReturn 
 IOUSBControllerV3::DoAbortStream(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3)
 {
     IOUSBControllerV3 *me = (IOUSBControllerV3 *)owner;
+	UInt32				bypass;
+	IOReturn			kr;
 	
-	return me->UIMAbortStream((UInt32)(uintptr_t)arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2, (short)(uintptr_t) arg3);
+	bypass = me->BeginCompletionBypass((USBDeviceAddress)(uintptr_t) arg1, (UInt8)(uintptr_t) arg2, (UInt8)(uintptr_t) arg3);
+	kr = me->UIMAbortStream((UInt32)(uintptr_t)arg0, (short)(uintptr_t) arg1, (short)(uintptr_t) arg2, (short)(uintptr_t) arg3);
+	me->EndCompletionBypass(bypass);
+	
+	return kr;
 }
 
 
@@ -2396,6 +2404,13 @@ IOUSBControllerV3::GetBandwidthAvailableForDevice(IOUSBDevice *forDevice,  UInt3
     return ret;
 }
 
+void
+IOUSBControllerV3::UIMCheckForCommandTimeouts(void)
+{
+	// a UIM which does not separate its timeout checks from the rest of its periodic work just does it all each time
+	UIMCheckForTimeouts();
+}
+
 OSMetaClassDefineReservedUsed(IOUSBControllerV3,  0);
 OSMetaClassDefineReservedUsed(IOUSBControllerV3,  1);
 
@@ -2417,8 +2432,8 @@ OSMetaClassDefineReservedUsed(IOUSBControllerV3,  16);
 OSMetaClassDefineReservedUsed(IOUSBControllerV3,  17);
 OSMetaClassDefineReservedUsed(IOUSBControllerV3,  18);
 OSMetaClassDefineReservedUsed(IOUSBControllerV3,  19);
+OSMetaClassDefineReservedUsed(IOUSBControllerV3,  20);
 
-OSMetaClassDefineReservedUnused(IOUSBControllerV3,  20);
 OSMetaClassDefineReservedUnused(IOUSBControllerV3,  21);
 OSMetaClassDefineReservedUnused(IOUSBControllerV3,  22);
 OSMetaClassDefineReservedUnused(IOUSBControllerV3,  23);
@@ -24,6 +24,8 @@
 #include <IOKit/system.h>
 
 #include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOSubMemoryDescriptor.h>
+#include <IOKit/IOMultiMemoryDescriptor.h>
 #include <IOKit/IOCommandPool.h>
 
 #include <IOKit/usb/IOUSBController.h>
@@ -35,6 +37,14 @@
 
 #define _freeUSBCommandPool				_expansionData->freeUSBCommandPool
 #define _freeUSBIsocCommandPool			_expansionData->freeUSBIsocCommandPool
+#define _bounceBufferLock				_expansionData->_bounceBufferLock
+#define _bounceBuffers					_expansionData->_bounceBuffers
+#define _bounceBufferCount				_expansionData->_bounceBufferCount
+#define _bounceCount					_expansionData->_bounceCount
+#define _bounceBytes					_expansionData->_bounceBytes
+#define _bounceBufferHits				_expansionData->_bounceBufferHits
+#define _bounceBufferMisses				_expansionData->_bounceBufferMisses
+#define _bounceCountReported			_expansionData->_bounceCountReported
 
 #define CONTROLLER_PIPES_USE_KPRINTF 0
 
@@ -58,37 +68,241 @@ IOReturn IOUSBController::OpenPipe(USBDeviceAddress address, UInt8 speed,
 IOReturn IOUSBController::ClosePipe(USBDeviceAddress address,
                                     		Endpoint * endpoint)
 {
-    return _commandGate->runAction(DoDeleteEP, (void *)(UInt32) address,
+	IOReturn	kr;
+	
+    kr = _commandGate->runAction(DoDeleteEP, (void *)(UInt32) address,
 			(void *)(UInt32) endpoint->number, (void *)(UInt32) endpoint->direction);
+	WaitForPipeCompletions(address, endpoint->number, endpoint->direction);
+	
+	return kr;
 }
 
 IOReturn IOUSBController::AbortPipe(USBDeviceAddress address,
                                     Endpoint * endpoint)
 {
-    return _commandGate->runAction(DoAbortEP, (void *)(UInt32) address,
+	IOReturn	kr;
+	
+    kr = _commandGate->runAction(DoAbortEP, (void *)(UInt32) address,
 			(void *)(UInt32) endpoint->number, (void *)(UInt32) endpoint->direction);
+	WaitForPipeCompletions(address, endpoint->number, endpoint->direction);
+	
+	return kr;
 }
 
 IOReturn IOUSBController::ResetPipe(USBDeviceAddress address,
                                     Endpoint * endpoint)
 {
-    return _commandGate->runAction(DoClearEPStall, (void *)(UInt32) address,
+	IOReturn	kr;
+	
+    kr = _commandGate->runAction(DoClearEPStall, (void *)(UInt32) address,
 			(void *)(UInt32) endpoint->number, (void *)(UInt32) endpoint->direction);
+	WaitForPipeCompletions(address, endpoint->number, endpoint->direction);
+	
+	return kr;
 }
 
 IOReturn IOUSBController::ClearPipeStall(USBDeviceAddress address,
                                          Endpoint * endpoint)
 {
-    return _commandGate->runAction(DoClearEPStall, (void *)(UInt32) address,
+	IOReturn	kr;
+	
+    kr = _commandGate->runAction(DoClearEPStall, (void *)(UInt32) address,
 			(void *)(UInt32) endpoint->number, (void *)(UInt32) endpoint->direction);
+	WaitForPipeCompletions(address, endpoint->number, endpoint->direction);
+	
+	return kr;
+}
+
+
+//================================================================================================
+//
+//   Bounce buffer pool
+//
+//   Transfers whose physical segments are not multiples of the max packet size have (part of) their
+//   data copied through a bounce buffer by CheckForDisjointDescriptor.  Rather than allocating and
+//   wiring a new IOBufferMemoryDescriptor for every such transfer, we keep a few idle buffers in each
+//   size class, already prepared, and hand them out again.  Transfers larger than the biggest class
+//   still get a buffer of their own, which is completed and released when the transfer finishes.
+//
+//   GetBounceBuffer can be called on a client thread and ReturnBounceBuffer on the workloop, so the
+//   pool is protected by a simple lock.  Nothing is allocated or prepared while holding it.
+//
+//================================================================================================
+//
+static int
+BounceBufferClass(IOByteCount length)
+{
+	int			sizeClass;
+	
+	for (sizeClass = 0; sizeClass < kUSBBounceBufferClasses; sizeClass++)
+		if (length <= ((IOByteCount)kUSBBounceBufferMinSize << (2 * sizeClass)))
+			return sizeClass;
+	
+	return -1;
+}
+
+
+
+IOBufferMemoryDescriptor *
+IOUSBController::GetBounceBuffer(IOByteCount length)
+{
+	IOBufferMemoryDescriptor	*buf = NULL;
+	IOByteCount					capacity = length;
+	int							sizeClass = BounceBufferClass(length);
+	IOInterruptState			intState;
+	IOReturn					err;
+	
+	if (sizeClass >= 0)
+		capacity = (IOByteCount)kUSBBounceBufferMinSize << (2 * sizeClass);
+	
+	if (_bounceBufferLock)
+	{
+		intState = IOSimpleLockLockDisableInterrupt(_bounceBufferLock);
+		if ((sizeClass >= 0) && _bounceBufferCount[sizeClass])
+		{
+			buf = _bounceBuffers[sizeClass][--_bounceBufferCount[sizeClass]];
+			_bounceBuffers[sizeClass][_bounceBufferCount[sizeClass]] = NULL;
+			_bounceBufferHits++;
+		}
+		else
+			_bounceBufferMisses++;
+		IOSimpleLockUnlockEnableInterrupt(_bounceBufferLock, intState);
+	}
+	
+	if (!buf)
+	{
+		// a buffer which does not cross a page boundary unless it has to will always produce segments which are whole pages or the whole buffer
+		buf = IOBufferMemoryDescriptor::withOptions(kIODirectionInOut, capacity, (capacity < PAGE_SIZE) ? capacity : PAGE_SIZE);
+		if (!buf)
+			return NULL;
+		
+		err = buf->prepare();
+		if (err)
+		{
+			USBLog(1, "%s[%p]::GetBounceBuffer - err 0x%x in prepare", getName(), this, err);
+			buf->release();
+			return NULL;
+		}
+		USBLog(6, "%s[%p]::GetBounceBuffer - allocated new bounce buffer (%p) of capacity %d", getName(), this, buf, (int)capacity);
+	}
+	
+	buf->setLength(length);
+	return buf;
 }
 
 
+
+void
+IOUSBController::ReturnBounceBuffer(IOBufferMemoryDescriptor *buf)
+{
+	int							sizeClass;
+	IOInterruptState			intState;
+	
+	if (!buf)
+		return;
+	
+	sizeClass = BounceBufferClass(buf->getCapacity());
+	if (_bounceBufferLock && (sizeClass >= 0) && (buf->getCapacity() == ((IOByteCount)kUSBBounceBufferMinSize << (2 * sizeClass))))
+	{
+		buf->setLength(buf->getCapacity());
+		
+		intState = IOSimpleLockLockDisableInterrupt(_bounceBufferLock);
+		if (_bounceBufferCount[sizeClass] < kUSBBounceBuffersPerClass)
+		{
+			_bounceBuffers[sizeClass][_bounceBufferCount[sizeClass]++] = buf;
+			buf = NULL;
+		}
+		IOSimpleLockUnlockEnableInterrupt(_bounceBufferLock, intState);
+	}
+	
+	if (buf)
+	{
+		buf->complete();
+		buf->release();
+	}
+}
+
+
+
+void
+IOUSBController::FreeBounceBuffers(void)
+{
+	IOBufferMemoryDescriptor	*buf;
+	IOInterruptState			intState;
+	int							sizeClass;
+	
+	if (!_bounceBufferLock)
+		return;
+	
+	for (sizeClass = 0; sizeClass < kUSBBounceBufferClasses; sizeClass++)
+	{
+		for (;;)
+		{
+			buf = NULL;
+			intState = IOSimpleLockLockDisableInterrupt(_bounceBufferLock);
+			if (_bounceBufferCount[sizeClass])
+			{
+				buf = _bounceBuffers[sizeClass][--_bounceBufferCount[sizeClass]];
+				_bounceBuffers[sizeClass][_bounceBufferCount[sizeClass]] = NULL;
+			}
+			IOSimpleLockUnlockEnableInterrupt(_bounceBufferLock, intState);
+			
+			if (!buf)
+				break;
+			
+			buf->complete();
+			buf->release();
+		}
+	}
+}
+
+
+
+//================================================================================================
+//
+//   UpdateBounceBufferStatistics
+//
+//   Called from the watchdog timer.  Only touches the registry if something has bounced since last time.
+//
+//================================================================================================
+//
+void
+IOUSBController::UpdateBounceBufferStatistics(void)
+{
+	IOInterruptState			intState;
+	UInt32						bounceCount, hits, misses;
+	UInt64						bounceBytes;
+	
+	if (!_bounceBufferLock)
+		return;
+	
+	intState = IOSimpleLockLockDisableInterrupt(_bounceBufferLock);
+	bounceCount = _bounceCount;
+	bounceBytes = _bounceBytes;
+	hits = _bounceBufferHits;
+	misses = _bounceBufferMisses;
+	IOSimpleLockUnlockEnableInterrupt(_bounceBufferLock, intState);
+	
+	if (bounceCount == _bounceCountReported)
+		return;
+	
+	_bounceCountReported = bounceCount;
+	setProperty("DisjointBounceCount", bounceCount, 32);
+	setProperty("DisjointBounceBytes", bounceBytes, 64);
+	setProperty("DisjointBounceBufferHits", hits, 32);
+	setProperty("DisjointBounceBufferMisses", misses, 32);
+}
+
+
+
 static void 
 DisjointCompletion(IOUSBController *me, IOUSBCommand *command, IOReturn status, UInt32 bufferSizeRemaining)
 {
-    IOBufferMemoryDescriptor	*buf = NULL;
+    IOMemoryDescriptor			*buf = NULL;
+    IOBufferMemoryDescriptor	*bounceBuf = NULL;
 	IODMACommand				*dmaCommand = NULL;
+	IOByteCount					bounceOffset;
+	IOByteCount					actual;
 
 	USBTrace_Start( kUSBTController, kTPControllerDisjointCompletion, (uintptr_t)me, (uintptr_t)command, status, bufferSizeRemaining );
 	
@@ -98,12 +312,14 @@ DisjointCompletion(IOUSBController *me, IOUSBCommand *command, IOReturn status,
 		return;
     }
 	
-	buf = OSDynamicCast(IOBufferMemoryDescriptor, command->GetBuffer());
+	buf = command->GetBuffer();
+	bounceBuf = command->GetBounceBuffer();
+	bounceOffset = command->GetBounceOffset();
 	dmaCommand = command->GetDMACommand();
 	
-	if (!dmaCommand || !buf)
+	if (!dmaCommand || !buf || !bounceBuf)
 	{
-		USBLog(1, "%s[%p]::DisjointCompletion - no dmaCommand, or buf(%p) is not an IOBMD", me->getName(), me, command->GetBuffer());
+		USBLog(1, "%s[%p]::DisjointCompletion - no dmaCommand, or buf(%p) has no bounce buffer", me->getName(), me, command->GetBuffer());
 		USBTrace( kUSBTController, kTPControllerDisjointCompletion, (uintptr_t)me, (uintptr_t)command->GetBuffer(), 0, 1 );
 		return;
 	}
@@ -121,18 +337,28 @@ DisjointCompletion(IOUSBController *me, IOUSBCommand *command, IOReturn status,
 		dmaCommand->clearMemoryDescriptor();
 	}
 	
-    if (command->GetDirection() == kUSBIn)
+	// only the part of the transfer from bounceOffset on went through the bounce buffer - the rest went straight into the client's buffer
+	actual = command->GetDblBufLength() - bufferSizeRemaining;
+    if ((command->GetDirection() == kUSBIn) && (actual > bounceOffset))
     {
-		USBLog(5, "%s[%p]::DisjointCompletion, copying %d out of %d bytes to desc %p from buffer %p", me->getName(), me, (int)(command->GetDblBufLength()-bufferSizeRemaining), (int)command->GetDblBufLength(), command->GetOrigBuffer(), buf);
-		command->GetOrigBuffer()->writeBytes(0, buf->getBytesNoCopy(), (command->GetDblBufLength()-bufferSizeRemaining));
+		USBLog(5, "%s[%p]::DisjointCompletion, copying %d out of %d bytes to desc %p at offset %d from buffer %p", me->getName(), me, (int)(actual - bounceOffset), (int)(command->GetDblBufLength() - bounceOffset), command->GetOrigBuffer(), (int)bounceOffset, bounceBuf);
+		command->GetOrigBuffer()->writeBytes(bounceOffset, bounceBuf->getBytesNoCopy(), actual - bounceOffset);
     }
 	
-    buf->complete();
-	buf->release();								// done with this buffer
+	if (buf != bounceBuf)
+	{
+		// this is the IOMultiMemoryDescriptor which combined the front of the client buffer with the bounce buffer
+		buf->complete();
+		buf->release();
+	}
+	me->ReturnBounceBuffer(bounceBuf);			// done with this buffer
 	command->SetBuffer(NULL);
+	command->SetBounceBuffer(NULL);
+	command->SetBounceOffset(0);
 	
-    // now call through to the original completion routine
+    // now call through to the original completion routine, or hand it to a completion thread if the controller uses them
     IOUSBCompletion completion = command->GetDisjointCompletion();
+	bool deferred = me->DeferCompletion(command, completion, status, bufferSizeRemaining);
 	
 	if ( !command->GetIsSyncTransfer() )
 	{
@@ -140,7 +366,7 @@ DisjointCompletion(IOUSBController *me, IOUSBCommand *command, IOReturn status,
 		me->ReturnUSBCommand(command);
 	}
 	
-   	if (completion.action)
+   	if (completion.action && !deferred)
 	{
 		USBLog(status == kIOReturnSuccess ? 7 : 3, "%s[%p]::DisjointCompletion calling through to %p - status 0x%x!", me->getName(), me, completion.action, (uint32_t)status);
 		(*completion.action)(completion.target, completion.parameter, status, bufferSizeRemaining);
@@ -159,6 +385,7 @@ IOUSBController::CheckForDisjointDescriptor(IOUSBCommand *command, UInt16 maxPac
 {
     IOMemoryDescriptor			*buf = command->GetBuffer();
     IOBufferMemoryDescriptor	*newBuf = NULL;
+    IOMemoryDescriptor			*xferBuf = NULL;
     IOByteCount					length = command->GetReqCount();
 	IODMACommand				*dmaCommand = command->GetDMACommand();
     IOByteCount					segLength = 0;
@@ -215,11 +442,11 @@ IOUSBController::CheckForDisjointDescriptor(IOUSBCommand *command, UInt16 maxPac
         // so the segment is less than the rest of the length - we need to check against maxPacketSize
         if (segLength % maxPacketSize)
         {
-            // this is the error case. I need to copy the descriptor to a new descriptor and remember that I did it
-            USBLog(6, "%s[%p]::CheckForDisjointDescriptor - found a disjoint segment of length (%d) MPS (%d)", getName(), this, (int)segLength, maxPacketSize);
-			length = command->GetReqCount();		// we will not return to the while loop, so don't worry about changing the value of length
-													// allocate a new descriptor which is the same total length as the old one
-			newBuf = IOBufferMemoryDescriptor::withOptions((command->GetDirection() == kUSBIn) ? kIODirectionIn : kIODirectionOut, length);
+            // this is the error case. Everything up to this segment was made of whole packets and can still go straight to
+			// the client's buffer, so only the rest of the transfer needs to go through a bounce buffer
+            USBLog(6, "%s[%p]::CheckForDisjointDescriptor - found a disjoint segment of length (%d) MPS (%d) at offset (%d)", getName(), this, (int)segLength, maxPacketSize, (int)offset);
+			length = command->GetReqCount() - offset;		// we will not return to the while loop, so don't worry about changing the value of length
+			newBuf = GetBounceBuffer(length);
 			if (!newBuf)
 			{
 				USBLog(1, "%s[%p]::CheckForDisjointDescriptor - could not allocate new buffer", getName(), this);
@@ -228,44 +455,82 @@ IOUSBController::CheckForDisjointDescriptor(IOUSBCommand *command, UInt16 maxPac
 			}
 			USBLog(7, "%s[%p]::CheckForDisjointDescriptor, obtained buffer %p of length %d", getName(), this, newBuf, (int)length);
 			
-			// first close out (and complete) the original dma command descriptor
-			USBLog(7, "%s[%p]::CheckForDisjointDescriptor, clearing memDec (%p) from dmaCommand (%p)", getName(), this, dmaCommand->getMemoryDescriptor(), dmaCommand);
-			dmaCommand->clearMemoryDescriptor();
-			
 			// copy the bytes to the buffer if necessary
 			if (command->GetDirection() == kUSBOut)
 			{
-				USBLog(7, "%s[%p]::CheckForDisjointDescriptor, copying %d bytes from desc %p to buffer %p", getName(), this, (int)length, buf, newBuf->getBytesNoCopy());
-				if (buf->readBytes(0, newBuf->getBytesNoCopy(), length) != length)
+				USBLog(7, "%s[%p]::CheckForDisjointDescriptor, copying %d bytes from desc %p at offset %d to buffer %p", getName(), this, (int)length, buf, (int)offset, newBuf->getBytesNoCopy());
+				if (buf->readBytes(offset, newBuf->getBytesNoCopy(), length) != length)
 				{
 					USBLog(1, "%s[%p]::CheckForDisjointDescriptor - bad copy on a write", getName(), this);
 					USBTrace( kUSBTController, kTPControllerCheckForDisjointDescriptor, (uintptr_t)this, 0, 0, 6 );
-					newBuf->release();
+					ReturnBounceBuffer(newBuf);
 					return kIOReturnNoMemory;
 				}
 			}
-			err = newBuf->prepare();
-			if (err)
+			
+			if (offset)
 			{
-				USBLog(1, "%s[%p]::CheckForDisjointDescriptor - err 0x%x in prepare", getName(), this, err);
-				USBTrace( kUSBTController, kTPControllerCheckForDisjointDescriptor, (uintptr_t)this, err, 0, 7 );
-				newBuf->release();
-				return err;
+				// the transfer is the front of the client's buffer followed by the bounce buffer
+				IOMemoryDescriptor		*descs[2];
+				IODirection				direction = (command->GetDirection() == kUSBIn) ? kIODirectionIn : kIODirectionOut;
+				
+				descs[0] = IOSubMemoryDescriptor::withSubRange(buf, 0, offset, direction);
+				descs[1] = newBuf;
+				xferBuf = descs[0] ? IOMultiMemoryDescriptor::withDescriptors(descs, 2, direction, false) : NULL;
+				if (descs[0])
+					descs[0]->release();						// the multi memory descriptor holds its own reference
+				if (!xferBuf)
+				{
+					USBLog(1, "%s[%p]::CheckForDisjointDescriptor - could not create the split descriptor", getName(), this);
+					USBTrace( kUSBTController, kTPControllerCheckForDisjointDescriptor, (uintptr_t)this, kIOReturnNoMemory, 0, 5 );
+					ReturnBounceBuffer(newBuf);
+					return kIOReturnNoMemory;
+				}
+				err = xferBuf->prepare();
+				if (err)
+				{
+					USBLog(1, "%s[%p]::CheckForDisjointDescriptor - err 0x%x in prepare", getName(), this, err);
+					USBTrace( kUSBTController, kTPControllerCheckForDisjointDescriptor, (uintptr_t)this, err, 0, 7 );
+					xferBuf->release();
+					ReturnBounceBuffer(newBuf);
+					return err;
+				}
 			}
-			err = dmaCommand->setMemoryDescriptor(newBuf);
+			else
+				xferBuf = newBuf;								// pooled bounce buffers are already prepared
+			
+			// close out (and complete) the original dma command descriptor
+			USBLog(7, "%s[%p]::CheckForDisjointDescriptor, clearing memDec (%p) from dmaCommand (%p)", getName(), this, dmaCommand->getMemoryDescriptor(), dmaCommand);
+			dmaCommand->clearMemoryDescriptor();
+			
+			err = dmaCommand->setMemoryDescriptor(xferBuf);
 			if (err)
 			{
 				USBLog(1, "%s[%p]::CheckForDisjointDescriptor - err 0x%x in setMemoryDescriptor", getName(), this, err);
 				USBTrace( kUSBTController, kTPControllerCheckForDisjointDescriptor, (uintptr_t)this, err, 0, 8 );
-				newBuf->complete();
-				newBuf->release();
+				if (xferBuf != newBuf)
+				{
+					xferBuf->complete();
+					xferBuf->release();
+				}
+				ReturnBounceBuffer(newBuf);
 				return err;
 			}
 			
+			if (_bounceBufferLock)
+			{
+				IOInterruptState	intState = IOSimpleLockLockDisableInterrupt(_bounceBufferLock);
+				_bounceCount++;
+				_bounceBytes += length;
+				IOSimpleLockUnlockEnableInterrupt(_bounceBufferLock, intState);
+			}
+			
 			command->SetOrigBuffer(command->GetBuffer());
 			command->SetDisjointCompletion(command->GetClientCompletion());
-			USBLog(7, "%s[%p]::CheckForDisjointDescriptor - changing buffer from (%p) to (%p) and putting new buffer in dmaCommand (%p)", getName(), this, command->GetBuffer(), newBuf, dmaCommand);
-			command->SetBuffer(newBuf);
+			USBLog(7, "%s[%p]::CheckForDisjointDescriptor - changing buffer from (%p) to (%p) and putting new buffer in dmaCommand (%p)", getName(), this, command->GetBuffer(), xferBuf, dmaCommand);
+			command->SetBuffer(xferBuf);
+			command->SetBounceBuffer(newBuf);
+			command->SetBounceOffset(offset);
 			
 			
 			IOUSBCompletion completion;
@@ -274,7 +539,7 @@ IOUSBController::CheckForDisjointDescriptor(IOUSBCommand *command, UInt16 maxPac
 			completion.parameter = command;
 			command->SetClientCompletion(completion);
 			
-			command->SetDblBufLength(length);			// for the IOFree - the other buffer may change size
+			command->SetDblBufLength(command->GetReqCount());	// the full transfer length, used to work out how much came back
             return kIOReturnSuccess;
 		}
         length -= segLength;		// adjust our master length pointer
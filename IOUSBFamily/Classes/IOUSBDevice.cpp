@@ -94,6 +94,14 @@ extern "C" {
 #define _WAKEUSB3POWERALLOCATED			_expansionData->_wakeUSB3PowerAllocated
 #define _ATTACHEDTOENCLOSUREANDUSINGEXTRAWAKEPOWER		_expansionData->_attachedToEnclosureAndUsingExtraWakePower
 #define _DEVICEISONTHUNDERBOLT				_expansionData->_deviceIsOnThunderbolt
+#define _STRINGCACHELOCK				_expansionData->_stringCacheLock
+#define _STRINGCACHE					_expansionData->_stringCache
+#define _STRINGCACHEHITS				_expansionData->_stringCacheHits
+#define _STRINGCACHEMISSES				_expansionData->_stringCacheMisses
+#define _STRINGCACHESTATSTHREAD			_expansionData->_stringCacheStatsThread
+#define _STRINGCACHESTATSPENDING		_expansionData->_stringCacheStatsPending
+#define _CONFIGINDEXLIST				_expansionData->_configIndexList
+#define _MATCHINGSTATISTICS				_expansionData->_matchingStatistics
 
 
 #define kNotifyTimerDelay			60000	// in milliseconds = 60 seconds
@@ -102,11 +110,48 @@ extern "C" {
 #define kMaxTimeToWaitForSuspend	20000   // in milliseconds = 20 seconds
 #define kGetConfigDeadlineInSecs	30
 
+#define kMaxStringUTF8Length		(127 * 4)	// a string descriptor holds at most 127 UTF-16 words, each at most 4 UTF-8 bytes
+#define kStringCacheStatsDelayMS	1000		// how long after a cache hit the counters are published
+
 typedef struct IOUSBDeviceMessage {
     UInt32			type;
     IOReturn		error;
 } IOUSBDeviceMessage;
 
+// A string descriptor we have already read, converted to UTF-8.  Allocated with room for the whole string.
+//
+struct IOUSBStringCacheEntry
+{
+	IOUSBStringCacheEntry *	next;
+	UInt16					lang;
+	UInt8					index;
+	UInt32					length;					// bytes in utf8, not counting the terminating NULL
+	char					utf8[1];
+};
+
+// Where each descriptor in a cached configuration descriptor starts, so that FindNextDescriptor and
+// FindNextInterfaceDescriptor can go straight to the next one of the type they want instead of walking
+// the bytes.  Allocated with room for count entries.
+//
+#define kConfigIndexNoEntry			0xFFFF
+
+struct IOUSBConfigIndexEntry
+{
+	UInt16					offset;					// from the start of the configuration descriptor
+	UInt16					nextOfType;				// entry of the next descriptor with the same bDescriptorType, or kConfigIndexNoEntry
+};
+
+struct IOUSBConfigIndex
+{
+	UInt32					length;					// bytes of the configuration descriptor that were indexed
+	UInt16					count;
+	UInt16					firstInterface;			// entry of the first interface descriptor, or kConfigIndexNoEntry
+	IOUSBConfigIndexEntry	entries[1];
+};
+
+static IOUSBConfigIndex *	BuildConfigIndex(const IOUSBConfigurationDescriptor *configDesc, UInt32 length);
+static void					FreeConfigIndex(IOUSBConfigIndex *index);
+
 
 /* Convert USBLog to use kprintf debugging */
 #ifndef IOUSBDEVICE_USE_KPRINTF
@@ -319,6 +364,18 @@ IOUSBDevice::start( IOService * provider )
         return kIOReturnNoMemory;
 	}
 	
+	// Without the lock we just read every string from the device, as we always used to
+	_STRINGCACHELOCK = IOLockAlloc();
+	if (!_STRINGCACHELOCK)
+	{
+		USBLog(1,"%s[%p]::start - unable to allocate _STRINGCACHELOCK, string descriptors will not be cached", getName(), this);
+	}
+	else
+	{
+		// Without this the counters are only published on a miss
+		_STRINGCACHESTATSTHREAD = thread_call_allocate((thread_call_func_t)PublishStringCacheStatisticsEntry, (thread_call_param_t)this);
+	}
+	
 	// Don't do this until we have a controller
     //
     _endpointZero.bLength = sizeof(_endpointZero);
@@ -422,6 +479,14 @@ IOUSBDevice::start( IOService * provider )
         if (!_configList)
 			goto ErrorExit;
         bzero(_configList, sizeof(IOBufferMemoryDescriptor*) * _descriptor.bNumConfigurations);
+		
+		// Without this we just walk the descriptors as we always used to
+		if (_descriptor.bNumConfigurations)
+		{
+			_CONFIGINDEXLIST = IONew(IOUSBConfigIndex*, _descriptor.bNumConfigurations);
+			if (_CONFIGINDEXLIST)
+				bzero(_CONFIGINDEXLIST, sizeof(IOUSBConfigIndex*) * _descriptor.bNumConfigurations);
+		}
     }
     else
     {
@@ -431,6 +496,17 @@ IOUSBDevice::start( IOService * provider )
         USBLog(3,"%s[%p]::start USB Device specified bNumConfigurations of 0, which is not legal", getName(), this);
     }
 	
+	// If asked to, read all the strings in one go now, so that matching and the property lookups below find them in the cache
+	propertyObj = copyProperty(kUSBPrefetchStringsKey);
+	if ( !propertyObj )
+		propertyObj = _controller->copyProperty(kUSBPrefetchStringsKey);
+    boolObj = OSDynamicCast( OSBoolean, propertyObj );
+    if ( boolObj == kOSBooleanTrue )
+		PrefetchStringDescriptors();
+	
+	if (propertyObj)
+		propertyObj->release();
+	
 	if  ((_descriptor.idVendor == 0x13FE) &&  ((_descriptor.idProduct == 0x1E00) ||(_descriptor.idProduct == 0x1F00)) )
 	{
 		//  Workaround for a faulty device that needs to be enumerated (rdar://5877895&6282251)
@@ -1019,6 +1095,19 @@ IOUSBDevice::free()
 		_configList = NULL;
     }
 	
+	if (_expansionData && _CONFIGINDEXLIST)
+	{
+		int 	i;
+		for(i=0; i<_descriptor.bNumConfigurations; i++) 
+			if (_CONFIGINDEXLIST[i])
+			{
+				FreeConfigIndex(_CONFIGINDEXLIST[i]);
+				_CONFIGINDEXLIST[i] = NULL;
+			}
+		IODelete(_CONFIGINDEXLIST, IOUSBConfigIndex*, _descriptor.bNumConfigurations);
+		_CONFIGINDEXLIST = NULL;
+	}
+	
     _currentConfigValue = 0;
 	
     //  This needs to be the LAST thing we do, as it disposes of our "fake" member
@@ -1046,6 +1135,22 @@ IOUSBDevice::free()
 			_INTERFACEARRAYLOCK = NULL;
 		}
 		
+		FreeMatchingStatistics(&_MATCHINGSTATISTICS);
+		
+		if ( _STRINGCACHESTATSTHREAD )
+		{
+			thread_call_cancel(_STRINGCACHESTATSTHREAD);
+			thread_call_free(_STRINGCACHESTATSTHREAD);
+			_STRINGCACHESTATSTHREAD = NULL;
+		}
+		
+		if ( _STRINGCACHELOCK )
+		{
+			FlushStringCache();
+			IOLockFree(_STRINGCACHELOCK);
+			_STRINGCACHELOCK = NULL;
+		}
+		
         IOFree(_expansionData, sizeof(ExpansionData));
         _expansionData = NULL;
     }
@@ -1385,8 +1490,9 @@ IOUSBDevice::_ResetDevice(OSObject *target, __unused void *arg0, __unused void *
 	
 	USBLog(6,"%s[%p]::_ResetDevice _HUBPARENT->ResetPort returned 0x%x", me->getName(), me, (uint32_t)status);
 	
-	// Since we have reset the device, make sure we set our configuration to 0
+	// Since we have reset the device, make sure we set our configuration to 0, and forget the strings it gave us
 	me->_currentConfigValue = 0;
+	me->FlushStringCache();
 	
 	// Recreate PipeZero object
 	me->_pipeZero = IOUSBPipeV2::ToEndpoint(&me->_endpointZero, NULL, me, me->_controller, NULL);
@@ -1486,6 +1592,121 @@ NextDescriptor(const void *desc)
 
 
 
+//================================================================================================
+//
+//   BuildConfigIndex
+//
+//   Records where each descriptor in the first length bytes of configDesc starts.  Returns NULL if
+//   we cannot allocate the index, or if the configuration has a zero length descriptor in it, in
+//   which case the descriptors are just walked - FindNextDescriptor's byte walk has its own way of
+//   stopping at a malformed descriptor, and we leave those configurations to it.
+//
+//================================================================================================
+//
+static IOUSBConfigIndex *
+BuildConfigIndex(const IOUSBConfigurationDescriptor *configDesc, UInt32 length)
+{
+	const UInt8 *		base = (const UInt8 *)configDesc;
+	IOUSBConfigIndex *	index;
+	UInt16				lastOfType[256];
+	UInt32				offset;
+	UInt32				count = 0;
+	UInt32				i;
+	
+	if ((length > kConfigIndexNoEntry) || (length < 2))
+		return NULL;
+	
+	for (offset = 0; offset + 2 <= length; offset += base[offset])
+	{
+		if (base[offset] == 0)
+		{
+			USBLog(3, "IOUSBDevice BuildConfigIndex - zero length descriptor at offset %d, not indexing this configuration", (int)offset);
+			return NULL;
+		}
+		count++;
+	}
+	
+	if (count >= kConfigIndexNoEntry)
+		return NULL;
+	
+	index = (IOUSBConfigIndex *)IOMalloc(sizeof(IOUSBConfigIndex) + (count - 1) * sizeof(IOUSBConfigIndexEntry));
+	if (!index)
+		return NULL;
+	
+	index->length = length;
+	index->count = count;
+	index->firstInterface = kConfigIndexNoEntry;
+	for (i = 0; i < 256; i++)
+		lastOfType[i] = kConfigIndexNoEntry;
+	
+	for (i = 0, offset = 0; i < count; offset += base[offset], i++)
+	{
+		UInt8	type = base[offset + 1];
+		
+		index->entries[i].offset = offset;
+		index->entries[i].nextOfType = kConfigIndexNoEntry;
+		if (lastOfType[type] != kConfigIndexNoEntry)
+			index->entries[lastOfType[type]].nextOfType = i;
+		else if (type == kUSBInterfaceDesc)
+			index->firstInterface = i;
+		lastOfType[type] = i;
+	}
+	
+	return index;
+}
+
+
+
+static void
+FreeConfigIndex(IOUSBConfigIndex *index)
+{
+	IOFree(index, sizeof(IOUSBConfigIndex) + (index->count - 1) * sizeof(IOUSBConfigIndexEntry));
+}
+
+
+
+// Returns the entry for the descriptor starting at offset, or kConfigIndexNoEntry if no descriptor starts there
+//
+static UInt32
+ConfigIndexLookup(IOUSBConfigIndex *index, UInt32 offset)
+{
+	UInt32		low = 0;
+	UInt32		high = index->count;
+	
+	while (low < high)
+	{
+		UInt32	mid = (low + high) / 2;
+		
+		if (index->entries[mid].offset == offset)
+			return mid;
+		if (index->entries[mid].offset < offset)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return kConfigIndexNoEntry;
+}
+
+
+
+IOUSBConfigIndex *
+IOUSBDevice::GetConfigIndex(const IOUSBConfigurationDescriptor *configDesc)
+{
+	int		i;
+	
+	if (!_configList || !_expansionData || !_CONFIGINDEXLIST)
+		return NULL;
+	
+	for (i = 0; i < _descriptor.bNumConfigurations; i++)
+	{
+		if (_configList[i] && (_configList[i]->getBytesNoCopy() == configDesc))
+			return _CONFIGINDEXLIST[i];
+	}
+	return NULL;
+}
+
+
+
 const IOUSBDescriptorHeader*
 IOUSBDevice::FindNextDescriptor(const void *cur, UInt8 descType)
 {
@@ -1543,6 +1764,35 @@ IOUSBDevice::FindNextDescriptor(const void *cur, UInt8 descType)
 		hdr = (IOUSBDescriptorHeader *)cur;
     }
 	
+	// If hdr is the start of a descriptor we indexed, go straight to the next one we want
+	if (_CONFIGINDEXLIST && _CONFIGINDEXLIST[configIndex])
+	{
+		IOUSBConfigIndex *	index = _CONFIGINDEXLIST[configIndex];
+		const UInt8 *		base = (const UInt8 *)curConfDesc;
+		UInt32				entry = ConfigIndexLookup(index, (uintptr_t)hdr - (uintptr_t)curConfDesc);
+		
+		if (entry != kConfigIndexNoEntry)
+		{
+			if ((descType != 0) && (hdr->bDescriptorType == descType))
+			{
+				entry = index->entries[entry].nextOfType;
+			}
+			else
+			{
+				for (entry++; entry < index->count; entry++)
+				{
+					if ((descType == 0) || (base[index->entries[entry].offset + 1] == descType))
+						break;
+				}
+			}
+			
+			if ((entry == kConfigIndexNoEntry) || (entry >= index->count))
+				return NULL;
+			
+			return (IOUSBDescriptorHeader *)(base + index->entries[entry].offset);
+		}
+	}
+	
     do 
     {
 		IOUSBDescriptorHeader 		*lasthdr = hdr;
@@ -1597,8 +1847,44 @@ IOUSBDevice::FindNextInterfaceDescriptor(const IOUSBConfigurationDescriptor *con
     {
 		if (((void*)intfDesc < (void*)configDesc) || (intfDesc->bDescriptorType != kUSBInterfaceDesc))
 			return kIOReturnBadArgument;
-		interface = (IOUSBInterfaceDescriptor *)NextDescriptor(intfDesc);
     }
+	
+	// If this is one of our cached configurations, only look at its interface descriptors
+	IOUSBConfigIndex *	index = GetConfigIndex(configDesc);
+	UInt32				entry = kConfigIndexNoEntry;
+	
+	if (index)
+	{
+		if (intfDesc == NULL)
+			entry = index->firstInterface;
+		else if ((entry = ConfigIndexLookup(index, (uintptr_t)intfDesc - (uintptr_t)configDesc)) != kConfigIndexNoEntry)
+			entry = index->entries[entry].nextOfType;
+		else
+			index = NULL;						// not on a descriptor boundary, so walk it the old way
+	}
+	
+	if (index)
+	{
+		for ( ; entry != kConfigIndexNoEntry; entry = index->entries[entry].nextOfType)
+		{
+			interface = (IOUSBInterfaceDescriptor *)(((UInt8*)configDesc) + index->entries[entry].offset);
+			if (interface >= end)
+				break;
+			
+			if (((request->bInterfaceClass == kIOUSBFindInterfaceDontCare) || (request->bInterfaceClass == interface->bInterfaceClass)) &&
+				((request->bInterfaceSubClass == kIOUSBFindInterfaceDontCare)  || (request->bInterfaceSubClass == interface->bInterfaceSubClass)) &&
+				((request->bInterfaceProtocol == kIOUSBFindInterfaceDontCare)  || (request->bInterfaceProtocol == interface->bInterfaceProtocol)) &&
+				((request->bAlternateSetting == kIOUSBFindInterfaceDontCare)   || (request->bAlternateSetting == interface->bAlternateSetting)))
+			{
+				*descOut = interface;
+				return kIOReturnSuccess;
+			}
+		}
+		return kIOUSBInterfaceNotFound;
+	}
+	
+    if (intfDesc != NULL)
+		interface = (IOUSBInterfaceDescriptor *)NextDescriptor(intfDesc);
     else
 		interface = (IOUSBInterfaceDescriptor *)NextDescriptor(configDesc);
 	
@@ -1916,6 +2202,10 @@ IOUSBDevice::GetFullConfigurationDescriptor(UInt8 index)
 		}
 	}
     configDescriptor = (IOUSBConfigurationDescriptor *)_configList[index]->getBytesNoCopy();
+	
+	// Index it now, while we still hold the lock, so FindNextDescriptor never has to walk it
+	if (_CONFIGINDEXLIST && !_CONFIGINDEXLIST[index])
+		_CONFIGINDEXLIST[index] = BuildConfigIndex(configDescriptor, _configList[index]->getLength());
 
 Exit:
 	ReleaseGetConfigLock();
@@ -2627,106 +2917,56 @@ IOUSBDevice::matchPropertyTable(OSDictionary * table, SInt32 *score)
         return false;
     }
 	
-    bool	vendorPropertyExists = table->getObject(gUSBVendorID) ? true : false ;
-    bool	productPropertyExists = table->getObject(gUSBProductID) ? true : false ;
-    bool	deviceReleasePropertyExists = table->getObject(gUSBDeviceReleaseNumber) ? true : false ;
-    bool	deviceClassPropertyExists = table->getObject(gUSBDeviceClass) ? true : false ;
-    bool	deviceSubClassPropertyExists = table->getObject(gUSBDeviceSubClass) ? true : false ;
-    bool	deviceProtocolPropertyExists= table->getObject(gUSBDeviceProtocol) ? true : false ;
-    bool        productIDMaskExists = table->getObject(gUSBProductIDMask) ? true : false;
-	bool	productIDArrayExists = OSDynamicCast(OSArray, table->getObject(kUSBProductIdsArrayName)) ? true : false;
-	
-    // USBComparePropery() will return false if the property does NOT exist, or if it exists and it doesn't match
-
-//    uint64_t	 timeStart = mach_absolute_time();
-
-    //
-    bool	vendorPropertyMatches = USBCompareProperty(table, gUSBVendorID);
-    bool	productPropertyMatches = USBCompareProperty(table, gUSBProductID);
-    bool	deviceReleasePropertyMatches = USBCompareProperty(table, gUSBDeviceReleaseNumber);
-    bool	deviceClassPropertyMatches = USBCompareProperty(table, gUSBDeviceClass);
-    bool	deviceSubClassPropertyMatches = USBCompareProperty(table, gUSBDeviceSubClass);
-    bool	deviceProtocolPropertyMatches= USBCompareProperty(table, gUSBDeviceProtocol);
-	
-//    uint64_t	 timeStop = mach_absolute_time();
-	
-	// If there is an productIDArray, then see if any of the entries matches to our productID
-	// USBLog(4, "%s[%p]::matchPropertyTable  USBCompareProperty took %qd", getName(), this, timeStop-timeStart);
+	uint64_t	timeStart = mach_absolute_time();
+	UInt32		presentKeys;
+	UInt32		matchedKeys;
+	UInt32		wildCardKeys;
+    bool		vendorPropertyExists, productPropertyExists, deviceReleasePropertyExists;
+    bool		deviceClassPropertyExists, deviceSubClassPropertyExists, deviceProtocolPropertyExists;
+    bool		vendorPropertyMatches, productPropertyMatches, deviceReleasePropertyMatches;
+    bool		deviceClassPropertyMatches, deviceSubClassPropertyMatches, deviceProtocolPropertyMatches;
+	bool		productIDArrayExists;
+	
+	// Which keys the dictionary has, which of them match our own properties, and which were the wild card "*".  The
+	// productID can also match through the kUSBProductIdsArrayName array or the kUSBProductIDMask.
+	//
+	CompareMatchKeys(table, kUSBDeviceMatchKeys, &presentKeys, &productIDArrayExists, &matchedKeys, &wildCardKeys, &productIDInArray, &usedMaskForProductID);
+	
+    vendorPropertyExists = (presentKeys & (1 << kUSBMatchVendorID)) ? true : false ;
+    productPropertyExists = (presentKeys & (1 << kUSBMatchProductID)) ? true : false ;
+    deviceReleasePropertyExists = (presentKeys & (1 << kUSBMatchDeviceReleaseNumber)) ? true : false ;
+    deviceClassPropertyExists = (presentKeys & (1 << kUSBMatchDeviceClass)) ? true : false ;
+    deviceSubClassPropertyExists = (presentKeys & (1 << kUSBMatchDeviceSubClass)) ? true : false ;
+    deviceProtocolPropertyExists = (presentKeys & (1 << kUSBMatchDeviceProtocol)) ? true : false ;
+	
+    vendorPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchVendorID)) ? true : false;
+    productPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchProductID)) ? true : false;
+    deviceReleasePropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchDeviceReleaseNumber)) ? true : false;
+    deviceClassPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchDeviceClass)) ? true : false;
+    deviceSubClassPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchDeviceSubClass)) ? true : false;
+    deviceProtocolPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchDeviceProtocol)) ? true : false;
 	
 	if ( productIDArrayExists )
 	{
-		productPropertyMatches = USBComparePropertyInArray( table, kUSBProductIdsArrayName, kUSBProductID, &productIDInArray);
         USBLog(7, "%s[%p]::matchPropertyTable  productIDArrayExists was true, matches = %s", getName(), this, productPropertyMatches?"true":"false");
 	}
 	
-    // Now, let's look and see whether any of the properties were OSString's AND their value was "*".  This indicates that
-    // we should match to all the values for that category -- i.e. a wild card match
-    //
-    if ( !vendorPropertyMatches )               
-    { 
-		vendorPropertyMatches = IsWildCardMatch(table, kUSBVendorID); 
-		if ( vendorPropertyMatches ) 
-			vendorIsWildCard++; 
-    }
-    
-    if ( !productPropertyMatches )              
-    { 
-		productPropertyMatches = IsWildCardMatch(table, kUSBProductID); 
-		if ( productPropertyMatches ) 
-			productIsWildCard++; 
-    }
-	
-    if ( !deviceReleasePropertyMatches )              
-    { 
-		deviceReleasePropertyMatches = IsWildCardMatch(table, kUSBDeviceReleaseNumber); 
-		if ( deviceReleasePropertyMatches ) 
-			deviceReleaseIsWildCard++; 
-    }
-	
-    if ( !deviceClassPropertyMatches )              
-    { 
-		deviceClassPropertyMatches = IsWildCardMatch(table, kUSBDeviceClass); 
-		if ( deviceClassPropertyMatches ) 
-			classIsWildCard++; 
-    }
-	
-    if ( !deviceSubClassPropertyMatches )            
-    { 
-		deviceSubClassPropertyMatches = IsWildCardMatch(table, kUSBDeviceSubClass); 
-		if ( deviceSubClassPropertyMatches ) 
-			subClassIsWildCard++; 
-    }
-	
-    if ( !deviceProtocolPropertyMatches )          
-    { 
-		deviceProtocolPropertyMatches = IsWildCardMatch(table, kUSBDeviceProtocol); 
-		if ( deviceProtocolPropertyMatches ) 
-			protocolIsWildCard++; 
-    }
-	
-    // If the productID didn't match, then see if there is a kProductIDMask property.  If there is, mask this device's prodID and the dictionary's prodID with it and see
-    // if they are equal and if so, then we say we productID matches.
-    //
-    if ( productIDMaskExists && !productPropertyMatches )
-    {
-		if ( !productIDArrayExists )
-		{
-			productPropertyMatches = USBComparePropertyWithMask( table, kUSBProductID, kUSBProductIDMask);
-			usedMaskForProductID = productPropertyMatches;
-		}
-		else 
-		{
-			productPropertyMatches = USBComparePropertyInArrayWithMask( table, kUSBProductIdsArrayName, kUSBProductID, kUSBProductIDMask, &productIDInArray);
-			usedMaskForProductID = productPropertyMatches;
-		}
-    }
+	vendorIsWildCard = (wildCardKeys & (1 << kUSBMatchVendorID)) ? 1 : 0;
+	productIsWildCard = (wildCardKeys & (1 << kUSBMatchProductID)) ? 1 : 0;
+	deviceReleaseIsWildCard = (wildCardKeys & (1 << kUSBMatchDeviceReleaseNumber)) ? 1 : 0;
+	classIsWildCard = (wildCardKeys & (1 << kUSBMatchDeviceClass)) ? 1 : 0;
+	subClassIsWildCard = (wildCardKeys & (1 << kUSBMatchDeviceSubClass)) ? 1 : 0;
+	protocolIsWildCard = (wildCardKeys & (1 << kUSBMatchDeviceProtocol)) ? 1 : 0;
     
     // If the service object wishes to compare some of its properties in its
     // property table against the supplied matching dictionary,
     // it should do so in this method and return truth on success.
     //
     if (!super::matchPropertyTable(table))  
+	{
+		AddMatchingTime(timeStart, &_MATCHINGSTATISTICS);
         return false;
+	}
 	
     // If the property score is > 10000, then clamp it to 9000.  We will then add this score
     // to the matching criteria score.  This will allow drivers
@@ -2909,6 +3149,8 @@ IOUSBDevice::matchPropertyTable(OSDictionary * table, SInt32 *score)
     }
     if (deviceClassProp)
 		deviceClassProp->release();
+	
+	AddMatchingTime(timeStart, &_MATCHINGSTATISTICS);
 		
     return returnValue;
 }
@@ -2978,6 +3220,7 @@ IOUSBDevice::_DeviceRequest(OSObject *target, void *arg0, void *arg1, __unused v
             if ( theRequest == kSetConfiguration)
             {
                 me->_currentConfigValue = wValue;
+                me->FlushStringCache();
             }
         }
  		if ( err == kIOUSBTransactionTimeout )
@@ -3057,6 +3300,7 @@ IOUSBDevice::_DeviceRequestDesc(OSObject *target, void *arg0, void *arg1, __unus
             {
  				USBLog(3, "%s[%p]:_DeviceRequestDesc kSetConfiguration to %d", me->getName(), me, wValue);
                 me->_currentConfigValue = wValue;
+                me->FlushStringCache();
 			}
         }
 		
@@ -3225,6 +3469,11 @@ IOUSBDevice::GetStringDescriptor(UInt8 index, char *utf8Buffer, int utf8BufferSi
     //
     bzero(utf8Buffer, utf8BufferSize);
     
+    // Strings only change across a reset or a SET_CONFIG, so if we have read this one before we are done
+    //
+    if ( CopyCachedString(index, lang, utf8Buffer, utf8BufferSize) )
+        return kIOReturnSuccess;
+    
     // First get actual length (lame devices don't like being asked for too much data)
     //
     request.bmRequestType = USBmakebmRequestType(kUSBIn, kUSBStandard, kUSBDevice);
@@ -3283,6 +3532,7 @@ IOUSBDevice::GetStringDescriptor(UInt8 index, char *utf8Buffer, int utf8BufferSi
     if (len == 0)
     {
         USBLog(5, "%s[%p]::GetStringDescriptor (%d)  Length was zero", getName(), this, index);
+        CacheString(index, lang, "", 0);
         return kIOReturnSuccess;
     }
     
@@ -3339,13 +3589,15 @@ IOUSBDevice::GetStringDescriptor(UInt8 index, char *utf8Buffer, int utf8BufferSi
     USBLog(5, "%s[%p]::GetStringDescriptor Got string descriptor %d, length %d, got %d", getName(), this,
            index, desc[0], request.wLength);
 	
-    // The string descriptor is in "Unicode".  We need to convert it to UTF-8.
+    // The string descriptor is in "Unicode".  We need to convert it to UTF-8.  We convert all of it, so that
+    // the cached copy is complete, and then give the caller as much as fits in their buffer.
     //
     SInt32              length = 0;
     UInt32              byteCounter = 0;
     SInt32              stringLength = desc[0] - 2;  // makes it neater
     UInt8 		utf8Bytes[4];
-    char *		temp = utf8Buffer;
+    char		utf8String[kMaxStringUTF8Length + 1];
+    char *		temp = utf8String;
     UInt16		*uniCodeBytes = (UInt16	*)desc + 1;	// Just the Unicode words (i.e., no size byte or descriptor type byte)
     
     // Endian swap the Unicode bytes
@@ -3365,7 +3617,7 @@ IOUSBDevice::GetStringDescriptor(UInt8 index, char *utf8Buffer, int utf8BufferSi
         //  Check to see if we have room in our buffer (leave room for NULL at the end)
         //
         length += byteCounter;			 
-        if ( length > (utf8BufferSize - 1) )
+        if ( length > kMaxStringUTF8Length )
             break;
         
         // Place the resulting byte(s) into our buffer and increment the buffer position
@@ -3373,12 +3625,295 @@ IOUSBDevice::GetStringDescriptor(UInt8 index, char *utf8Buffer, int utf8BufferSi
         bcopy (utf8Bytes, temp, byteCounter);					// place resulting byte[s] in new buffer
         temp += byteCounter;							// inc buffer
     }
+    *temp = 0;
+    
+    CacheString(index, lang, utf8String, temp - utf8String);
+    
+    // Only hand back whole characters - if the last one does not fit, leave it out
+    //
+    length = temp - utf8String;
+    if ( length > (utf8BufferSize - 1) )
+    {
+        length = utf8BufferSize - 1;
+        while ( (length > 0) && ((utf8String[length] & 0xC0) == 0x80) )
+            length--;
+    }
+    bcopy (utf8String, utf8Buffer, length);
     
     return kIOReturnSuccess;
 }
 
 
 
+//================================================================================================
+//
+//   CopyCachedString
+//
+//   Copies string index in language lang from the cache into utf8Buffer (already zeroed by the
+//   caller), truncated to whole characters the same way GetStringDescriptor does.  Returns false
+//   if we have not read that string yet.
+//
+//================================================================================================
+//
+bool
+IOUSBDevice::CopyCachedString(UInt8 index, UInt16 lang, char *utf8Buffer, int utf8BufferSize)
+{
+	IOUSBStringCacheEntry *		entry;
+	UInt32						length = 0;
+	UInt32						hits, misses;
+	bool						found = false;
+	bool						publishLater = false;
+	uint64_t					deadline;
+	
+	if ( !_expansionData || !_STRINGCACHELOCK )
+		return false;
+	
+	IOLockLock(_STRINGCACHELOCK);
+	for ( entry = _STRINGCACHE; entry; entry = entry->next )
+	{
+		if ( (entry->index == index) && (entry->lang == lang) )
+		{
+			length = entry->length;
+			if ( length > (UInt32)(utf8BufferSize - 1) )
+			{
+				length = utf8BufferSize - 1;
+				while ( (length > 0) && ((entry->utf8[length] & 0xC0) == 0x80) )
+					length--;
+			}
+			bcopy(entry->utf8, utf8Buffer, length);
+			found = true;
+			break;
+		}
+	}
+	if ( found )
+	{
+		_STRINGCACHEHITS++;
+		if ( _STRINGCACHESTATSTHREAD && !_STRINGCACHESTATSPENDING )
+		{
+			_STRINGCACHESTATSPENDING = true;
+			publishLater = true;
+		}
+	}
+	else
+		_STRINGCACHEMISSES++;
+	hits = _STRINGCACHEHITS;
+	misses = _STRINGCACHEMISSES;
+	IOLockUnlock(_STRINGCACHELOCK);
+	
+	USBLog(6, "%s[%p]::CopyCachedString(%d, 0x%x) - %s (%d hits, %d misses)", getName(), this, index, lang, found ? "hit" : "miss", (uint32_t)hits, (uint32_t)misses);
+	
+	// A miss is about to cost a bus round trip, so publishing then is free by comparison.  A hit is the path the cache
+	// is there to make cheap, so the first one in a while schedules PublishStringCacheStatisticsEntry, which picks up
+	// every hit up to when it runs
+	if ( !found )
+	{
+		setProperty("StringCacheHits", hits, 32);
+		setProperty("StringCacheMisses", misses, 32);
+	}
+	else if ( publishLater )
+	{
+		clock_interval_to_deadline(kStringCacheStatsDelayMS, kMillisecondScale, &deadline);
+		retain();
+		if ( thread_call_enter_delayed(_STRINGCACHESTATSTHREAD, deadline) == TRUE )
+			release();
+	}
+	
+	return found;
+}
+
+
+
+//================================================================================================
+//
+//   PublishStringCacheStatisticsEntry
+//
+//   Scheduled by CopyCachedString on a hit, and holds a reference on the device until it runs.
+//
+//================================================================================================
+//
+void
+IOUSBDevice::PublishStringCacheStatisticsEntry(OSObject *target, thread_call_param_t unused)
+{
+#pragma unused (unused)
+	IOUSBDevice *	me = OSDynamicCast(IOUSBDevice, target);
+	UInt32			hits, misses;
+	
+	if (!me)
+		return;
+	
+	if ( me->_expansionData && me->_STRINGCACHELOCK )
+	{
+		IOLockLock(me->_STRINGCACHELOCK);
+		me->_STRINGCACHESTATSPENDING = false;
+		hits = me->_STRINGCACHEHITS;
+		misses = me->_STRINGCACHEMISSES;
+		IOLockUnlock(me->_STRINGCACHELOCK);
+		
+		me->setProperty("StringCacheHits", hits, 32);
+		me->setProperty("StringCacheMisses", misses, 32);
+	}
+	
+	me->release();
+}
+
+
+
+//================================================================================================
+//
+//   CacheString
+//
+//   Remembers a string we have just read from the device.  If two threads read the same string
+//   at once the second copy is dropped.  Failing to allocate an entry only costs us a later
+//   bus round trip.
+//
+//================================================================================================
+//
+void
+IOUSBDevice::CacheString(UInt8 index, UInt16 lang, const char *utf8String, UInt32 length)
+{
+	IOUSBStringCacheEntry *		entry;
+	IOUSBStringCacheEntry *		newEntry;
+	
+	if ( !_expansionData || !_STRINGCACHELOCK )
+		return;
+	
+	newEntry = (IOUSBStringCacheEntry *)IOMalloc(sizeof(IOUSBStringCacheEntry) + length);
+	if ( !newEntry )
+		return;
+	
+	newEntry->index = index;
+	newEntry->lang = lang;
+	newEntry->length = length;
+	bcopy(utf8String, newEntry->utf8, length);
+	newEntry->utf8[length] = 0;
+	
+	IOLockLock(_STRINGCACHELOCK);
+	for ( entry = _STRINGCACHE; entry; entry = entry->next )
+	{
+		if ( (entry->index == index) && (entry->lang == lang) )
+			break;
+	}
+	if ( !entry )
+	{
+		newEntry->next = _STRINGCACHE;
+		_STRINGCACHE = newEntry;
+		newEntry = NULL;
+	}
+	IOLockUnlock(_STRINGCACHELOCK);
+	
+	if ( newEntry )
+		IOFree(newEntry, sizeof(IOUSBStringCacheEntry) + length);
+}
+
+
+
+//================================================================================================
+//
+//   FlushStringCache
+//
+//   Called when the device is reset or reconfigured, since it may then report different strings.
+//
+//================================================================================================
+//
+void
+IOUSBDevice::FlushStringCache(void)
+{
+	IOUSBStringCacheEntry *		entry;
+	
+	if ( !_expansionData || !_STRINGCACHELOCK )
+		return;
+	
+	IOLockLock(_STRINGCACHELOCK);
+	entry = _STRINGCACHE;
+	_STRINGCACHE = NULL;
+	IOLockUnlock(_STRINGCACHELOCK);
+	
+	while ( entry )
+	{
+		IOUSBStringCacheEntry *	next = entry->next;
+		
+		IOFree(entry, sizeof(IOUSBStringCacheEntry) + entry->length);
+		entry = next;
+	}
+}
+
+
+
+static void
+WantString(UInt32 *wanted, UInt8 index)
+{
+	if ( index != 0 )
+		wanted[index / 32] |= (1U << (index % 32));
+}
+
+
+
+//================================================================================================
+//
+//   PrefetchStringDescriptors
+//
+//   Called from start() when kUSBPrefetchStringsKey is set.  Reads, in the default language,
+//   every string named by the device descriptor and by each configuration, interface and
+//   interface association descriptor, so that later lookups never have to go to the bus.
+//
+//================================================================================================
+//
+void
+IOUSBDevice::PrefetchStringDescriptors(void)
+{
+	UInt32									wanted[256 / 32];
+	char									name[256];
+	const IOUSBConfigurationDescriptor *	cd;
+	const UInt8 *							desc;
+	const UInt8 *							end;
+	UInt8									stringIndex;
+	int										i;
+	
+	bzero(wanted, sizeof(wanted));
+	
+	WantString(wanted, _descriptor.iManufacturer);
+	WantString(wanted, _descriptor.iProduct);
+	WantString(wanted, _descriptor.iSerialNumber);
+	
+	for ( i = 0; i < _descriptor.bNumConfigurations; i++ )
+	{
+		cd = GetFullConfigurationDescriptor(i);
+		if ( !cd )
+			continue;
+		
+		WantString(wanted, cd->iConfiguration);
+		
+		desc = (const UInt8 *)cd + cd->bLength;
+		end = (const UInt8 *)cd + USBToHostWord(cd->wTotalLength);
+		while ( (desc + 2 <= end) && (desc[0] != 0) && (desc + desc[0] <= end) )
+		{
+			if ( (desc[1] == kUSBInterfaceDesc) && (desc[0] >= sizeof(IOUSBInterfaceDescriptor)) )
+			{
+				WantString(wanted, ((const IOUSBInterfaceDescriptor *)desc)->iInterface);
+			}
+			else if ( (desc[1] == kUSBInterfaceAssociationDesc) && (desc[0] >= sizeof(IOUSBInterfaceAssociationDescriptor)) )
+			{
+				WantString(wanted, ((const IOUSBInterfaceAssociationDescriptor *)desc)->iFunction);
+			}
+			desc += desc[0];
+		}
+	}
+	
+	for ( i = 1; i < 256; i++ )
+	{
+		if ( !(wanted[i / 32] & (1U << (i % 32))) )
+			continue;
+		
+		stringIndex = i;
+		if ( GetStringDescriptor(stringIndex, name, sizeof(name)) != kIOReturnSuccess )
+		{
+			USBLog(5, "%s[%p]::PrefetchStringDescriptors - could not read string %d", getName(), this, stringIndex);
+		}
+	}
+}
+
+
+
 void
 IOUSBDevice::DisplayNotEnoughPowerNotice()
 {
@@ -3912,6 +4447,7 @@ IOUSBDevice::_DeviceRequestWithTimeout(OSObject *target, void *arg0, void *arg1,
             {
 				USBLog(6, "%s[%p]:_DeviceRequestWithTimeout kSetConfiguration to %d", me->getName(), me, wValue);
                 me->_currentConfigValue = wValue;
+                me->FlushStringCache();
 			}
         }
         return err;
@@ -3989,6 +4525,7 @@ IOUSBDevice::_DeviceRequestDescWithTimeout(OSObject *target, void *arg0, void *a
             {
 				USBLog(6, "%s[%p]:_DeviceRequestDescWithTimeout kSetConfiguration to %d", me->getName(), me, wValue);
                 me->_currentConfigValue = wValue;
+                me->FlushStringCache();
             }
         }
         return err;
@@ -32,6 +32,7 @@
 #include <libkern/c++/OSDictionary.h>
 #include <libkern/c++/OSData.h>
 #include <libkern/version.h>
+#include <mach/mach_time.h>
 
 #include <IOKit/usb/IOUSBDevice.h>
 #include <IOKit/usb/IOUSBController.h>
@@ -65,6 +66,13 @@ extern KernelDebugLevel	    gKernelDebugLevel;
 #define _NEED_TO_CLOSE	_expansionData->_needToClose
 #define _OPEN_CLIENTS	_expansionData->_openClients
 #define _REMEBEREDSTREAMS	_expansionData->_RememberedStreams
+#define _MATCHINGSTATISTICS	_expansionData->_matchingStatistics
+#define _PIPEINDEXBYADDRESS			_expansionData->_pipeIndexByAddress
+#define _PIPESBYTYPEANDDIRECTION	_expansionData->_pipesByTypeAndDirection
+
+// Where an endpoint goes in _pipeIndexByAddress - the endpoint number, plus 16 for IN endpoints
+#define PipeIndexAddress(ENDPOINT)		(((ENDPOINT)->number & kUSBPipeIDMask) | (((ENDPOINT)->direction == kUSBIn) ? 0x10 : 0))
+#define PipeIndexTypeAndDirection(TYPE, DIRECTION)		((((TYPE) & 0x03) << 2) | ((DIRECTION) & 0x03))
 
 /* Convert USBLog to use kprintf debugging */
 #define IOUSBINTERFACE_USE_KPRINTF 0
@@ -715,6 +723,7 @@ IOUSBInterface::free()
     //
     if (_expansionData)
     {
+		FreeMatchingStatistics(&_MATCHINGSTATISTICS);
         IOFree(_expansionData, sizeof(ExpansionData));
         _expansionData = NULL;
     }
@@ -1163,6 +1172,9 @@ IOUSBInterface::ClosePipesGated(bool close)
         }
     }
 	
+	if (close)
+		RebuildPipeIndex();
+	
 	USBLog(7,"-%s[%p]::ClosePipesGated", getName(), this);
 	
 	return ret;
@@ -1209,6 +1221,8 @@ IOUSBInterface::ReopenPipesGated()
         }
     }
 	
+	RebuildPipeIndex();
+	
 	USBLog(7,"-%s[%p]::ReopenPipesGated", getName(), this);
 	
 	return ret;
@@ -1319,10 +1333,51 @@ IOUSBInterface::CreatePipes(void)
         // This is true for some devices that incorrectly specify an interrupt pipe with a polling interval of 0ms along with their other pipes
     }
     
+	RebuildPipeIndex();
+	
     return res;
 }
 
 
+
+// FindNextPipeGated does not walk _pipeList.  It finds the current pipe from its endpoint address, and the next candidate from
+// a bitmask of the _pipeList entries for each transfer type and direction.  This has to be called whenever _pipeList changes.
+//
+void
+IOUSBInterface::RebuildPipeIndex(void)
+{
+	const IOUSBController::Endpoint *	endpoint;
+	IOUSBPipe *							pipe;
+	UInt8								indexByAddress[kUSBMaxPipes];
+	UInt32								byTypeAndDirection[kUSBPipeIndexTypeDirectionCount];
+	
+	if (!_expansionData)
+		return;
+	
+	bzero(indexByAddress, sizeof(indexByAddress));
+	bzero(byTypeAndDirection, sizeof(byTypeAndDirection));
+	
+	for ( unsigned int i = 0; i < kUSBMaxPipes; i++ )
+	{
+		pipe = OSDynamicCast(IOUSBPipe, _pipeList[i]);
+		if ( !pipe )
+			continue;
+		
+		endpoint = pipe->GetEndpoint();
+		
+		// A badly formed interface can have two endpoints with the same address - we keep the first, as the walk would have found it first
+		if ( indexByAddress[PipeIndexAddress(endpoint)] == 0 )
+			indexByAddress[PipeIndexAddress(endpoint)] = i + 1;
+		
+		byTypeAndDirection[PipeIndexTypeAndDirection(endpoint->transferType, endpoint->direction)] |= (1U << i);
+	}
+	
+	// Build the tables on the stack and copy them in, so a lookup never sees them half empty
+	bcopy(indexByAddress, _PIPEINDEXBYADDRESS, sizeof(indexByAddress));
+	bcopy(byTypeAndDirection, _PIPESBYTYPEANDDIRECTION, sizeof(byTypeAndDirection));
+}
+
+
 const IOUSBInterfaceDescriptor *
 IOUSBInterface::FindNextAltInterface(const IOUSBInterfaceDescriptor *current,
                                     IOUSBFindInterfaceRequest *request)
@@ -1424,23 +1479,28 @@ IOUSBInterface::FindNextPipeGated(IOUSBPipe *current,
 {
 	const IOUSBController::Endpoint *	endpoint;
 	IOUSBPipe *							pipe = NULL;
+	UInt32								candidates = 0;
+	UInt32								type;
+	UInt32								direction;
 	int									numEndpoints;
 	int									i;
 	
 	numEndpoints = _bNumEndpoints;
 	
-	if (request == 0)
+	if (request == 0 || _expansionData == NULL)
 		return NULL;
 	
 	if (current != 0)
 	{
-		for(i=0; (i < numEndpoints) && (i < kUSBMaxPipes) ; i++)
+		// Go straight to the current pipe from its endpoint address, and start looking at the entry after it
+		endpoint = current->GetEndpoint();
+		i = _PIPEINDEXBYADDRESS[PipeIndexAddress(endpoint)];
+		if ( (i == 0) || (_pipeList[i - 1] != current) )
 		{
-			if (_pipeList[i] == current)
-			{
-				i++; // Skip the one we just did
-				break;
-			}
+			// Either not one of ours, or a second endpoint with the same address
+			for (i = 0; (i < kUSBMaxPipes) && (_pipeList[i] != current); i++)
+				;
+			i++;
 		}
 	}
 	else
@@ -1448,28 +1508,33 @@ IOUSBInterface::FindNextPipeGated(IOUSBPipe *current,
 		i = 0;	// Start at beginning.
 	}
 	
-	for ( ; (i < numEndpoints) && (i < kUSBMaxPipes) ; i++) 
+	// Collect every pipe with the right type and direction, then drop the ones before i and past the end of the interface
+	for (type = kUSBControl; type <= kUSBInterrupt; type++)
 	{
-		pipe = OSDynamicCast(IOUSBPipe,_pipeList[i]);
-		USBLog(6,"%s[%p]::FindNextPipeGated created pipe %p", getName(), this, pipe);
-		if (!pipe)
+		if (request->type != kUSBAnyType && request->type != type)
 			continue;
 		
-		endpoint = pipe->GetEndpoint();
-		
-		// check the request parameters
-		if (request->type != kUSBAnyType && request->type != endpoint->transferType)
-		{
-			pipe = NULL;								// this is not it
-		}
-		else if (request->direction != kUSBAnyDirn && request->direction != endpoint->direction)
+		for (direction = kUSBOut; direction <= kUSBAnyDirn; direction++)
 		{
-			pipe = NULL;								// this is not it
+			if (request->direction == kUSBAnyDirn || request->direction == direction)
+				candidates |= _PIPESBYTYPEANDDIRECTION[PipeIndexTypeAndDirection(type, direction)];
 		}
+	}
+	
+	if (numEndpoints < kUSBMaxPipes)
+		candidates &= (1U << numEndpoints) - 1;
+	
+	for ( ; (i < kUSBMaxPipes) && (candidates >> i) ; i++) 
+	{
+		if (!(candidates & (1U << i)))
+			continue;
 		
-		if (pipe == NULL)
+		pipe = OSDynamicCast(IOUSBPipe,_pipeList[i]);
+		USBLog(6,"%s[%p]::FindNextPipeGated created pipe %p", getName(), this, pipe);
+		if (!pipe)
 			continue;
 		
+		endpoint = pipe->GetEndpoint();
 		request->type = endpoint->transferType;
 		request->direction = endpoint->direction;
 		request->maxPacketSize = endpoint->maxPacketSize;
@@ -1657,120 +1722,62 @@ IOUSBInterface::matchPropertyTable(OSDictionary * table, SInt32 *score)
         return false;
     }
 	
-    bool	vendorPropertyExists = table->getObject(gUSBVendorID) ? true : false ;
-    bool	productPropertyExists = table->getObject(gUSBProductID) ? true : false ;
-    bool	interfaceNumberPropertyExists = table->getObject(gUSBInterfaceNumber) ? true : false ;
-    bool	configurationValuePropertyExists = table->getObject(gUSBConfigurationValue) ? true : false ;
-    bool	deviceReleasePropertyExists = table->getObject(gUSBDeviceReleaseNumber) ? true : false ;
-    bool	interfaceClassPropertyExists = table->getObject(gUSBInterfaceClass) ? true : false ;
-    bool	interfaceSubClassPropertyExists = table->getObject(gUSBInterfaceSubClass) ? true : false ;
-    bool	interfaceProtocolPropertyExists= table->getObject(gUSBInterfaceProtocol) ? true : false ;
-    bool    productIDMaskExists = table->getObject(gUSBProductIDMask) ? true : false;
-	bool	productIDArrayExists = OSDynamicCast(OSArray, table->getObject(kUSBProductIdsArrayName)) ? true : false;
-	
-    // USBComparePropery() will return false if the property does NOT exist, or if it exists and it doesn't match
-    //
-    bool	vendorPropertyMatches = USBCompareProperty(table, gUSBVendorID);
-    bool	productPropertyMatches = USBCompareProperty(table, gUSBProductID);
-    bool	interfaceNumberPropertyMatches = USBCompareProperty(table, gUSBInterfaceNumber);
-    bool	configurationValuePropertyMatches = USBCompareProperty(table, gUSBConfigurationValue);
-    bool	deviceReleasePropertyMatches = USBCompareProperty(table, gUSBDeviceReleaseNumber);
-    bool	interfaceClassPropertyMatches = USBCompareProperty(table, gUSBInterfaceClass);
-    bool	interfaceSubClassPropertyMatches = USBCompareProperty(table, gUSBInterfaceSubClass);
-    bool	interfaceProtocolPropertyMatches= USBCompareProperty(table, gUSBInterfaceProtocol);
-    
-	// If there is an productIDArray, then see if any of the entries matches to our productID
+	uint64_t	timeStart = mach_absolute_time();
+	UInt32		presentKeys;
+	UInt32		matchedKeys;
+	UInt32		wildCardKeys;
+    bool		vendorPropertyExists, productPropertyExists, interfaceNumberPropertyExists, configurationValuePropertyExists;
+    bool		deviceReleasePropertyExists, interfaceClassPropertyExists, interfaceSubClassPropertyExists, interfaceProtocolPropertyExists;
+    bool		vendorPropertyMatches, productPropertyMatches, interfaceNumberPropertyMatches, configurationValuePropertyMatches;
+    bool		deviceReleasePropertyMatches, interfaceClassPropertyMatches, interfaceSubClassPropertyMatches, interfaceProtocolPropertyMatches;
+	bool		productIDArrayExists;
+	
+	// Which keys the dictionary has, which of them match our own properties, and which were the wild card "*".  The
+	// productID can also match through the kUSBProductIdsArrayName array or the kUSBProductIDMask.
+	//
+	CompareMatchKeys(table, kUSBInterfaceMatchKeys, &presentKeys, &productIDArrayExists, &matchedKeys, &wildCardKeys, &productIDInArray, &usedMaskForProductID);
+	
+    vendorPropertyExists = (presentKeys & (1 << kUSBMatchVendorID)) ? true : false ;
+    productPropertyExists = (presentKeys & (1 << kUSBMatchProductID)) ? true : false ;
+    interfaceNumberPropertyExists = (presentKeys & (1 << kUSBMatchInterfaceNumber)) ? true : false ;
+    configurationValuePropertyExists = (presentKeys & (1 << kUSBMatchConfigurationValue)) ? true : false ;
+    deviceReleasePropertyExists = (presentKeys & (1 << kUSBMatchDeviceReleaseNumber)) ? true : false ;
+    interfaceClassPropertyExists = (presentKeys & (1 << kUSBMatchInterfaceClass)) ? true : false ;
+    interfaceSubClassPropertyExists = (presentKeys & (1 << kUSBMatchInterfaceSubClass)) ? true : false ;
+    interfaceProtocolPropertyExists = (presentKeys & (1 << kUSBMatchInterfaceProtocol)) ? true : false ;
+	
+    vendorPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchVendorID)) ? true : false;
+    productPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchProductID)) ? true : false;
+    interfaceNumberPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchInterfaceNumber)) ? true : false;
+    configurationValuePropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchConfigurationValue)) ? true : false;
+    deviceReleasePropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchDeviceReleaseNumber)) ? true : false;
+    interfaceClassPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchInterfaceClass)) ? true : false;
+    interfaceSubClassPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchInterfaceSubClass)) ? true : false;
+    interfaceProtocolPropertyMatches = ((matchedKeys | wildCardKeys) & (1 << kUSBMatchInterfaceProtocol)) ? true : false;
 	
 	if ( productIDArrayExists )
 	{
-		productPropertyMatches = USBComparePropertyInArray( table, kUSBProductIdsArrayName, kUSBProductID, &productIDInArray);
         USBLog(7, "%s[%p]::matchPropertyTable  productIDArrayExists was true, matches = %s", getName(), this, productPropertyMatches?"true":"false");
 	}
-
-    // Now, let's look and see whether any of the properties were OSString's AND their value was "*".  This indicates that
-    // we should match to all the values for that category -- i.e. a wild card match
-    //
-    if ( !vendorPropertyMatches )               
-    { 
-		vendorPropertyMatches = IsWildCardMatch(table, kUSBVendorID); 
-		if ( vendorPropertyMatches ) 
-			vendorIsWildCard++; 
-    }
-    
-    if ( !productPropertyMatches )
-    { 
-		productPropertyMatches = IsWildCardMatch(table, kUSBProductID);
-		if ( productPropertyMatches ) 
-		{
-			productIsWildCard++; 
-		}
-    }
-    
-    if ( !interfaceNumberPropertyMatches )
-    { 
-		interfaceNumberPropertyMatches = IsWildCardMatch(table, kUSBInterfaceNumber);
-		if ( interfaceNumberPropertyMatches ) 
-			interfaceNumberIsWildCard++; 
-    }
-    
-    if ( !configurationValuePropertyMatches )
-    { 
-		configurationValuePropertyMatches = IsWildCardMatch(table, kUSBConfigurationValue);
-		if ( configurationValuePropertyMatches ) 
-			configurationValueIsWildCard++; 
-    }
-    
-    if ( !deviceReleasePropertyMatches )
-    { 
-		deviceReleasePropertyMatches = IsWildCardMatch(table, kUSBDeviceReleaseNumber);
-		if ( deviceReleasePropertyMatches ) 
-			deviceReleaseIsWildCard++;
-    }
-    
-    if ( !interfaceClassPropertyMatches )
-    { 
-		interfaceClassPropertyMatches = IsWildCardMatch(table, kUSBInterfaceClass);
-		if ( interfaceClassPropertyMatches ) 
-			classIsWildCard++;
-    }
-    
-    if ( !interfaceSubClassPropertyMatches )
-    { 
-		interfaceSubClassPropertyMatches = IsWildCardMatch(table, kUSBInterfaceSubClass);
-		if ( interfaceSubClassPropertyMatches ) 
-			subClassIsWildCard++; 
-    }
-    
-    if ( !interfaceProtocolPropertyMatches )
-    { 
-		interfaceProtocolPropertyMatches = IsWildCardMatch(table, kUSBInterfaceProtocol);
-		if ( interfaceProtocolPropertyMatches ) 
-			protocolIsWildCard++; 
-    }
-    
-    // If the productID didn't match, then see if there is a kProductIDMask property.  If there is, mask this device's prodID and the dictionary's prodID with it and see
-    // if they are equal and if so, then we say we productID matches.
-	//
-    if ( !productPropertyMatches && productIDMaskExists )
-    {
-		if ( !productIDArrayExists )
-		{
-			productPropertyMatches = USBComparePropertyWithMask( table, kUSBProductID, kUSBProductIDMask);
-			usedMaskForProductID = productPropertyMatches;
-		}
-		else 
-		{
-			productPropertyMatches = USBComparePropertyInArrayWithMask( table, kUSBProductIdsArrayName, kUSBProductID, kUSBProductIDMask, &productIDInArray);
-			usedMaskForProductID = productPropertyMatches;
-		}
-    }
+	
+	vendorIsWildCard = (wildCardKeys & (1 << kUSBMatchVendorID)) ? 1 : 0;
+	productIsWildCard = (wildCardKeys & (1 << kUSBMatchProductID)) ? 1 : 0;
+	interfaceNumberIsWildCard = (wildCardKeys & (1 << kUSBMatchInterfaceNumber)) ? 1 : 0;
+	configurationValueIsWildCard = (wildCardKeys & (1 << kUSBMatchConfigurationValue)) ? 1 : 0;
+	deviceReleaseIsWildCard = (wildCardKeys & (1 << kUSBMatchDeviceReleaseNumber)) ? 1 : 0;
+	classIsWildCard = (wildCardKeys & (1 << kUSBMatchInterfaceClass)) ? 1 : 0;
+	subClassIsWildCard = (wildCardKeys & (1 << kUSBMatchInterfaceSubClass)) ? 1 : 0;
+	protocolIsWildCard = (wildCardKeys & (1 << kUSBMatchInterfaceProtocol)) ? 1 : 0;
     
     // If the service object wishes to compare some of its properties in its
     // property table against the supplied matching dictionary,
     // it should do so in this method and return truth on success.
     //
     if (!super::matchPropertyTable(table))  
+	{
+		AddMatchingTime(timeStart, &_MATCHINGSTATISTICS);
 		return false;
+	}
         
     // If the property score is > 10000, then clamp it to 9000.  We will then add this score
     // to the matching criteria score.  This will allow drivers
@@ -1989,6 +1996,8 @@ IOUSBInterface::matchPropertyTable(OSDictionary * table, SInt32 *score)
 	if (interfaceClassProp)
 		interfaceClassProp->release();
 	
+	AddMatchingTime(timeStart, &_MATCHINGSTATISTICS);
+	
 	return returnValue;
 }
 
@@ -25,6 +25,7 @@
 #include <libkern/OSByteOrder.h>
 #include <libkern/c++/OSDictionary.h>
 #include <libkern/c++/OSData.h>
+#include <mach/mach_time.h>
 
 #include <IOKit/IOMemoryDescriptor.h>
 #include <IOKit/IOKitKeys.h>
@@ -52,6 +53,45 @@ const OSSymbol *gUSBDeviceClass = NULL;
 const OSSymbol *gUSBDeviceSubClass = NULL;
 const OSSymbol *gUSBDeviceProtocol = NULL;
 
+// The symbol for each kUSBMatch key, in the order of the enum in IOUSBNub.h
+//
+static const OSSymbol ** gUSBMatchKeySymbols[kUSBMatchKeyCount] =
+{
+	&gUSBVendorID,
+	&gUSBProductID,
+	&gUSBDeviceReleaseNumber,
+	&gUSBDeviceClass,
+	&gUSBDeviceSubClass,
+	&gUSBDeviceProtocol,
+	&gUSBInterfaceNumber,
+	&gUSBConfigurationValue,
+	&gUSBInterfaceClass,
+	&gUSBInterfaceSubClass,
+	&gUSBInterfaceProtocol,
+	&gUSBProductIDMask
+};
+
+// How long after a call to matchPropertyTable the matching statistics are published
+//
+enum
+{
+	kUSBMatchingStatisticsDelayMS = 1000
+};
+
+// Matching dictionaries we have already compiled, indexed by a hash of the dictionary's address.  Each entry holds a
+// retain on its dictionary, so the address cannot be reused by a different dictionary while the entry is valid.
+//
+typedef struct IOUSBCompiledMatchCacheEntry
+{
+	OSDictionary *		dictionary;
+	OSData *			compiled;
+} IOUSBCompiledMatchCacheEntry;
+
+static IOUSBCompiledMatchCacheEntry		gUSBCompiledMatchCache[kUSBCompiledMatchCacheSize];
+static IOLock *							gUSBCompiledMatchCacheLock = NULL;
+
+static OSData *	CompileMatchingDictionary(OSDictionary * matching);
+
 #define super	IOService
 
 /* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
@@ -74,6 +114,8 @@ void IOUSBNub::initialize()
     gUSBDeviceClass = OSSymbol::withCString(kUSBDeviceClass);
     gUSBDeviceSubClass = OSSymbol::withCString(kUSBDeviceSubClass);
     gUSBDeviceProtocol = OSSymbol::withCString(kUSBDeviceProtocol);
+	
+	gUSBCompiledMatchCacheLock = IOLockAlloc();
 }
 
 
@@ -255,6 +297,372 @@ IOUSBNub::USBComparePropertyWithMask( OSDictionary *matching, const char *key, c
 
 
 
+// Extract everything matchPropertyTable needs from a matching dictionary into an IOUSBCompiledMatch
+//
+static OSData *
+CompileMatchingDictionary(OSDictionary * matching)
+{
+	IOUSBCompiledMatch	header;
+	OSArray *			productIDArray;
+	OSData *			compiled;
+	OSNumber *			number;
+	UInt32				key;
+	unsigned int		index;
+	
+	bzero(&header, sizeof(header));
+	header.dictionaryCount = matching->getCount();
+	
+	for (key = 0; key < kUSBMatchKeyCount; key++)
+	{
+		OSObject *	value = matching->getObject(*gUSBMatchKeySymbols[key]);
+		OSString *	string = OSDynamicCast(OSString, value);
+		
+		if (!value)
+			continue;
+		
+		header.present |= (1 << key);
+		number = OSDynamicCast(OSNumber, value);
+		if (number)
+		{
+			header.numeric |= (1 << key);
+			header.value[key] = number->unsigned64BitValue();
+		}
+		else if (string && string->isEqualTo("*"))
+		{
+			header.wildCard |= (1 << key);
+		}
+	}
+	
+	// Only the OSNumbers in the array can ever match, so those are the only ones we keep
+	productIDArray = OSDynamicCast(OSArray, matching->getObject(kUSBProductIdsArrayName));
+	if (productIDArray)
+	{
+		header.hasProductIDArray = true;
+		for (index = 0; index < productIDArray->getCount(); index++)
+		{
+			if (OSDynamicCast(OSNumber, productIDArray->getObject(index)))
+				header.productIDCount++;
+		}
+	}
+	
+	compiled = OSData::withCapacity(sizeof(header) + (header.productIDCount * sizeof(UInt64)));
+	if (!compiled)
+		return NULL;
+	
+	compiled->appendBytes(&header, sizeof(header));
+	for (index = 0; productIDArray && (index < productIDArray->getCount()); index++)
+	{
+		number = OSDynamicCast(OSNumber, productIDArray->getObject(index));
+		if (number)
+		{
+			UInt64	productID = number->unsigned64BitValue();
+			
+			compiled->appendBytes(&productID, sizeof(productID));
+		}
+	}
+	
+	return compiled;
+}
+
+
+
+// Return a retained IOUSBCompiledMatch for the matching dictionary, compiling it the first time we see the dictionary.  Only
+// driver personalities (which have an IOClass) are cached.  Any other dictionary, such as one a client builds for
+// IOServiceGetMatchingServices and may refill with new values between calls, is compiled afresh every time.
+//
+OSData *
+IOUSBNub::CopyCompiledMatch( OSDictionary * matching )
+{
+	IOUSBCompiledMatchCacheEntry *	entry;
+	OSData *						compiled = NULL;
+	OSDictionary *					oldDictionary = NULL;
+	OSData *						oldCompiled = NULL;
+	UInt32							hash;
+	
+	if ( !matching )
+		return NULL;
+	
+	if ( !gUSBCompiledMatchCacheLock || !matching->getObject(kIOClassKey) )
+		return CompileMatchingDictionary(matching);
+	
+	hash = (UInt32)((uintptr_t)matching >> 4) * 2654435761U;
+	entry = &gUSBCompiledMatchCache[(hash >> 16) & (kUSBCompiledMatchCacheSize - 1)];
+	
+	IOLockLock(gUSBCompiledMatchCacheLock);
+	
+	// A personality does not change once it has been published, but a dictionary that has had keys added or removed since
+	// we compiled it is treated as a new one
+	if ( (entry->dictionary == matching) && (((IOUSBCompiledMatch *)entry->compiled->getBytesNoCopy())->dictionaryCount == matching->getCount()) )
+	{
+		compiled = entry->compiled;
+		compiled->retain();
+	}
+	else
+	{
+		compiled = CompileMatchingDictionary(matching);
+		if ( compiled )
+		{
+			oldDictionary = entry->dictionary;
+			oldCompiled = entry->compiled;
+			
+			matching->retain();
+			compiled->retain();
+			entry->dictionary = matching;
+			entry->compiled = compiled;
+		}
+	}
+	
+	IOLockUnlock(gUSBCompiledMatchCacheLock);
+	
+	if ( oldDictionary )
+		oldDictionary->release();
+	if ( oldCompiled )
+		oldCompiled->release();
+	
+	return compiled;
+}
+
+
+
+// Compare the keys in "keys" against our own properties.  On return, "matches" has a bit set for each key whose value
+// is equal to ours (for idProduct, that includes a match in the kUSBProductIdsArrayName array or a match under
+// kUSBProductIDMask) and "wildCards" has a bit set for each key which did not match but was the wild card "*".  This
+// gives the same answers as USBCompareProperty, IsWildCardMatch and the mask and array variants.
+//
+void
+IOUSBNub::CompareCompiledMatch( const IOUSBCompiledMatch * compiled, UInt32 keys, UInt32 * matches, UInt32 * wildCards, UInt32 * theProductIDThatMatched, bool * usedMaskForProductID )
+{
+	const UInt32	productBit = (1 << kUSBMatchProductID);
+	UInt32			wanted = keys & compiled->numeric;
+	UInt32			found = 0;
+	UInt64			nubValue[kUSBMatchKeyCount];
+	UInt32			key;
+	UInt32			index;
+	
+	*matches = 0;
+	*wildCards = 0;
+	*theProductIDThatMatched = 0;
+	*usedMaskForProductID = false;
+	
+	// The array and the mask both need our idProduct, even when the dictionary has no idProduct of its own
+	if ( compiled->hasProductIDArray || (compiled->numeric & (1 << kUSBMatchProductIDMask)) )
+		wanted |= productBit;
+	
+	for (key = 0; key < kUSBMatchKeyCount; key++)
+	{
+		if ( wanted & (1 << key) )
+		{
+			OSObject *	property = copyProperty(*gUSBMatchKeySymbols[key]);
+			OSNumber *	number = OSDynamicCast(OSNumber, property);
+			
+			if ( number )
+			{
+				nubValue[key] = number->unsigned64BitValue();
+				found |= (1 << key);
+			}
+			if ( property )
+				property->release();
+			
+			if ( (found & compiled->numeric & keys & (1 << key)) && (nubValue[key] == compiled->value[key]) )
+				*matches |= (1 << key);
+		}
+	}
+	
+	// If there is a productID array, it decides whether idProduct matches
+	if ( compiled->hasProductIDArray )
+	{
+		*matches &= ~productBit;
+		for (index = 0; (found & productBit) && (index < compiled->productIDCount); index++)
+		{
+			if ( compiled->productIDs[index] == nubValue[kUSBMatchProductID] )
+			{
+				*matches |= productBit;
+				*theProductIDThatMatched = (UInt32)compiled->productIDs[index];
+				break;
+			}
+		}
+	}
+	
+	*wildCards = keys & compiled->wildCard & ~(*matches);
+	
+	// Finally, an idProduct that still has not matched might match under the mask
+	if ( (keys & productBit) && !((*matches | *wildCards) & productBit) && (found & productBit) && (compiled->numeric & (1 << kUSBMatchProductIDMask)) )
+	{
+		UInt32	mask = (UInt32)compiled->value[kUSBMatchProductIDMask];
+		UInt32	nubProductID = (UInt32)nubValue[kUSBMatchProductID];
+		
+		if ( !compiled->hasProductIDArray )
+		{
+			if ( (compiled->numeric & productBit) && ((nubProductID & mask) == ((UInt32)compiled->value[kUSBMatchProductID] & mask)) )
+				*matches |= productBit;
+		}
+		else
+		{
+			for (index = 0; index < compiled->productIDCount; index++)
+			{
+				if ( (nubProductID & mask) == ((UInt32)compiled->productIDs[index] & mask) )
+				{
+					USBLog(7, "%s[%p]::CompareCompiledMatch - 0x%x, 0x%x, mask 0x%x matched", getName(), this, (uint32_t)compiled->productIDs[index], (uint32_t)nubProductID, (uint32_t)mask);
+					*matches |= productBit;
+					*theProductIDThatMatched = nubProductID;
+					break;
+				}
+			}
+		}
+		*usedMaskForProductID = (*matches & productBit) ? true : false;
+	}
+}
+
+
+
+// The same answers as CompareCompiledMatch, for the keys in "keys", plus which keys the dictionary has at all and whether it
+// has a kUSBProductIdsArrayName array.  If the dictionary cannot be compiled (we are most likely short of memory), every key
+// is looked up in it directly with USBCompareProperty, IsWildCardMatch and the array and mask variants, as we always used to.
+//
+void
+IOUSBNub::CompareMatchKeys( OSDictionary * matching, UInt32 keys, UInt32 * present, bool * hasProductIDArray, UInt32 * matches, UInt32 * wildCards, UInt32 * theProductIDThatMatched, bool * usedMaskForProductID )
+{
+	const UInt32	productBit = (1 << kUSBMatchProductID);
+	OSData *		compiledData = CopyCompiledMatch(matching);
+	UInt32			key;
+	
+	if ( compiledData )
+	{
+		const IOUSBCompiledMatch *	compiled = (const IOUSBCompiledMatch *) compiledData->getBytesNoCopy();
+		
+		*present = compiled->present;
+		*hasProductIDArray = compiled->hasProductIDArray;
+		CompareCompiledMatch(compiled, keys, matches, wildCards, theProductIDThatMatched, usedMaskForProductID);
+		compiledData->release();
+		return;
+	}
+	
+	*present = 0;
+	*matches = 0;
+	*wildCards = 0;
+	*theProductIDThatMatched = 0;
+	*usedMaskForProductID = false;
+	*hasProductIDArray = OSDynamicCast(OSArray, matching->getObject(kUSBProductIdsArrayName)) ? true : false;
+	
+	for (key = 0; key < kUSBMatchKeyCount; key++)
+	{
+		if ( matching->getObject(*gUSBMatchKeySymbols[key]) )
+			*present |= (1 << key);
+		
+		// USBComparePropery() will return false if the property does NOT exist, or if it exists and it doesn't match
+		if ( (keys & (1 << key)) && USBCompareProperty(matching, *gUSBMatchKeySymbols[key]) )
+			*matches |= (1 << key);
+	}
+	
+	// If there is a productID array, it decides whether idProduct matches
+	if ( (keys & productBit) && *hasProductIDArray )
+	{
+		*matches &= ~productBit;
+		if ( USBComparePropertyInArray(matching, kUSBProductIdsArrayName, kUSBProductID, theProductIDThatMatched) )
+			*matches |= productBit;
+	}
+	
+	for (key = 0; key < kUSBMatchKeyCount; key++)
+	{
+		if ( (keys & ~(*matches) & (1 << key)) && IsWildCardMatch(matching, (*gUSBMatchKeySymbols[key])->getCStringNoCopy()) )
+			*wildCards |= (1 << key);
+	}
+	
+	// Finally, an idProduct that still has not matched might match under the mask
+	if ( (keys & productBit) && !((*matches | *wildCards) & productBit) && (*present & (1 << kUSBMatchProductIDMask)) )
+	{
+		if ( !*hasProductIDArray )
+			*usedMaskForProductID = USBComparePropertyWithMask(matching, kUSBProductID, kUSBProductIDMask);
+		else
+			*usedMaskForProductID = USBComparePropertyInArrayWithMask(matching, kUSBProductIdsArrayName, kUSBProductID, kUSBProductIDMask, theProductIDThatMatched);
+		
+		if ( *usedMaskForProductID )
+			*matches |= productBit;
+	}
+}
+
+
+
+// Add the time since startTime to the matching statistics of a device or interface.  A nub is matched against every
+// personality of its class one after the other, so instead of publishing the totals on every call, the first call after
+// they were last published schedules PublishMatchingStatisticsEntry, which picks up every call up to when it runs.
+//
+void
+IOUSBNub::AddMatchingTime( uint64_t startTime, IOUSBMatchingStatistics * statistics )
+{
+	uint64_t		elapsedTime = mach_absolute_time() - startTime;
+	uint64_t		elapsedNS;
+	uint64_t		deadline;
+	thread_call_t	publishThread;
+	
+	absolutetime_to_nanoseconds(*(AbsoluteTime *)&elapsedTime, &elapsedNS);
+	
+	// matchPropertyTable can be called for the same nub from more than one thread
+	OSAddAtomic64((SInt64)elapsedNS, (volatile SInt64 *)&statistics->time);
+	OSIncrementAtomic((volatile SInt32 *)&statistics->count);
+	
+	// Whoever sets publishPending owns publishThread until it runs, so only one thread can be allocating it
+	if ( !OSCompareAndSwap(0, 1, &statistics->publishPending) )
+		return;
+	
+	publishThread = statistics->publishThread;
+	if ( !publishThread )
+	{
+		publishThread = thread_call_allocate((thread_call_func_t)PublishMatchingStatisticsEntry, (thread_call_param_t)this);
+		if ( !publishThread )
+		{
+			setProperty("MatchingTimeUS", statistics->time / 1000, 64);
+			setProperty("MatchingCount", statistics->count, 32);
+			statistics->publishPending = 0;
+			return;
+		}
+		statistics->publishThread = publishThread;
+	}
+	
+	clock_interval_to_deadline(kUSBMatchingStatisticsDelayMS, kMillisecondScale, &deadline);
+	retain();
+	if ( thread_call_enter1_delayed(publishThread, (thread_call_param_t)statistics, deadline) == TRUE )
+		release();
+}
+
+
+
+// Called from free() by IOUSBDevice and IOUSBInterface.  A pending PublishMatchingStatisticsEntry holds a reference on the
+// nub, so there cannot be one by now.
+//
+void
+IOUSBNub::FreeMatchingStatistics( IOUSBMatchingStatistics * statistics )
+{
+	if ( statistics->publishThread )
+	{
+		thread_call_cancel(statistics->publishThread);
+		thread_call_free(statistics->publishThread);
+		statistics->publishThread = NULL;
+	}
+}
+
+
+
+void
+IOUSBNub::PublishMatchingStatisticsEntry( OSObject * target, thread_call_param_t param )
+{
+	IOUSBNub *					me = OSDynamicCast(IOUSBNub, target);
+	IOUSBMatchingStatistics *	statistics = (IOUSBMatchingStatistics *)param;
+	
+	if ( !me )
+		return;
+	
+	// Clear it first, so that a call which comes in while we publish schedules us again
+	OSCompareAndSwap(1, 0, &statistics->publishPending);
+	
+	me->setProperty("MatchingTimeUS", statistics->time / 1000, 64);
+	me->setProperty("MatchingCount", statistics->count, 32);
+	
+	me->release();
+}
+
+
+
 // this method will override the Platform specific implementation of joinPMtree
 // it will cause any IOUSBDevice and IOUSBInterface clients to join the IOPower tree as
 // children of the IOUSHubPolicyMaker for the hub to which they are attached
@@ -1441,6 +1441,139 @@ IOUSBPipe::ToEndpoint(const IOUSBEndpointDescriptor *ed, UInt8 speed, USBDeviceA
 
 
 
+#pragma mark Batched Transfers
+//================================================================================================
+//
+//   ReadBatch / WriteBatch
+//
+//   Queue a number of async transfers while holding the controller's gate.  Each transfer still goes
+//   through Read or Write, and so gets its own IOUSBCommand, but the runAction done by each of those
+//   finds the gate already held by this thread and goes straight through.
+//
+//================================================================================================
+//
+struct IOUSBPipeBatchRequest
+{
+	IOUSBPipe *				pipe;
+	IOUSBPipeBatchEntry *	entries;
+	UInt32					count;
+	UInt32					noDataTimeout;
+	UInt32					completionTimeout;
+	UInt32					queued;
+	bool					isRead;
+};
+
+
+
+IOReturn
+IOUSBPipe::DoTransferBatch(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+#pragma unused (owner, arg1, arg2, arg3)
+	IOUSBPipeBatchRequest	*request = (IOUSBPipeBatchRequest *)arg0;
+	IOUSBPipe				*me = request ? request->pipe : NULL;
+	IOUSBPipeBatchEntry		*entry;
+	IOReturn				err = kIOReturnSuccess;
+	
+	if (!me)
+		return kIOReturnBadArgument;
+	
+	for (request->queued = 0; request->queued < request->count; request->queued++)
+	{
+		entry = &request->entries[request->queued];
+		if (request->isRead)
+			err = me->Read(entry->buffer, request->noDataTimeout, request->completionTimeout, entry->reqCount, &entry->completion);
+		else
+			err = me->Write(entry->buffer, request->noDataTimeout, request->completionTimeout, entry->reqCount, &entry->completion);
+		
+		if (err)
+		{
+			USBLog(3, "IOUSBPipe[%p]::DoTransferBatch - entry %d of %d returned 0x%x (%s)", me, (int)request->queued, (int)request->count, err, USBStringFromReturn(err));
+			break;
+		}
+	}
+	
+	return err;
+}
+
+
+
+static IOReturn
+CheckTransferBatch(IOUSBPipeBatchRequest *request)
+{
+	UInt32			i;
+	
+	if (!request->entries || (request->count == 0))
+		return kIOReturnBadArgument;
+	
+	// there is no way to run a batch synchronously, so every entry needs its own completion
+	for (i = 0; i < request->count; i++)
+	{
+		if (request->entries[i].completion.action == NULL)
+		{
+			USBLog(2, "IOUSBPipe[%p]::CheckTransferBatch - entry %d has no completion action", request->pipe, (int)i);
+			return kIOReturnNoCompletion;
+		}
+	}
+	
+	return kIOReturnSuccess;
+}
+
+
+
+IOReturn
+IOUSBPipe::TransferBatch(IOUSBPipeBatchEntry *entries, UInt32 count, UInt32 noDataTimeout, UInt32 completionTimeout, UInt32 *entriesQueued, bool isRead)
+{
+	IOUSBPipeBatchRequest	request;
+	IOCommandGate			*commandGate;
+	IOReturn				err;
+	
+	USBLog(7, "IOUSBPipe[%p]::%s (addr %d:%d type %d) - %d entries", this, isRead ? "ReadBatch" : "WriteBatch", _address, _endpoint.number , _endpoint.transferType, (int)count);
+	
+	bzero(&request, sizeof(request));
+	request.pipe = this;
+	request.entries = entries;
+	request.count = count;
+	request.noDataTimeout = noDataTimeout;
+	request.completionTimeout = completionTimeout;
+	request.isRead = isRead;
+	
+	if (entriesQueued)
+		*entriesQueued = 0;
+	
+	err = CheckTransferBatch(&request);
+	if (err)
+		return err;
+	
+	commandGate = _controller ? _controller->GetCommandGate() : NULL;
+	if (!commandGate)
+		return kIOReturnNotAttached;
+	
+	err = commandGate->runAction(DoTransferBatch, &request);
+	
+	if (entriesQueued)
+		*entriesQueued = request.queued;
+	
+	return err;
+}
+
+
+
+IOReturn
+IOUSBPipe::ReadBatch(IOUSBPipeBatchEntry *entries, UInt32 count, UInt32 noDataTimeout, UInt32 completionTimeout, UInt32 *entriesQueued)
+{
+	return TransferBatch(entries, count, noDataTimeout, completionTimeout, entriesQueued, true);
+}
+
+
+
+IOReturn
+IOUSBPipe::WriteBatch(IOUSBPipeBatchEntry *entries, UInt32 count, UInt32 noDataTimeout, UInt32 completionTimeout, UInt32 *entriesQueued)
+{
+	return TransferBatch(entries, count, noDataTimeout, completionTimeout, entriesQueued, false);
+}
+
+
+
 IOUSBPipe *
 IOUSBPipe::ToEndpoint(const IOUSBEndpointDescriptor *ed, IOUSBDevice * device, IOUSBController *controller)
 {
@@ -1469,9 +1602,9 @@ OSMetaClassDefineReservedUsed(IOUSBPipe,  11);
 OSMetaClassDefineReservedUsed(IOUSBPipe,  12);
 OSMetaClassDefineReservedUsed(IOUSBPipe,  13);
 OSMetaClassDefineReservedUsed(IOUSBPipe,  14);
+OSMetaClassDefineReservedUsed(IOUSBPipe,  15);
+OSMetaClassDefineReservedUsed(IOUSBPipe,  16);
 
-OSMetaClassDefineReservedUnused(IOUSBPipe,  15);
-OSMetaClassDefineReservedUnused(IOUSBPipe,  16);
 OSMetaClassDefineReservedUnused(IOUSBPipe,  17);
 OSMetaClassDefineReservedUnused(IOUSBPipe,  18);
 OSMetaClassDefineReservedUnused(IOUSBPipe,  19);
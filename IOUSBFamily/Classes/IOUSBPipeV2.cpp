@@ -40,6 +40,7 @@
 #include <IOKit/usb/IOUSBPipeV2.h>
 #include <IOKit/usb/IOUSBNub.h>
 #include <IOKit/usb/IOUSBLog.h>
+#include <IOKit/IOSubMemoryDescriptor.h>
 
 #include "IOUSBInterfaceUserClient.h"
 
@@ -65,6 +66,44 @@
 #define	_SYNCTYPE						_expansionData->_syncType
 #define	_OUTOFSPECMPSOK					_status				// if non-zero, then we should ignore an out of spec MPS
 
+#define _REGISTEREDBUFFERLOCK			_v2PipeExpansionData->_registeredBufferLock
+#define _REGISTEREDBUFFERGENERATION		_v2PipeExpansionData->_registeredBufferGeneration
+#define _REGISTEREDBUFFERS				_v2PipeExpansionData->_registeredBuffers
+
+// a registered buffer ID is the slot number + 1 in the low byte, and a generation count above it, so that a stale ID is not
+// mistaken for whatever was registered in that slot later
+#define RegisteredBufferSlot(bufferID)	((int)((bufferID) & 0xFF) - 1)
+
+#define _ISOCHSTREAMLOCK				_v2PipeExpansionData->_isochStreamLock
+#define _ISOCHSTREAM					_v2PipeExpansionData->_isochStream
+
+// How far ahead of the current frame a stream whose schedule ran dry is restarted
+enum
+{
+	kIsochStreamRestartFrames		= 10
+};
+
+// State of a running isochronous stream.  Everything which changes while the stream runs is protected by _ISOCHSTREAMLOCK
+struct IOUSBPipeIsochStream
+{
+	IOMemoryDescriptor *			buffer;						// prepared for the life of the stream
+	IOMemoryDescriptor **			slots;						// one subrange of buffer per slot, made once in StartIsochStream
+	IOUSBIsocFrame *				frameList;
+	IOUSBIsochStreamIndices *		indices;
+	UInt32							slotCount;
+	UInt32							framesPerSlot;
+	UInt32							frameAdvance;				// frames per slot, or 0 to let a SuperSpeed controller continue on its own
+	UInt64							nextFrame;
+	UInt32							submitIndex;				// number of slots handed to the controller so far
+	UInt32							inFlight;
+	bool							isRead;
+	bool							prepared;
+	bool							stopping;
+	bool							aborted;					// a slot came back aborted, so writeIndex stops where it is
+	bool							filling;					// a thread is in FillIsochStream
+	bool							refill;						// a slot was released while that thread was submitting
+};
+
 
 #ifndef IOUSBPIPEV2_USE_KPRINTF
 	#define IOUSBPIPEV2_USE_KPRINTF 0
@@ -115,6 +154,22 @@ IOUSBPipeV2::InitToEndpoint(const IOUSBEndpointDescriptor *ed, IOUSBSuperSpeedEn
         bzero(_expansionData, sizeof(ExpansionData));
     }
 	
+    if (!_v2PipeExpansionData)
+    {
+        _v2PipeExpansionData = (V2PipeExpansionData *)IOMalloc(sizeof(V2PipeExpansionData));
+        if (!_v2PipeExpansionData)
+            return false;
+        bzero(_v2PipeExpansionData, sizeof(V2PipeExpansionData));
+		
+		_REGISTEREDBUFFERLOCK = IOLockAlloc();
+		if (!_REGISTEREDBUFFERLOCK)
+			return false;
+		
+		_ISOCHSTREAMLOCK = IOLockAlloc();
+		if (!_ISOCHSTREAMLOCK)
+			return false;
+    }
+	
     _controller = controller;
     controllerV3 = OSDynamicCast(IOUSBControllerV3, _controller);
     if ( controllerV3 == NULL )
@@ -423,6 +478,53 @@ IOUSBPipeV2::ToEndpoint(const IOUSBEndpointDescriptor *ed, IOUSBSuperSpeedEndpoi
 
 
 
+//================================================================================================
+//
+//   free
+//
+//================================================================================================
+//
+void
+IOUSBPipeV2::free()
+{
+	int		i;
+	
+    if (_v2PipeExpansionData)
+    {
+		for (i = 0; i < kUSBPipeMaxRegisteredBuffers; i++)
+		{
+			if (_REGISTEREDBUFFERS[i].bufferID)
+				UnregisterBuffer(_REGISTEREDBUFFERS[i].bufferID);
+		}
+		
+		if (_REGISTEREDBUFFERLOCK)
+		{
+			IOLockFree(_REGISTEREDBUFFERLOCK);
+			_REGISTEREDBUFFERLOCK = NULL;
+		}
+		
+		// a running stream holds a reference on us, so there can only be one left here if StartIsochStream failed half way
+		if (_ISOCHSTREAM)
+		{
+			FreeIsochStream(_ISOCHSTREAM);
+			_ISOCHSTREAM = NULL;
+		}
+		
+		if (_ISOCHSTREAMLOCK)
+		{
+			IOLockFree(_ISOCHSTREAMLOCK);
+			_ISOCHSTREAMLOCK = NULL;
+		}
+		
+        IOFree(_v2PipeExpansionData, sizeof(V2PipeExpansionData));
+        _v2PipeExpansionData = NULL;
+    }
+	
+    super::free();
+}
+
+
+
 #pragma mark IOUSBPipeV2 State
 
 //================================================================================================
@@ -733,6 +835,639 @@ IOUSBPipeV2::Write(UInt32 streamID, IOMemoryDescriptor *buffer, UInt32 noDataTim
     return err;
 }
 
+#pragma mark Registered Buffers
+//================================================================================================
+//
+//   RegisterBuffer
+//
+//   Drivers which cycle through the same few buffers would otherwise pay for wiring the memory on every
+//   transfer when the controller prepares its IODMACommand.  A registered buffer is prepared once here, so
+//   the prepare done for each transfer only bumps the wire count, and the sub-descriptors used for transfers
+//   at an offset are kept around and reused.
+//
+//================================================================================================
+//
+IOReturn
+IOUSBPipeV2::RegisterBuffer(IOMemoryDescriptor *buffer, UInt32 *bufferID)
+{
+	IOUSBPipeRegisteredBuffer	*regBuf = NULL;
+	IOReturn					err;
+	int							i;
+	
+	if (!buffer || !bufferID || !_v2PipeExpansionData)
+		return kIOReturnBadArgument;
+	
+	if ((_endpoint.transferType != kUSBBulk) && (_endpoint.transferType != kUSBInterrupt))
+	{
+		USBLog(5, "IOUSBPipeV2[%p]::RegisterBuffer - only bulk and interrupt pipes can use registered buffers", this);
+		return kIOReturnUnsupported;
+	}
+	
+	err = buffer->prepare();
+	if (err)
+	{
+		USBLog(2, "IOUSBPipeV2[%p]::RegisterBuffer - prepare returned 0x%x", this, err);
+		return err;
+	}
+	
+	IOLockLock(_REGISTEREDBUFFERLOCK);
+	for (i = 0; i < kUSBPipeMaxRegisteredBuffers; i++)
+	{
+		if (_REGISTEREDBUFFERS[i].bufferID == 0)
+		{
+			regBuf = &_REGISTEREDBUFFERS[i];
+			break;
+		}
+	}
+	if (regBuf)
+	{
+		bzero(regBuf, sizeof(IOUSBPipeRegisteredBuffer));
+		regBuf->buffer = buffer;
+		regBuf->bufferID = (++_REGISTEREDBUFFERGENERATION << 8) | (i + 1);
+		*bufferID = regBuf->bufferID;
+	}
+	IOLockUnlock(_REGISTEREDBUFFERLOCK);
+	
+	if (!regBuf)
+	{
+		USBLog(2, "IOUSBPipeV2[%p]::RegisterBuffer - all %d registered buffer slots are in use", this, kUSBPipeMaxRegisteredBuffers);
+		buffer->complete();
+		return kIOReturnNoResources;
+	}
+	
+	buffer->retain();
+	USBLog(6, "IOUSBPipeV2[%p]::RegisterBuffer - registered buffer (%p) length (%qd) as ID 0x%x", this, buffer, (uint64_t)buffer->getLength(), (uint32_t)*bufferID);
+	
+	return kIOReturnSuccess;
+}
+
+
+
+//================================================================================================
+//
+//   UnregisterBuffer
+//
+//================================================================================================
+//
+IOReturn
+IOUSBPipeV2::UnregisterBuffer(UInt32 bufferID)
+{
+	IOUSBPipeRegisteredBuffer	regBuf;
+	int							slot = RegisteredBufferSlot(bufferID);
+	int							i;
+	
+	if (!_v2PipeExpansionData || (slot < 0) || (slot >= kUSBPipeMaxRegisteredBuffers))
+		return kIOReturnBadArgument;
+	
+	IOLockLock(_REGISTEREDBUFFERLOCK);
+	if (_REGISTEREDBUFFERS[slot].bufferID != bufferID)
+	{
+		IOLockUnlock(_REGISTEREDBUFFERLOCK);
+		USBLog(2, "IOUSBPipeV2[%p]::UnregisterBuffer - ID 0x%x is not registered", this, (uint32_t)bufferID);
+		return kIOReturnBadArgument;
+	}
+	regBuf = _REGISTEREDBUFFERS[slot];
+	bzero(&_REGISTEREDBUFFERS[slot], sizeof(IOUSBPipeRegisteredBuffer));
+	IOLockUnlock(_REGISTEREDBUFFERLOCK);
+	
+	for (i = 0; i < kUSBPipeRegisteredBufferSlices; i++)
+	{
+		if (regBuf.slices[i])
+			regBuf.slices[i]->release();
+	}
+	
+	USBLog(6, "IOUSBPipeV2[%p]::UnregisterBuffer - unregistered buffer (%p) ID 0x%x", this, regBuf.buffer, (uint32_t)bufferID);
+	regBuf.buffer->complete();
+	regBuf.buffer->release();
+	
+	return kIOReturnSuccess;
+}
+
+
+
+//================================================================================================
+//
+//   CopyRegisteredBufferSlice
+//
+//   Returns a retained descriptor for the registered buffer from offset to its end, or NULL if the ID
+//   is not registered or the transfer does not fit.  The caller releases it once the transfer has been
+//   queued - the controller's IODMACommand holds its own reference for as long as it needs it.
+//
+//================================================================================================
+//
+IOMemoryDescriptor *
+IOUSBPipeV2::CopyRegisteredBufferSlice(UInt32 bufferID, IOByteCount offset, IOByteCount reqCount)
+{
+	IOUSBPipeRegisteredBuffer	*regBuf;
+	IOMemoryDescriptor			*buffer;
+	IOMemoryDescriptor			*slice = NULL;
+	IOMemoryDescriptor			*oldSlice = NULL;
+	int							slot = RegisteredBufferSlot(bufferID);
+	int							i;
+	
+	if (!_v2PipeExpansionData || (slot < 0) || (slot >= kUSBPipeMaxRegisteredBuffers))
+		return NULL;
+	
+	regBuf = &_REGISTEREDBUFFERS[slot];
+	
+	IOLockLock(_REGISTEREDBUFFERLOCK);
+	if ((regBuf->bufferID != bufferID) || (offset > regBuf->buffer->getLength()) || (reqCount > (regBuf->buffer->getLength() - offset)))
+	{
+		IOLockUnlock(_REGISTEREDBUFFERLOCK);
+		return NULL;
+	}
+	
+	buffer = regBuf->buffer;
+	if (offset == 0)
+	{
+		slice = buffer;
+	}
+	else
+	{
+		for (i = 0; i < kUSBPipeRegisteredBufferSlices; i++)
+		{
+			if (regBuf->slices[i] && (regBuf->sliceOffset[i] == offset))
+			{
+				slice = regBuf->slices[i];
+				break;
+			}
+		}
+	}
+	if (slice)
+	{
+		slice->retain();
+		IOLockUnlock(_REGISTEREDBUFFERLOCK);
+		return slice;
+	}
+	buffer->retain();
+	IOLockUnlock(_REGISTEREDBUFFERLOCK);
+	
+	// first transfer at this offset - make the sub-descriptor outside of the lock and then remember it
+	slice = IOSubMemoryDescriptor::withSubRange(buffer, offset, buffer->getLength() - offset, buffer->getDirection());
+	buffer->release();
+	if (!slice)
+		return NULL;
+	
+	IOLockLock(_REGISTEREDBUFFERLOCK);
+	if (regBuf->bufferID == bufferID)
+	{
+		i = regBuf->nextSlice;
+		regBuf->nextSlice = (i + 1) % kUSBPipeRegisteredBufferSlices;
+		oldSlice = regBuf->slices[i];
+		regBuf->slices[i] = slice;
+		regBuf->sliceOffset[i] = offset;
+		slice->retain();
+	}
+	IOLockUnlock(_REGISTEREDBUFFERLOCK);
+	
+	if (oldSlice)
+		oldSlice->release();
+	
+	return slice;
+}
+
+
+
+//================================================================================================
+//
+//   ReadRegisteredBuffer
+//
+//================================================================================================
+//
+IOReturn
+IOUSBPipeV2::ReadRegisteredBuffer(UInt32 bufferID, IOByteCount offset, UInt32 noDataTimeout, UInt32 completionTimeout, IOByteCount reqCount, IOUSBCompletion *completion, IOByteCount *bytesRead)
+{
+	IOMemoryDescriptor		*slice;
+	IOReturn				err;
+	
+	slice = CopyRegisteredBufferSlice(bufferID, offset, reqCount);
+	if (!slice)
+	{
+		USBLog(5, "IOUSBPipeV2[%p]::ReadRegisteredBuffer - bad arguments: ID 0x%x offset %qd reqCount %qd", this, (uint32_t)bufferID, (uint64_t)offset, (uint64_t)reqCount);
+		return kIOReturnBadArgument;
+	}
+	
+	err = Read(0, slice, noDataTimeout, completionTimeout, reqCount, completion, bytesRead);
+	slice->release();
+	
+	return err;
+}
+
+
+
+//================================================================================================
+//
+//   WriteRegisteredBuffer
+//
+//================================================================================================
+//
+IOReturn
+IOUSBPipeV2::WriteRegisteredBuffer(UInt32 bufferID, IOByteCount offset, UInt32 noDataTimeout, UInt32 completionTimeout, IOByteCount reqCount, IOUSBCompletion *completion)
+{
+	IOMemoryDescriptor		*slice;
+	IOReturn				err;
+	
+	slice = CopyRegisteredBufferSlice(bufferID, offset, reqCount);
+	if (!slice)
+	{
+		USBLog(5, "IOUSBPipeV2[%p]::WriteRegisteredBuffer - bad arguments: ID 0x%x offset %qd reqCount %qd", this, (uint32_t)bufferID, (uint64_t)offset, (uint64_t)reqCount);
+		return kIOReturnBadArgument;
+	}
+	
+	err = Write(0, slice, noDataTimeout, completionTimeout, reqCount, completion);
+	slice->release();
+	
+	return err;
+}
+
+
+
+#pragma mark Isochronous Streams
+
+//================================================================================================
+//
+//   StartIsochStream
+//
+//================================================================================================
+//
+IOReturn
+IOUSBPipeV2::StartIsochStream(IOMemoryDescriptor *buffer, UInt64 frameStart, UInt32 slotCount, UInt32 framesPerSlot, IOUSBIsocFrame *frameList, IOUSBIsochStreamIndices *indices)
+{
+	IOUSBPipeIsochStream	*stream;
+	IOByteCount				offset = 0;
+	IOByteCount				slotLength;
+	UInt32					frameAdvance;
+	UInt32					i, j;
+	IOReturn				err;
+	
+	if (!_v2PipeExpansionData || !buffer || !frameList || !indices || (slotCount < 2) || (framesPerSlot == 0))
+		return kIOReturnBadArgument;
+	
+	if (_endpoint.transferType != kUSBIsoc)
+	{
+		USBLog(2, "IOUSBPipeV2[%p]::StartIsochStream - not an isochronous pipe", this);
+		return kIOReturnBadArgument;
+	}
+	
+    if (_endpoint.maxPacketSize == 0)
+    {
+        USBLog(2, "IOUSBPipeV2[%p]::StartIsochStream - no bandwidth on an isoc pipe", this);
+        return kIOReturnNoBandwidth;
+    }
+	
+	// work out how many (1ms) frames each slot takes, so that the next slot can be scheduled right after it
+	if (_SPEED == kUSBDeviceSpeedSuper)
+	{
+		frameAdvance = 0;
+	}
+	else if (_SPEED == kUSBDeviceSpeedHigh)
+	{
+		UInt32	interval = _endpoint.interval ? _endpoint.interval : 1;
+		UInt32	microFramesPerFrame = 1 << (((interval > 4) ? 4 : interval) - 1);
+		
+		if ((framesPerSlot * microFramesPerFrame) % 8)
+		{
+			USBLog(2, "IOUSBPipeV2[%p]::StartIsochStream - %d frames per slot is not a whole number of frames at interval %d", this, (int)framesPerSlot, (int)interval);
+			return kIOReturnBadArgument;
+		}
+		frameAdvance = (framesPerSlot * microFramesPerFrame) / 8;
+	}
+	else
+	{
+		frameAdvance = framesPerSlot;
+	}
+	
+	stream = (IOUSBPipeIsochStream *)IOMalloc(sizeof(IOUSBPipeIsochStream));
+	if (!stream)
+		return kIOReturnNoMemory;
+	bzero(stream, sizeof(IOUSBPipeIsochStream));
+	
+	stream->slots = (IOMemoryDescriptor **)IOMalloc(slotCount * sizeof(IOMemoryDescriptor *));
+	if (!stream->slots)
+	{
+		IOFree(stream, sizeof(IOUSBPipeIsochStream));
+		return kIOReturnNoMemory;
+	}
+	bzero(stream->slots, slotCount * sizeof(IOMemoryDescriptor *));
+	
+	stream->slotCount = slotCount;
+	stream->buffer = buffer;
+	buffer->retain();
+	
+	for (i = 0; i < slotCount; i++)
+	{
+		slotLength = 0;
+		for (j = 0; j < framesPerSlot; j++)
+			slotLength += frameList[(i * framesPerSlot) + j].frReqCount;
+		
+		if ((offset + slotLength) > buffer->getLength())
+		{
+			USBLog(2, "IOUSBPipeV2[%p]::StartIsochStream - frame list needs more than the %qd bytes in the buffer", this, (uint64_t)buffer->getLength());
+			FreeIsochStream(stream);
+			return kIOReturnBadArgument;
+		}
+		
+		stream->slots[i] = IOSubMemoryDescriptor::withSubRange(buffer, offset, slotLength, buffer->getDirection());
+		if (!stream->slots[i])
+		{
+			FreeIsochStream(stream);
+			return kIOReturnNoMemory;
+		}
+		offset += slotLength;
+	}
+	
+	// wire the whole ring once, so that preparing each slot as it is scheduled does not have to
+	err = buffer->prepare();
+	if (err)
+	{
+		FreeIsochStream(stream);
+		return err;
+	}
+	stream->prepared = true;
+	
+	stream->frameList = frameList;
+	stream->indices = indices;
+	stream->framesPerSlot = framesPerSlot;
+	stream->frameAdvance = frameAdvance;
+	stream->nextFrame = frameStart;
+	stream->isRead = ((_descriptor->bEndpointAddress & 0x80) != 0);
+	
+	indices->writeIndex = 0;
+	indices->readIndex = 0;
+	indices->overruns = 0;
+	indices->lastError = kIOReturnSuccess;
+	
+	IOLockLock(_ISOCHSTREAMLOCK);
+	if (_ISOCHSTREAM)
+	{
+		IOLockUnlock(_ISOCHSTREAMLOCK);
+		USBLog(2, "IOUSBPipeV2[%p]::StartIsochStream - a stream is already running", this);
+		FreeIsochStream(stream);
+		return kIOReturnExclusiveAccess;
+	}
+	_ISOCHSTREAM = stream;
+	IOLockUnlock(_ISOCHSTREAMLOCK);
+	
+	// the stream holds a reference on us until StopIsochStream
+	retain();
+	
+	USBLog(5, "IOUSBPipeV2[%p]::StartIsochStream - %d slots of %d frames from frame %qd", this, (int)slotCount, (int)framesPerSlot, frameStart);
+	FillIsochStream();
+	
+	if (indices->lastError != kIOReturnSuccess)
+	{
+		err = indices->lastError;
+		StopIsochStream();
+		return err;
+	}
+	
+	return kIOReturnSuccess;
+}
+
+
+
+//================================================================================================
+//
+//   StopIsochStream
+//
+//================================================================================================
+//
+IOReturn
+IOUSBPipeV2::StopIsochStream(void)
+{
+	IOUSBPipeIsochStream	*stream;
+	
+	if (!_v2PipeExpansionData)
+		return kIOReturnNotOpen;
+	
+	IOLockLock(_ISOCHSTREAMLOCK);
+	stream = _ISOCHSTREAM;
+	if (!stream)
+	{
+		IOLockUnlock(_ISOCHSTREAMLOCK);
+		return kIOReturnNotOpen;
+	}
+	stream->stopping = true;
+	IOLockUnlock(_ISOCHSTREAMLOCK);
+	
+	Abort();
+	
+	IOLockLock(_ISOCHSTREAMLOCK);
+	while (stream->inFlight || stream->filling)
+		IOLockSleep(_ISOCHSTREAMLOCK, stream, THREAD_UNINT);
+	_ISOCHSTREAM = NULL;
+	IOLockUnlock(_ISOCHSTREAMLOCK);
+	
+	USBLog(5, "IOUSBPipeV2[%p]::StopIsochStream - stopped after %d slots, %d overruns", this, (int)stream->indices->writeIndex, (int)stream->indices->overruns);
+	FreeIsochStream(stream);
+	release();
+	
+	return kIOReturnSuccess;
+}
+
+
+
+//================================================================================================
+//
+//   FillIsochStream
+//
+//   Puts every slot the client has released back on the schedule.  Only one thread submits at a
+//   time, so that the slots reach the controller in order.  The lock is not held across the
+//   submission, since that goes through the controller's gate.
+//
+//================================================================================================
+//
+void
+IOUSBPipeV2::FillIsochStream(void)
+{
+	IOUSBPipeIsochStream	*stream;
+	IOUSBIsocCompletion		completion;
+	IOUSBIsocFrame			*frames;
+	UInt64					frameStart;
+	UInt32					slot;
+	UInt32					i;
+	IOReturn				err;
+	
+	IOLockLock(_ISOCHSTREAMLOCK);
+	stream = _ISOCHSTREAM;
+	if (!stream || stream->stopping)
+	{
+		IOLockUnlock(_ISOCHSTREAMLOCK);
+		return;
+	}
+	if (stream->filling)
+	{
+		stream->refill = true;
+		IOLockUnlock(_ISOCHSTREAMLOCK);
+		return;
+	}
+	stream->filling = true;
+	
+	do
+	{
+		stream->refill = false;
+		
+		while (!stream->stopping)
+		{
+			if ((stream->submitIndex - stream->indices->readIndex) >= stream->slotCount)
+			{
+				if (stream->inFlight > 1)
+					break;
+				
+				// the client still has every slot except the one on the schedule.  Once that one completes the schedule
+				// would run dry and we could not pick it up again without a gap, so take the oldest one back now
+				stream->indices->overruns++;
+			}
+			
+			// if the schedule did run dry, the frames after the last slot are already gone - start again a little in the future
+			if (!stream->inFlight && stream->submitIndex && stream->frameAdvance)
+			{
+				UInt64		earliestFrame = _controller->GetFrameNumber() + kIsochStreamRestartFrames;
+				
+				if (stream->nextFrame < earliestFrame)
+				{
+					USBLog(2, "IOUSBPipeV2[%p]::FillIsochStream - schedule ran dry, restarting at frame %qd instead of %qd", this, earliestFrame, stream->nextFrame);
+					stream->nextFrame = earliestFrame;
+				}
+			}
+			
+			slot = stream->submitIndex % stream->slotCount;
+			frameStart = stream->nextFrame;
+			stream->nextFrame = stream->frameAdvance ? (stream->nextFrame + stream->frameAdvance) : kAppleUSBSSIsocContinuousFrame;
+			stream->submitIndex++;
+			stream->inFlight++;
+			IOLockUnlock(_ISOCHSTREAMLOCK);
+			
+			frames = &stream->frameList[slot * stream->framesPerSlot];
+			for (i = 0; i < stream->framesPerSlot; i++)
+				frames[i].frActCount = 0;
+			
+			completion.target = this;
+			completion.action = &IOUSBPipeV2::IsochStreamCompletion;
+			completion.parameter = (void *)(uintptr_t)slot;
+			
+			if (stream->isRead)
+				err = Read(stream->slots[slot], frameStart, stream->framesPerSlot, frames, &completion);
+			else
+				err = Write(stream->slots[slot], frameStart, stream->framesPerSlot, frames, &completion);
+			
+			IOLockLock(_ISOCHSTREAMLOCK);
+			if (err)
+			{
+				// a slot which never completes would put the ring out of step with writeIndex, so the stream ends here
+				USBLog(1, "IOUSBPipeV2[%p]::FillIsochStream - could not schedule slot %d at frame %qd (0x%x) - stopping the stream", this, (int)slot, frameStart, err);
+				stream->inFlight--;
+				stream->indices->lastError = err;
+				stream->stopping = true;
+			}
+		}
+	} while (stream->refill && !stream->stopping);
+	
+	stream->filling = false;
+	if (stream->stopping)
+		IOLockWakeup(_ISOCHSTREAMLOCK, stream, false);
+	IOLockUnlock(_ISOCHSTREAMLOCK);
+}
+
+
+
+//================================================================================================
+//
+//   IsochStreamCompletion
+//
+//================================================================================================
+//
+void
+IOUSBPipeV2::IsochStreamCompletion(void *target, void *parameter, IOReturn status, IOUSBIsocFrame *pFrames)
+{
+#pragma unused (parameter, pFrames)
+	IOUSBPipeV2				*me = OSDynamicCast(IOUSBPipeV2, (OSObject *)target);
+	IOUSBPipeIsochStream	*stream;
+	
+	if (!me || !me->_v2PipeExpansionData)
+		return;
+	
+	IOLockLock(me->_ISOCHSTREAMLOCK);
+	stream = me->_ISOCHSTREAM;
+	if (!stream)
+	{
+		IOLockUnlock(me->_ISOCHSTREAMLOCK);
+		return;
+	}
+	
+	stream->inFlight--;
+	
+	// once inFlight can reach zero StopIsochStream may drop the stream's reference on us, so keep our own across FillIsochStream
+	me->retain();
+	
+	if ((status != kIOReturnSuccess) && (status != kIOReturnUnderrun))
+	{
+		if (status != kIOReturnAborted)
+		{
+			USBLog(2, "IOUSBPipeV2[%p]::IsochStreamCompletion - slot %d completed with 0x%x - stopping the stream", me, (int)(uintptr_t)parameter, status);
+		}
+		stream->indices->lastError = status;
+		stream->stopping = true;
+	}
+	
+	// an aborted slot's frame list still holds whatever was there before, and the slots behind it are aborted too, so none of
+	// them is handed to the client.  Anything else has a final frame list, so the client may have it now
+	if (status == kIOReturnAborted)
+		stream->aborted = true;
+	if (!stream->aborted)
+		stream->indices->writeIndex++;
+	
+	if (stream->stopping)
+	{
+		IOLockWakeup(me->_ISOCHSTREAMLOCK, stream, false);
+		IOLockUnlock(me->_ISOCHSTREAMLOCK);
+		me->release();
+		return;
+	}
+	IOLockUnlock(me->_ISOCHSTREAMLOCK);
+	
+	me->FillIsochStream();
+	me->release();
+}
+
+
+
+//================================================================================================
+//
+//   FreeIsochStream
+//
+//================================================================================================
+//
+void
+IOUSBPipeV2::FreeIsochStream(IOUSBPipeIsochStream *stream)
+{
+	UInt32		i;
+	
+	if (!stream)
+		return;
+	
+	if (stream->slots)
+	{
+		for (i = 0; i < stream->slotCount; i++)
+		{
+			if (stream->slots[i])
+				stream->slots[i]->release();
+		}
+		IOFree(stream->slots, stream->slotCount * sizeof(IOMemoryDescriptor *));
+	}
+	
+	if (stream->buffer)
+	{
+		if (stream->prepared)
+			stream->buffer->complete();
+		stream->buffer->release();
+	}
+	
+	IOFree(stream, sizeof(IOUSBPipeIsochStream));
+}
+
+
+
 IOReturn 
 IOUSBPipeV2::CreateStreams(UInt32 maxStreams)
 {
@@ -870,12 +1605,12 @@ IOUSBPipeV2::SetPipePolicy(UInt16 maxPacketSize, UInt8 maxInterval)
 
 #pragma mark Padding Slots
 
-OSMetaClassDefineReservedUnused(IOUSBPipeV2,  0);
-OSMetaClassDefineReservedUnused(IOUSBPipeV2,  1);
-OSMetaClassDefineReservedUnused(IOUSBPipeV2,  2);
-OSMetaClassDefineReservedUnused(IOUSBPipeV2,  3);
-OSMetaClassDefineReservedUnused(IOUSBPipeV2,  4);
-OSMetaClassDefineReservedUnused(IOUSBPipeV2,  5);
+OSMetaClassDefineReservedUsed(IOUSBPipeV2,  0);
+OSMetaClassDefineReservedUsed(IOUSBPipeV2,  1);
+OSMetaClassDefineReservedUsed(IOUSBPipeV2,  2);
+OSMetaClassDefineReservedUsed(IOUSBPipeV2,  3);
+OSMetaClassDefineReservedUsed(IOUSBPipeV2,  4);
+OSMetaClassDefineReservedUsed(IOUSBPipeV2,  5);
 OSMetaClassDefineReservedUnused(IOUSBPipeV2,  6);
 OSMetaClassDefineReservedUnused(IOUSBPipeV2,  7);
 OSMetaClassDefineReservedUnused(IOUSBPipeV2,  8);
@@ -26,7 +26,9 @@
 
 #include <IOKit/IOCommand.h>
 #include <IOKit/IOCommandPool.h>
+#include <IOKit/IOLocks.h>
 #include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IODMACommand.h>
 #include <IOKit/usb/USB.h>
 
@@ -98,8 +100,23 @@ protected:
 		IOUSBCommand		*_masterUSBCommand;						// points from the bufferUSBCommand back to the parent command
 		UInt32				_streamID;
 		void *				_backTrace[kUSBCommandScratchBuffers];
+		IOBufferMemoryDescriptor *_bounceBuffer;						// the pooled buffer the tail of the transfer was bounced through
+		IOByteCount			_bounceOffset;							// offset in _origBuffer where the bounced part begins
+		
+		// the controller's list of outstanding bulk, interrupt and control commands, used to schedule the watchdog
+		UInt64				_watchdogDeadline;						// mach_absolute_time() by which the UIM should time this out, 0 if never
+		UInt64				_watchdogSubmitTime;					// mach_absolute_time() when the command went on the list
+		UInt64				_watchdogBaseline;						// first UIM pass which could have seen a no-data timeout start, 0 before that
+		UInt32				_watchdogSubmitFrame;					// GetFrameNumber32() when the command went on the list, 0 if unknown
+		IOUSBCommand *		_watchdogNext;
+		IOUSBCommand *		_watchdogPrev;
+		bool				_onWatchdogList;
     };
     ExpansionData * 		_expansionData;
+	
+	// _expansionData points here rather than at a second allocation.  Everything above keeps the offset it has always
+	// had, since UIMs built separately use the inline accessors; new per-command state goes at the end of ExpansionData
+    ExpansionData			_expansionStorage;
     
     // we override these OSObject method in order to allocate and release our expansion data
     virtual bool init();
@@ -140,6 +157,15 @@ public:
 	void					SetIsSyncTransfer(bool);
 	inline void				SetDMACommand(IODMACommand *dmaCommand)					{ _expansionData->_dmaCommand = dmaCommand; }
 	inline void				SetStreamID(UInt32 streamID)					{ _expansionData->_streamID = streamID; }
+	inline void				SetBounceBuffer(IOBufferMemoryDescriptor *buffer)		{ _expansionData->_bounceBuffer = buffer; }
+	inline void				SetBounceOffset(IOByteCount offset)				{ _expansionData->_bounceOffset = offset; }
+	inline void				SetWatchdogDeadline(UInt64 deadline)			{ _expansionData->_watchdogDeadline = deadline; }
+	inline void				SetWatchdogSubmitTime(UInt64 submitTime)		{ _expansionData->_watchdogSubmitTime = submitTime; }
+	inline void				SetWatchdogBaseline(UInt64 baseline)			{ _expansionData->_watchdogBaseline = baseline; }
+	inline void				SetWatchdogSubmitFrame(UInt32 frame)			{ _expansionData->_watchdogSubmitFrame = frame; }
+	inline void				SetWatchdogNext(IOUSBCommand *next)				{ _expansionData->_watchdogNext = next; }
+	inline void				SetWatchdogPrev(IOUSBCommand *prev)				{ _expansionData->_watchdogPrev = prev; }
+	inline void				SetOnWatchdogList(bool onList)					{ _expansionData->_onWatchdogList = onList; }
 	void					SetBufferUSBCommand(IOUSBCommand *bufferUSBCommand);
 	void					SetBT(UInt32 index, void * value);
 	
@@ -174,6 +200,15 @@ public:
 	inline IODMACommand *		GetDMACommand(void)							{return _expansionData->_dmaCommand; }
 	inline UInt32				GetStreamID(void)							{return _expansionData->_streamID; }
 	inline IOUSBCommand *		GetBufferUSBCommand(void)					{return _expansionData->_bufferUSBCommand; }
+	inline IOBufferMemoryDescriptor *	GetBounceBuffer(void)				{return _expansionData->_bounceBuffer; }
+	inline IOByteCount			GetBounceOffset(void)						{return _expansionData->_bounceOffset; }
+	inline UInt64				GetWatchdogDeadline(void)					{return _expansionData->_watchdogDeadline; }
+	inline UInt64				GetWatchdogSubmitTime(void)					{return _expansionData->_watchdogSubmitTime; }
+	inline UInt64				GetWatchdogBaseline(void)					{return _expansionData->_watchdogBaseline; }
+	inline UInt32				GetWatchdogSubmitFrame(void)				{return _expansionData->_watchdogSubmitFrame; }
+	inline IOUSBCommand *		GetWatchdogNext(void)						{return _expansionData->_watchdogNext; }
+	inline IOUSBCommand *		GetWatchdogPrev(void)						{return _expansionData->_watchdogPrev; }
+	inline bool					GetOnWatchdogList(void)						{return _expansionData->_onWatchdogList; }
 };
 
 
@@ -258,16 +293,50 @@ public:
 	bool					GetLowLatency(void)								{ return _expansionData->_lowLatency; }
 };
 
+enum
+{
+	kUSBCommandPoolMagazines		= 8,			// per CPU caches in front of the gated pool (CPUs beyond this share)
+	kUSBCommandPoolMagazineSize		= 16			// commands each one holds before returns spill to the gated pool
+};
+
+/*
+ * A small spin lock protected stack of free commands. getCommand and returnCommand go
+ * to the magazine for the current CPU first and only take the workloop gate when it is
+ * empty (get) or full (return).
+ */
+typedef struct IOUSBCommandMagazine
+{
+	IOSimpleLock *			lock;
+	UInt32					count;
+	UInt32					hits;						// getCommand satisfied from this magazine
+	UInt32					misses;						// getCommand which had to go through the gate
+	IOCommand *				commands[kUSBCommandPoolMagazineSize];
+} IOUSBCommandMagazine;
+
 class IOUSBCommandPool : public IOCommandPool
 {
     OSDeclareDefaultStructors( IOUSBCommandPool )
 	
+	IOUSBCommandMagazine	_magazines[kUSBCommandPoolMagazines];
+	
 protected:
     virtual IOReturn gatedReturnCommand(IOCommand * command);
 	virtual IOReturn gatedGetCommand(IOCommand ** command, bool blockForCommand);
+	virtual void free();
+	
+	IOReturn				PrepareCommandForPool(IOCommand * command);
 	
 public:
     static IOCommandPool * withWorkLoop(IOWorkLoop * inWorkLoop);
+	
+	virtual bool			initWithWorkLoop(IOWorkLoop * inWorkLoop);
+	virtual IOCommand *		getCommand(bool blockForCommand = true);
+	virtual void			returnCommand(IOCommand * command);
+	
+	// put everything sitting in the magazines back into the gated pool, e.g. before trimming or growing it,
+	// and return how many commands that was
+	UInt32					DrainMagazines(void);
+	void					GetMagazineStatistics(UInt32 * hits, UInt32 * misses);
 };
 
 
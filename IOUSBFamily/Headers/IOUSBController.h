@@ -86,11 +86,36 @@ enum
     kErrataEHCIUseRLvalue                       = (1 << 26)     // we want to program Control and Bulk QHs with the RL on some controllers
 };
 
+// The watchdog fires at the earliest outstanding transfer deadline (plus kUSBWatchdogSlackMS, so the UIM's frame
+// based check sees it as expired), but at least every kUSBWatchdogTimeoutMS while any transfer is queued, since
+// that is when the UIM does its periodic checks.  Once the controller has been idle for kUSBWatchdogIdleTicks of
+// those, it is left disarmed until the next transfer.
 enum
 {
-    kUSBWatchdogTimeoutMS = 1000
+    kUSBWatchdogTimeoutMS = 1000,
+    kUSBWatchdogSlackMS = 2,
+    kUSBWatchdogIdleTicks = 32							// housekeeping ticks after the controller goes idle, enough for the pools and the UIM to trim
 };
 
+// Bounce buffers for disjoint descriptors are kept in size classes of kUSBBounceBufferMinSize << (2 * class)
+// (1K, 4K, 16K, 64K), with at most kUSBBounceBuffersPerClass idle buffers held per class
+enum
+{
+	kUSBBounceBufferClasses		= 4,
+	kUSBBounceBuffersPerClass	= 4,
+	kUSBBounceBufferMinSize		= 1024
+};
+
+// Client completions for bulk and interrupt transfers can be handed to up to kUSBCompletionQueuesMax completion
+// threads instead of being called on the workloop.  This is off unless the controller's personality sets
+// kUSBCompletionThreadsKey to a non-zero count.  Every pipe always maps to the same queue, so completions for
+// a pipe are still delivered in order.
+enum
+{
+	kUSBCompletionQueuesMax		= 8
+};
+#define kUSBCompletionThreadsKey	"USBCompletionThreads"
+
 
 // Here are some constants which really need to be moved to IOPCIFamily
 // This is a Power Management Register Block (section 3.2 of the PCI Power Management Spec)
@@ -164,6 +189,8 @@ class IOUSBLog;
 class IOUSBHubDevice;
 class IOUSBRootHubDevice;
 class IOMemoryDescriptor;
+class IOBufferMemoryDescriptor;
+struct IOUSBCompletionQueue;
 class AppleUSBHubPort;
 
 //================================================================================================
@@ -222,6 +249,36 @@ protected:
 		UInt32				_isochMaxBusStall;					// value (in ns) of the maximum PCI bus stall allowed for Isoch.
 		SInt32				_activeInterruptTransfers;			// interrupt transfers in the queue
 		IOUSBRootHubDevice	*_rootHubDeviceSS;
+		UInt32				_commandPoolIdleTicks;				// watchdog ticks since either command pool last had to grow
+		UInt32				_commandPoolHighWater;				// largest _currentSizeOfCommandPool we have had
+		UInt32				_isocCommandPoolHighWater;			// largest _currentSizeOfIsocCommandPool we have had
+		IOSimpleLock		*_bounceBufferLock;					// protects the bounce buffer pool and its counters
+		IOBufferMemoryDescriptor *_bounceBuffers[kUSBBounceBufferClasses][kUSBBounceBuffersPerClass];	// idle, already prepared
+		UInt32				_bounceBufferCount[kUSBBounceBufferClasses];
+		UInt32				_bounceCount;						// transfers which needed a bounce buffer
+		UInt64				_bounceBytes;						// bytes which went through a bounce buffer
+		UInt32				_bounceBufferHits;					// bounce buffers which came from the pool
+		UInt32				_bounceBufferMisses;				// bounce buffers which had to be allocated
+		UInt32				_bounceCountReported;				// _bounceCount when we last updated the properties
+		IOUSBCompletionQueue *_completionQueues;				// deferred completion queues, NULL if completions are called inline
+		UInt32				_completionQueueCount;
+		bool				_completionQueuesStopping;			// set in stop() - no new completions are deferred after this
+		UInt32				_completionBypassPipe;				// pipe being aborted or closed, whose completions are not deferred (0 if none)
+		UInt32				_deferredCompletionsReported;		// deferred completion count when we last updated the properties
+		IOUSBCommand		*_watchdogCommands;					// outstanding control, interrupt and bulk commands, see WatchdogTrackCommand
+		UInt32				_watchdogCommandCount;
+		UInt32				_watchdogTimedCommandCount;			// those of them which have a timeout, and so a deadline
+		UInt64				_watchdogDeadline;					// when the watchdog is due to fire, 0 if it is disarmed
+		UInt32				_watchdogWakeups;					// times the watchdog has fired
+		UInt32				_watchdogDisarms;					// times it was left disarmed because the controller was idle
+		UInt32				_watchdogWakeupsReported;			// _watchdogWakeups when we last updated the properties
+		UInt32				_watchdogIdleTicks;					// housekeeping ticks since anything was outstanding
+		UInt64				_watchdogMaxLateness;				// worst time between a deadline and the watchdog running for it
+		UInt64				_watchdogLastHousekeeping;			// when we last trimmed the pools and updated the statistics
+		UInt32				_devZeroAcquisitions;				// times AcquireDeviceZero got the device zero lock
+		UInt64				_devZeroWaitTime;					// total time spent waiting for the device zero lock
+		UInt64				_devZeroHoldTime;					// total time the device zero lock has been held
+		UInt64				_devZeroAcquiredTime;				// when the current holder got the lock, 0 if not from AcquireDeviceZero
     };
     ExpansionData *_expansionData;
 	
@@ -240,6 +297,13 @@ public:
 	
     void 				ReturnUSBCommand( IOUSBCommand *  command );
 	
+	IOBufferMemoryDescriptor *	GetBounceBuffer( IOByteCount length );
+	void				ReturnBounceBuffer( IOBufferMemoryDescriptor * buffer );
+	
+	// Queues the client completion of an asynchronous transfer to a completion thread.  Returns false if the
+	// caller should call the completion itself - deferral is off, the transfer is synchronous, or we are stopping.
+	bool				DeferCompletion( IOUSBCommand * command, IOUSBCompletion completion, IOReturn status, UInt32 actualByteCount, AbsoluteTime * timeStamp = NULL );
+	
 protected:
 		
     IOReturn			getNubResources( IOService *  regEntry );
@@ -1106,6 +1170,25 @@ public:
 protected:
     void							IncreaseIsocCommandPool();
     void							IncreaseCommandPool();
+	void							TrimCommandPools();
+	void							DrainCommandPoolMagazines();
+	void							UpdateCommandPoolStatistics();
+	void							FreeBounceBuffers();
+	void							UpdateBounceBufferStatistics();
+	bool							AllocateCompletionQueues( UInt32 count );
+	void							FreeCompletionQueues();
+	void							UpdateCompletionQueueStatistics();
+	static void						CompletionQueueEntry( OSObject * target, thread_call_param_t queue );
+	static IOReturn					DoStopCompletionQueues( OSObject * owner, void * arg0, void * arg1, void * arg2, void * arg3 );
+	bool							CallQueuedCompletions( UInt32 pipe );
+	UInt32							BeginCompletionBypass( USBDeviceAddress address, UInt8 endpoint, UInt8 direction );
+	void							EndCompletionBypass( UInt32 previousPipe );
+	void							WaitForPipeCompletions( USBDeviceAddress address, UInt8 endpoint, UInt8 direction );
+	void							WatchdogTrackCommand( IOUSBCommand * command );
+	void							WatchdogUntrackCommand( IOUSBCommand * command );
+	void							ScheduleWatchdog( bool afterTimeoutCheck = false );
+	void							UpdateWatchdogStatistics();
+	void							UpdateDeviceZeroStatistics();
     void							ParsePCILocation(const char *str, int *deviceNum, int *functionNum);
     int								ValueOfHexDigit(char c);
 	
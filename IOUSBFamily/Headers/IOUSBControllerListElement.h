@@ -118,6 +118,7 @@ public:
 	UInt32								interval;					// this is the decoded interval value for HS endpoints and is 1 for FS endpoints
     UInt8								direction;
 	bool								aborting;
+	IOUSBControllerIsochEndpoint		*nextHashEP;				// next endpoint in the same IOUSBControllerV2 hash bucket
 };
 
 
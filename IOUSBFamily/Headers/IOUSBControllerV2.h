@@ -29,6 +29,12 @@
 #include <IOKit/usb/IOUSBControllerListElement.h>
 #include <IOKit/usb/IOUSBController.h>
 
+// Active isoch endpoints are hashed on (function address, endpoint number, direction) into this many buckets
+// so that FindIsochronousEndpoint does not have to walk _isochEPList for every transfer
+enum
+{
+	kUSBIsochEPHashBuckets	= 64
+};
 
 
 /*!
@@ -62,6 +68,7 @@ protected:
 		IOUSBControllerIsochEndpoint				*_isochEPList;						// linked list of active Isoch "endpoints"
 		IOUSBControllerIsochEndpoint				*_freeIsochEPList;					// linked list of freed Isoch EP data structures
 		thread_call_t								_returnIsochDoneQueueThread;
+		IOUSBControllerIsochEndpoint				*_isochEPHash[kUSBIsochEPHashBuckets];	// the same endpoints as _isochEPList, chained through nextHashEP
 	};
     V2ExpansionData *_v2ExpansionData;
 
@@ -83,6 +90,7 @@ protected:
 	#define _isochEPList						_v2ExpansionData->_isochEPList
 	#define _freeIsochEPList					_v2ExpansionData->_freeIsochEPList
 	#define _returnIsochDoneQueueThread			_v2ExpansionData->_returnIsochDoneQueueThread
+	#define _isochEPHash						_v2ExpansionData->_isochEPHash
 	
     virtual bool 		init( OSDictionary *  propTable );
     virtual bool 		start( IOService *  provider );
@@ -103,6 +111,9 @@ protected:
                               USBDeviceAddress hubAddress,
                               int port);
 
+	// unlinks an endpoint made by CreateIsochronousEndpoint from _isochEPList and the hash, before the UIM deallocates it
+	void		RemoveIsochronousEndpoint(IOUSBControllerIsochEndpoint *pEP);
+
 public:
 
        /*!
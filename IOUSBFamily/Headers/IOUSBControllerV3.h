@@ -443,8 +443,15 @@ class IOUSBControllerV3 : public IOUSBControllerV2
      */
     virtual IOReturn        GetBandwidthAvailableForDevice(IOUSBDevice *forDevice, UInt32 *pBandwidthAvailable);
     
+	OSMetaClassDeclareReservedUsed(IOUSBControllerV3,  20);
+    /* !
+     @function UIMCheckForCommandTimeouts
+     @abstract UIM function, called when the watchdog comes in early for a command deadline. Only the outstanding transfers
+     need to be looked at - UIMCheckForTimeouts is still called once a second for the rest of the periodic checks.  The default
+     implementation calls UIMCheckForTimeouts.
+     */
+    virtual void			UIMCheckForCommandTimeouts(void);
 
-	OSMetaClassDeclareReservedUnused(IOUSBControllerV3,  20);
 	OSMetaClassDeclareReservedUnused(IOUSBControllerV3,  21);
 	OSMetaClassDeclareReservedUnused(IOUSBControllerV3,  22);
 	OSMetaClassDeclareReservedUnused(IOUSBControllerV3,  23);
@@ -46,11 +46,18 @@
 #define kAllowConfigValueOfZero		"kAllowZeroConfigValue"
 #define kAllowNumConfigsOfZero		"kAllowZeroNumConfigs"
 
+// If this Boolean property is true on the device (or on its controller), every string referenced by the device and
+// configuration descriptors is read into the string descriptor cache when the device is started
+//
+#define kUSBPrefetchStringsKey		"USBPrefetchStrings"
+
 
 class IOUSBController;
 class IOUSBControllerV2;
 class IOUSBInterface;
 class IOUSBHubPolicyMaker;
+struct IOUSBStringCacheEntry;
+struct IOUSBConfigIndex;
 /*!
     @class IOUSBDevice
     @abstract The IOService object representing a device on the USB bus.
@@ -130,12 +137,27 @@ protected:
 		UInt32					_wakeUSB3PowerAllocated;			// how much extra "USB3" power during wake did we already give our client
 		bool					_attachedToEnclosureAndUsingExtraWakePower;
 		bool					_deviceIsOnThunderbolt;					// Will be set if all our upstream hubs are on Thunderbolt
+		IOLock *				_stringCacheLock;					// protects _stringCache and the counters
+		IOUSBStringCacheEntry *	_stringCache;						// strings we have already read, by index and language
+		UInt32					_stringCacheHits;
+		UInt32					_stringCacheMisses;
+		thread_call_t			_stringCacheStatsThread;			// publishes the counters a little after a hit, off the lookup path
+		bool					_stringCacheStatsPending;			// _stringCacheStatsThread has been entered and has not run yet
+		IOUSBConfigIndex **		_configIndexList;					// parallel to _configList - where each descriptor starts, built when the config is cached
+		IOUSBMatchingStatistics	_matchingStatistics;				// time spent in matchPropertyTable
 
     };
     ExpansionData * _expansionData;
 
     const IOUSBConfigurationDescriptor *FindConfig(UInt8 configValue, UInt8 *configIndex=0);
 
+	bool		CopyCachedString(UInt8 index, UInt16 lang, char *utf8Buffer, int utf8BufferSize);
+	void		CacheString(UInt8 index, UInt16 lang, const char *utf8String, UInt32 length);
+	void		FlushStringCache(void);
+	static void	PublishStringCacheStatisticsEntry(OSObject *target, thread_call_param_t unused);
+	void		PrefetchStringDescriptors(void);
+	IOUSBConfigIndex *	GetConfigIndex(const IOUSBConfigurationDescriptor *configDesc);
+
     virtual IOUSBInterface * GetInterface(const IOUSBInterfaceDescriptor *interface);
 
 public:
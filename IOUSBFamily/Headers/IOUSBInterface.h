@@ -31,6 +31,11 @@
 #include <IOKit/usb/IOUSBNub.h>
 #include <IOKit/usb/IOUSBDevice.h>
 
+enum
+{
+	kUSBPipeIndexTypeDirectionCount = 16		// 4 transfer types x (kUSBOut, kUSBIn, kUSBNone, kUSBAnyDirn)
+};
+
 /*!
     @class IOUSBInterface
     @abstract The object representing an interface of a device on the USB bus.
@@ -70,6 +75,9 @@ protected:
 		IOLock *			_pipeObjLock;				// Deprecated
 		OSSet *				_openClients;
         UInt32              _RememberedStreams[kUSBMaxPipes];
+		IOUSBMatchingStatistics	_matchingStatistics;	// time spent in matchPropertyTable
+		UInt8				_pipeIndexByAddress[kUSBMaxPipes];			// _pipeList index + 1 for each endpoint number, IN endpoints at +16.  0 if none
+		UInt32				_pipesByTypeAndDirection[kUSBPipeIndexTypeDirectionCount];	// bitmask of _pipeList entries for each (transferType << 2) | direction
     };
     ExpansionData * _expansionData;
 
@@ -86,6 +94,7 @@ protected:
     IOReturn 			ReopenPipesGated();             // relink all pipes (except pipe zero) (not virtual)
 	void	 			RememberStreamsGated(void);
 	IOReturn	 		RecreateStreamsGated(void);
+	void				RebuildPipeIndex(void);			// recompute the _pipeList lookup tables after a pipe is added or removed
     
     // Return the "Full" MaxPacketSize, given an endpoint descriptor and a pointer to an sscd if there is one
     // This will multiple the MPS in the ep by the mult and the burst which may or may not be present
@@ -27,6 +27,7 @@
 #include <IOKit/IOService.h>
 #include <libkern/c++/OSData.h>
 #include <IOKit/IOMemoryDescriptor.h>
+#include <kern/thread_call.h>
 
 #include <IOKit/usb/USB.h>
 
@@ -46,6 +47,59 @@ extern const OSSymbol *gUSBDeviceProtocol;
 class IOUSBController;
 class IOUSBPipe;
 
+// The keys a compiled matching dictionary knows about - bit (1 << key) in the masks below
+//
+enum
+{
+	kUSBMatchVendorID = 0,
+	kUSBMatchProductID,
+	kUSBMatchDeviceReleaseNumber,
+	kUSBMatchDeviceClass,
+	kUSBMatchDeviceSubClass,
+	kUSBMatchDeviceProtocol,
+	kUSBMatchInterfaceNumber,
+	kUSBMatchConfigurationValue,
+	kUSBMatchInterfaceClass,
+	kUSBMatchInterfaceSubClass,
+	kUSBMatchInterfaceProtocol,
+	kUSBMatchProductIDMask,
+	kUSBMatchKeyCount,
+	
+	kUSBDeviceMatchKeys = (1 << kUSBMatchVendorID) | (1 << kUSBMatchProductID) | (1 << kUSBMatchDeviceReleaseNumber) |
+						  (1 << kUSBMatchDeviceClass) | (1 << kUSBMatchDeviceSubClass) | (1 << kUSBMatchDeviceProtocol),
+	kUSBInterfaceMatchKeys = (1 << kUSBMatchVendorID) | (1 << kUSBMatchProductID) | (1 << kUSBMatchDeviceReleaseNumber) |
+							 (1 << kUSBMatchInterfaceNumber) | (1 << kUSBMatchConfigurationValue) |
+							 (1 << kUSBMatchInterfaceClass) | (1 << kUSBMatchInterfaceSubClass) | (1 << kUSBMatchInterfaceProtocol),
+	
+	kUSBCompiledMatchCacheSize = 256						// matching dictionaries we keep compiled, must be a power of 2
+};
+
+// A matching dictionary boiled down to integers, so that matchPropertyTable does not have to look anything up in it.
+// The numbers in the kUSBProductIdsArrayName array, if there is one, follow the structure.
+//
+typedef struct IOUSBCompiledMatch
+{
+	UInt32		dictionaryCount;						// getCount() of the dictionary when it was compiled
+	UInt32		present;								// keys in the dictionary, whatever their type
+	UInt32		numeric;								// keys whose value is an OSNumber
+	UInt32		wildCard;								// keys whose value is the OSString "*"
+	UInt64		value[kUSBMatchKeyCount];
+	bool		hasProductIDArray;
+	UInt32		productIDCount;
+	UInt64		productIDs[0];
+} IOUSBCompiledMatch;
+
+// The time a device or interface has spent in matchPropertyTable, published as "MatchingTimeUS" and "MatchingCount".  That is
+// the time spent comparing the nub against every personality of its class, not the time taken to probe or start a driver.
+//
+typedef struct IOUSBMatchingStatistics
+{
+	UInt64					time;						// total nanoseconds
+	UInt32					count;						// number of calls
+	volatile UInt32			publishPending;				// publishThread has been entered and has not run yet
+	thread_call_t			publishThread;				// allocated by the first AddMatchingTime
+} IOUSBMatchingStatistics;
+
 /*
  IOUSBNub
  Super class for for IOUSBDevice and IOUSBInterface.
@@ -67,6 +121,13 @@ public:
 	bool							USBComparePropertyInArray( OSDictionary *matching, const char *arrayName, const char * key, UInt32 * theProductIDThatMatched );
 	bool							USBComparePropertyInArrayWithMask( OSDictionary *matching, const char *arrayName, const char * key, const char * maskKey, UInt32 * theProductIDThatMatched );
 
+	OSData *						CopyCompiledMatch( OSDictionary * matching );
+	void							CompareCompiledMatch( const IOUSBCompiledMatch * compiled, UInt32 keys, UInt32 * matches, UInt32 * wildCards, UInt32 * theProductIDThatMatched, bool * usedMaskForProductID );
+	void							CompareMatchKeys( OSDictionary * matching, UInt32 keys, UInt32 * present, bool * hasProductIDArray, UInt32 * matches, UInt32 * wildCards, UInt32 * theProductIDThatMatched, bool * usedMaskForProductID );
+	void							AddMatchingTime( uint64_t startTime, IOUSBMatchingStatistics * statistics );
+	void							FreeMatchingStatistics( IOUSBMatchingStatistics * statistics );
+	static void						PublishMatchingStatisticsEntry( OSObject * target, thread_call_param_t statistics );
+
 };
 
 #ifdef __cplusplus
@@ -34,6 +34,20 @@ class IOUSBInterface;
 
 #define	kAppleUSBSSIsocContinuousFrame		0xFFFFFFFFFFFFFFFEull
 
+/*!
+    @struct IOUSBPipeBatchEntry
+    @discussion One transfer in a ReadBatch or WriteBatch call.
+    @field buffer place to put (or get) the transferred data
+    @field reqCount requested number of bytes to transfer. must be <= buffer->getLength()
+    @field completion describes action to take when this transfer has completed. must have a non NULL action
+*/
+typedef struct IOUSBPipeBatchEntry
+{
+	IOMemoryDescriptor *			buffer;
+	IOByteCount						reqCount;
+	IOUSBCompletion					completion;
+} IOUSBPipeBatchEntry;
+
 /*!
     @class IOUSBPipe
     @abstract The object representing an open pipe for a device.
@@ -71,6 +85,9 @@ protected:
     
     IOReturn ClosePipe(void);
 	
+	static IOReturn DoTransferBatch(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+	IOReturn		TransferBatch(IOUSBPipeBatchEntry *entries, UInt32 count, UInt32 noDataTimeout, UInt32 completionTimeout, UInt32 *entriesQueued, bool isRead);
+	
 public:
     
     // The following 4 methods are deprecated (replaced by the new IOUSBPipeV2 class)
@@ -385,8 +402,40 @@ public:
     OSMetaClassDeclareReservedUsed(IOUSBPipe,  14);
 	virtual UInt8	GetSyncType(void);
 	
-    OSMetaClassDeclareReservedUnused(IOUSBPipe,  15);
-    OSMetaClassDeclareReservedUnused(IOUSBPipe,  16);
+    OSMetaClassDeclareReservedUsed(IOUSBPipe,  15);
+    /*!
+        @function ReadBatch
+	 Queue several asynchronous reads on an interrupt or bulk endpoint at once. The transfers are queued in order while holding the controller's
+	 gate, so the per call cost of getting into the controller is paid once for the whole batch. If one of the transfers cannot be queued, the
+	 ones before it stay queued (and will complete normally), the rest are not queued, and the error is returned.
+	 @param entries the transfers to queue
+	 @param count number of entries
+	 @param noDataTimeout number of milliseconds of no bus activity until a transaction times out (bulk only)
+	 @param completionTimeout number of milliseconds from the time a transaction is placed on the bus until it times out (bulk only)
+	 @param entriesQueued if not NULL, returns the number of entries which were queued
+	 */
+	virtual IOReturn ReadBatch(IOUSBPipeBatchEntry *	entries,
+							   UInt32					count,
+							   UInt32					noDataTimeout,
+							   UInt32					completionTimeout,
+							   UInt32 *					entriesQueued = 0);
+	
+    OSMetaClassDeclareReservedUsed(IOUSBPipe,  16);
+    /*!
+        @function WriteBatch
+	 Queue several asynchronous writes on an interrupt or bulk endpoint at once. See ReadBatch.
+	 @param entries the transfers to queue
+	 @param count number of entries
+	 @param noDataTimeout number of milliseconds of no bus activity until a transaction times out (bulk only)
+	 @param completionTimeout number of milliseconds from the time a transaction is placed on the bus until it times out (bulk only)
+	 @param entriesQueued if not NULL, returns the number of entries which were queued
+	 */
+	virtual IOReturn WriteBatch(IOUSBPipeBatchEntry *	entries,
+								UInt32					count,
+								UInt32					noDataTimeout,
+								UInt32					completionTimeout,
+								UInt32 *				entriesQueued = 0);
+	
     OSMetaClassDeclareReservedUnused(IOUSBPipe,  17);
 	OSMetaClassDeclareReservedUnused(IOUSBPipe,  18);
     OSMetaClassDeclareReservedUnused(IOUSBPipe,  19);
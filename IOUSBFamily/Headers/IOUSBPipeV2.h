@@ -31,6 +31,44 @@
 #include <IOKit/usb/IOUSBControllerV2.h>
 #include <IOKit/usb/IOUSBPipe.h>
 
+// Buffers registered with IOUSBPipeV2::RegisterBuffer.  Each one remembers the sub-descriptors it has handed out for
+// the last few offsets, so that cycling through the same slices of a buffer does not create a descriptor per transfer
+enum
+{
+	kUSBPipeMaxRegisteredBuffers		= 16,
+	kUSBPipeRegisteredBufferSlices		= 8
+};
+
+struct IOUSBPipeRegisteredBuffer
+{
+	UInt32							bufferID;											// 0 if the slot is free
+	IOMemoryDescriptor *			buffer;												// prepared for as long as it is registered
+	IOMemoryDescriptor *			slices[kUSBPipeRegisteredBufferSlices];				// buffer from sliceOffset[i] to the end
+	IOByteCount						sliceOffset[kUSBPipeRegisteredBufferSlices];
+	UInt32							nextSlice;											// round robin replacement
+};
+
+/*!
+    @struct IOUSBIsochStreamIndices
+    @discussion Progress of an isochronous stream started with IOUSBPipeV2::StartIsochStream, shared between the pipe and the client.
+	Slot n of the stream is ring entry (n % slotCount).  Slots from readIndex up to writeIndex have completed and belong to the client.
+	A slot is only put back on the schedule once the client has moved readIndex past it, unless the client holds every slot but the last
+	one on the schedule, in which case the oldest one is taken back so that the schedule never runs dry, and overruns is incremented.
+    @field writeIndex number of slots the controller has completed.  Slots which were aborted, by StopIsochStream or otherwise, are not counted.  Written only by the pipe.
+    @field readIndex number of slots the client is done with.  Written only by the client.
+    @field overruns number of slots which were rescheduled before the client had released them.
+    @field lastError last error status with which a slot completed or could not be scheduled.  The stream stops on anything but an underrun.
+*/
+typedef struct IOUSBIsochStreamIndices
+{
+	volatile UInt32					writeIndex;
+	volatile UInt32					readIndex;
+	volatile UInt32					overruns;
+	volatile IOReturn				lastError;
+} IOUSBIsochStreamIndices;
+
+struct IOUSBPipeIsochStream;
+
 
 /*!
     @class IOUSBPipeV2
@@ -54,12 +92,25 @@ protected:
 
     struct V2PipeExpansionData
     {
+		IOLock *					_registeredBufferLock;
+		UInt32						_registeredBufferGeneration;
+		IOUSBPipeRegisteredBuffer	_registeredBuffers[kUSBPipeMaxRegisteredBuffers];
+		IOLock *					_isochStreamLock;
+		IOUSBPipeIsochStream *		_isochStream;						// NULL unless StartIsochStream has been called
     };
     V2PipeExpansionData * _v2PipeExpansionData;
     	
     static IOUSBPipeV2 *ToEndpoint(const IOUSBEndpointDescriptor *endpoint, IOUSBSuperSpeedEndpointCompanionDescriptor *sscd,
                                  IOUSBDevice * device, IOUSBController * controller, IOUSBInterface *interface);
 	
+    virtual void free();
+	
+	IOMemoryDescriptor *	CopyRegisteredBufferSlice(UInt32 bufferID, IOByteCount offset, IOByteCount reqCount);
+	
+	void					FillIsochStream(void);
+	static void				FreeIsochStream(IOUSBPipeIsochStream *stream);
+	static void				IsochStreamCompletion(void *target, void *parameter, IOReturn status, IOUSBIsocFrame *pFrames);
+	
 public:
     using IOUSBPipe::Read;
     using IOUSBPipe::Write;
@@ -161,12 +212,92 @@ public:
 	 */
     virtual UInt16 GetBytesPerInterval();
 	
-	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  0);
-	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  1);
-	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  2);
-	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  3);
-	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  4);
-	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  5);
+	OSMetaClassDeclareReservedUsed(IOUSBPipeV2,  0);
+	/*!
+	 @function RegisterBuffer
+	 Register a buffer which will be used for many transfers on this pipe.  The buffer is prepared (wired) once here and stays
+	 prepared until it is unregistered, and transfers on it are then made with ReadRegisteredBuffer and WriteRegisteredBuffer.
+	 The pipe keeps a reference to the buffer while it is registered.
+	 @param buffer the buffer to register
+	 @param bufferID returns the ID to use for transfers on this buffer
+	 */
+	virtual IOReturn RegisterBuffer(IOMemoryDescriptor * buffer, UInt32 * bufferID);
+	
+	OSMetaClassDeclareReservedUsed(IOUSBPipeV2,  1);
+	/*!
+	 @function UnregisterBuffer
+	 Unregister a buffer registered with RegisterBuffer. There must be no transfers outstanding on the buffer.
+	 @param bufferID the ID returned by RegisterBuffer
+	 */
+	virtual IOReturn UnregisterBuffer(UInt32 bufferID);
+	
+	OSMetaClassDeclareReservedUsed(IOUSBPipeV2,  2);
+    /*!
+	 @function ReadRegisteredBuffer
+     Read from an interrupt or bulk endpoint into a registered buffer
+     @param bufferID ID of the buffer, from RegisterBuffer
+     @param offset offset in the buffer at which to put the data
+     @param noDataTimeout number of milliseconds of no bus activity until transaction times out.
+     @param completionTimeout number of milliseconds from the time the transaction is placed on the bus until it times out
+     @param reqCount requested number of bytes to transfer. offset + reqCount must be <= the length of the buffer
+     @param completion describes action to take when the data has been transferred
+     @param bytesRead returns total bytes read for synchronous reads
+     */
+	virtual IOReturn ReadRegisteredBuffer(UInt32				bufferID,
+										  IOByteCount			offset,
+										  UInt32				noDataTimeout,
+										  UInt32				completionTimeout,
+										  IOByteCount			reqCount,
+										  IOUSBCompletion *		completion = 0,
+										  IOByteCount *			bytesRead = 0);
+	
+	OSMetaClassDeclareReservedUsed(IOUSBPipeV2,  3);
+    /*!
+	 @function WriteRegisteredBuffer
+     Write to an interrupt or bulk endpoint from a registered buffer
+     @param bufferID ID of the buffer, from RegisterBuffer
+     @param offset offset in the buffer of the data to send
+     @param noDataTimeout number of milliseconds of no bus activity until transaction times out.
+     @param completionTimeout number of milliseconds from the time the transaction is placed on the bus until it times out
+     @param reqCount requested number of bytes to transfer. offset + reqCount must be <= the length of the buffer
+     @param completion describes action to take when the data has been transferred
+     */
+	virtual IOReturn WriteRegisteredBuffer(UInt32				bufferID,
+										   IOByteCount			offset,
+										   UInt32				noDataTimeout,
+										   UInt32				completionTimeout,
+										   IOByteCount			reqCount,
+										   IOUSBCompletion *	completion = 0);
+	
+	OSMetaClassDeclareReservedUsed(IOUSBPipeV2,  4);
+    /*!
+	 @function StartIsochStream
+     Start streaming on an isochronous endpoint.  The buffer is divided into slotCount consecutive slots of framesPerSlot frames each,
+	 the size of each slot being the sum of the frReqCount fields of its frames in frameList.  The pipe keeps the slots scheduled
+	 back to back until StopIsochStream is called, and the client follows the progress of the stream in indices instead of
+	 getting a completion for every slot.  For an OUT endpoint the client must have filled the slots before calling this.
+     @param buffer the ring of slots. It stays prepared while the stream is running
+     @param frameStart USB frame number at which to start the first slot. Later slots follow on without a gap
+     @param slotCount number of slots in the ring - at least 2
+     @param framesPerSlot number of frames in each slot
+     @param frameList slotCount * framesPerSlot frames. The client sets frReqCount, and the pipe reports frActCount and frStatus of completed slots here
+     @param indices shared progress of the stream
+     */
+	virtual IOReturn StartIsochStream(IOMemoryDescriptor *			buffer,
+									  UInt64						frameStart,
+									  UInt32						slotCount,
+									  UInt32						framesPerSlot,
+									  IOUSBIsocFrame *				frameList,
+									  IOUSBIsochStreamIndices *		indices);
+	
+	OSMetaClassDeclareReservedUsed(IOUSBPipeV2,  5);
+	/*!
+	 @function StopIsochStream
+	 Stop a stream started with StartIsochStream.  Aborts the slots which are still scheduled and returns once they have all completed.
+	 Must not be called on the controller's workloop.
+	 */
+	virtual IOReturn StopIsochStream(void);
+	
 	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  6);
 	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  7);
 	OSMetaClassDeclareReservedUnused(IOUSBPipeV2,  8);
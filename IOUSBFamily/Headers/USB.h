@@ -1204,6 +1204,7 @@ enum {
 #define kUSBSuspendPort							"kSuspendPort"
 #define kUSBExpressCardCantWake					"ExpressCardCantWake"
 #define kUSBControllerNeedsContiguousMemoryForIsoch	"Need contiguous memory for isoch"
+#define kUSBControllerPerSlotAddressing			"Per-slot addressing"
 #define kUSBHubDontAllowLowPower				"kUSBHubDontAllowLowPower"
 #define kUSBDeviceResumeRecoveryTime			"kUSBDeviceResumeRecoveryTime"
 #define kUSBOutOfSpecMPSOK						"Out of spec MPS OK"
@@ -220,7 +220,8 @@ extern "C" {
 		kTPBulkPacketHandlerData					= 39,
 		kTPInterruptPacketHandlerData				= 40,
         kTPControllerPutTDOnDoneQueue               = 41,
-        kTPControllerHibernationWake                = 42
+        kTPControllerHibernationWake                = 42,
+		kTPControllerWatchdog						= 43
 	};
 	
 	// USB Device Tracepoints			
@@ -50,6 +50,15 @@
 #define FDELAYED_WORKLOOP_FREE						fIOUSBInterfaceUserClientExpansionData->fDelayedWorkLoopFree
 #define FOWNER_WAS_RELEASED							fIOUSBInterfaceUserClientExpansionData->fOwnerWasReleased
 #define FORIGINALALTERNATEINTERFACE					fIOUSBInterfaceUserClientExpansionData->fOriginalAlternateInterface
+#define FASYNCPARAMBLOCKLOCK						fIOUSBInterfaceUserClientExpansionData->fAsyncParamBlockLock
+#define FFREEASYNCPARAMBLOCKCOUNT					fIOUSBInterfaceUserClientExpansionData->fFreeAsyncParamBlockCount
+#define FFREEASYNCPARAMBLOCKS						fIOUSBInterfaceUserClientExpansionData->fFreeAsyncParamBlocks
+#define FASYNCPARAMBLOCKALLOCATIONS					fIOUSBInterfaceUserClientExpansionData->fAsyncParamBlockAllocations
+#define FASYNCPARAMBLOCKREUSES						fIOUSBInterfaceUserClientExpansionData->fAsyncParamBlockReuses
+#define FASYNCPARAMBLOCKSINUSE						fIOUSBInterfaceUserClientExpansionData->fAsyncParamBlocksInUse
+#define FASYNCPARAMBLOCKSINUSEHIGHWATER				fIOUSBInterfaceUserClientExpansionData->fAsyncParamBlocksInUseHighWater
+
+#define kAsyncParamBlockStatisticsKey				"AsyncParamBlockStatistics"
 
 #ifndef kIOUserClientCrossEndianKey
 #define kIOUserClientCrossEndianKey "IOUserClientCrossEndian"
@@ -349,7 +358,7 @@ IOUSBInterfaceUserClientV2::ReqComplete(void *obj, void *param, IOReturn res, UI
 		sendAsyncResult64(pb->fAsyncRef, res, args, 1);
 	
 	releaseAsyncReference64(pb->fAsyncRef);
-    IOFree(pb, sizeof(*pb));
+    me->FreeAsyncParamBlock(pb);
     me->DecrementOutstandingIO();
 	me->release();
 }
@@ -497,6 +506,11 @@ IOUSBInterfaceUserClientV2::initWithTask(task_t owningTask,void *security_id , U
         bzero(fIOUSBInterfaceUserClientExpansionData, sizeof(IOUSBInterfaceUserClientExpansionData));
     }
 	
+	// The async param block free list is optional:  without the lock we just IOMalloc/IOFree every block
+	//
+	if (!FASYNCPARAMBLOCKLOCK)
+		FASYNCPARAMBLOCKLOCK = IOLockAlloc();
+	
 	
     fTask = owningTask;
     fDead = false;
@@ -1414,7 +1428,7 @@ IOReturn IOUSBInterfaceUserClientV2::_ReadPipe(IOUSBInterfaceUserClientV2 * targ
 	if ( arguments->asyncWakePort ) 
 	{
 		IOUSBCompletion							tap;
-		IOUSBUserClientAsyncParamBlock *		pb = (IOUSBUserClientAsyncParamBlock*) IOMalloc(sizeof(IOUSBUserClientAsyncParamBlock));
+		IOUSBUserClientAsyncParamBlock *		pb = target->AllocateAsyncParamBlock();
 		
         if (!pb) 
             return kIOReturnNoMemory;
@@ -1440,7 +1454,7 @@ IOReturn IOUSBInterfaceUserClientV2::_ReadPipe(IOUSBInterfaceUserClientV2 * targ
 		{
             if ( pb )
 			{
-				IOFree(pb, sizeof(*pb));
+				target->FreeAsyncParamBlock(pb);
 			}
 			
 			target->DecrementOutstandingIO();
@@ -1677,7 +1691,7 @@ IOReturn IOUSBInterfaceUserClientV2::_WritePipe(IOUSBInterfaceUserClientV2 * tar
 	if ( arguments->asyncWakePort ) 
 	{
 		IOUSBCompletion							tap;
-		IOUSBUserClientAsyncParamBlock *		pb = (IOUSBUserClientAsyncParamBlock*) IOMalloc(sizeof(IOUSBUserClientAsyncParamBlock));
+		IOUSBUserClientAsyncParamBlock *		pb = target->AllocateAsyncParamBlock();
 		
         if (!pb) 
             return kIOReturnNoMemory;
@@ -1703,7 +1717,7 @@ IOReturn IOUSBInterfaceUserClientV2::_WritePipe(IOUSBInterfaceUserClientV2 * tar
 		{
             if ( pb )
 			{
-				IOFree(pb, sizeof(*pb));
+				target->FreeAsyncParamBlock(pb);
 			}
 			
 			target->DecrementOutstandingIO();
@@ -2402,7 +2416,7 @@ IOUSBInterfaceUserClientV2::_ControlRequestOut(IOUSBInterfaceUserClientV2 * targ
 	if ( arguments->asyncWakePort ) 
 	{
 		IOUSBCompletion						tap;
-		IOUSBUserClientAsyncParamBlock *	pb = (IOUSBUserClientAsyncParamBlock*) IOMalloc(sizeof(IOUSBUserClientAsyncParamBlock));
+		IOUSBUserClientAsyncParamBlock *	pb = target->AllocateAsyncParamBlock();
 		
         if (!pb) 
             return kIOReturnNoMemory;
@@ -2433,7 +2447,7 @@ IOUSBInterfaceUserClientV2::_ControlRequestOut(IOUSBInterfaceUserClientV2 * targ
 		{
             if ( pb )
 			{
-				IOFree(pb, sizeof(*pb));
+				target->FreeAsyncParamBlock(pb);
 			}
 			
 			target->DecrementOutstandingIO();
@@ -2708,7 +2722,7 @@ IOReturn IOUSBInterfaceUserClientV2::_ControlRequestIn(IOUSBInterfaceUserClientV
 	if ( arguments->asyncWakePort ) 
 	{
 		IOUSBCompletion							tap;
-		IOUSBUserClientAsyncParamBlock *	pb = (IOUSBUserClientAsyncParamBlock*) IOMalloc(sizeof(IOUSBUserClientAsyncParamBlock));
+		IOUSBUserClientAsyncParamBlock *	pb = target->AllocateAsyncParamBlock();
 		
         if (!pb) 
             return kIOReturnNoMemory;
@@ -2739,7 +2753,7 @@ IOReturn IOUSBInterfaceUserClientV2::_ControlRequestIn(IOUSBInterfaceUserClientV
 		{
             if ( pb )
 			{
-				IOFree(pb, sizeof(*pb));
+				target->FreeAsyncParamBlock(pb);
 			}
 			
 			target->DecrementOutstandingIO();
@@ -4474,6 +4488,146 @@ IOUSBInterfaceUserClientV2::ReleaseWorkLoopAndGate()
 	}
 }
 
+
+//
+// AllocateAsyncParamBlock - hand out a param block for an async request, reusing one from the
+// free list when we can.  The list only grows as far as the deepest queue the client has kept
+// outstanding (capped at kMaxFreeAsyncParamBlocks), so a steady stream of requests stops hitting IOMalloc
+//
+IOUSBUserClientAsyncParamBlock *
+IOUSBInterfaceUserClientV2::AllocateAsyncParamBlock()
+{
+	IOUSBUserClientAsyncParamBlock *	pb = NULL;
+	SInt32								inUse;
+	SInt32								highWater;
+	
+	if (FASYNCPARAMBLOCKLOCK)
+	{
+		IOLockLock(FASYNCPARAMBLOCKLOCK);
+		if (FFREEASYNCPARAMBLOCKCOUNT > 0)
+		{
+			pb = FFREEASYNCPARAMBLOCKS[--FFREEASYNCPARAMBLOCKCOUNT];
+			FFREEASYNCPARAMBLOCKS[FFREEASYNCPARAMBLOCKCOUNT] = NULL;
+		}
+		IOLockUnlock(FASYNCPARAMBLOCKLOCK);
+	}
+	
+	if (pb)
+	{
+		OSIncrementAtomic(&FASYNCPARAMBLOCKREUSES);
+	}
+	else
+	{
+		pb = (IOUSBUserClientAsyncParamBlock*) IOMalloc(sizeof(IOUSBUserClientAsyncParamBlock));
+		if (!pb)
+			return NULL;
+		
+		OSIncrementAtomic(&FASYNCPARAMBLOCKALLOCATIONS);
+	}
+	
+	inUse = OSIncrementAtomic(&FASYNCPARAMBLOCKSINUSE) + 1;
+	for (highWater = FASYNCPARAMBLOCKSINUSEHIGHWATER; inUse > highWater; highWater = FASYNCPARAMBLOCKSINUSEHIGHWATER)
+	{
+		if (OSCompareAndSwap((UInt32)highWater, (UInt32)inUse, (volatile UInt32 *)&FASYNCPARAMBLOCKSINUSEHIGHWATER))
+		{
+			USBLog(7, "IOUSBInterfaceUserClientV2[%p]::AllocateAsyncParamBlock  new high water of %d outstanding param blocks",  this, (int)inUse);
+			PublishAsyncParamBlockStatistics();
+			break;
+		}
+	}
+	
+	return pb;
+}
+
+
+
+//
+// FreeAsyncParamBlock - return a param block to the free list, or to the kernel if the list is full
+//
+void
+IOUSBInterfaceUserClientV2::FreeAsyncParamBlock( IOUSBUserClientAsyncParamBlock * pb )
+{
+	if (!pb)
+		return;
+	
+	OSDecrementAtomic(&FASYNCPARAMBLOCKSINUSE);
+	
+	if (FASYNCPARAMBLOCKLOCK)
+	{
+		IOLockLock(FASYNCPARAMBLOCKLOCK);
+		if (FFREEASYNCPARAMBLOCKCOUNT < kMaxFreeAsyncParamBlocks)
+		{
+			FFREEASYNCPARAMBLOCKS[FFREEASYNCPARAMBLOCKCOUNT++] = pb;
+			pb = NULL;
+		}
+		IOLockUnlock(FASYNCPARAMBLOCKLOCK);
+	}
+	
+	if (pb)
+		IOFree(pb, sizeof(*pb));
+}
+
+
+
+//
+// ReleaseAsyncParamBlocks - give back everything on the free list.  Called from free(), once no requests can be outstanding
+//
+void
+IOUSBInterfaceUserClientV2::ReleaseAsyncParamBlocks()
+{
+	UInt32		i;
+	
+	for (i = 0; i < FFREEASYNCPARAMBLOCKCOUNT; i++)
+	{
+		if (FFREEASYNCPARAMBLOCKS[i])
+		{
+			IOFree(FFREEASYNCPARAMBLOCKS[i], sizeof(IOUSBUserClientAsyncParamBlock));
+			FFREEASYNCPARAMBLOCKS[i] = NULL;
+		}
+	}
+	FFREEASYNCPARAMBLOCKCOUNT = 0;
+}
+
+
+
+//
+// PublishAsyncParamBlockStatistics - show how well the free list is doing in the registry.  We only do this when the high water
+// goes up, which is also when the free list has had to grow, so the cost stays off the steady state path
+//
+void
+IOUSBInterfaceUserClientV2::PublishAsyncParamBlockStatistics()
+{
+	OSDictionary *		statistics = OSDictionary::withCapacity(3);
+	OSNumber *			number;
+	
+	if (!statistics)
+		return;
+	
+	number = OSNumber::withNumber((UInt32)FASYNCPARAMBLOCKALLOCATIONS, 32);
+	if (number)
+	{
+		statistics->setObject("Allocations", number);
+		number->release();
+	}
+	
+	number = OSNumber::withNumber((UInt32)FASYNCPARAMBLOCKREUSES, 32);
+	if (number)
+	{
+		statistics->setObject("Reuses", number);
+		number->release();
+	}
+	
+	number = OSNumber::withNumber((UInt32)FASYNCPARAMBLOCKSINUSEHIGHWATER, 32);
+	if (number)
+	{
+		statistics->setObject("HighWater", number);
+		number->release();
+	}
+	
+	setProperty(kAsyncParamBlockStatisticsKey, statistics);
+	statistics->release();
+}
+
 #pragma mark IOKit Methods
 
 //
@@ -4692,6 +4846,15 @@ IOUSBInterfaceUserClientV2::free()
     //
     if (fIOUSBInterfaceUserClientExpansionData)
     {
+		USBLog(5, "IOUSBInterfaceUserClientV2[%p]::free  async param blocks: %d allocated, %d reused, high water %d",  this, (int)FASYNCPARAMBLOCKALLOCATIONS, (int)FASYNCPARAMBLOCKREUSES, (int)FASYNCPARAMBLOCKSINUSEHIGHWATER);
+		ReleaseAsyncParamBlocks();
+		
+		if (FASYNCPARAMBLOCKLOCK)
+		{
+			IOLockFree(FASYNCPARAMBLOCKLOCK);
+			FASYNCPARAMBLOCKLOCK = NULL;
+		}
+		
         IOFree(fIOUSBInterfaceUserClientExpansionData, sizeof(IOUSBInterfaceUserClientExpansionData));
         fIOUSBInterfaceUserClientExpansionData = NULL;
     }
@@ -243,6 +243,26 @@ IOUSBInterfaceUserClientV3::sV3Methods[kIOUSBLibInterfaceUserClientV3NumCommands
 		(IOExternalMethodAction) &IOUSBInterfaceUserClientV3::_AbortStreamsPipe,
 		2, 0,
 		0, 0
+    },
+    { //    kUSBInterfaceUserClientRegisterBuffer
+		(IOExternalMethodAction) &IOUSBInterfaceUserClientV3::_RegisterBuffer,
+		4, 0,
+		0, 0
+    },
+    { //    kUSBInterfaceUserClientUnregisterBuffer
+		(IOExternalMethodAction) &IOUSBInterfaceUserClientV3::_UnregisterBuffer,
+		1, 0,
+		0, 0
+    },
+    { //    kUSBInterfaceUserClientReadPipeRegistered
+		(IOExternalMethodAction) &IOUSBInterfaceUserClientV3::_ReadPipeRegistered,
+		6, 0,
+		0, 0
+    },
+    { //    kUSBInterfaceUserClientWritePipeRegistered
+		(IOExternalMethodAction) &IOUSBInterfaceUserClientV3::_WritePipeRegistered,
+		6, 0,
+		0, 0
     }
 };
 
@@ -483,7 +503,7 @@ IOReturn IOUSBInterfaceUserClientV3::_ReadStreamsPipe(IOUSBInterfaceUserClientV3
 	if ( arguments->asyncWakePort )
 	{
 		IOUSBCompletion							tap;
-		IOUSBUserClientAsyncParamBlock *		pb = (IOUSBUserClientAsyncParamBlock*) IOMalloc(sizeof(IOUSBUserClientAsyncParamBlock));
+		IOUSBUserClientAsyncParamBlock *		pb = target->AllocateAsyncParamBlock();
 		
         if (!pb)
             return kIOReturnNoMemory;
@@ -510,7 +530,7 @@ IOReturn IOUSBInterfaceUserClientV3::_ReadStreamsPipe(IOUSBInterfaceUserClientV3
 		{
             if ( pb )
 			{
-				IOFree(pb, sizeof(*pb));
+				target->FreeAsyncParamBlock(pb);
 			}
 			
 			target->DecrementOutstandingIO();
@@ -762,7 +782,7 @@ IOReturn IOUSBInterfaceUserClientV3::_WriteStreamsPipe(IOUSBInterfaceUserClientV
 	if ( arguments->asyncWakePort )
 	{
 		IOUSBCompletion							tap;
-		IOUSBUserClientAsyncParamBlock *		pb = (IOUSBUserClientAsyncParamBlock*) IOMalloc(sizeof(IOUSBUserClientAsyncParamBlock));
+		IOUSBUserClientAsyncParamBlock *		pb = target->AllocateAsyncParamBlock();
 		
         if (!pb)
             return kIOReturnNoMemory;
@@ -789,7 +809,7 @@ IOReturn IOUSBInterfaceUserClientV3::_WriteStreamsPipe(IOUSBInterfaceUserClientV
 		{
             if ( pb )
 			{
-				IOFree(pb, sizeof(*pb));
+				target->FreeAsyncParamBlock(pb);
 			}
 			
 			target->DecrementOutstandingIO();
@@ -1089,10 +1109,444 @@ IOUSBInterfaceUserClientV3::AbortStreamsPipe(UInt8 pipeRef, UInt32 streamID)
 
 
 
+#pragma mark Registered Buffers
+
+//================================================================================================
+//
+//   A registered buffer is a range of the client's memory that we wire once, when it is registered, instead of
+//   on every transfer.  The client then reads and writes pipes with a (cookie, offset, size) into it, in the
+//   direction(s) it registered the buffer for.  It lives in the same list as the low latency buffers, so it is
+//   released with kUSBInterfaceUserClientUnregisterBuffer (or kUSBInterfaceUserClientLowLatencyReleaseBuffer)
+//   and, like them, when the client goes away.  A client can have at most kMaxRegisteredUserBuffers of them,
+//   covering at most kMaxRegisteredUserBufferBytes.
+//
+//================================================================================================
+//
+IOReturn
+IOUSBInterfaceUserClientV3::_RegisterBuffer(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments)
+{
+#pragma unused (reference)
+	IOReturn							kr;
+	
+    USBLog(7, "+IOUSBInterfaceUserClientV3[%p]::_RegisterBuffer",  target);
+	
+	if (!target->isInactive() && target->fGate && target->fWorkLoop)
+	{
+		IOCommandGate *	gate = target->fGate;
+		IOWorkLoop *	workLoop = target->fWorkLoop;
+		
+		workLoop->retain();
+		gate->retain();
+		
+		kr = gate->runAction(target->RegisterBufferGated, (void *)&(arguments->scalarInput[0]), (void *)&(arguments->scalarInput[1]), (void *)&(arguments->scalarInput[2]), (void *)&(arguments->scalarInput[3]));
+		if ( kr != kIOReturnSuccess)
+		{
+			USBLog(3, "IOUSBInterfaceUserClientV3[%p]::_RegisterBuffer  runAction returned 0x%x, isInactive(%s)",  target, kr, target->isInactive() ? "true" : "false");
+		}
+		
+		gate->release();
+		workLoop->release();
+	}
+	else
+		kr = kIOReturnNoResources;
+	
+	return kr;
+}
+
+
+IOReturn 
+IOUSBInterfaceUserClientV3::RegisterBufferGated(OSObject *target, void *param1, void *param2, void *param3, void *param4)
+{
+	IOUSBInterfaceUserClientV3 *			me = OSDynamicCast(IOUSBInterfaceUserClientV3, target);
+	
+    if (!me)
+    {
+		USBLog(1, "IOUSBInterfaceUserClientV3::RegisterBufferGated - invalid target");
+		return kIOReturnBadArgument;
+    }
+	
+	return me->RegisterBuffer(*(uint64_t *)param1, *(mach_vm_address_t *)param2, *(mach_vm_size_t *)param3, (IODirection)*(uint64_t *)param4);
+}
+
+
+IOReturn 
+IOUSBInterfaceUserClientV3::RegisterBuffer(uint64_t cookie, mach_vm_address_t buffer, mach_vm_size_t size, IODirection direction)
+{
+	IOReturn								ret = kIOReturnSuccess;
+    IOMemoryDescriptor *					aDescriptor = NULL;
+    IOUSBLowLatencyUserClientBufferInfoV4 *	kernelDataBuffer = NULL;
+    IOUSBLowLatencyUserClientBufferInfoV4 *	registeredBuffer;
+	UInt32									registeredCount = 0;
+	mach_vm_size_t							registeredBytes = 0;
+	
+    IncrementOutstandingIO();
+    
+    USBLog(7, "+IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  cookie: %qd, buffer: 0x%qx, size: %qd, direction: %d",  this, cookie, buffer, size, (uint32_t)direction);
+	
+    if (fOwner && !isInactive())
+    {
+		if ( (buffer == 0) || (size == 0) || (size > kMaxRegisteredUserBufferBytes) )
+		{
+            USBLog(3,"IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  bad buffer (0x%qx, %qd)", this, buffer, size);
+			ret = kIOReturnBadArgument;
+			goto ErrorExit;
+		}
+		
+		if ( (direction != kIODirectionIn) && (direction != kIODirectionOut) && (direction != kIODirectionOutIn) )
+		{
+            USBLog(3,"IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  bad direction (%d)", this, (uint32_t)direction);
+			ret = kIOReturnBadArgument;
+			goto ErrorExit;
+		}
+		
+		for ( registeredBuffer = fUserClientBufferInfoListHead; registeredBuffer != NULL; registeredBuffer = registeredBuffer->nextBuffer )
+		{
+			if ( registeredBuffer->bufferType == kUSBRegisteredUserBuffer )
+			{
+				registeredCount++;
+				registeredBytes += registeredBuffer->bufferSize;
+			}
+		}
+		
+		if ( (registeredCount >= kMaxRegisteredUserBuffers) || (size > (kMaxRegisteredUserBufferBytes - registeredBytes)) )
+		{
+            USBLog(3,"IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  already have %d registered buffers of %qd bytes, cannot add %qd more", this, (uint32_t)registeredCount, (uint64_t)registeredBytes, size);
+			ret = kIOReturnNoResources;
+			goto ErrorExit;
+		}
+		
+		// The cookie is how the client will name the buffer, so it has to be unique among all of our buffers
+		if ( fUserClientBufferInfoListHead && FindBufferCookieInListV2(cookie) )
+		{
+            USBLog(3,"IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  cookie %qd is already in use", this, cookie);
+			ret = kIOReturnBadArgument;
+			goto ErrorExit;
+		}
+		
+        kernelDataBuffer = ( IOUSBLowLatencyUserClientBufferInfoV4 *) IOMalloc( sizeof(IOUSBLowLatencyUserClientBufferInfoV4) );
+        if (kernelDataBuffer == NULL )
+        {
+            USBLog(1,"IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  Could not malloc buffer info (size = %ld)!", this, sizeof(IOUSBLowLatencyUserClientBufferInfoV4) );
+            ret = kIOReturnNoMemory;
+			goto ErrorExit;
+        }
+        bzero(kernelDataBuffer, sizeof(IOUSBLowLatencyUserClientBufferInfoV4));
+		
+		// Wire the client's pages now, for as long as the buffer is registered
+		aDescriptor = IOMemoryDescriptor::withAddressRange(buffer, size, direction, fTask);
+		if (!aDescriptor) 
+		{
+			USBLog(1,"IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  Could not create a memory descriptor (addr: 0x%qx, size %qd)!", this, buffer, size );
+			ret = kIOReturnNoMemory;
+			goto ErrorExit;
+		}
+		
+		ret = aDescriptor->prepare();
+		if (ret != kIOReturnSuccess)
+		{
+			USBLog(1,"IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  Could not prepare the memory descriptor (0x%x)",  this, ret );
+			goto ErrorExit;
+		}
+		
+		kernelDataBuffer->cookie = cookie;
+		kernelDataBuffer->bufferType = kUSBRegisteredUserBuffer;
+		kernelDataBuffer->bufferAddress = buffer;
+		kernelDataBuffer->bufferSize = size;
+		kernelDataBuffer->bufferDescriptor = aDescriptor;
+		
+        AddDataBufferToList( kernelDataBuffer );
+		
+		USBLog(6, "IOUSBInterfaceUserClientV3[%p]::RegisterBuffer  registered buffer 0x%qx, size %qd, desc: %p, cookie: %qd",  this, buffer, size, aDescriptor, cookie);
+    }
+    else
+        ret = kIOReturnNotAttached;
+	
+ErrorExit:
+	
+	if (ret)
+	{
+		USBLog(3, "IOUSBInterfaceUserClientV3[%p]::RegisterBuffer - returning err 0x%x (%s)", this, ret, USBStringFromReturn(ret));
+		
+		if ( aDescriptor )
+			aDescriptor->release();
+		
+		if ( kernelDataBuffer )
+			IOFree(kernelDataBuffer, sizeof(IOUSBLowLatencyUserClientBufferInfoV4));
+	}
+	
+    DecrementOutstandingIO();
+    return ret;
+}
+
+
+IOReturn
+IOUSBInterfaceUserClientV3::_UnregisterBuffer(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments)
+{
+#pragma unused (reference)
+	LowLatencyUserBufferInfoV3		dataBuffer;
+	IOReturn						kr;
+	
+    USBLog(7, "+IOUSBInterfaceUserClientV3[%p]::_UnregisterBuffer",  target);
+	
+	bzero(&dataBuffer, sizeof(dataBuffer));
+	dataBuffer.cookie = arguments->scalarInput[0];
+	dataBuffer.bufferType = kUSBRegisteredUserBuffer;
+	
+	if (!target->isInactive() && target->fGate && target->fWorkLoop)
+	{
+		IOCommandGate *	gate = target->fGate;
+		IOWorkLoop *	workLoop = target->fWorkLoop;
+		
+		workLoop->retain();
+		gate->retain();
+		
+		kr = gate->runAction(target->UnregisterBufferGated, &dataBuffer);
+		if ( kr != kIOReturnSuccess)
+		{
+			USBLog(3, "IOUSBInterfaceUserClientV3[%p]::_UnregisterBuffer  runAction returned 0x%x, isInactive(%s)",  target, kr, target->isInactive() ? "true" : "false");
+		}
+		
+		gate->release();
+		workLoop->release();
+	}
+	else
+		kr = kIOReturnNoResources;
+	
+	return kr;
+}
+
+
+IOReturn 
+IOUSBInterfaceUserClientV3::UnregisterBufferGated(OSObject *target, void *param1, void *param2, void *param3, void *param4)
+{
+#pragma unused (param2, param3, param4)
+	IOUSBInterfaceUserClientV3 *			me = OSDynamicCast(IOUSBInterfaceUserClientV3, target);
+	LowLatencyUserBufferInfoV3 *			dataBuffer = (LowLatencyUserBufferInfoV3 *)param1;
+    IOUSBLowLatencyUserClientBufferInfoV4 *	kernelDataBuffer;
+	
+    if (!me)
+    {
+		USBLog(1, "IOUSBInterfaceUserClientV3::UnregisterBufferGated - invalid target");
+		return kIOReturnBadArgument;
+    }
+	
+	// Low latency buffers share the cookies, but they are not ours to release here
+	kernelDataBuffer = me->FindBufferCookieInListV2(dataBuffer->cookie);
+	if ( (kernelDataBuffer == NULL) || (kernelDataBuffer->bufferType != kUSBRegisteredUserBuffer) )
+	{
+		USBLog(3, "IOUSBInterfaceUserClientV3[%p]::UnregisterBufferGated - cookie %qd is not a registered buffer",  me, dataBuffer->cookie);
+		return kIOReturnBadArgument;
+	}
+	
+	return me->LowLatencyReleaseBuffer(dataBuffer);
+}
+
+
+IOReturn
+IOUSBInterfaceUserClientV3::_ReadPipeRegistered(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments)
+{
+#pragma unused (reference)
+    USBLog(7, "+IOUSBInterfaceUserClientV3[%p]::_ReadPipeRegistered",  target);
+	
+	return RegisteredBufferPipeAsync(target, arguments, kIODirectionIn);
+}
+
+
+IOReturn
+IOUSBInterfaceUserClientV3::_WritePipeRegistered(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments)
+{
+#pragma unused (reference)
+    USBLog(7, "+IOUSBInterfaceUserClientV3[%p]::_WritePipeRegistered",  target);
+	
+	return RegisteredBufferPipeAsync(target, arguments, kIODirectionOut);
+}
+
+
+//================================================================================================
+//
+//   RegisteredBufferPipeAsync
+//
+//   Transfers to and from registered buffers are always async, and complete through ReqComplete like any other ReadPipe or WritePipe.
+//
+//================================================================================================
+//
+IOReturn
+IOUSBInterfaceUserClientV3::RegisteredBufferPipeAsync(IOUSBInterfaceUserClientV3 * target, IOExternalMethodArguments * arguments, IODirection direction)
+{
+	IOUSBRegisteredBufferIOStruct			ioInfo;
+	IOUSBCompletion							tap;
+	IOUSBUserClientAsyncParamBlock *		pb;
+	IOReturn								ret;
+	
+	if ( !arguments->asyncWakePort )
+	{
+		USBLog(3, "IOUSBInterfaceUserClientV3[%p]::RegisteredBufferPipeAsync - registered buffers are only used for async requests",  target);
+		return kIOReturnBadArgument;
+	}
+	
+	if ( target->isInactive() || !target->fGate || !target->fWorkLoop )
+		return kIOReturnNoResources;
+	
+	ioInfo.fPipe = arguments->scalarInput[0];
+	ioInfo.fNoDataTimeout = arguments->scalarInput[1];
+	ioInfo.fCompletionTimeout = arguments->scalarInput[2];
+	ioInfo.fBufferCookie = arguments->scalarInput[3];
+	ioInfo.fBufferOffset = arguments->scalarInput[4];
+	ioInfo.fBufSize = (mach_vm_size_t) arguments->scalarInput[5];
+	
+	pb = target->AllocateAsyncParamBlock();
+	if (!pb)
+		return kIOReturnNoMemory;
+	
+	target->retain();
+	target->IncrementOutstandingIO();
+	
+	bcopy(arguments->asyncReference, pb->fAsyncRef, sizeof(OSAsyncReference64));
+	pb->fAsyncCount = arguments->asyncReferenceCount;
+	
+	tap.target = target;
+	tap.action = &IOUSBInterfaceUserClientV3::ReqComplete;
+	tap.parameter = pb;
+	
+	IOCommandGate *	gate = target->fGate;
+	IOWorkLoop *	workLoop = target->fWorkLoop;
+	
+	workLoop->retain();
+	gate->retain();
+	
+	ret = gate->runAction(target->DoRegisteredBufferPipeAsyncGated, &ioInfo, &tap, (void *)(uintptr_t)direction);
+	
+	gate->release();
+	workLoop->release();
+	
+	if ( ret )
+	{
+		target->FreeAsyncParamBlock(pb);
+		target->DecrementOutstandingIO();
+		target->release();
+	}
+	
+	return ret;
+}
+
+
+IOReturn 
+IOUSBInterfaceUserClientV3::DoRegisteredBufferPipeAsyncGated(OSObject *target, void *param1, void *param2, void *param3, void *param4)
+{
+#pragma unused (param4)
+	IOUSBInterfaceUserClientV3 *			me = OSDynamicCast(IOUSBInterfaceUserClientV3, target);
+	
+    if (!me)
+    {
+		USBLog(1, "IOUSBInterfaceUserClientV3::DoRegisteredBufferPipeAsyncGated - invalid target");
+		return kIOReturnBadArgument;
+    }
+	
+	return me->DoRegisteredBufferPipeAsync((IOUSBRegisteredBufferIOStruct *)param1, (IOUSBCompletion *)param2, (uintptr_t)param3);
+}
+
+
+IOReturn 
+IOUSBInterfaceUserClientV3::DoRegisteredBufferPipeAsync(IOUSBRegisteredBufferIOStruct *ioInfo, IOUSBCompletion *completion, uintptr_t direction)
+{
+	IOReturn								ret = kIOReturnSuccess;
+    IOUSBPipe *								pipeObj = NULL;
+    IOMemoryDescriptor *					aDescriptor = NULL;
+    IOMemoryDescriptor *					bufferDescriptor;
+    IOUSBLowLatencyUserClientBufferInfoV4 *	dataBuffer;
+	bool									prepared = false;
+	
+    USBLog(7, "+IOUSBInterfaceUserClientV3[%p]::DoRegisteredBufferPipeAsync (pipeRef: %d, cookie: %qd, offset: %qd, size: %qd, %s)",  this, (uint32_t)ioInfo->fPipe, ioInfo->fBufferCookie, ioInfo->fBufferOffset, (uint64_t)ioInfo->fBufSize, direction == kIODirectionIn ? "in" : "out");
+	
+    if (fOwner && !isInactive())
+    {
+		pipeObj = GetPipeObj((UInt8)ioInfo->fPipe);
+		if (pipeObj)
+		{
+			do {
+				IOUSBUserClientAsyncParamBlock * pb = (IOUSBUserClientAsyncParamBlock *)completion->parameter;
+				
+				dataBuffer = FindBufferCookieInListV2(ioInfo->fBufferCookie);
+				if ( dataBuffer == NULL )
+				{
+					USBLog(3,"IOUSBInterfaceUserClientV3[%p]::DoRegisteredBufferPipeAsync: Could not find our buffer (cookie %qd) in the list", this, ioInfo->fBufferCookie );
+					ret = kIOReturnBadArgument;
+					break;
+				}
+				
+				// A low latency read or write buffer is already wired too, so we can use that as well as a registered one
+				bufferDescriptor = (dataBuffer->bufferDescriptor == NULL) ? dataBuffer->dataBufferIOMD : dataBuffer->bufferDescriptor;
+				if ( (bufferDescriptor == NULL) || (ioInfo->fBufSize == 0) || (ioInfo->fBufferOffset > dataBuffer->bufferSize) || (ioInfo->fBufSize > (dataBuffer->bufferSize - ioInfo->fBufferOffset)) )
+				{
+					USBLog(3,"IOUSBInterfaceUserClientV3[%p]::DoRegisteredBufferPipeAsync: offset %qd, size %qd is not within buffer (cookie %qd) of size %qd", this, ioInfo->fBufferOffset, (uint64_t)ioInfo->fBufSize, ioInfo->fBufferCookie, (uint64_t)dataBuffer->bufferSize );
+					ret = kIOReturnBadArgument;
+					break;
+				}
+				
+				if ( (dataBuffer->bufferType == kUSBRegisteredUserBuffer) && ((bufferDescriptor->getDirection() & direction) != direction) )
+				{
+					USBLog(3,"IOUSBInterfaceUserClientV3[%p]::DoRegisteredBufferPipeAsync: buffer (cookie %qd) was not registered for %s transfers", this, ioInfo->fBufferCookie, direction == kIODirectionIn ? "in" : "out" );
+					ret = kIOReturnBadArgument;
+					break;
+				}
+				
+				// The subrange keeps the buffer retained and wired until the transfer completes, even if the client unregisters
+				// it in the meantime, and preparing it only bumps the wire count of pages that are already wired.
+				aDescriptor = IOSubMemoryDescriptor::withSubRange(bufferDescriptor, ioInfo->fBufferOffset, ioInfo->fBufSize, (IODirection)direction);
+				if ( aDescriptor == NULL )
+				{
+					USBLog(3,"IOUSBInterfaceUserClientV3[%p]::DoRegisteredBufferPipeAsync: Could not create an IOMD:withSubRange", this );
+					ret = kIOReturnNoMemory;
+					break;
+				}
+				
+				ret = aDescriptor->prepare();
+				if (ret != kIOReturnSuccess)
+				{
+					USBLog(3,"IOUSBInterfaceUserClientV3[%p]::DoRegisteredBufferPipeAsync: Preparing the descriptor returned 0x%x", this, ret );
+					break;
+				}
+				prepared = true;
+				
+				pb->fMax = ioInfo->fBufSize;
+				pb->fMem = aDescriptor;
+				
+				if ( direction == kIODirectionOut )
+					ret = pipeObj->Write(aDescriptor, (UInt32)ioInfo->fNoDataTimeout, (UInt32)ioInfo->fCompletionTimeout, completion);
+				else
+					ret = pipeObj->Read(aDescriptor, (UInt32)ioInfo->fNoDataTimeout, (UInt32)ioInfo->fCompletionTimeout, completion, NULL);
+				
+			} while (false);
+			
+			pipeObj->release();
+		}
+		else
+			ret = kIOUSBUnknownPipeErr;
+    }
+    else
+        ret = kIOReturnNotAttached;
+	
+    if (kIOReturnSuccess != ret) 
+    {
+		USBLog(3, "IOUSBInterfaceUserClientV3[%p]::DoRegisteredBufferPipeAsync err 0x%x (%s)", this, ret, USBStringFromReturn(ret));
+		
+        if ( aDescriptor )
+        {
+			if ( prepared )
+				aDescriptor->complete();
+            aDescriptor->release();
+        }
+    }
+	
+    return ret;
+}
+
+
+
 #pragma mark Padding Methods
 
-OSMetaClassDefineReservedUnused(IOUSBInterfaceUserClientV3, 0);
-OSMetaClassDefineReservedUnused(IOUSBInterfaceUserClientV3, 1);
+OSMetaClassDefineReservedUsed(IOUSBInterfaceUserClientV3, 0);
+OSMetaClassDefineReservedUsed(IOUSBInterfaceUserClientV3, 1);
 OSMetaClassDefineReservedUnused(IOUSBInterfaceUserClientV3, 2);
 OSMetaClassDefineReservedUnused(IOUSBInterfaceUserClientV3, 3);
 OSMetaClassDefineReservedUnused(IOUSBInterfaceUserClientV3, 4);
@@ -50,7 +50,23 @@
 enum
 {
     kSizeToIncrementLowLatencyCommandPool = 10,
-	kMaxExtendedDataEntriesSupported = 20
+	kMaxExtendedDataEntriesSupported = 20,
+	kMaxFreeAsyncParamBlocks = 32
+};
+
+// bufferType of a user buffer that was wired with kUSBInterfaceUserClientRegisterBuffer.  It shares the list (and the cookies) with
+// the low latency buffers, and is released the same way.
+enum
+{
+	kUSBRegisteredUserBuffer = 0x10
+};
+
+// Registered buffers stay wired for as long as the client keeps them, so each client is limited in how many it can have and how
+// much memory they cover.
+enum
+{
+	kMaxRegisteredUserBuffers = 64,
+	kMaxRegisteredUserBufferBytes = 64 * 1024 * 1024
 };
 
 
@@ -139,6 +155,18 @@ struct IOUSBLowLatencyIsocStructV3 {
     uint64_t								fFrameListBufferOffset;
 };
 
+// Structure to request a bulk or interrupt transfer to or from part of a registered buffer
+//
+typedef struct IOUSBRegisteredBufferIOStruct  IOUSBRegisteredBufferIOStruct;
+struct IOUSBRegisteredBufferIOStruct {
+    uint64_t								fPipe;
+    uint64_t								fNoDataTimeout;
+    uint64_t								fCompletionTimeout;
+    uint64_t								fBufferCookie;
+    uint64_t								fBufferOffset;
+    mach_vm_size_t							fBufSize;
+};
+
 
 //================================================================================================
 //
@@ -259,6 +287,13 @@ private:
 		bool									fDelayedWorkLoopFree;
 		bool									fOwnerWasReleased;
 		UInt8									fOriginalAlternateInterface;
+		IOLock *								fAsyncParamBlockLock;
+		UInt32									fFreeAsyncParamBlockCount;
+		IOUSBUserClientAsyncParamBlock *		fFreeAsyncParamBlocks[kMaxFreeAsyncParamBlocks];	// blocks of completed requests, kept for the next ones
+		volatile SInt32							fAsyncParamBlockAllocations;
+		volatile SInt32							fAsyncParamBlockReuses;								// allocations that came from fFreeAsyncParamBlocks
+		volatile SInt32							fAsyncParamBlocksInUse;
+		SInt32									fAsyncParamBlocksInUseHighWater;
     };
     
     IOUSBInterfaceUserClientExpansionData *		fIOUSBInterfaceUserClientExpansionData;
@@ -414,6 +449,10 @@ public:
 	
 	void										PrintExternalMethodArgs( IOExternalMethodArguments * arguments, UInt32 level );
 	void										ReleaseWorkLoopAndGate();
+	IOUSBUserClientAsyncParamBlock *			AllocateAsyncParamBlock();
+	void										FreeAsyncParamBlock( IOUSBUserClientAsyncParamBlock * pb );
+	void										ReleaseAsyncParamBlocks();
+	void										PublishAsyncParamBlockStatistics();
 	
     // static methods
     //
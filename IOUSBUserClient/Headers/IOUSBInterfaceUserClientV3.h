@@ -94,10 +94,26 @@ public:
 	static	IOReturn							_AbortStreamsPipe(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments);
 	virtual IOReturn                            AbortStreamsPipe(UInt8 pipeRef, UInt32 streamID);
 
+	// Registered buffers
+	static	IOReturn							_RegisterBuffer(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments);
+	static	IOReturn                            RegisterBufferGated(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+
+	static	IOReturn							_UnregisterBuffer(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments);
+	static	IOReturn                            UnregisterBufferGated(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+
+	static	IOReturn							_ReadPipeRegistered(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments);
+	static	IOReturn							_WritePipeRegistered(IOUSBInterfaceUserClientV3 * target, void * reference, IOExternalMethodArguments * arguments);
+	static	IOReturn							RegisteredBufferPipeAsync(IOUSBInterfaceUserClientV3 * target, IOExternalMethodArguments * arguments, IODirection direction);
+	static	IOReturn                            DoRegisteredBufferPipeAsyncGated(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+
 	// padding methods
     //
-	OSMetaClassDeclareReservedUnused(IOUSBInterfaceUserClientV3, 0);
-	OSMetaClassDeclareReservedUnused(IOUSBInterfaceUserClientV3, 1);
+	OSMetaClassDeclareReservedUsed(IOUSBInterfaceUserClientV3, 0);
+	virtual IOReturn                            RegisterBuffer(uint64_t cookie, mach_vm_address_t buffer, mach_vm_size_t size, IODirection direction);
+
+	OSMetaClassDeclareReservedUsed(IOUSBInterfaceUserClientV3, 1);
+	virtual IOReturn                            DoRegisteredBufferPipeAsync(IOUSBRegisteredBufferIOStruct *ioInfo, IOUSBCompletion *completion, uintptr_t direction);
+
 	OSMetaClassDeclareReservedUnused(IOUSBInterfaceUserClientV3, 2);
 	OSMetaClassDeclareReservedUnused(IOUSBInterfaceUserClientV3, 3);
 	OSMetaClassDeclareReservedUnused(IOUSBInterfaceUserClientV3, 4);
@@ -89,6 +89,10 @@ enum {
 	kUSBInterfaceUserClientReadStreamsPipe,
 	kUSBInterfaceUserClientWriteStreamsPipe,
 	kUSBInterfaceUserClientAbortStreamsPipe,
+	kUSBInterfaceUserClientRegisterBuffer,
+	kUSBInterfaceUserClientUnregisterBuffer,
+	kUSBInterfaceUserClientReadPipeRegistered,
+	kUSBInterfaceUserClientWritePipeRegistered,
 	kIOUSBLibInterfaceUserClientV3NumCommands
    };
 